@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Compares the byte loops with the word and SIMD string kernels, for sizes
+ * from 1 B to 1 MiB. Every cell is the number of TSC cycles per call, the
+ * best of a few runs.
+ */
+
+#include <internal/string.h>
+#include <internal/arch/x86_64/cpu_features.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <stdio.h>
+
+#define MAX_SIZE	(1UL << 20)
+#define RUNS		5
+
+static char *source, *destination;
+
+static inline unsigned long rdtsc(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__ ("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long)hi << 32) | lo;
+}
+
+enum kernel { BYTE, WORD, SSE2, AVX2, NUM_KERNELS };
+
+static const char * const kernel_names[NUM_KERNELS] = { "byte", "word", "sse2", "avx2" };
+
+static void *(*const memcpy_kernels[])(void *, const void *, size_t) = {
+	__memcpy_byte, __memcpy_word, __memcpy_sse2, __memcpy_avx2
+};
+
+static void *(*const memmove_kernels[])(void *, const void *, size_t) = {
+	__memmove_byte, __memmove_word, __memmove_sse2, __memmove_avx2
+};
+
+static void *(*const memset_kernels[])(void *, int, size_t) = {
+	__memset_byte, __memset_word, __memset_sse2, __memset_avx2
+};
+
+static int (*const memcmp_kernels[])(const void *, const void *, size_t) = {
+	__memcmp_byte, __memcmp_word, __memcmp_sse2, __memcmp_avx2
+};
+
+static size_t (*const strlen_kernels[])(const char *) = {
+	__strlen_byte, __strlen_word, __strlen_sse2, __strlen_avx2
+};
+
+static char *(*const strchr_kernels[])(const char *, int) = {
+	__strchr_byte, __strchr_word, __strchr_sse2, __strchr_avx2
+};
+
+static const char * const function_names[] = {
+	"memcpy", "memmove", "memset", "memcmp", "strlen", "strchr"
+};
+
+#define NUM_FUNCTIONS	(sizeof(function_names) / sizeof(function_names[0]))
+
+static void call(size_t function, enum kernel kernel, size_t size)
+{
+	switch (function) {
+	case 0:
+		memcpy_kernels[kernel](destination, source, size);
+		break;
+	case 1:
+		// overlapping regions, copied backwards
+		memmove_kernels[kernel](source + 1, source, size - 1);
+		break;
+	case 2:
+		memset_kernels[kernel](destination, 'x', size);
+		break;
+	case 3:
+		memcmp_kernels[kernel](destination, source, size);
+		break;
+	case 4:
+		strlen_kernels[kernel](source);
+		break;
+	case 5:
+		strchr_kernels[kernel](source, '!');
+		break;
+	}
+}
+
+// best time of a call, over RUNS runs of enough calls to reach about 2^22 bytes
+static unsigned long measure(size_t function, enum kernel kernel, size_t size)
+{
+	unsigned long calls = (1UL << 22) / size + 1;
+	unsigned long best = (unsigned long)-1;
+
+	for (int run = 0; run < RUNS; run++) {
+		unsigned long start = rdtsc();
+
+		for (unsigned long i = 0; i < calls; i++)
+			call(function, kernel, size);
+
+		unsigned long elapsed = (rdtsc() - start) / calls;
+
+		if (elapsed < best)
+			best = elapsed;
+	}
+
+	return best;
+}
+
+int main(void)
+{
+	int kernels = __cpu_has_avx2() ? NUM_KERNELS : AVX2;
+
+	source = mmap(NULL, MAX_SIZE + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	destination = mmap(NULL, MAX_SIZE + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (source == MAP_FAILED || destination == MAP_FAILED) {
+		puts("mmap failed");
+		return 1;
+	}
+
+	for (size_t function = 0; function < NUM_FUNCTIONS; function++) {
+		printf("%s (cycles per call)\n%8s", function_names[function], "size");
+
+		for (int kernel = 0; kernel < kernels; kernel++)
+			printf("%10s", kernel_names[kernel]);
+
+		printf("\n");
+
+		for (size_t size = 1; size <= MAX_SIZE; size *= 4) {
+			// the strings end right after size bytes, memcmp sees equal data
+			__memset_word(source, 'a', size);
+			__memset_word(destination, 'a', size);
+			source[size] = '\0';
+
+			printf("%8zu", size);
+
+			for (int kernel = 0; kernel < kernels; kernel++)
+				printf("%10lu", measure(function, kernel, size));
+
+			printf("\n");
+		}
+
+		printf("\n");
+	}
+
+	return 0;
+}
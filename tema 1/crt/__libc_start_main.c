@@ -1,25 +1,39 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 #include <internal/types.h>
-#include <internal/mm/mem_list.h>
+#include <unistd.h>
+#include <sys/auxv.h>
 
-static void init(void)
-{
-	mem_list_init();
-}
+char **environ;
+
+/* Auxiliary vector, pairs of type and value right after envp. */
+static unsigned long *auxv;
 
-static void cleanup(void)
+unsigned long getauxval(unsigned long type)
 {
-	mem_list_cleanup();
+	for (unsigned long *entry = auxv; entry != NULL && entry[0] != AT_NULL; entry += 2)
+		if (entry[0] == type)
+			return entry[1];
+
+	return 0;
 }
 
-int __libc_start_main(int (*main_fn)(void))
+/*
+ * Nothing is set up ahead of main: the heap grows on the first allocation,
+ * stdio picks its buffering on the first use of a stream and the string
+ * kernels are chosen on their first call. exit() only flushes stdio, the
+ * kernel takes the memory back.
+ */
+int __libc_start_main(int (*main_fn)(int, char **, char **), int argc, char **argv)
 {
-	int exit_code;
+	char **envp = argv + argc + 1;
+	char **end = envp;
+
+	environ = envp;
 
-	init();
-	exit_code = main_fn();
-	cleanup();
+	while (*end != NULL)
+		end++;
+	auxv = (unsigned long *)(end + 1);
 
-	return exit_code;
+	return main_fn(argc, argv, envp);
 }
@@ -7,7 +7,11 @@ section .text
 global _start
 
 _start:
+    ; The kernel leaves argc at [rsp], then argv and envp, each NULL ended.
+    xor ebp, ebp
     mov rdi, main
+    mov rsi, [rsp]
+    lea rdx, [rsp + 8]
     call __libc_start_main
 
     mov rdi, rax
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __FILE_VIEW_H__
+#define __FILE_VIEW_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <internal/types.h>
+
+/* Flags for map_file.  */
+#define FILE_VIEW_WRITE		0x1	/* Shared, writable mapping.  */
+#define FILE_VIEW_POPULATE	0x2	/* Fault all pages in up front.  */
+#define FILE_VIEW_SEQUENTIAL	0x4	/* The file is read front to back.  */
+
+/*
+ * A whole file mapped in memory. An empty file has a NULL data pointer and
+ * a length of 0.
+ */
+struct file_view {
+	void *data;
+	size_t length;
+};
+
+int map_file(const char *path, int flags, struct file_view *view);
+int sync_file(struct file_view *view);
+int unmap_file(struct file_view *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
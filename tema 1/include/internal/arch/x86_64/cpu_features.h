@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __CPU_FEATURES_X86_64__
+#define __CPU_FEATURES_X86_64__		1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void __cpuid(unsigned int leaf, unsigned int subleaf, unsigned int *eax,
+			   unsigned int *ebx, unsigned int *ecx, unsigned int *edx)
+{
+	__asm__ __volatile__ ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+						  : "a"(leaf), "c"(subleaf));
+}
+
+/* AVX2 needs both the CPU and the kernel, which must save the YMM registers. */
+static inline int __cpu_has_avx2(void)
+{
+	unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+	__cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax < 7)
+		return 0;
+
+	/* OSXSAVE */
+	__cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1u << 27)))
+		return 0;
+
+	/* XMM and YMM state enabled in XCR0 */
+	__asm__ __volatile__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	if ((xcr0_lo & 0x6) != 0x6)
+		return 0;
+
+	__cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+	return !!(ebx & (1u << 5));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
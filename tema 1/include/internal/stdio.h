@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __INTERNAL_STDIO_H__
+#define __INTERNAL_STDIO_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Flushes the standard streams, called when the program ends. */
+void __stdio_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __INTERNAL_STRING_H__
+#define __INTERNAL_STRING_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <internal/types.h>
+
+/*
+ * Kernels behind memcpy, memmove, memset, memcmp, strlen and strchr. The byte
+ * loops are the reference versions, the word versions handle 8 bytes at a
+ * time and the SIMD ones a whole vector. The first call of any of them
+ * picks the fastest kernels the CPU supports.
+ */
+
+void *__memcpy_byte(void *destination, const void *source, size_t num);
+void *__memmove_byte(void *destination, const void *source, size_t num);
+void *__memset_byte(void *source, int value, size_t num);
+int __memcmp_byte(const void *ptr1, const void *ptr2, size_t num);
+size_t __strlen_byte(const char *str);
+char *__strchr_byte(const char *str, int c);
+
+void *__memcpy_word(void *destination, const void *source, size_t num);
+void *__memmove_word(void *destination, const void *source, size_t num);
+void *__memset_word(void *source, int value, size_t num);
+int __memcmp_word(const void *ptr1, const void *ptr2, size_t num);
+size_t __strlen_word(const char *str);
+char *__strchr_word(const char *str, int c);
+
+void *__memcpy_sse2(void *destination, const void *source, size_t num);
+void *__memmove_sse2(void *destination, const void *source, size_t num);
+void *__memset_sse2(void *source, int value, size_t num);
+int __memcmp_sse2(const void *ptr1, const void *ptr2, size_t num);
+size_t __strlen_sse2(const char *str);
+char *__strchr_sse2(const char *str, int c);
+
+void *__memcpy_avx2(void *destination, const void *source, size_t num);
+void *__memmove_avx2(void *destination, const void *source, size_t num);
+void *__memset_avx2(void *source, int value, size_t num);
+int __memcmp_avx2(const void *ptr1, const void *ptr2, size_t num);
+size_t __strlen_avx2(const char *str);
+char *__strchr_avx2(const char *str, int c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,12 @@ extern "C" {
 #endif
 
 #include <internal/arch/x86_64/syscall_list.h>
+#include <internal/arch/x86_64/syscall_arch.h>
+
+/*
+ * The wrappers call __syscall0..6 with the exact number of arguments, the
+ * variadic syscall() is only kept for callers outside the library.
+ */
 
 long syscall(long n, ...);
 
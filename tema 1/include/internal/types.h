@@ -22,6 +22,8 @@ typedef unsigned int uint32_t;
 typedef unsigned long uint64_t;
 typedef int int32_t;
 typedef long int64_t;
+typedef long intptr_t;
+typedef unsigned long uintptr_t;
 
 typedef long int off_t; // added by me
 
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __INTERNAL_VDSO_H__
+#define __INTERNAL_VDSO_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Address of a function the vDSO exports, NULL without a vDSO or symbol. */
+void *__vdso_sym(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
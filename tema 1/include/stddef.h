@@ -5,4 +5,6 @@
 
 #include <internal/types.h>
 
+#define offsetof(type, member)	__builtin_offsetof(type, member)
+
 #endif
@@ -7,14 +7,43 @@
 extern "C" {
 #endif
 
-#define stdin   0
-#define stdout  1
-#define stderr  2
+#include <internal/types.h>
+#include <stdarg.h>
 
-#define EOF -1
+#define EOF		-1
+#define BUFSIZ		4096
 
+/* Buffering modes of setvbuf */
+#define _IOFBF		0	/* Fully buffered */
+#define _IOLBF		1	/* Line buffered */
+#define _IONBF		2	/* Unbuffered */
+
+typedef struct _FILE FILE;
+
+extern FILE *const stdin;
+extern FILE *const stdout;
+extern FILE *const stderr;
+
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+int fflush(FILE *stream);
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+int fputc(int c, FILE *stream);
+int putc(int c, FILE *stream);
+int putchar(int c);
+int fputs(const char *str, FILE *stream);
 int puts(const char *str);
 
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
+int fgetc(FILE *stream);
+int getc(FILE *stream);
+int getchar(void);
+
+int printf(const char *format, ...);
+int fprintf(FILE *stream, const char *format, ...);
+int vprintf(const char *format, va_list args);
+int vfprintf(FILE *stream, const char *format, va_list args);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@ char *strrchr(const char *str, int c);
 
 char *strstr(const char *str1, const char *str2);
 char *strrstr(const char *str1, const char *str2);
+void *memmem(const void *haystack, size_t haystack_len, const void *needle, size_t needle_len);
 
 void *memcpy(void *destination, const void *source, size_t num);
 void *memset(void *source, int value, size_t num);
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __SYS_AUXV_H__
+#define __SYS_AUXV_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_NULL		0		/* End of the vector.  */
+#define AT_PAGESZ	6		/* System page size.  */
+#define AT_SYSINFO_EHDR	33		/* Address of the vDSO ELF header.  */
+
+/* Value of an entry of the auxiliary vector, 0 if absent. */
+unsigned long getauxval(unsigned long type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,19 @@ extern "C" {
 #define MAP_PRIVATE	0x02		/* Changes are private.  */
 #define MAP_ANONYMOUS	0x20		/* Don't use a file.  */
 #define MAP_ANON	MAP_ANONYMOUS
+#define MAP_POPULATE	0x08000		/* Populate (prefault) pagetables.  */
+
+/* Flags for msync.  */
+#define MS_ASYNC	1		/* Sync memory asynchronously.  */
+#define MS_INVALIDATE	2		/* Invalidate the caches.  */
+#define MS_SYNC		4		/* Synchronous memory sync.  */
+
+/* Advice for madvise.  */
+#define MADV_NORMAL	0		/* No further special treatment.  */
+#define MADV_RANDOM	1		/* Expect random page references.  */
+#define MADV_SEQUENTIAL	2		/* Expect sequential page references.  */
+#define MADV_WILLNEED	3		/* Will need these pages.  */
+#define MADV_DONTNEED	4		/* Don't need these pages.  */
 
 #define MREMAP_MAYMOVE	1
 
@@ -27,6 +40,8 @@ extern "C" {
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
 void *mremap(void *old_address, size_t old_size, size_t new_size, int flags);
 int munmap(void *addr, size_t length);
+int msync(void *addr, size_t length, int flags);
+int madvise(void *addr, size_t length, int advice);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __SYS_TIME_H__
+#define __SYS_TIME_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+
+typedef long suseconds_t;
+
+struct timeval {
+	time_t tv_sec;
+	suseconds_t tv_usec;
+};
+
+struct timezone {
+	int tz_minuteswest;
+	int tz_dsttime;
+};
+
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __SYS_UIO_H__
+#define __SYS_UIO_H__	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <internal/types.h>
+
+#define IOV_MAX		1024	/* Most buffers a single call accepts.  */
+
+struct iovec {
+	void *iov_base;		/* Start of the buffer.  */
+	size_t iov_len;		/* Number of bytes in the buffer.  */
+};
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,13 +2,27 @@
 #define __TIME_H__	1
 
 typedef long time_t;
+typedef int clockid_t;
 
 struct timespec {
     time_t tv_sec;
     long tv_nsec;
 };
 
+#define CLOCK_REALTIME			0
+#define CLOCK_MONOTONIC			1
+#define CLOCK_PROCESS_CPUTIME_ID	2
+#define CLOCK_THREAD_CPUTIME_ID		3
+#define CLOCK_MONOTONIC_RAW		4
+#define CLOCK_REALTIME_COARSE		5
+#define CLOCK_MONOTONIC_COARSE		6
+#define CLOCK_BOOTTIME			7
+
 int nanosleep(const struct timespec *t1, struct timespec *t2);
 unsigned int sleep(unsigned int seconds);
 
+/* Read through the vDSO when the kernel maps one, without a syscall. */
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+time_t time(time_t *tloc);
+
 #endif
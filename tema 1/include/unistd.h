@@ -16,11 +16,21 @@ extern "C" {
 #define SEEK_DATA 3
 #define SEEK_HOLE 4
 
+extern char **environ;
+
 int close(int fd);
 off_t lseek(int fd, off_t offset, int whence);
 int truncate(const char *path, off_t length);
 int ftruncate(int fd, off_t length);
 unsigned int sleep(unsigned int seconds);
+int brk(void *addr);
+void *sbrk(intptr_t increment);
+int isatty(int fd);
+ssize_t pread(int fd, void *buf, size_t len, off_t offset);
+ssize_t pwrite(int fd, const void *buf, size_t len, off_t offset);
+ssize_t pread64(int fd, void *buf, size_t len, off_t offset);
+ssize_t pwrite64(int fd, const void *buf, size_t len, off_t offset);
+ssize_t copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
 
 #ifdef __cplusplus
 }
@@ -2,12 +2,11 @@
 
 #include <unistd.h>
 #include <internal/syscall.h>
-#include <stdarg.h>
 #include <errno.h>
 
 int close(int fd)
 {
-	int ret = syscall(__NR_close, fd);
+	long ret = __syscall1(__NR_close, fd);
 
 	if (ret < 0) {
 		errno = -ret;
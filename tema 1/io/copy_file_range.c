@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <unistd.h>
+#include <internal/syscall.h>
+#include <internal/types.h>
+#include <errno.h>
+
+ssize_t copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags)
+{
+	ssize_t ret = __syscall6(__NR_copy_file_range, fd_in, (long)off_in, fd_out, (long)off_out, len, flags);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
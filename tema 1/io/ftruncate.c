@@ -7,7 +7,7 @@
 
 int ftruncate(int fd, off_t length)
 {
-	int ret = syscall(__NR_ftruncate, fd, length);
+	long ret = __syscall2(__NR_ftruncate, fd, length);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <unistd.h>
+#include <internal/syscall.h>
+#include <errno.h>
+
+#define TCGETS		0x5401
+
+int isatty(int fd)
+{
+	// room for a struct termios, only the result of the ioctl matters
+	char termios[64];
+	long ret = __syscall3(__NR_ioctl, fd, TCGETS, (long)termios);
+
+	if (ret < 0) {
+		errno = ret == -EBADF ? EBADF : ENOTTY;
+		return 0;
+	}
+
+	return 1;
+}
@@ -7,7 +7,7 @@
 
 off_t lseek(int fd, off_t offset, int whence)
 {
-	int ret = syscall(__NR_lseek, fd, offset, whence);
+	off_t ret = __syscall3(__NR_lseek, fd, offset, whence);
 
 	if (ret < 0) {
 		errno = -ret;
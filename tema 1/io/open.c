@@ -7,7 +7,18 @@
 
 int open(const char *filename, int flags, ...)
 {
-	int ret = syscall(__NR_open, filename, flags);
+	mode_t mode = 0;
+
+	// the mode is only passed when a file can be created
+	if (flags & O_CREAT || (flags & O_TMPFILE) == O_TMPFILE) {
+		va_list args;
+
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+
+	long ret = __syscall3(__NR_open, (long)filename, flags, mode);
 
 	if (ret < 0) {
 		errno = -ret;
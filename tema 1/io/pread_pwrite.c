@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <unistd.h>
+#include <internal/syscall.h>
+#include <internal/types.h>
+#include <errno.h>
+
+// off_t is already 64 bits wide, the 64 versions are the same functions
+
+ssize_t pread(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t ret = __syscall4(__NR_pread64, fd, (long)buf, len, offset);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t ret = __syscall4(__NR_pwrite64, fd, (long)buf, len, offset);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+ssize_t pread64(int fd, void *buf, size_t len, off_t offset) __attribute__((alias("pread")));
+ssize_t pwrite64(int fd, const void *buf, size_t len, off_t offset) __attribute__((alias("pwrite")));
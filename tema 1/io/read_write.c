@@ -7,7 +7,7 @@
 
 ssize_t write(int fd, const void *buf, size_t len)
 {
-	int ret = syscall(__NR_write, fd, buf, len);
+	ssize_t ret = __syscall3(__NR_write, fd, (long)buf, len);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -19,7 +19,7 @@ ssize_t write(int fd, const void *buf, size_t len)
 
 ssize_t read(int fd, void *buf, size_t len)
 {
-	int ret =  syscall(__NR_read, fd, buf, len);
+	ssize_t ret = __syscall3(__NR_read, fd, (long)buf, len);
 
 	if (ret < 0) {
 		errno = -ret;
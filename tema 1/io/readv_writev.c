@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/uio.h>
+#include <internal/syscall.h>
+#include <internal/types.h>
+#include <errno.h>
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t ret = __syscall3(__NR_readv, fd, (long)iov, iovcnt);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t ret = __syscall3(__NR_writev, fd, (long)iov, iovcnt);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/sendfile.h>
+#include <internal/syscall.h>
+#include <internal/types.h>
+#include <errno.h>
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	ssize_t ret = __syscall4(__NR_sendfile, out_fd, in_fd, (long)offset, count);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
@@ -7,7 +7,7 @@
 
 int truncate(const char *path, off_t length)
 {
-	int ret = syscall(__NR_truncate, path, length);
+	long ret = __syscall2(__NR_truncate, (long)path, length);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <unistd.h>
+#include <internal/syscall.h>
+#include <errno.h>
+#include <internal/types.h>
+
+// Current program break, read from the kernel on first use.
+static void *current_brk;
+
+int brk(void *addr)
+{
+	// the syscall returns the new break, or the old one when it fails
+	void *ret = (void *)__syscall1(__NR_brk, (long)addr);
+
+	current_brk = ret;
+
+	if (ret != addr) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+void *sbrk(intptr_t increment)
+{
+	if (!current_brk)
+		current_brk = (void *)__syscall1(__NR_brk, 0);
+
+	void *old_brk = current_brk;
+
+	if (increment && brk(old_brk + increment) < 0)
+		return (void *)-1;
+
+	return old_brk;
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <file_view.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+static int map_fd(int fd, int flags, struct file_view *view)
+{
+	int writable = flags & FILE_VIEW_WRITE;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if ((st.st_mode & __S_IFMT) != __S_IFREG) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	view->data = NULL;
+	view->length = st.st_size;
+
+	// mmap refuses empty mappings, an empty file is an empty view
+	if (!view->length)
+		return 0;
+
+	void *data = mmap(NULL, view->length, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			  (writable ? MAP_SHARED : MAP_PRIVATE) |
+			  (flags & FILE_VIEW_POPULATE ? MAP_POPULATE : 0), fd, 0);
+
+	if (data == MAP_FAILED)
+		return -1;
+
+	// only a hint, the view is usable even if the kernel ignores it
+	if (flags & FILE_VIEW_SEQUENTIAL)
+		madvise(data, view->length, MADV_SEQUENTIAL);
+
+	view->data = data;
+
+	return 0;
+}
+
+int map_file(const char *path, int flags, struct file_view *view)
+{
+	int fd = open(path, (flags & FILE_VIEW_WRITE ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	int ret = map_fd(fd, flags, view);
+	int saved_errno = errno;
+
+	// the mapping keeps its own reference to the file
+	close(fd);
+	errno = saved_errno;
+
+	return ret;
+}
+
+int sync_file(struct file_view *view)
+{
+	return view->length ? msync(view->data, view->length, MS_SYNC) : 0;
+}
+
+int unmap_file(struct file_view *view)
+{
+	int ret = view->length ? munmap(view->data, view->length) : 0;
+
+	view->data = NULL;
+	view->length = 0;
+
+	return ret;
+}
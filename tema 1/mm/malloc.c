@@ -1,47 +1,300 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
-#include <internal/mm/mem_list.h>
 #include <internal/types.h>
 #include <internal/essentials.h>
+#include <stddef.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
 
-void *malloc(size_t size)
+/*
+ * Small chunks are carved from an arena grown with brk, or with mmap when brk
+ * cannot grow, and go back to the free list of their size class when freed.
+ * Chunk sizes are powers of 2, from MIN_CHUNK_SIZE up to MAX_CHUNK_SIZE,
+ * header included. Larger requests get a mapping of their own. The metadata of
+ * a chunk is its header, right in front of the pointer given to the caller.
+ *
+ * free and realloc only read the header of a pointer inside the memory of the
+ * allocator: the brk arena, one of the mapped arenas, or the first page of a
+ * mapping, for mapped chunks. Others are ignored, as if they had no magic.
+ */
+
+#define CHUNK_MAGIC		0x4D4C4C43u
+#define MAPPED_CLASS		((unsigned int)-1)
+
+#define MIN_CHUNK_SHIFT		5
+#define MAX_CHUNK_SHIFT		17
+#define MIN_CHUNK_SIZE		(1UL << MIN_CHUNK_SHIFT)
+#define MAX_CHUNK_SIZE		(1UL << MAX_CHUNK_SHIFT)
+#define NUM_SIZE_CLASSES	(MAX_CHUNK_SHIFT - MIN_CHUNK_SHIFT + 1)
+
+// the arena grows by at least this much at a time
+#define ARENA_GROWTH		(256 * 1024)
+
+#define PAGE_SIZE		4096
+#define ALIGN_UP(size, align)	(((size) + (align) - 1) & ~((align) - 1))
+
+struct chunk {
+	size_t size;			/* Size of the chunk, header included. */
+	unsigned int class;		/* Size class, or MAPPED_CLASS. */
+	unsigned int magic;		/* CHUNK_MAGIC while the chunk is allocated. */
+	struct chunk *next_free;	/* Next free chunk of the class, in the payload. */
+};
+
+// the payload keeps the 16 byte alignment of the chunk
+#define CHUNK_HEADER_SIZE	offsetof(struct chunk, next_free)
+
+/* Header of an arena mapped when brk could not grow, in front of its chunks. */
+struct arena {
+	char *end;
+	struct arena *next;
+};
+
+#define ARENA_HEADER_SIZE	ALIGN_UP(sizeof(struct arena), 16)
+
+static struct chunk *free_chunks[NUM_SIZE_CLASSES];
+
+// Part of the arena not carved into chunks yet.
+static char *arena_start, *arena_end;
+
+// Memory of the arenas, grown with brk or mapped.
+static char *brk_arena_start, *brk_arena_end;
+static struct arena *mapped_arenas;
+
+static inline void *chunk_to_ptr(struct chunk *chunk)
+{
+	return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+static inline struct chunk *ptr_to_chunk(void *ptr)
+{
+	return (struct chunk *)((char *)ptr - CHUNK_HEADER_SIZE);
+}
+
+// smallest class whose chunks hold size bytes, header included
+static unsigned int size_class(size_t size)
+{
+	unsigned int class = 0;
+
+	while ((MIN_CHUNK_SIZE << class) < size)
+		class++;
+
+	return class;
+}
+
+// makes room for at least size more bytes in the arena
+static int grow_arena(size_t size)
+{
+	size_t growth = ALIGN_UP(MAX(size, ARENA_GROWTH), PAGE_SIZE);
+	char *brk_end = sbrk(0);
+
+	// the arena grows with brk for as long as it ends at the program break
+	if (brk_end != (void *)-1 && (!arena_end || brk_end == arena_end)) {
+		char *start = (char *)ALIGN_UP((uintptr_t)brk_end, 16);
+
+		if (sbrk(start - brk_end + growth) != (void *)-1) {
+			if (!arena_end) {
+				arena_start = start;
+				brk_arena_start = start;
+			}
+
+			arena_end = start + growth;
+			brk_arena_end = arena_end;
+			return 0;
+		}
+	}
+
+	growth = ALIGN_UP(growth + ARENA_HEADER_SIZE, PAGE_SIZE);
+
+	struct arena *arena = mmap(NULL, growth, PROT_READ | PROT_WRITE,
+							   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (arena == MAP_FAILED)
+		return -1;
+
+	arena->end = (char *)arena + growth;
+	arena->next = mapped_arenas;
+	mapped_arenas = arena;
+
+	// what is left of the old arena is dropped
+	arena_start = (char *)arena + ARENA_HEADER_SIZE;
+	arena_end = arena->end;
+
+	return 0;
+}
+
+// whether the header of a chunk at this address can be read, without looking
+// at it: inside an arena, or at the start of a page that is mapped
+static int chunk_readable(struct chunk *chunk)
+{
+	char *header = (char *)chunk;
+
+	// chunks keep the 16 byte alignment of the arenas and mappings
+	if ((uintptr_t)header % 16)
+		return 0;
+
+	if (header >= brk_arena_start && header + CHUNK_HEADER_SIZE <= brk_arena_end)
+		return 1;
+
+	for (struct arena *arena = mapped_arenas; arena; arena = arena->next)
+		if (header >= (char *)arena && header + CHUNK_HEADER_SIZE <= arena->end)
+			return 1;
+
+	if ((uintptr_t)header % PAGE_SIZE)
+		return 0;
+
+	// msync fails on a page that is not mapped, errno is left as it was
+	int saved_errno = errno;
+	int mapped = msync(header, PAGE_SIZE, MS_ASYNC) == 0;
+
+	errno = saved_errno;
+	return mapped;
+}
+
+// whether ptr was given by malloc and not freed since
+static int chunk_allocated(void *ptr)
+{
+	struct chunk *chunk = ptr_to_chunk(ptr);
+
+	return chunk_readable(chunk) && chunk->magic == CHUNK_MAGIC;
+}
+
+static struct chunk *alloc_chunk(unsigned int class)
 {
-	// get an available address on the heap
-	void *start = mmap(NULL, size + sizeof(size_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	struct chunk *chunk = free_chunks[class];
+	size_t size = MIN_CHUNK_SIZE << class;
+
+	if (chunk) {
+		free_chunks[class] = chunk->next_free;
+		return chunk;
+	}
 
-	if (start == MAP_FAILED)
+	if ((size_t)(arena_end - arena_start) < size && grow_arena(size) < 0)
 		return NULL;
 
-	// store total allocated size on heap for the current malloc call
-	*((size_t *)start) = size + sizeof(size_t);
+	chunk = (struct chunk *)arena_start;
+	arena_start += size;
+
+	chunk->size = size;
+	chunk->class = class;
 
-	if (mem_list_add(start + sizeof(size_t), size) == -1) {
-		munmap(start, size + sizeof(size_t));
+	return chunk;
+}
+
+static struct chunk *map_chunk(size_t size)
+{
+	size = ALIGN_UP(size, PAGE_SIZE);
+
+	struct chunk *chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (chunk == MAP_FAILED)
+		return NULL;
+
+	chunk->size = size;
+	chunk->class = MAPPED_CLASS;
+
+	return chunk;
+}
+
+void *malloc(size_t size)
+{
+	if (size > (size_t)-1 - PAGE_SIZE - CHUNK_HEADER_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	size_t chunk_size = size + CHUNK_HEADER_SIZE;
+	struct chunk *chunk;
+
+	if (chunk_size <= MAX_CHUNK_SIZE)
+		chunk = alloc_chunk(size_class(chunk_size));
+	else
+		chunk = map_chunk(chunk_size);
+
+	if (!chunk) {
+		errno = ENOMEM;
 		return NULL;
 	}
 
-	// return the requested address
-	return start + sizeof(size_t);
+	chunk->magic = CHUNK_MAGIC;
+
+	return chunk_to_ptr(chunk);
 }
 
 void *calloc(size_t nmemb, size_t size)
 {
+	if (size && nmemb > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	void *start = malloc(nmemb * size);
 
-	// intialize with 0 all bytes of the added block
-	memset(start + sizeof(size_t), 0, nmemb * size);
+	if (!start)
+		return NULL;
+
+	// fresh mappings are already zeroed
+	if (ptr_to_chunk(start)->class != MAPPED_CLASS)
+		memset(start, 0, nmemb * size);
 
 	return start;
 }
 
 void free(void *ptr)
 {
-	if (!mem_list_del(ptr))
-		munmap(ptr - sizeof(size_t), *(size_t *)(ptr - sizeof(size_t)));
+	if (!ptr)
+		return;
+
+	struct chunk *chunk = ptr_to_chunk(ptr);
+
+	// pointers that were not given by malloc are ignored
+	if (!chunk_allocated(ptr))
+		return;
+
+	chunk->magic = 0;
+
+	if (chunk->class == MAPPED_CLASS) {
+		munmap(chunk, chunk->size);
+		return;
+	}
+
+	chunk->next_free = free_chunks[chunk->class];
+	free_chunks[chunk->class] = chunk;
+}
+
+// grows a chunk in place with the free end of the arena, when it is the last
+// chunk carved from it
+static int grow_chunk(struct chunk *chunk, size_t chunk_size)
+{
+	unsigned int class = size_class(chunk_size);
+	size_t size = MIN_CHUNK_SIZE << class;
+
+	if ((char *)chunk + chunk->size != arena_start ||
+		size - chunk->size > (size_t)(arena_end - arena_start))
+		return -1;
+
+	arena_start += size - chunk->size;
+	chunk->size = size;
+	chunk->class = class;
+
+	return 0;
+}
+
+// resizes a mapped chunk, the kernel moves its pages instead of copying them
+static struct chunk *remap_chunk(struct chunk *chunk, size_t chunk_size)
+{
+	size_t size = ALIGN_UP(chunk_size, PAGE_SIZE);
+	struct chunk *new_chunk = mremap(chunk, chunk->size, size, MREMAP_MAYMOVE);
+
+	if (new_chunk == MAP_FAILED)
+		return NULL;
+
+	new_chunk->size = size;
+
+	return new_chunk;
 }
 
 void *realloc(void *ptr, size_t size)
@@ -49,31 +302,58 @@ void *realloc(void *ptr, size_t size)
 	if (!ptr)
 		return malloc(size);
 
-	struct mem_list *item = mem_list_find(ptr);
+	struct chunk *chunk = ptr_to_chunk(ptr);
 
-	// no block found at address ptr in the allocated blocks
-	if (!item)
+	// no block allocated at address ptr
+	if (!chunk_allocated(ptr))
 		return NULL;
 
-	void *new_start = malloc(size);
-
-	if (!new_start) {
-		free(item->start);
+	if (size > (size_t)-1 - PAGE_SIZE - CHUNK_HEADER_SIZE) {
+		errno = ENOMEM;
 		return NULL;
 	}
 
-	memcpy(new_start, ptr, MIN(item->len, size));
-	free(item->start);
+	size_t chunk_size = size + CHUNK_HEADER_SIZE;
 
-	if (mem_list_add(new_start, size) == -1) {
-		munmap(new_start, size);
-		return NULL;
+	// the chunk is large enough already, unless a mapping would now span
+	// unused pages or a small chunk would waste most of its size class
+	if (chunk_size <= chunk->size &&
+		(chunk->class == MAPPED_CLASS ? chunk->size - chunk_size < PAGE_SIZE :
+		 chunk_size > chunk->size / 4))
+		return ptr;
+
+	if (chunk->class == MAPPED_CLASS && chunk_size > MAX_CHUNK_SIZE) {
+		chunk = remap_chunk(chunk, chunk_size);
+
+		if (!chunk) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		return chunk_to_ptr(chunk);
 	}
 
+	if (chunk->class != MAPPED_CLASS && chunk_size <= MAX_CHUNK_SIZE &&
+		chunk_size > chunk->size && !grow_chunk(chunk, chunk_size))
+		return ptr;
+
+	void *new_start = malloc(size);
+
+	if (!new_start)
+		return NULL;
+
+	memcpy(new_start, ptr, MIN(chunk->size - CHUNK_HEADER_SIZE, size));
+	free(ptr);
+
 	return new_start;
 }
 
 void *reallocarray(void *ptr, size_t nmemb, size_t size)
 {
+	if (size && nmemb > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	return realloc(ptr, nmemb * size);
 }
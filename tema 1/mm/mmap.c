@@ -6,7 +6,7 @@
 
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
-	long ret = syscall(__NR_mmap, addr, length, prot, flags, fd, offset);
+	long ret = __syscall6(__NR_mmap, (long)addr, length, prot, flags, fd, offset);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -18,7 +18,7 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 
 void *mremap(void *old_address, size_t old_size, size_t new_size, int flags)
 {
-	long ret = syscall(__NR_mremap, old_address, old_size, new_size, flags);
+	long ret = __syscall4(__NR_mremap, (long)old_address, old_size, new_size, flags);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -30,7 +30,31 @@ void *mremap(void *old_address, size_t old_size, size_t new_size, int flags)
 
 int munmap(void *addr, size_t length)
 {
-	int ret = syscall(__NR_munmap, addr, length);
+	long ret = __syscall2(__NR_munmap, (long)addr, length);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+int msync(void *addr, size_t length, int flags)
+{
+	long ret = __syscall3(__NR_msync, (long)addr, length, flags);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+int madvise(void *addr, size_t length, int advice)
+{
+	long ret = __syscall3(__NR_madvise, (long)addr, length, advice);
 
 	if (ret < 0) {
 		errno = -ret;
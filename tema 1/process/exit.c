@@ -1,9 +1,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 #include <internal/syscall.h>
+#include <internal/stdio.h>
 #include <stdlib.h>
 
 long exit(long exit_code)
 {
-	return syscall(__NR_exit, exit_code);
+	__stdio_exit();
+
+	return __syscall1(__NR_exit, exit_code);
 }
@@ -6,7 +6,7 @@
 
 int nanosleep(const struct timespec *t1, struct timespec *t2)
 {
-	int ret = syscall(__NR_nanosleep, t1, t2);
+	long ret = __syscall2(__NR_nanosleep, (long)t1, (long)t2);
 
 	if (ret < 0) {
 		errno = -ret;
@@ -6,7 +6,7 @@
 
 int fstat(int fd, struct stat *st)
 {
-	int ret = syscall(__NR_fstat, fd, st);
+	long ret = __syscall2(__NR_fstat, fd, (long)st);
 
 	if (ret < 0) {
 		errno = -ret;
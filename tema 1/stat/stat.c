@@ -7,7 +7,7 @@
 
 int stat(const char *restrict path, struct stat *restrict buf)
 {
-	int ret = syscall(__NR_stat, path, buf);
+	long ret = __syscall2(__NR_stat, (long)path, (long)buf);
 
 	if (ret < 0) {
 		errno = -ret;
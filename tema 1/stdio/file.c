@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <internal/io.h>
+#include <internal/stdio.h>
+#include <internal/types.h>
+
+#define MODE_UNKNOWN	-1	/* Picked on first use, line buffered on a TTY. */
+
+#define FLAG_ERROR	1
+#define FLAG_EOF	2
+
+struct _FILE {
+	int fd;
+	int mode;		/* _IOFBF, _IOLBF, _IONBF or MODE_UNKNOWN */
+	int flags;
+	char *buf;
+	size_t size;		/* Size of buf. */
+	size_t pos;		/* Next byte of buf to read or write. */
+	size_t len;		/* Bytes read into buf, 0 while writing. */
+};
+
+static char stdin_buf[BUFSIZ];
+static char stdout_buf[BUFSIZ];
+
+static struct _FILE std_files[] = {
+	{ .fd = 0, .mode = MODE_UNKNOWN, .buf = stdin_buf, .size = BUFSIZ },
+	{ .fd = 1, .mode = MODE_UNKNOWN, .buf = stdout_buf, .size = BUFSIZ },
+	{ .fd = 2, .mode = _IONBF },
+};
+
+FILE *const stdin = &std_files[0];
+FILE *const stdout = &std_files[1];
+FILE *const stderr = &std_files[2];
+
+static void pick_mode(FILE *stream)
+{
+	if (stream->mode == MODE_UNKNOWN)
+		stream->mode = isatty(stream->fd) ? _IOLBF : _IOFBF;
+}
+
+// writes all of buf, retrying short writes
+static int write_all(FILE *stream, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(stream->fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			stream->flags |= FLAG_ERROR;
+			return EOF;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// writes the buffered bytes followed by data, gathered in a single writev
+static int write_gather(FILE *stream, const char *data, size_t len)
+{
+	struct iovec iov[2] = {
+		{ stream->buf, stream->pos },
+		{ (void *)data, len },
+	};
+	struct iovec *vec = iov;
+	int count = 2;
+
+	stream->pos = 0;
+
+	while (count) {
+		ssize_t ret = writev(stream->fd, vec, count);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			stream->flags |= FLAG_ERROR;
+			return EOF;
+		}
+
+		// a short write resumes in the middle of a buffer
+		for (; count && (size_t)ret >= vec->iov_len; vec++, count--)
+			ret -= vec->iov_len;
+
+		if (count) {
+			vec->iov_base = (char *)vec->iov_base + ret;
+			vec->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+int setvbuf(FILE *stream, char *buf, int mode, size_t size)
+{
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+		return EOF;
+
+	if (fflush(stream) == EOF)
+		return EOF;
+
+	stream->mode = mode;
+
+	if (buf && size) {
+		stream->buf = buf;
+		stream->size = size;
+	}
+
+	// a stream without a buffer can only be unbuffered
+	if (!stream->buf)
+		stream->mode = _IONBF;
+
+	return 0;
+}
+
+int fflush(FILE *stream)
+{
+	if (!stream) {
+		int ret = 0;
+
+		for (size_t i = 0; i < sizeof(std_files) / sizeof(std_files[0]); i++)
+			if (fflush(&std_files[i]) == EOF)
+				ret = EOF;
+
+		return ret;
+	}
+
+	// input that was buffered but not consumed is dropped
+	if (stream->len) {
+		stream->pos = stream->len = 0;
+		return 0;
+	}
+
+	size_t pending = stream->pos;
+
+	stream->pos = 0;
+
+	return pending ? write_all(stream, stream->buf, pending) : 0;
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	const char *data = ptr;
+	size_t len = size * nmemb;
+
+	if (!len)
+		return 0;
+
+	pick_mode(stream);
+
+	// switching from reading to writing
+	if (stream->len)
+		fflush(stream);
+
+	if (stream->mode == _IONBF)
+		return write_all(stream, data, len) == EOF ? 0 : nmemb;
+
+	// a line buffered stream is flushed up to its last newline
+	size_t flush_len = 0;
+
+	if (stream->mode == _IOLBF) {
+		for (size_t i = len; i > 0; i--) {
+			if (data[i - 1] == '\n') {
+				flush_len = i;
+				break;
+			}
+		}
+	}
+
+	// data larger than the buffer goes out together with what is buffered
+	if (len >= stream->size)
+		return write_gather(stream, data, len) == EOF ? 0 : nmemb;
+
+	if (stream->pos + len > stream->size && fflush(stream) == EOF)
+		return 0;
+
+	memcpy(stream->buf + stream->pos, data, len);
+	stream->pos += len;
+
+	// a single write for the buffer up to the newline, the rest stays
+	if (flush_len) {
+		size_t rest = len - flush_len;
+		size_t pending = stream->pos - rest;
+
+		stream->pos = 0;
+
+		if (write_all(stream, stream->buf, pending) == EOF)
+			return 0;
+
+		memmove(stream->buf, stream->buf + pending, rest);
+		stream->pos = rest;
+	}
+
+	return nmemb;
+}
+
+int fputc(int c, FILE *stream)
+{
+	unsigned char byte = c;
+
+	// the common case stays a store in the buffer
+	if (stream->mode == _IOFBF && !stream->len && stream->pos < stream->size) {
+		stream->buf[stream->pos++] = byte;
+		return byte;
+	}
+
+	return fwrite(&byte, 1, 1, stream) ? byte : EOF;
+}
+
+int putc(int c, FILE *stream)
+{
+	return fputc(c, stream);
+}
+
+int putchar(int c)
+{
+	return fputc(c, stdout);
+}
+
+int fputs(const char *str, FILE *stream)
+{
+	size_t len = strlen(str);
+
+	return fwrite(str, 1, len, stream) == len || !len ? 1 : EOF;
+}
+
+// refills the buffer of an input stream, returns the number of bytes read
+static ssize_t fill(FILE *stream)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(stream->fd, stream->buf, stream->size);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		stream->flags |= ret ? FLAG_ERROR : FLAG_EOF;
+		stream->pos = stream->len = 0;
+		return ret;
+	}
+
+	stream->pos = 0;
+	stream->len = ret;
+
+	return ret;
+}
+
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	char *data = ptr;
+	size_t len = size * nmemb, done = 0;
+
+	if (!len)
+		return 0;
+
+	pick_mode(stream);
+
+	// switching from writing to reading, the output goes first
+	if (!stream->len && stream->pos && fflush(stream) == EOF)
+		return 0;
+
+	// reading from a TTY shows the prompt written to stdout first
+	if (stream == stdin && stream->pos == stream->len && stdout->mode == _IOLBF)
+		fflush(stdout);
+
+	while (done < len) {
+		if (stream->pos == stream->len) {
+			// large reads skip the buffer
+			if (len - done >= stream->size || !stream->buf) {
+				ssize_t ret = read(stream->fd, data + done, len - done);
+
+				if (ret < 0 && errno == EINTR)
+					continue;
+
+				if (ret <= 0) {
+					stream->flags |= ret ? FLAG_ERROR : FLAG_EOF;
+					break;
+				}
+
+				done += ret;
+				continue;
+			}
+
+			if (fill(stream) <= 0)
+				break;
+		}
+
+		size_t chunk = stream->len - stream->pos;
+
+		if (chunk > len - done)
+			chunk = len - done;
+
+		memcpy(data + done, stream->buf + stream->pos, chunk);
+		stream->pos += chunk;
+		done += chunk;
+	}
+
+	// a fully consumed buffer is ready for writing again
+	if (stream->pos == stream->len)
+		stream->pos = stream->len = 0;
+
+	return done / size;
+}
+
+int fgetc(FILE *stream)
+{
+	unsigned char byte;
+
+	return fread(&byte, 1, 1, stream) ? byte : EOF;
+}
+
+int getc(FILE *stream)
+{
+	return fgetc(stream);
+}
+
+int getchar(void)
+{
+	return fgetc(stdin);
+}
+
+void __stdio_exit(void)
+{
+	fflush(NULL);
+}
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <internal/types.h>
+#include <internal/essentials.h>
+
+/*
+ * Minimal printf: the flags '-' and '0', a width and a precision (also given
+ * as '*'), the length modifiers hh, h, l, ll, z and t, and the conversions
+ * d, i, u, x, X, o, p, c, s and %.
+ */
+
+#define FLAG_LEFT	1
+#define FLAG_ZERO	2
+
+struct spec {
+	int flags;
+	int width;
+	int precision;		/* -1 when not given */
+};
+
+// Padding written at once, so that an unbuffered stream takes one write.
+#define PAD_CHUNK	64
+
+static int pad(FILE *stream, char c, int count)
+{
+	char buf[PAD_CHUNK];
+	int left = count;
+
+	memset(buf, c, MIN(count > 0 ? count : 0, PAD_CHUNK));
+
+	while (left > 0) {
+		size_t len = MIN(left, PAD_CHUNK);
+
+		if (fwrite(buf, 1, len, stream) != len)
+			return -1;
+
+		left -= len;
+	}
+
+	return count > 0 ? count : 0;
+}
+
+// writes str padded to the width of the spec
+static int emit(FILE *stream, const struct spec *spec, const char *prefix, const char *str, size_t len)
+{
+	size_t prefix_len = strlen(prefix);
+	int fill = spec->width - (int)(prefix_len + len);
+
+	if (!(spec->flags & (FLAG_LEFT | FLAG_ZERO)) && pad(stream, ' ', fill) < 0)
+		return -1;
+
+	if (fwrite(prefix, 1, prefix_len, stream) != prefix_len && prefix_len)
+		return -1;
+
+	if (spec->flags & FLAG_ZERO && !(spec->flags & FLAG_LEFT) && pad(stream, '0', fill) < 0)
+		return -1;
+
+	if (fwrite(str, 1, len, stream) != len && len)
+		return -1;
+
+	if (spec->flags & FLAG_LEFT && pad(stream, ' ', fill) < 0)
+		return -1;
+
+	return MAX(fill, 0) + prefix_len + len;
+}
+
+static int emit_number(FILE *stream, struct spec *spec, unsigned long long value,
+		       int negative, unsigned int base, int upper, const char *prefix)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char buf[24];
+	int pos = sizeof(buf);
+
+	// a zero precision prints no digits for the value 0
+	if (value || spec->precision)
+		do {
+			buf[--pos] = digits[value % base];
+			value /= base;
+		} while (value);
+
+	// a precision gives the minimum number of digits and disables '0'
+	if (spec->precision >= 0) {
+		spec->flags &= ~FLAG_ZERO;
+
+		while ((int)sizeof(buf) - pos < spec->precision && pos > 0)
+			buf[--pos] = '0';
+	}
+
+	return emit(stream, spec, negative ? "-" : prefix, buf + pos, sizeof(buf) - pos);
+}
+
+int vfprintf(FILE *stream, const char *format, va_list args)
+{
+	int count = 0;
+
+	while (*format) {
+		// plain text up to the next conversion goes out in one piece
+		const char *percent = strchr(format, '%');
+		size_t len = percent ? (size_t)(percent - format) : strlen(format);
+
+		if (len) {
+			if (fwrite(format, 1, len, stream) != len)
+				return -1;
+
+			count += len;
+			format += len;
+			continue;
+		}
+
+		format++;
+
+		struct spec spec = { 0, 0, -1 };
+
+		for (;; format++) {
+			if (*format == '-')
+				spec.flags |= FLAG_LEFT;
+			else if (*format == '0')
+				spec.flags |= FLAG_ZERO;
+			else
+				break;
+		}
+
+		if (*format == '*') {
+			spec.width = va_arg(args, int);
+			format++;
+
+			if (spec.width < 0) {
+				spec.flags |= FLAG_LEFT;
+				spec.width = -spec.width;
+			}
+		} else {
+			for (; *format >= '0' && *format <= '9'; format++)
+				spec.width = 10 * spec.width + *format - '0';
+		}
+
+		if (*format == '.') {
+			format++;
+			spec.precision = 0;
+
+			if (*format == '*') {
+				spec.precision = va_arg(args, int);
+				format++;
+			} else {
+				for (; *format >= '0' && *format <= '9'; format++)
+					spec.precision = 10 * spec.precision + *format - '0';
+			}
+		}
+
+		// number of longs the argument takes, 0 for int and smaller
+		int longs = 0, shorts = 0;
+
+		for (;; format++) {
+			if (*format == 'l')
+				longs++;
+			else if (*format == 'z' || *format == 't')
+				longs = 1;
+			else if (*format == 'h')
+				shorts++;
+			else
+				break;
+		}
+
+		unsigned long long value;
+		int ret;
+
+		switch (*format) {
+		case 'd':
+		case 'i': {
+			long long number = longs ? va_arg(args, long) : va_arg(args, int);
+
+			if (shorts == 1)
+				number = (short)number;
+			else if (shorts > 1)
+				number = (signed char)number;
+
+			value = number < 0 ? -(unsigned long long)number : (unsigned long long)number;
+			ret = emit_number(stream, &spec, value, number < 0, 10, 0, "");
+			break;
+		}
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			value = longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+
+			if (shorts == 1)
+				value = (unsigned short)value;
+			else if (shorts > 1)
+				value = (unsigned char)value;
+
+			ret = emit_number(stream, &spec, value, 0,
+					  *format == 'u' ? 10 : *format == 'o' ? 8 : 16,
+					  *format == 'X', "");
+			break;
+		case 'p':
+			value = (unsigned long)va_arg(args, void *);
+			ret = emit_number(stream, &spec, value, 0, 16, 0, "0x");
+			break;
+		case 'c': {
+			char c = va_arg(args, int);
+
+			spec.flags &= ~FLAG_ZERO;
+			ret = emit(stream, &spec, "", &c, 1);
+			break;
+		}
+		case 's': {
+			const char *str = va_arg(args, const char *);
+
+			if (!str)
+				str = "(null)";
+
+			size_t str_len = strlen(str);
+
+			if (spec.precision >= 0 && (size_t)spec.precision < str_len)
+				str_len = spec.precision;
+
+			spec.flags &= ~FLAG_ZERO;
+			ret = emit(stream, &spec, "", str, str_len);
+			break;
+		}
+		case '%':
+			ret = fputc('%', stream) == EOF ? -1 : 1;
+			break;
+		default:
+			// unknown conversions are printed as they are
+			if (!*format)
+				return count;
+
+			ret = fputc('%', stream) == EOF || fputc(*format, stream) == EOF ? -1 : 2;
+		}
+
+		if (ret < 0)
+			return -1;
+
+		count += ret;
+		format++;
+	}
+
+	return count;
+}
+
+int vprintf(const char *format, va_list args)
+{
+	return vfprintf(stdout, format, args);
+}
+
+int fprintf(FILE *stream, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	int ret = vfprintf(stream, format, args);
+
+	va_end(args);
+
+	return ret;
+}
+
+int printf(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	int ret = vfprintf(stdout, format, args);
+
+	va_end(args);
+
+	return ret;
+}
@@ -1,19 +1,11 @@
-#include <internal/io.h>
-#include <internal/syscall.h>
-#include <internal/types.h>
-#include <errno.h>
+// SPDX-License-Identifier: BSD-3-Clause
+
 #include <stdio.h>
 
 int puts(const char *str)
 {
-    int i = 0;
-
-    for (; str[i]; i++)
-        if (write(stdout, str + i, 1) == EOF)
-            return EOF;
-
-    if (write(stdout, "\n", 1) == EOF)
-        return EOF;
+	if (fputs(str, stdout) == EOF || fputc('\n', stdout) == EOF)
+		return EOF;
 
-    return 1;
+	return 1;
 }
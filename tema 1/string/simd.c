@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <internal/string.h>
+#include <internal/types.h>
+
+/* SSE2 is part of x86_64, so these kernels run everywhere. */
+#define VEC_SIZE	16
+#define MOVEMASK	__builtin_ia32_pmovmskb128
+#define KERNEL(name)	__##name##_sse2
+
+#include "vector_kernels.h"
+
+#undef VEC_SIZE
+#undef MOVEMASK
+#undef KERNEL
+
+/* The AVX2 kernels are only picked once the CPU was found to have AVX2. */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#define VEC_SIZE	32
+#define MOVEMASK	__builtin_ia32_pmovmskb256
+#define KERNEL(name)	__##name##_avx2
+
+#include "vector_kernels.h"
+
+#pragma GCC pop_options
@@ -3,6 +3,75 @@
 #include <string.h>
 #include <stdlib.h>
 #include <internal/types.h>
+#include <internal/string.h>
+#include <internal/arch/x86_64/cpu_features.h>
+
+static void *memcpy_resolve(void *destination, const void *source, size_t num);
+static void *memmove_resolve(void *destination, const void *source, size_t num);
+static void *memset_resolve(void *source, int value, size_t num);
+static int memcmp_resolve(const void *ptr1, const void *ptr2, size_t num);
+static size_t strlen_resolve(const char *str);
+static char *strchr_resolve(const char *str, int c);
+
+/*
+ * Kernels in use. They start as resolvers, so that a program that never
+ * calls them does not pay for the CPUID at startup.
+ */
+static void *(*memcpy_kernel)(void *, const void *, size_t) = memcpy_resolve;
+static void *(*memmove_kernel)(void *, const void *, size_t) = memmove_resolve;
+static void *(*memset_kernel)(void *, int, size_t) = memset_resolve;
+static int (*memcmp_kernel)(const void *, const void *, size_t) = memcmp_resolve;
+static size_t (*strlen_kernel)(const char *) = strlen_resolve;
+static char *(*strchr_kernel)(const char *, int) = strchr_resolve;
+
+/* SSE2 is always there on x86_64. */
+static void string_init(void)
+{
+	int avx2 = __cpu_has_avx2();
+
+	memcpy_kernel = avx2 ? __memcpy_avx2 : __memcpy_sse2;
+	memmove_kernel = avx2 ? __memmove_avx2 : __memmove_sse2;
+	memset_kernel = avx2 ? __memset_avx2 : __memset_sse2;
+	memcmp_kernel = avx2 ? __memcmp_avx2 : __memcmp_sse2;
+	strlen_kernel = avx2 ? __strlen_avx2 : __strlen_sse2;
+	strchr_kernel = avx2 ? __strchr_avx2 : __strchr_sse2;
+}
+
+static void *memcpy_resolve(void *destination, const void *source, size_t num)
+{
+	string_init();
+	return memcpy_kernel(destination, source, num);
+}
+
+static void *memmove_resolve(void *destination, const void *source, size_t num)
+{
+	string_init();
+	return memmove_kernel(destination, source, num);
+}
+
+static void *memset_resolve(void *source, int value, size_t num)
+{
+	string_init();
+	return memset_kernel(source, value, num);
+}
+
+static int memcmp_resolve(const void *ptr1, const void *ptr2, size_t num)
+{
+	string_init();
+	return memcmp_kernel(ptr1, ptr2, num);
+}
+
+static size_t strlen_resolve(const char *str)
+{
+	string_init();
+	return strlen_kernel(str);
+}
+
+static char *strchr_resolve(const char *str, int c)
+{
+	string_init();
+	return strchr_kernel(str, c);
+}
 
 char *strcpy(char *destination, const char *source)
 {
@@ -111,23 +180,12 @@ int strncmp(const char *str1, const char *str2, size_t len)
 
 size_t strlen(const char *str)
 {
-	size_t i = 0;
-
-	for (; *str != '\0'; str++, i++)
-		;
-
-	return i;
+	return strlen_kernel(str);
 }
 
 char *strchr(const char *str, int c)
 {
-	const char *_str = str;
-
-	if (_str)
-		while (*_str && *_str != c)
-			_str++;
-
-	return (char *)((*_str == c) ? _str : NULL);
+	return strchr_kernel(str, c);
 }
 
 char *strrchr(const char *str, int c)
@@ -145,115 +203,22 @@ char *strrchr(const char *str, int c)
 	return ret;
 }
 
-// KMP algorithm running in O(strlen(haystack) + strlen(needle))
-char *strstr(const char *haystack, const char *needle)
-{
-	const char *_haystack = haystack;
-	size_t len = (int)strlen(needle);
-	int *pf = (int *)malloc((len + 1) * sizeof(char));
-	size_t i, j;
-
-	for (i = 1, j = 0; needle[i]; i++) {
-		while (needle[i] != needle[j] && j)
-			j = pf[j - 1];
-
-		if (needle[i] == needle[j])
-			pf[i] = (j++) + 1;
-	}
-
-	for (i = j = 0; _haystack[i]; i++) {
-		while (_haystack[i] != needle[j] && j)
-			j = pf[j - 1];
-
-		if (_haystack[i] == needle[j])
-			j++;
-
-		if (j == len) {
-			free(pf);
-			return (char *)(haystack + i - len + 1);
-		}
-	}
-
-	free(pf);
-
-	return NULL;
-}
-
-char *strrstr(const char *haystack, const char *needle)
-{
-	size_t strlen_haystack = strlen(haystack);
-	size_t strlen_needle = strlen(needle);
-
-	for (char *rpos = (char *)haystack + strlen_haystack - strlen_needle; rpos != haystack; rpos--)
-		if (!strncmp(rpos, needle, strlen_needle))
-			return rpos;
-
-	return NULL;
-}
-
 void *memcpy(void *destination, const void *source, size_t num)
 {
-	char *_destination = (char *)destination;
-	const char *_source = (const char *)source;
-
-	if (_destination && source) {
-		for (size_t pos = 0; pos < num; pos++) {
-			*(_destination++) = *(_source++);
-		}
-	}
-
-	return destination;
+	return memcpy_kernel(destination, source, num);
 }
 
 void *memmove(void *destination, const void *source, size_t num)
 {
-	char *_destination = (char *)destination;
-	const char *_source = (const char *)source;
-	char *temp = malloc(num * sizeof(char));
-	char *_temp = temp;
-
-	if (_destination && source) {
-		for (size_t pos = 0; pos < num; pos++) {
-			*(_temp++) = *(_source++);
-		}
-
-		_temp = temp;
-		for (size_t pos = 0; pos < num; pos++) {
-			*(_destination++) = *(_temp++);
-		}
-	}
-
-	free(temp);
-
-	return destination;
+	return memmove_kernel(destination, source, num);
 }
 
 int memcmp(const void *ptr1, const void *ptr2, size_t num)
 {
-	const unsigned char *_ptr1 = (unsigned char *)ptr1;
-	const unsigned char *_ptr2 = (unsigned char *)ptr2;
-
-	if (_ptr1 && _ptr2) {
-		for (size_t pos = 0; pos < num; pos++) {
-			if (*_ptr1 != *_ptr2)
-				return (*_ptr1) - (*_ptr2);
-
-			_ptr1++;
-			_ptr2++;
-		}
-	}
-
-	return 0;
+	return memcmp_kernel(ptr1, ptr2, num);
 }
 
 void *memset(void *source, int value, size_t num)
 {
-	char *_source = (char *)source;
-
-	if (source) {
-		for (size_t pos = 0; pos < num; pos++)
-			*(uint8_t *)(_source++) = value;
-	}
-
-	return source;
+	return memset_kernel(source, value, num);
 }
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include <internal/types.h>
+#include <internal/essentials.h>
+
+/*
+ * Substring search. Candidates are first filtered 16 positions at a time by
+ * the first and last bytes of the needle, which is enough for most needles.
+ * When the filter keeps finding false candidates, the rest of the haystack is
+ * searched with the Two-Way algorithm, which is linear in the worst case; its
+ * implementation follows the one of musl libc.
+ */
+
+typedef char vec_t __attribute__((vector_size(16)));
+typedef char __attribute__((vector_size(16), aligned(1), may_alias)) unaligned_vec_t;
+
+#define LOAD(ptr)		(*(const unaligned_vec_t *)(ptr))
+#define EQUAL_MASK(a, b)	((unsigned int)__builtin_ia32_pmovmskb128((vec_t)((a) == (b))))
+
+#define BITOP(set, byte, op) \
+	((set)[(size_t)(byte) / (8 * sizeof(*(set)))] op((size_t)1 << ((size_t)(byte) % (8 * sizeof(*(set))))))
+
+/*
+ * Two-Way search of needle in [haystack, end). The first match is returned,
+ * or the last one when last is set, since after a match the search can always
+ * go on from one period of the needle further.
+ */
+static const unsigned char *two_way(const unsigned char *haystack, const unsigned char *end,
+				    const unsigned char *needle, size_t len, int last)
+{
+	size_t byteset[32 / sizeof(size_t)] = { 0 };
+	size_t shift[256];
+	size_t i, ip, jp, k, p, ms, p0, mem, mem0;
+	const unsigned char *match = NULL;
+
+	// the shift that brings the last occurrence of each byte under the end
+	for (i = 0; i < len; i++) {
+		BITOP(byteset, needle[i], |=);
+		shift[needle[i]] = i + 1;
+	}
+
+	// maximal suffix for the byte order
+	ip = -1;
+	jp = 0;
+	k = p = 1;
+	while (jp + k < len) {
+		if (needle[ip + k] == needle[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if (needle[ip + k] > needle[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	ms = ip;
+	p0 = p;
+
+	// and for the reversed order, the longest one gives the critical factorization
+	ip = -1;
+	jp = 0;
+	k = p = 1;
+	while (jp + k < len) {
+		if (needle[ip + k] == needle[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if (needle[ip + k] < needle[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	if (ip + 1 > ms + 1)
+		ms = ip;
+	else
+		p = p0;
+
+	// when the needle is not periodic, only a lower bound of its period is known
+	if (memcmp(needle, needle + p, ms + 1)) {
+		mem0 = 0;
+		p = MAX(ms, len - ms - 1) + 1;
+	} else {
+		mem0 = len - p;
+	}
+	mem = 0;
+
+	while ((size_t)(end - haystack) >= len) {
+		// skip ahead by the last byte of the window first
+		if (BITOP(byteset, haystack[len - 1], &)) {
+			k = len - shift[haystack[len - 1]];
+			if (k) {
+				haystack += MAX(k, mem);
+				mem = 0;
+				continue;
+			}
+		} else {
+			haystack += len;
+			mem = 0;
+			continue;
+		}
+
+		// compare the right half
+		for (k = MAX(ms + 1, mem); k < len && needle[k] == haystack[k]; k++)
+			;
+		if (k < len) {
+			haystack += k - ms;
+			mem = 0;
+			continue;
+		}
+
+		// then the left half
+		for (k = ms + 1; k > mem && needle[k - 1] == haystack[k - 1]; k--)
+			;
+		if (k <= mem) {
+			if (!last)
+				return haystack;
+
+			match = haystack;
+		}
+
+		haystack += p;
+		mem = mem0;
+	}
+
+	return match;
+}
+
+void *memmem(const void *haystack, size_t haystack_len, const void *needle, size_t needle_len)
+{
+	const unsigned char *_haystack = haystack;
+	const unsigned char *_needle = needle;
+	size_t pos = 0, verified = 0;
+
+	if (!needle_len)
+		return (void *)haystack;
+
+	if (needle_len > haystack_len)
+		return NULL;
+
+	const vec_t first = (vec_t){ 0 } + (char)_needle[0];
+	const vec_t final = (vec_t){ 0 } + (char)_needle[needle_len - 1];
+
+	for (; pos + needle_len - 1 + sizeof(vec_t) <= haystack_len; pos += sizeof(vec_t)) {
+		// the filter gives up once checking its candidates costs more than the
+		// haystack they were found in, so the search stays linear
+		if (verified > 4 * pos + 256)
+			break;
+
+		unsigned int mask = EQUAL_MASK(LOAD(_haystack + pos), first) &
+				    EQUAL_MASK(LOAD(_haystack + pos + needle_len - 1), final);
+
+		for (; mask; mask &= mask - 1) {
+			const unsigned char *candidate = _haystack + pos + __builtin_ctz(mask);
+
+			if (needle_len <= 2 || !memcmp(candidate + 1, _needle + 1, needle_len - 2))
+				return (void *)candidate;
+
+			verified += needle_len;
+		}
+	}
+
+	return (void *)two_way(_haystack + pos, _haystack + haystack_len, _needle, needle_len, 0);
+}
+
+char *strstr(const char *haystack, const char *needle)
+{
+	return memmem(haystack, strlen(haystack), needle, strlen(needle));
+}
+
+char *strrstr(const char *haystack, const char *needle)
+{
+	size_t haystack_len = strlen(haystack);
+	size_t needle_len = strlen(needle);
+
+	if (!needle_len)
+		return (char *)haystack + haystack_len;
+
+	if (needle_len > haystack_len)
+		return NULL;
+
+	return (char *)two_way((const unsigned char *)haystack,
+			       (const unsigned char *)haystack + haystack_len,
+			       (const unsigned char *)needle, needle_len, 1);
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * SIMD kernels, included once per instruction set by simd.c with VEC_SIZE,
+ * MOVEMASK and KERNEL defined. Strings are read a whole aligned vector at a
+ * time, so the bytes read past their end never cross into another page.
+ */
+
+// every instruction set gets its own vector types
+#define vec_t			KERNEL(vec_t)
+#define unaligned_vec_t		KERNEL(unaligned_vec_t)
+
+typedef char vec_t __attribute__((vector_size(VEC_SIZE)));
+typedef char __attribute__((vector_size(VEC_SIZE), aligned(1), may_alias)) unaligned_vec_t;
+
+#define LOAD(ptr)		(*(const unaligned_vec_t *)(ptr))
+#define STORE(ptr, vec)		(*(unaligned_vec_t *)(ptr) = (vec))
+#define LOAD_ALIGNED(ptr)	(*(const vec_t *)(ptr))
+
+// one bit per byte of the vector, set where a and b are equal
+#define EQUAL_MASK(a, b)	((unsigned int)MOVEMASK((vec_t)((a) == (b))))
+#define FULL_MASK		((unsigned int)((1UL << VEC_SIZE) - 1))
+
+void *KERNEL(memmove)(void *destination, const void *source, size_t num)
+{
+	char *_destination = (char *)destination;
+	const char *_source = (const char *)source;
+
+	if (num < VEC_SIZE)
+		return __memmove_word(destination, source, num);
+
+	// the first and last vectors are loaded before anything is stored, so
+	// the copies are also correct when the regions overlap
+	vec_t head = LOAD(_source);
+	vec_t tail = LOAD(_source + num - VEC_SIZE);
+
+	if (_destination <= _source || _destination >= _source + num) {
+		for (size_t pos = VEC_SIZE; pos < num - VEC_SIZE; pos += VEC_SIZE)
+			STORE(_destination + pos, LOAD(_source + pos));
+	} else {
+		// copy from the end, vectors must not overlap or a load could read
+		// what a previous store overwrote, so the last bytes go word by word
+		size_t end = num - VEC_SIZE;
+
+		for (; end >= 2 * VEC_SIZE; end -= VEC_SIZE)
+			STORE(_destination + end - VEC_SIZE, LOAD(_source + end - VEC_SIZE));
+
+		if (end > VEC_SIZE)
+			__memmove_word(_destination + VEC_SIZE, _source + VEC_SIZE, end - VEC_SIZE);
+	}
+
+	STORE(_destination, head);
+	STORE(_destination + num - VEC_SIZE, tail);
+
+	return destination;
+}
+
+void *KERNEL(memcpy)(void *destination, const void *source, size_t num)
+{
+	return KERNEL(memmove)(destination, source, num);
+}
+
+void *KERNEL(memset)(void *source, int value, size_t num)
+{
+	char *_source = (char *)source;
+	vec_t vec = (vec_t){ 0 } + (char)value;
+
+	if (num < VEC_SIZE)
+		return __memset_word(source, value, num);
+
+	for (size_t pos = 0; pos < num - VEC_SIZE; pos += VEC_SIZE)
+		STORE(_source + pos, vec);
+
+	STORE(_source + num - VEC_SIZE, vec);
+
+	return source;
+}
+
+int KERNEL(memcmp)(const void *ptr1, const void *ptr2, size_t num)
+{
+	const unsigned char *_ptr1 = (unsigned char *)ptr1;
+	const unsigned char *_ptr2 = (unsigned char *)ptr2;
+	size_t pos = 0;
+
+	for (; pos + VEC_SIZE <= num; pos += VEC_SIZE) {
+		unsigned int mask = EQUAL_MASK(LOAD(_ptr1 + pos), LOAD(_ptr2 + pos));
+
+		if (mask != FULL_MASK) {
+			pos += __builtin_ctz(~mask);
+			return _ptr1[pos] - _ptr2[pos];
+		}
+	}
+
+	return __memcmp_word(_ptr1 + pos, _ptr2 + pos, num - pos);
+}
+
+size_t KERNEL(strlen)(const char *str)
+{
+	const vec_t zero = { 0 };
+	size_t offset = (uintptr_t)str & (VEC_SIZE - 1);
+	const char *vec = str - offset;
+
+	// ignore the bytes of the first vector that are before the string
+	unsigned int mask = EQUAL_MASK(LOAD_ALIGNED(vec), zero) >> offset << offset;
+
+	while (!mask) {
+		vec += VEC_SIZE;
+		mask = EQUAL_MASK(LOAD_ALIGNED(vec), zero);
+	}
+
+	return vec + __builtin_ctz(mask) - str;
+}
+
+char *KERNEL(strchr)(const char *str, int c)
+{
+	const vec_t zero = { 0 };
+	const vec_t pattern = (vec_t){ 0 } + (char)c;
+	size_t offset = (uintptr_t)str & (VEC_SIZE - 1);
+	const char *vec = str - offset;
+	vec_t data = LOAD_ALIGNED(vec);
+
+	// stop at the first byte that is either c or the terminator
+	unsigned int mask = (EQUAL_MASK(data, zero) | EQUAL_MASK(data, pattern)) >> offset << offset;
+
+	while (!mask) {
+		vec += VEC_SIZE;
+		data = LOAD_ALIGNED(vec);
+		mask = EQUAL_MASK(data, zero) | EQUAL_MASK(data, pattern);
+	}
+
+	vec += __builtin_ctz(mask);
+
+	return *vec == (char)c ? (char *)vec : NULL;
+}
+
+#undef vec_t
+#undef unaligned_vec_t
+#undef LOAD
+#undef STORE
+#undef LOAD_ALIGNED
+#undef EQUAL_MASK
+#undef FULL_MASK
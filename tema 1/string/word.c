@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <internal/string.h>
+#include <internal/types.h>
+
+/*
+ * Byte loops, and their versions working on 8 byte words. Words are only ever
+ * read at aligned addresses past the end of a string, so the extra bytes read
+ * never cross into another page.
+ */
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+#define WORD_SIZE	sizeof(word_t)
+#define ONES		0x0101010101010101UL
+#define HIGHS		0x8080808080808080UL
+
+// nonzero if the word has a zero byte, the lowest set high bit marks the first
+#define HAS_ZERO(x)	(((x) - ONES) & ~(x) & HIGHS)
+
+#define IS_ALIGNED(ptr)	(!((uintptr_t)(ptr) & (WORD_SIZE - 1)))
+
+void *__memcpy_byte(void *destination, const void *source, size_t num)
+{
+	char *_destination = (char *)destination;
+	const char *_source = (const char *)source;
+
+	for (size_t pos = 0; pos < num; pos++)
+		*(_destination++) = *(_source++);
+
+	return destination;
+}
+
+void *__memmove_byte(void *destination, const void *source, size_t num)
+{
+	char *_destination = (char *)destination;
+	const char *_source = (const char *)source;
+
+	if (_destination <= _source || _destination >= _source + num)
+		return __memcpy_byte(destination, source, num);
+
+	// the regions overlap with the destination last, copy from the end
+	while (num--)
+		_destination[num] = _source[num];
+
+	return destination;
+}
+
+void *__memset_byte(void *source, int value, size_t num)
+{
+	uint8_t *_source = (uint8_t *)source;
+
+	for (size_t pos = 0; pos < num; pos++)
+		*(_source++) = value;
+
+	return source;
+}
+
+int __memcmp_byte(const void *ptr1, const void *ptr2, size_t num)
+{
+	const unsigned char *_ptr1 = (unsigned char *)ptr1;
+	const unsigned char *_ptr2 = (unsigned char *)ptr2;
+
+	for (size_t pos = 0; pos < num; pos++) {
+		if (*_ptr1 != *_ptr2)
+			return (*_ptr1) - (*_ptr2);
+
+		_ptr1++;
+		_ptr2++;
+	}
+
+	return 0;
+}
+
+size_t __strlen_byte(const char *str)
+{
+	size_t i = 0;
+
+	for (; *str != '\0'; str++, i++)
+		;
+
+	return i;
+}
+
+char *__strchr_byte(const char *str, int c)
+{
+	while (*str && *str != (char)c)
+		str++;
+
+	return (char *)((*str == (char)c) ? str : NULL);
+}
+
+void *__memcpy_word(void *destination, const void *source, size_t num)
+{
+	char *_destination = (char *)destination;
+	const char *_source = (const char *)source;
+
+	// align the stores, the loads may stay unaligned
+	for (; num && !IS_ALIGNED(_destination); num--)
+		*(_destination++) = *(_source++);
+
+	for (; num >= WORD_SIZE; num -= WORD_SIZE) {
+		*(word_t *)_destination = *(const unaligned_word_t *)_source;
+		_destination += WORD_SIZE;
+		_source += WORD_SIZE;
+	}
+
+	while (num--)
+		*(_destination++) = *(_source++);
+
+	return destination;
+}
+
+void *__memmove_word(void *destination, const void *source, size_t num)
+{
+	char *_destination = (char *)destination;
+	const char *_source = (const char *)source;
+
+	// a forward copy reads every word before it can be overwritten
+	if (_destination <= _source || _destination >= _source + num)
+		return __memcpy_word(destination, source, num);
+
+	_destination += num;
+	_source += num;
+
+	for (; num && !IS_ALIGNED(_destination); num--)
+		*(--_destination) = *(--_source);
+
+	for (; num >= WORD_SIZE; num -= WORD_SIZE) {
+		_destination -= WORD_SIZE;
+		_source -= WORD_SIZE;
+		*(word_t *)_destination = *(const unaligned_word_t *)_source;
+	}
+
+	while (num--)
+		*(--_destination) = *(--_source);
+
+	return destination;
+}
+
+void *__memset_word(void *source, int value, size_t num)
+{
+	uint8_t *_source = (uint8_t *)source;
+	word_t word = ONES * (uint8_t)value;
+
+	for (; num && !IS_ALIGNED(_source); num--)
+		*(_source++) = value;
+
+	for (; num >= WORD_SIZE; num -= WORD_SIZE) {
+		*(word_t *)_source = word;
+		_source += WORD_SIZE;
+	}
+
+	while (num--)
+		*(_source++) = value;
+
+	return source;
+}
+
+int __memcmp_word(const void *ptr1, const void *ptr2, size_t num)
+{
+	const unsigned char *_ptr1 = (unsigned char *)ptr1;
+	const unsigned char *_ptr2 = (unsigned char *)ptr2;
+
+	// skip the equal words, the byte loop finds the first difference
+	for (; num >= WORD_SIZE; num -= WORD_SIZE) {
+		if (*(const unaligned_word_t *)_ptr1 != *(const unaligned_word_t *)_ptr2)
+			break;
+
+		_ptr1 += WORD_SIZE;
+		_ptr2 += WORD_SIZE;
+	}
+
+	return __memcmp_byte(_ptr1, _ptr2, num);
+}
+
+size_t __strlen_word(const char *str)
+{
+	const char *_str = str;
+
+	for (; !IS_ALIGNED(_str); _str++)
+		if (!*_str)
+			return _str - str;
+
+	const word_t *word = (const word_t *)_str;
+
+	while (!HAS_ZERO(*word))
+		word++;
+
+	// the lowest marked byte is the first zero on little endian
+	return (const char *)word + __builtin_ctzl(HAS_ZERO(*word)) / 8 - str;
+}
+
+char *__strchr_word(const char *str, int c)
+{
+	word_t pattern = ONES * (uint8_t)c;
+
+	for (; !IS_ALIGNED(str); str++) {
+		if (*str == (char)c)
+			return (char *)str;
+
+		if (!*str)
+			return NULL;
+	}
+
+	const word_t *word = (const word_t *)str;
+
+	while (!HAS_ZERO(*word) && !HAS_ZERO(*word ^ pattern))
+		word++;
+
+	return __strchr_byte((const char *)word, c);
+}
@@ -17,5 +17,5 @@ long syscall(long num, ...)
 	f = va_arg(valist, long);
 	va_end(valist);
 
-	return __syscall(num, a, b, c, d, e, f);
+	return __syscall6(num, a, b, c, d, e, f);
 }
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <internal/syscall.h>
+#include <internal/types.h>
+#include <internal/vdso.h>
+
+/*
+ * The clocks are read through the vDSO, which the kernel keeps up to date
+ * in a page shared with every process, so a read costs no syscall. The
+ * functions are looked up on the first read; without a vDSO, or for a
+ * clock it cannot read, the syscall is made instead.
+ */
+static int (*vdso_clock_gettime)(clockid_t, struct timespec *);
+static int (*vdso_gettimeofday)(struct timeval *, struct timezone *);
+static time_t (*vdso_time)(time_t *);
+static int vdso_resolved;
+
+static void vdso_resolve(void)
+{
+	vdso_clock_gettime = (int (*)(clockid_t, struct timespec *))
+		__vdso_sym("__vdso_clock_gettime");
+	vdso_gettimeofday = (int (*)(struct timeval *, struct timezone *))
+		__vdso_sym("__vdso_gettimeofday");
+	vdso_time = (time_t (*)(time_t *))__vdso_sym("__vdso_time");
+	vdso_resolved = 1;
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	long ret;
+
+	if (!vdso_resolved)
+		vdso_resolve();
+
+	/* The vDSO makes the syscall itself for the clocks it cannot read,
+	 * and returns its result the same way.
+	 */
+	if (vdso_clock_gettime != NULL)
+		ret = vdso_clock_gettime(clock_id, tp);
+	else
+		ret = __syscall2(__NR_clock_gettime, clock_id, (long)tp);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+int gettimeofday(struct timeval *tv, struct timezone *tz)
+{
+	long ret;
+
+	if (!vdso_resolved)
+		vdso_resolve();
+
+	if (vdso_gettimeofday != NULL)
+		ret = vdso_gettimeofday(tv, tz);
+	else
+		ret = __syscall2(__NR_gettimeofday, (long)tv, (long)tz);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+time_t time(time_t *tloc)
+{
+	if (!vdso_resolved)
+		vdso_resolve();
+
+	if (vdso_time != NULL)
+		return vdso_time(tloc);
+
+	return __syscall1(__NR_time, (long)tloc);
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <string.h>
+#include <sys/auxv.h>
+#include <internal/types.h>
+#include <internal/vdso.h>
+
+/*
+ * The vDSO is a whole ELF shared object the kernel maps in every process,
+ * section headers included: its functions are found in .dynsym, by name.
+ * Only the parts of ELF64 needed for that are described here.
+ */
+
+#define PT_LOAD		1
+#define SHT_DYNSYM	11
+#define SHN_UNDEF	0
+#define STT_FUNC	2
+#define STB_GLOBAL	1
+#define STB_WEAK	2
+
+struct elf64_ehdr {
+	unsigned char e_ident[16];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+
+struct elf64_phdr {
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_vaddr;
+	uint64_t p_paddr;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+
+struct elf64_shdr {
+	uint32_t sh_name;
+	uint32_t sh_type;
+	uint64_t sh_flags;
+	uint64_t sh_addr;
+	uint64_t sh_offset;
+	uint64_t sh_size;
+	uint32_t sh_link;
+	uint32_t sh_info;
+	uint64_t sh_addralign;
+	uint64_t sh_entsize;
+};
+
+struct elf64_sym {
+	uint32_t st_name;
+	unsigned char st_info;
+	unsigned char st_other;
+	uint16_t st_shndx;
+	uint64_t st_value;
+	uint64_t st_size;
+};
+
+void *__vdso_sym(const char *name)
+{
+	const char *image = (const char *)getauxval(AT_SYSINFO_EHDR);
+	const struct elf64_ehdr *ehdr = (const struct elf64_ehdr *)image;
+	const struct elf64_phdr *phdr;
+	const struct elf64_shdr *shdr;
+	uintptr_t bias = 0;
+	int loaded = 0;
+
+	if (image == NULL || memcmp(ehdr->e_ident, "\177ELF", 4) != 0)
+		return NULL;
+
+	/* Symbol values are addresses the image was linked at. */
+	phdr = (const struct elf64_phdr *)(image + ehdr->e_phoff);
+	for (int i = 0; i < ehdr->e_phnum && !loaded; i++) {
+		if (phdr[i].p_type == PT_LOAD) {
+			bias = (uintptr_t)image + phdr[i].p_offset - phdr[i].p_vaddr;
+			loaded = 1;
+		}
+	}
+	if (!loaded)
+		return NULL;
+
+	shdr = (const struct elf64_shdr *)(image + ehdr->e_shoff);
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		const struct elf64_sym *syms;
+		const char *strtab;
+		size_t count;
+
+		if (shdr[i].sh_type != SHT_DYNSYM || shdr[i].sh_entsize == 0)
+			continue;
+
+		syms = (const struct elf64_sym *)(image + shdr[i].sh_offset);
+		strtab = image + shdr[shdr[i].sh_link].sh_offset;
+		count = shdr[i].sh_size / shdr[i].sh_entsize;
+
+		for (size_t j = 0; j < count; j++) {
+			unsigned int type = syms[j].st_info & 0xf;
+			unsigned int bind = syms[j].st_info >> 4;
+
+			if (type != STT_FUNC || syms[j].st_shndx == SHN_UNDEF ||
+			    (bind != STB_GLOBAL && bind != STB_WEAK))
+				continue;
+			if (strcmp(strtab + syms[j].st_name, name) == 0)
+				return (void *)(bias + syms[j].st_value);
+		}
+	}
+
+	return NULL;
+}
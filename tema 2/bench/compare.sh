@@ -0,0 +1,34 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Replays every trace of bench/traces with glibc malloc, libosmem and, when it
+# is installed, jemalloc, each one picked through LD_PRELOAD. Set JEMALLOC to
+# the path of libjemalloc.so if it is not found by ldconfig.
+
+cd "$(dirname "$0")" || exit 1
+
+TRACES="churn prodcons realloc server"
+OSMEM=./libosmem-preload.so
+JEMALLOC=${JEMALLOC:-$(ldconfig -p 2>/dev/null | awk '/libjemalloc\.so/ { print $NF; exit }')}
+
+# without OSMEM_THREADS=1 the library has no locking, so it cannot replay
+# the trace with two threads
+threaded_osmem=0
+nm -D ../libosmem.so 2>/dev/null | grep -q ' tcache_get$' && threaded_osmem=1
+
+printf "%-10s %-10s %12s %10s %12s %10s\n" trace allocator "calls/s" "p99 (ns)" \
+	"peak RSS KiB" "frag"
+
+for trace in $TRACES; do
+	./traces "$trace" glibc
+
+	if [ "$trace" != prodcons ] || [ $threaded_osmem = 1 ]; then
+		LD_PRELOAD=$OSMEM ./traces "$trace" osmem
+	else
+		printf "%-10s %-10s %s\n" "$trace" osmem "skipped, needs OSMEM_THREADS=1"
+	fi
+
+	if [ -n "$JEMALLOC" ]; then
+		LD_PRELOAD=$JEMALLOC ./traces "$trace" jemalloc
+	fi
+done
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Routes the malloc family to libosmem, so unmodified programs can be run on
+ * it with LD_PRELOAD. Programs with more than one thread need a library built
+ * with OSMEM_THREADS=1.
+ */
+
+#include <stddef.h>
+#include "osmem.h"
+
+void *malloc(size_t size)
+{
+	return os_malloc(size);
+}
+
+void free(void *ptr)
+{
+	os_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	return os_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	return os_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	return os_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return os_aligned_alloc(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	return os_posix_memalign(memptr, alignment, size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	return os_malloc_usable_size(ptr);
+}
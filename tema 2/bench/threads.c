@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Scaling benchmark for the thread-safe allocator. Every thread replaces random
+ * entries of its own working set of small blocks, the total number of
+ * free/malloc pairs per second is reported for 1 up to MAX_THREADS threads.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+
+#define MAX_THREADS 64
+#define WORKING_SET 64
+#define MAX_SIZE 512
+#define OPS_PER_THREAD (1 << 20)
+
+static void *churn(void *arg)
+{
+	unsigned int seed = (unsigned long)arg;
+	void *blocks[WORKING_SET] = { NULL };
+
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		int slot = rand_r(&seed) % WORKING_SET;
+
+		os_free(blocks[slot]);
+		blocks[slot] = os_malloc(1 + rand_r(&seed) % MAX_SIZE);
+	}
+
+	for (int i = 0; i < WORKING_SET; i++)
+		os_free(blocks[i]);
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	pthread_t threads[MAX_THREADS];
+	double base = 0;
+
+	printf("%8s %12s %10s\n", "threads", "Mops/s", "speedup");
+
+	for (long num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+		double start = now();
+
+		for (long i = 0; i < num_threads; i++)
+			DIE(pthread_create(&threads[i], NULL, churn, (void *)(i + 1)),
+				"pthread_create failed");
+
+		for (long i = 0; i < num_threads; i++)
+			pthread_join(threads[i], NULL);
+
+		double mops = num_threads * OPS_PER_THREAD / (now() - start) / 1e6;
+
+		if (num_threads == 1)
+			base = mops;
+
+		printf("%8ld %12.2f %10.2f\n", num_threads, mops, mops / base);
+	}
+
+	return 0;
+}
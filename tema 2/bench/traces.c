@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Allocation traces replayed against whatever malloc the program is linked
+ * with, use LD_PRELOAD to pick the allocator (see compare.sh). Every trace is
+ * generated from a fixed seed, so all allocators replay the same sequence of
+ * calls. One line is printed per run: calls per second, the 99th percentile
+ * of the latency of a call, the peak RSS and the fragmentation, that is the
+ * share of the peak RSS that did not hold live data at the peak. Latencies are
+ * sampled, one call out of SAMPLE_PERIOD is timed.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define SEED 42
+#define SAMPLE_PERIOD 16
+#define MAX_SAMPLES (1 << 18)
+
+#define CHURN_SLOTS 4096
+#define CHURN_OPS (1 << 22)
+
+#define PRODCONS_MESSAGES (1 << 21)
+#define PRODCONS_QUEUE 1024
+
+#define REALLOC_BUFFERS 256
+#define REALLOC_ROUNDS 8
+#define REALLOC_MAX_SIZE (256 * 1024)
+
+#define SERVER_REQUESTS (1 << 17)
+#define SERVER_CACHE 2048
+
+// Latency samples, one every SAMPLE_PERIOD calls, merged from every thread.
+static unsigned int samples[MAX_SAMPLES];
+static size_t num_samples;
+static size_t num_calls;
+
+// Samples of the calling thread, merged when it is done.
+static __thread unsigned int local_samples[MAX_SAMPLES / 2];
+static __thread size_t local_num_samples;
+static __thread size_t local_num_calls;
+
+// Bytes requested and not freed yet, and their maximum.
+static size_t live_bytes;
+static size_t peak_live_bytes;
+
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// current RSS in KiB
+static long current_rss(void)
+{
+	long pages = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (statm) {
+		if (fscanf(statm, "%*s %ld", &pages) != 1)
+			pages = 0;
+
+		fclose(statm);
+	}
+
+	return pages * (getpagesize() / 1024);
+}
+
+static void account(size_t freed, size_t allocated)
+{
+	size_t live = __atomic_add_fetch(&live_bytes, allocated - freed,
+									 __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+
+	while (live > peak &&
+		   !__atomic_compare_exchange_n(&peak_live_bytes, &peak, live, true,
+										__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// only one call out of SAMPLE_PERIOD is timed, so the clock does not weigh
+// on the throughput
+static long long start_call(void)
+{
+	return local_num_calls++ % SAMPLE_PERIOD ? 0 : now_ns();
+}
+
+static void end_call(long long start)
+{
+	if (start && local_num_samples < MAX_SAMPLES / 2)
+		local_samples[local_num_samples++] = now_ns() - start;
+}
+
+static void merge_samples(void)
+{
+	pthread_mutex_lock(&samples_lock);
+
+	for (size_t i = 0; i < local_num_samples && num_samples < MAX_SAMPLES; i++)
+		samples[num_samples++] = local_samples[i];
+
+	num_calls += local_num_calls;
+	pthread_mutex_unlock(&samples_lock);
+}
+
+static void *timed_malloc(size_t size)
+{
+	long long start = start_call();
+	void *ptr = malloc(size);
+
+	end_call(start);
+
+	// touch the block, as a real program would
+	memset(ptr, 0xA5, size < 64 ? size : 64);
+	account(0, size);
+	return ptr;
+}
+
+static void *timed_realloc(void *ptr, size_t old_size, size_t size)
+{
+	long long start = start_call();
+	void *new_ptr = realloc(ptr, size);
+
+	end_call(start);
+
+	account(old_size, size);
+	return new_ptr;
+}
+
+static void timed_free(void *ptr, size_t size)
+{
+	long long start = start_call();
+
+	free(ptr);
+	end_call(start);
+
+	account(size, 0);
+}
+
+// sizes biased towards small requests, like most programs
+static size_t random_size(unsigned int *seed, size_t max_size)
+{
+	size_t bits = 3 + rand_r(seed) % 8;
+	size_t size = 1 + rand_r(seed) % ((size_t)1 << bits);
+
+	return size < max_size ? size : max_size;
+}
+
+// small objects freed in random order
+static void churn(void)
+{
+	static void *blocks[CHURN_SLOTS];
+	static size_t sizes[CHURN_SLOTS];
+	unsigned int seed = SEED;
+
+	for (int i = 0; i < CHURN_OPS; i++) {
+		int slot = rand_r(&seed) % CHURN_SLOTS;
+
+		if (blocks[slot])
+			timed_free(blocks[slot], sizes[slot]);
+
+		sizes[slot] = random_size(&seed, 256);
+		blocks[slot] = timed_malloc(sizes[slot]);
+	}
+
+	for (int i = 0; i < CHURN_SLOTS; i++) {
+		if (blocks[i])
+			timed_free(blocks[i], sizes[i]);
+	}
+}
+
+struct message {
+	size_t size;
+	char data[];
+};
+
+static struct message *queue[PRODCONS_QUEUE];
+static size_t queue_head, queue_tail;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+
+static void *consumer(void *arg)
+{
+	(void)arg;
+
+	for (int i = 0; i < PRODCONS_MESSAGES; i++) {
+		pthread_mutex_lock(&queue_lock);
+
+		while (queue_head == queue_tail)
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+
+		struct message *message = queue[queue_head++ % PRODCONS_QUEUE];
+
+		pthread_cond_signal(&queue_not_full);
+		pthread_mutex_unlock(&queue_lock);
+
+		timed_free(message, message->size);
+	}
+
+	merge_samples();
+	return NULL;
+}
+
+// messages allocated by one thread and freed by another
+static void prodcons(void)
+{
+	pthread_t thread;
+	unsigned int seed = SEED;
+
+	if (pthread_create(&thread, NULL, consumer, NULL)) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < PRODCONS_MESSAGES; i++) {
+		size_t size = sizeof(struct message) + random_size(&seed, 1024);
+		struct message *message = timed_malloc(size);
+
+		message->size = size;
+
+		pthread_mutex_lock(&queue_lock);
+
+		while (queue_tail - queue_head == PRODCONS_QUEUE)
+			pthread_cond_wait(&queue_not_full, &queue_lock);
+
+		queue[queue_tail++ % PRODCONS_QUEUE] = message;
+
+		pthread_cond_signal(&queue_not_empty);
+		pthread_mutex_unlock(&queue_lock);
+	}
+
+	pthread_join(thread, NULL);
+}
+
+// buffers grown by small appends, then dropped
+static void realloc_growth(void)
+{
+	static char *buffers[REALLOC_BUFFERS];
+	static size_t sizes[REALLOC_BUFFERS];
+	unsigned int seed = SEED;
+
+	for (int round = 0; round < REALLOC_ROUNDS; round++) {
+		for (bool growing = true; growing;) {
+			growing = false;
+
+			for (int i = 0; i < REALLOC_BUFFERS; i++) {
+				size_t limit = REALLOC_MAX_SIZE >> (i % 8);
+
+				if (sizes[i] >= limit)
+					continue;
+
+				size_t size = sizes[i] + 1 + rand_r(&seed) % 256;
+
+				buffers[i] = timed_realloc(buffers[i], sizes[i], size);
+				buffers[i][size - 1] = 0;
+				sizes[i] = size;
+				growing = true;
+			}
+		}
+
+		for (int i = 0; i < REALLOC_BUFFERS; i++) {
+			timed_free(buffers[i], sizes[i]);
+			buffers[i] = NULL;
+			sizes[i] = 0;
+		}
+	}
+}
+
+// short lived headers and bodies per request, next to a cache of long lived
+// entries that are replaced at random
+static void server(void)
+{
+	static void *cache[SERVER_CACHE];
+	static size_t cache_sizes[SERVER_CACHE];
+	unsigned int seed = SEED;
+
+	for (int i = 0; i < SERVER_REQUESTS; i++) {
+		void *headers[8];
+		size_t header_sizes[8];
+		int num_headers = 1 + rand_r(&seed) % 8;
+
+		for (int j = 0; j < num_headers; j++) {
+			header_sizes[j] = 16 + rand_r(&seed) % 240;
+			headers[j] = timed_malloc(header_sizes[j]);
+		}
+
+		// most bodies are small, a few are large enough to be mapped
+		size_t body_size = rand_r(&seed) % 100 ? 512 + rand_r(&seed) % 16384 :
+							1024 * 1024 + rand_r(&seed) % (1024 * 1024);
+		void *body = timed_malloc(body_size);
+
+		if (rand_r(&seed) % 4 == 0) {
+			int slot = rand_r(&seed) % SERVER_CACHE;
+
+			if (cache[slot])
+				timed_free(cache[slot], cache_sizes[slot]);
+
+			cache_sizes[slot] = 64 + rand_r(&seed) % 4096;
+			cache[slot] = timed_malloc(cache_sizes[slot]);
+		}
+
+		timed_free(body, body_size);
+
+		for (int j = 0; j < num_headers; j++)
+			timed_free(headers[j], header_sizes[j]);
+	}
+
+	for (int i = 0; i < SERVER_CACHE; i++) {
+		if (cache[i])
+			timed_free(cache[i], cache_sizes[i]);
+	}
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} traces[] = {
+	{ "churn", churn },
+	{ "prodcons", prodcons },
+	{ "realloc", realloc_growth },
+	{ "server", server },
+};
+
+int main(int argc, char *argv[])
+{
+	const char *allocator = argc > 2 ? argv[2] : "default";
+
+	for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+		if (argc < 2 || strcmp(argv[1], traces[i].name))
+			continue;
+
+		// the sample buffers are not part of the peak RSS of the trace
+		memset(samples, 0, sizeof(samples));
+		memset(local_samples, 0, sizeof(local_samples));
+
+		long base_rss = current_rss();
+		double start = now();
+
+		traces[i].run();
+		merge_samples();
+
+		double elapsed = now() - start;
+		struct rusage usage;
+
+		getrusage(RUSAGE_SELF, &usage);
+
+		long peak_rss = usage.ru_maxrss - base_rss;
+		double fragmentation = peak_rss > 0 ?
+			1 - (double)peak_live_bytes / 1024 / peak_rss : 0;
+
+		qsort(samples, num_samples, sizeof(samples[0]), compare_samples);
+
+		printf("%-10s %-10s %12.0f %10u %12ld %9.1f%%\n", traces[i].name,
+			   allocator, num_calls / elapsed,
+			   num_samples ? samples[num_samples * 99 / 100] : 0, peak_rss,
+			   fragmentation < 0 ? 0 : 100 * fragmentation);
+		return 0;
+	}
+
+	fprintf(stderr, "usage: %s churn|prodcons|realloc|server [allocator]\n",
+			argv[0]);
+	return EXIT_FAILURE;
+}
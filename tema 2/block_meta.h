@@ -3,6 +3,7 @@
 #pragma once
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -24,18 +25,30 @@
 		} \
 	} while (0)
 
-/* Structure to hold memory block metadata */
+/*
+ * Structure to hold memory block metadata
+ *
+ * Only size and magic make up the header of an allocated block, the free list
+ * links live in the payload of free blocks. Heap blocks end with a footer
+ * holding their size, so the previous block of the heap can be found from the
+ * start of the next one. Mapped blocks have no footer. The hardened build adds
+ * a canary to the header.
+ */
 struct block_meta {
-	size_t size; // The size of the memory block.
-	int status; // The status of the memory block (free or allocated).
-	struct block_meta *prev; // Pointer to the previous block in the list.
-	struct block_meta *next; // Pointer to the next block in the list.
+	size_t size; // The size of the memory block, the status in the low bits.
+	unsigned int magic; // BLOCK_MAGIC while the header is a live block header.
+	unsigned int owner; // Thread cache the block belongs to, 0 for none.
+#ifdef OSMEM_HARDEN
+	size_t canary; // Checks the header, see harden.h.
+#endif
+	struct block_meta *prev_free; // Free blocks only, previous in the free list.
+	struct block_meta *next_free; // Free blocks only, next in the free list.
 };
 
-// Pointer to the head of the list of allocated blocks.
+// Pointer to the first block of the heap.
 extern struct block_meta *head;
 
-// Pointer to the tail of the list of allocated blocks.
+// Pointer to the last block of the heap.
 extern struct block_meta *tail;
 
 /**
@@ -46,27 +59,46 @@ extern struct block_meta *tail;
 bool find_preallocation();
 
 /**
- * @brief Checks if the memory allocator's list of blocks is empty.
+ * @brief Grows the heap through sbrk and keeps track of its bounds.
+ *
+ * @param size The number of bytes to add to the heap.
+ *
+ * @return The previous end of the heap, or BRK_FAILED on error.
+ */
+void *extend_heap(size_t size);
+
+/**
+ * @brief Gives the end of the heap back to the OS through a negative sbrk.
+ *
+ * Nothing is done if the program break was moved past the heap by someone
+ * else.
+ *
+ * @param size The number of bytes to remove from the heap.
+ *
+ * @return The previous end of the heap, or BRK_FAILED on error.
+ */
+void *shrink_heap(size_t size);
+
+/**
+ * @brief Checks if the heap has no blocks.
  *
- * @return true if the memory allocator's list of blocks is empty, false
- * otherwise.
+ * @return true if the heap has no blocks, false otherwise.
  */
 bool empty();
 
 /**
- * @brief Sets the metadata of a memory block.
+ * @brief Sets the metadata of a memory block, footer included.
  *
  * @param block Pointer to the block metadata structure.
  * @param size The size of the memory block.
  * @param status The status of the memory block (free or allocated).
- * @param prev Pointer to the previous block in the list.
- * @param next Pointer to the next block in the list.
  */
-void set_block(struct block_meta *block, size_t size, int status,
-			   struct block_meta *prev, struct block_meta *next);
+void set_block(struct block_meta *block, size_t size, int status);
 
 /**
- * Sets the size of the given block.
+ * Sets the size of the given block and rewrites its footer.
+ *
+ * A free block is moved to the free list of its new size class.
  *
  * @param block Pointer to the block metadata.
  * @param size The size to set for the block.
@@ -76,6 +108,9 @@ void set_size(struct block_meta *block, size_t size);
 /**
  * @brief Sets the status of a memory block.
  *
+ * Blocks entering or leaving STATUS_FREE are added to or removed from the free
+ * lists.
+ *
  * @param block Pointer to the block metadata structure.
  * @param status The status of the memory block (free or allocated).
  */
@@ -100,50 +135,60 @@ size_t get_size(struct block_meta *block);
 int get_status(struct block_meta *block);
 
 /**
- * Returns a pointer to the first block in the memory allocator's list of
- * blocks.
+ * @brief Gets the number of bytes the user can store in a memory block.
+ *
+ * @param block Pointer to the block metadata structure.
+ *
+ * @return The size of the block without its header and footer.
+ */
+size_t get_payload_size(struct block_meta *block);
+
+/**
+ * Returns a pointer to the first block of the heap.
  *
- * @return A pointer to the first block in the memory allocator's list of
- * blocks.
+ * @return A pointer to the first block of the heap.
  */
 struct block_meta *front();
 
 /**
- * @brief Returns a pointer to the last block in the linked list of block
- * metadata.
+ * @brief Returns a pointer to the last block of the heap.
  *
- * @return A pointer to the last block in the linked list of block metadata.
+ * @return A pointer to the last block of the heap.
  */
 struct block_meta *back();
 
 /**
- * @brief Adds a block to the end of the list of allocated blocks.
+ * @brief Returns the block following a heap block in memory.
  *
  * @param block Pointer to the block metadata structure.
- * @param size The size of the memory block.
- * @param status The status of the memory block (free or allocated).
+ *
+ * @return A pointer to the next block, or NULL for the last block.
  */
-void emplace_back(struct block_meta *block, size_t size, int status);
+struct block_meta *next_block(struct block_meta *block);
 
 /**
- * @brief Inserts a new block at the beginning of the linked list.
- * 
- * @param block Pointer to the block to be inserted.
- * @param size Size of the block to be inserted.
- * @param status Status of the block to be inserted.
+ * @brief Returns the block preceding a heap block in memory, found through
+ * its footer.
+ *
+ * @param block Pointer to the block metadata structure.
+ *
+ * @return A pointer to the previous block, or NULL for the first block.
  */
-void emplace_front(struct block_meta *block, size_t size, int status);
+struct block_meta *prev_block(struct block_meta *block);
 
 /**
- * @brief Removes a block from the list of allocated blocks.
+ * @brief Adds a block to the end of the heap.
  *
  * @param block Pointer to the block metadata structure.
+ * @param size The size of the memory block.
+ * @param status The status of the memory block (free or allocated).
  */
-void erase(struct block_meta *block);
+void emplace_back(struct block_meta *block, size_t size, int status);
 
 /**
  * Splits a block into two blocks, one with the requested size and the other
- * with the remaining size.
+ * with the remaining size. The remaining block is merged with the next block if
+ * that one is free.
  * 
  * @param block Pointer to the block to be split.
  * @param size The size of the first block after the split.
@@ -153,8 +198,8 @@ void erase(struct block_meta *block);
 bool split_block(struct block_meta *block, size_t size);
 
 /**
- * @brief Searches for a block of memory with a given address in the list of
- * allocated blocks.
+ * @brief Searches for a block of memory with a given address among the blocks
+ * of the heap and the mapped blocks.
  *
  * @param block A pointer to the block_meta structure representing the block of
  * memory to search for.
@@ -163,6 +208,31 @@ bool split_block(struct block_meta *block, size_t size);
  */
 bool find_block(struct block_meta *block);
 
+/**
+ * @brief Checks in constant time if a block is a live block of the sbrk heap.
+ *
+ * The block must lie inside the heap bounds and carry BLOCK_MAGIC. Mapped
+ * blocks are never heap blocks.
+ *
+ * @param block A pointer to the block_meta structure to check.
+ *
+ * @return true if the block is a live heap block, false otherwise.
+ */
+bool is_heap_block(struct block_meta *block);
+
+/**
+ * @brief Checks in constant time if a block was handed out by the allocator.
+ *
+ * brk blocks are checked against the heap bounds and their magic word, mapped
+ * blocks against the registry of mappings. When built with OSMEM_DEBUG, the
+ * whole heap is walked instead.
+ *
+ * @param block A pointer to the block_meta structure to check.
+ *
+ * @return true if the block is a live block of the allocator, false otherwise.
+ */
+bool is_valid_block(struct block_meta *block);
+
 /**
  * @brief Coalesces the given block with the next block if it is free.
  * 
@@ -173,13 +243,49 @@ bool find_block(struct block_meta *block);
 bool coalesce_with_next(struct block_meta *block);
 
 /**
- * @brief Coalesces all adjacent free blocks in the memory pool.
+ * @brief Marks a block as free and merges it with its free neighbours.
+ *
+ * Free blocks are merged as soon as they appear, so no two free blocks are
+ * ever adjacent and merging only has to look at the previous and the next
+ * block.
+ *
+ * @param block Pointer to the block to be freed.
+ *
+ * @return A pointer to the free block that now contains the given block.
+ */
+struct block_meta *coalesce(struct block_meta *block);
+
+/**
+ * @brief Computes the size class of a memory block.
+ *
+ * Size class i holds the free blocks whose size lies in [2^i, 2^(i+1)).
+ *
+ * @param size The size of the memory block, must be greater than 0.
+ *
+ * @return The index of the free list the block belongs to.
+ */
+size_t size_class(size_t size);
+
+/**
+ * @brief Adds a free block to the free list of its size class.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void free_list_insert(struct block_meta *block);
+
+/**
+ * @brief Removes a free block from the free list of its size class.
+ *
+ * @param block Pointer to the block metadata structure.
  */
-void coalesce_free_blocks();
+void free_list_remove(struct block_meta *block);
 
 /**
  * @brief Finds the best fit block for a given size.
  *
+ * Only the size class of the request and the first non-empty larger class are
+ * searched, the rest of the heap is never walked.
+ *
  * @param size The size of the memory block.
  *
  * @return A pointer to the block metadata structure representing the best fit
@@ -187,16 +293,57 @@ void coalesce_free_blocks();
  */
 struct block_meta *find_best_fit(size_t size);
 
+/**
+ * @brief Walks the free lists to sum up the free blocks of the heap.
+ *
+ * @param free_bytes Set to the total size of the free blocks.
+ * @param largest Set to the size of the largest free block.
+ */
+void free_list_stats(size_t *free_bytes, size_t *largest);
+
 #define ALIGNMENT 8
 
 // aligns size to the next multiple of ALIGNMENT
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
-#define ALIGNED_METADATA_SIZE ALIGN(sizeof(struct block_meta))
+#define ALIGNED_METADATA_SIZE ALIGN(offsetof(struct block_meta, prev_free))
+
+#define FOOTER_SIZE sizeof(size_t)
+
+/* A heap block must be able to hold the free list links once it is freed */
+#define MIN_BLOCK_SIZE (sizeof(struct block_meta) + FOOTER_SIZE)
+
+// size of a heap block, metadata included, that holds size bytes
+#define HEAP_BLOCK_SIZE(size) \
+	(ALIGNED_METADATA_SIZE + ALIGN(size) + FOOTER_SIZE < MIN_BLOCK_SIZE ? \
+	 MIN_BLOCK_SIZE : ALIGNED_METADATA_SIZE + ALIGN(size) + FOOTER_SIZE)
+
+// size of a mapped block, metadata included, that holds size bytes
+#define MAPPED_BLOCK_SIZE(size) (ALIGNED_METADATA_SIZE + ALIGN(size))
 
 #define MMAP_THRESHOLD (128 * 1024)
 
-/* Block metadata status values */
+/* The dynamic mmap threshold never grows past this size, as in glibc */
+#define MMAP_THRESHOLD_MAX (4 * 1024 * 1024 * sizeof(long))
+
+/* A free block at the end of the heap larger than this is trimmed */
+#define TRIM_THRESHOLD (128 * 1024)
+
+/* Freed pages inside a free block at least this large are madvised */
+#define MADVISE_THRESHOLD (1024 * 1024)
+
+/* Smaller runs of freed pages are not worth a madvise call */
+#define MADVISE_MIN_PAGES 4
+
+#define BRK_FAILED ((void *)-1)
+
+#define BLOCK_MAGIC 0x05B10C4Bu
+
+/* One free list for every power of two a size_t can hold */
+#define NUM_SIZE_CLASSES (8 * sizeof(size_t))
+
+/* Block metadata status values, kept in the low bits of the size */
 #define STATUS_FREE   0
 #define STATUS_ALLOC  1
 #define STATUS_MAPPED 2
+#define STATUS_MASK   3
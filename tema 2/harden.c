@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "harden.h"
+
+// Mixed into every canary, picked on first use so that no header was sealed
+// with another value.
+static uintptr_t secret;
+
+// Freed blocks in the order they were freed, oldest at ring_head; one more
+// slot than QUARANTINE_BLOCKS, a block is added before the oldest leaves.
+static struct block_meta *ring[QUARANTINE_BLOCKS + 1];
+static size_t ring_head;
+static size_t ring_count;
+static size_t ring_bytes;
+
+// Bytes the quarantine holds before letting blocks go, 0 turns it off.
+static size_t quarantine_limit = QUARANTINE_BYTES;
+
+// reports a corrupted block, without stdio, which may allocate
+static void __attribute__((noreturn)) fail(const char *what, void *ptr)
+{
+	char line[128];
+	int len = snprintf(line, sizeof(line), "osmem: %s at %p\n", what, ptr);
+
+	if (len > 0)
+		write(STDERR_FILENO, line, MIN((size_t)len, sizeof(line) - 1));
+	abort();
+}
+
+static uintptr_t canary(struct block_meta *block)
+{
+	if (!secret) {
+		if (getrandom(&secret, sizeof(secret), GRND_NONBLOCK) != sizeof(secret))
+			secret = (uintptr_t)&secret * 0x9E3779B97F4A7C15ULL;
+		secret |= 1;
+	}
+
+	return (((uintptr_t)block ^ block->size) * 0x9E3779B97F4A7C15ULL) ^ secret;
+}
+
+void harden_seal(struct block_meta *block)
+{
+	block->canary = canary(block);
+}
+
+void harden_check(struct block_meta *block)
+{
+	if (block->canary != canary(block))
+		fail("corrupted block header", block);
+
+	// the size was checked along with the canary, the footer can be read
+	if (get_status(block) != STATUS_MAPPED &&
+		*(size_t *)((void *)block + get_size(block) - FOOTER_SIZE) != get_size(block))
+		fail("corrupted block footer, overflow of the block", block);
+}
+
+void harden_bad_pointer(void *ptr)
+{
+	fail("invalid pointer or double free", ptr);
+}
+
+void harden_poison_alloc(void *ptr)
+{
+	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
+
+	// mapped blocks come zeroed from the kernel, and are never reused
+	if (ptr && get_status(block) != STATUS_MAPPED)
+		memset(ptr, HARDEN_ALLOC_POISON, get_payload_size(block));
+}
+
+// checks that nothing wrote to a block since it was freed
+static void check_poison(struct block_meta *block)
+{
+	unsigned char *payload = (void *)block + ALIGNED_METADATA_SIZE;
+	size_t size = get_payload_size(block);
+
+	for (size_t i = 0; i < size; i++) {
+		if (payload[i] != HARDEN_FREE_POISON)
+			fail("write after free", payload + i);
+	}
+}
+
+struct block_meta *harden_quarantine(struct block_meta *block)
+{
+	if (block) {
+		if (!quarantine_limit)
+			return block;
+
+		memset((void *)block + ALIGNED_METADATA_SIZE, HARDEN_FREE_POISON,
+			   get_payload_size(block));
+		block->magic = QUARANTINE_MAGIC;
+
+		ring[(ring_head + ring_count) % (QUARANTINE_BLOCKS + 1)] = block;
+		ring_count++;
+		ring_bytes += get_size(block);
+	}
+
+	if (!ring_count ||
+		(ring_count <= QUARANTINE_BLOCKS && ring_bytes <= quarantine_limit))
+		return NULL;
+
+	block = ring[ring_head];
+	ring_head = (ring_head + 1) % (QUARANTINE_BLOCKS + 1);
+	ring_count--;
+	ring_bytes -= get_size(block);
+
+	harden_check(block);
+	check_poison(block);
+	block->magic = BLOCK_MAGIC;
+
+	return block;
+}
+
+struct block_meta *harden_mmap(size_t size)
+{
+	size_t page_size = getpagesize();
+	size_t len = ALIGN_PAGE(size, page_size);
+	void *base = mmap(NULL, len + 2 * page_size, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED)
+		return MAP_FAILED;
+
+	DIE(mprotect(base, page_size, PROT_NONE), "mprotect failed");
+	DIE(mprotect(base + page_size + len, page_size, PROT_NONE),
+		"mprotect failed");
+
+	// an overflow of the payload runs into the second guard page at once
+	return base + page_size + len - size;
+}
+
+int harden_munmap(struct block_meta *block)
+{
+	size_t page_size = getpagesize();
+	uintptr_t first = ((uintptr_t)block & ~(page_size - 1)) - page_size;
+	uintptr_t end = (uintptr_t)block + get_size(block) + page_size;
+
+	return munmap((void *)first, end - first);
+}
+
+static void __attribute__((constructor)) init_quarantine(void)
+{
+	char *value = getenv("OSMEM_QUARANTINE_BYTES"), *end;
+
+	if (value && *value) {
+		unsigned long long parsed = strtoull(value, &end, 0);
+
+		if (!*end)
+			quarantine_limit = parsed;
+	}
+}
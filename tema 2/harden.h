@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/mman.h>
+#include "osmem.h"
+
+/*
+ * Integrity checks of the hardened build, only built with OSMEM_HARDEN.
+ *
+ * Every block header carries a canary derived from its address, its size and
+ * a secret picked at startup, and heap blocks end with their size in the
+ * footer; both are checked before a header is trusted, and a mismatch aborts
+ * the program. Mapped blocks lie between two inaccessible guard pages, with
+ * the end of the payload against the second one. Freed heap blocks are filled
+ * with HARDEN_FREE_POISON and wait in a quarantine before going back to the
+ * heap, where the poison is checked again to catch writes after the free. A
+ * second free of a block in quarantine is reported as a double free.
+ *
+ * Without OSMEM_HARDEN all of it compiles away to nothing.
+ */
+
+#ifdef OSMEM_HARDEN
+
+/* Byte written over the payload of freed blocks, and of fresh heap blocks */
+#define HARDEN_FREE_POISON  0xDF
+#define HARDEN_ALLOC_POISON 0xA5
+
+/* Magic word of the blocks waiting in quarantine */
+#define QUARANTINE_MAGIC 0x0DEAD10Cu
+
+/* Default bytes of freed blocks held back, tuned with OSMEM_QUARANTINE_BYTES */
+#define QUARANTINE_BYTES (4 * 1024 * 1024)
+
+/* Most blocks held back at once, whatever their size */
+#define QUARANTINE_BLOCKS 4096
+
+/**
+ * @brief Writes the canary of a block, after its size or status changed.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void harden_seal(struct block_meta *block);
+
+/**
+ * @brief Checks the canary of a block and, for heap blocks, its footer.
+ *
+ * Aborts the program if the block is corrupted.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void harden_check(struct block_meta *block);
+
+/**
+ * @brief Reports a pointer that cannot be freed or resized and aborts.
+ *
+ * @param ptr The pointer given by the user.
+ */
+void harden_bad_pointer(void *ptr);
+
+/**
+ * @brief Fills the payload of a fresh heap block with HARDEN_ALLOC_POISON.
+ *
+ * @param ptr The pointer handed out to the user, may be NULL.
+ */
+void harden_poison_alloc(void *ptr);
+
+/**
+ * @brief Puts a freed heap block in quarantine.
+ *
+ * The block is poisoned and stays STATUS_ALLOC, so the heap cannot reuse it.
+ * Once the quarantine is full, its oldest block is checked and let go.
+ *
+ * @param block Pointer to the block metadata structure.
+ *
+ * @return The block to give back to the heap now, or NULL.
+ */
+struct block_meta *harden_quarantine(struct block_meta *block);
+
+/**
+ * @brief Maps a block between two guard pages.
+ *
+ * @param size The size of the block, metadata included.
+ *
+ * @return The block, placed so that it ends at the second guard page, or
+ * MAP_FAILED.
+ */
+struct block_meta *harden_mmap(size_t size);
+
+/**
+ * @brief Unmaps a block mapped by harden_mmap, guard pages included.
+ *
+ * @param block Pointer to the block metadata structure.
+ *
+ * @return The result of munmap.
+ */
+int harden_munmap(struct block_meta *block);
+
+/* mremap would move the block away from its guard pages */
+#define HARDEN_REMAP false
+
+#else
+
+#define HARDEN_REMAP true
+
+static inline void harden_seal(struct block_meta *block)
+{
+	(void)block;
+}
+
+static inline void harden_check(struct block_meta *block)
+{
+	(void)block;
+}
+
+static inline void harden_bad_pointer(void *ptr)
+{
+	(void)ptr;
+}
+
+static inline void harden_poison_alloc(void *ptr)
+{
+	(void)ptr;
+}
+
+static inline struct block_meta *harden_quarantine(struct block_meta *block)
+{
+	return block;
+}
+
+static inline struct block_meta *harden_mmap(size_t size)
+{
+	return MMAP_CALL(size);
+}
+
+static inline int harden_munmap(struct block_meta *block)
+{
+	return munmap(block, get_size(block));
+}
+
+#endif
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include "mapped_blocks.h"
+#include "stats.h"
+
+// Marks a slot whose block was removed, so that probing continues past it.
+#define TOMBSTONE ((struct block_meta *)1)
+
+#define MIN_CAPACITY 512
+
+static struct block_meta **slots;
+static size_t capacity; // Number of slots, always a power of 2.
+static size_t used; // Number of slots holding a block or a tombstone.
+static size_t count; // Number of slots holding a block.
+
+static size_t hash(struct block_meta *block)
+{
+	// mapped blocks are page aligned, the low bits carry no information
+	return (((uintptr_t)block >> 12) * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+}
+
+static struct block_meta **find_slot(struct block_meta *block)
+{
+	size_t i = hash(block);
+
+	while (slots[i] && slots[i] != block)
+		i = (i + 1) & (capacity - 1);
+
+	return &slots[i];
+}
+
+static void resize(size_t new_capacity)
+{
+	struct block_meta **old_slots = slots;
+	size_t old_capacity = capacity;
+
+	slots = mmap(NULL, new_capacity * sizeof(*slots), PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	DIE(slots == MAP_FAILED, "mmap failed");
+	heap_stats.mmap_calls++;
+
+	capacity = new_capacity;
+	used = 0;
+
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_slots[i] && old_slots[i] != TOMBSTONE) {
+			*find_slot(old_slots[i]) = old_slots[i];
+			used++;
+		}
+	}
+
+	if (old_slots) {
+		DIE(munmap(old_slots, old_capacity * sizeof(*slots)), "munmap failed");
+		heap_stats.munmap_calls++;
+	}
+}
+
+void add_mapped_block(struct block_meta *block)
+{
+	// keep the load factor, tombstones included, under 3/4 and rehash into a
+	// table that is at most half full, dropping the tombstones
+	if (4 * (used + 1) > 3 * capacity) {
+		size_t new_capacity = MIN_CAPACITY;
+
+		while (2 * (count + 1) > new_capacity)
+			new_capacity *= 2;
+
+		resize(new_capacity);
+	}
+
+	*find_slot(block) = block;
+	used++;
+	count++;
+}
+
+void remove_mapped_block(struct block_meta *block)
+{
+	if (!capacity)
+		return;
+
+	struct block_meta **slot = find_slot(block);
+
+	if (*slot) {
+		*slot = TOMBSTONE;
+		count--;
+	}
+}
+
+bool is_mapped_block(struct block_meta *block)
+{
+	return capacity && *find_slot(block);
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stdbool.h>
+#include "block_meta.h"
+
+/**
+ * @brief Registers a block obtained through mmap.
+ *
+ * The registry is an open addressing hash set kept in its own anonymous
+ * mapping, so looking a pointer up never touches the block list.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void add_mapped_block(struct block_meta *block);
+
+/**
+ * @brief Removes a block from the registry of mapped blocks.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void remove_mapped_block(struct block_meta *block);
+
+/**
+ * @brief Checks if a block is a registered mapped block.
+ *
+ * @param block Pointer to the block metadata structure.
+ *
+ * @return true if the block was mapped by the allocator and not yet unmapped,
+ * false otherwise.
+ */
+bool is_mapped_block(struct block_meta *block);
@@ -1,27 +1,62 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <stdint.h>
 #include "block_meta.h"
+#include "harden.h"
+#include "mapped_blocks.h"
+#include "stats.h"
 #include "printf.h"
 
 struct block_meta *head;
 struct block_meta *tail;
 
+// Heads of the segregated free lists, indexed by size class.
+static struct block_meta *free_lists[NUM_SIZE_CLASSES];
+
+// Bit i is set if and only if free_lists[i] is not empty.
+static size_t free_lists_mask;
+
+// Bounds of the memory obtained through sbrk.
+static void *heap_start;
+static void *heap_end;
+
 bool find_preallocation(void)
 {
-	static bool preallocation_done;
+	return heap_start != NULL;
+}
 
-	if (preallocation_done)
-		return true;
+void *extend_heap(size_t size)
+{
+	void *old_end = sbrk(size);
 
-	for (struct block_meta *curr_block = head; curr_block;
-		 curr_block = curr_block->next) {
-		if (curr_block->status != STATUS_MAPPED) {
-			preallocation_done = true;
-			return true;
-		}
-	}
+	heap_stats.sbrk_calls++;
 
-	return false;
+	if (old_end == BRK_FAILED)
+		return BRK_FAILED;
+
+	if (!heap_start)
+		heap_start = old_end;
+
+	heap_end = old_end + size;
+	return old_end;
+}
+
+void *shrink_heap(size_t size)
+{
+	// memory after the heap that someone else got through sbrk is not ours
+	// to give back
+	if (sbrk(0) != heap_end)
+		return BRK_FAILED;
+
+	void *old_end = sbrk(-(intptr_t)size);
+
+	heap_stats.sbrk_calls++;
+
+	if (old_end == BRK_FAILED)
+		return BRK_FAILED;
+
+	heap_end = old_end - size;
+	return old_end;
 }
 
 bool empty(void)
@@ -29,32 +64,72 @@ bool empty(void)
 	return head == NULL;
 }
 
-void set_block(struct block_meta *block, size_t size, int status, struct block_meta *prev, struct block_meta *next)
+// writes the size of a heap block at its end
+static void set_footer(struct block_meta *block)
 {
-	block->size = size;
-	block->status = status;
-	block->prev = prev;
-	block->next = next;
+	*(size_t *)((void *)block + get_size(block) - FOOTER_SIZE) = get_size(block);
+}
+
+void set_block(struct block_meta *block, size_t size, int status)
+{
+	block->size = size | status;
+	block->magic = BLOCK_MAGIC;
+	block->owner = 0;
+	harden_seal(block);
+
+	if (status != STATUS_MAPPED)
+		set_footer(block);
+
+	if (status == STATUS_FREE)
+		free_list_insert(block);
 }
 
 void set_size(struct block_meta *block, size_t size)
 {
-	block->size = size;
+	int status = get_status(block);
+
+	// a free block may change its size class, so it has to be moved
+	if (status == STATUS_FREE) {
+		free_list_remove(block);
+		block->size = size | status;
+		free_list_insert(block);
+	} else {
+		block->size = size | status;
+	}
+
+	harden_seal(block);
+
+	if (status != STATUS_MAPPED)
+		set_footer(block);
 }
 
 void set_status(struct block_meta *block, int status)
 {
-	block->status = status;
+	if (get_status(block) == STATUS_FREE && status != STATUS_FREE)
+		free_list_remove(block);
+	else if (get_status(block) != STATUS_FREE && status == STATUS_FREE)
+		free_list_insert(block);
+
+	block->size = get_size(block) | status;
+	harden_seal(block);
 }
 
 size_t get_size(struct block_meta *block)
 {
-	return block->size;
+	return block->size & ~(size_t)STATUS_MASK;
 }
 
 int get_status(struct block_meta *block)
 {
-	return block->status;
+	return block->size & STATUS_MASK;
+}
+
+size_t get_payload_size(struct block_meta *block)
+{
+	if (get_status(block) == STATUS_MAPPED)
+		return get_size(block) - ALIGNED_METADATA_SIZE;
+
+	return get_size(block) - ALIGNED_METADATA_SIZE - FOOTER_SIZE;
 }
 
 struct block_meta *front(void)
@@ -67,60 +142,52 @@ struct block_meta *back(void)
 	return tail;
 }
 
-void emplace_back(struct block_meta *block, size_t size, int status)
+struct block_meta *next_block(struct block_meta *block)
 {
-	if (!head) {
-		set_block(block, size, status, NULL, NULL);
-		head = block;
-		tail = block;
-	} else {
-		set_block(block, size, status, tail, NULL);
-		tail->next = block;
-		tail = block;
-	}
+	if (block == tail)
+		return NULL;
+
+	return (void *)block + get_size(block);
 }
 
-void emplace_front(struct block_meta *block, size_t size, int status)
+struct block_meta *prev_block(struct block_meta *block)
 {
-	if (!head) {
-		set_block(block, size, status, NULL, NULL);
-		head = block;
-		tail = block;
-	} else {
-		set_block(block, size, status, NULL, head);
-		head->prev = block;
-		head = block;
-	}
+	if (block == head)
+		return NULL;
+
+	return (void *)block - *(size_t *)((void *)block - FOOTER_SIZE);
 }
 
-void erase(struct block_meta *block)
+void emplace_back(struct block_meta *block, size_t size, int status)
 {
-	if (block == NULL)
-		return;
+	set_block(block, size, status);
 
-	if (block == head)
-		head = block->next;
-	else
-		block->prev->next = block->next;
+	if (!head)
+		head = block;
 
-	if (block == tail)
-		tail = block->prev;
-	else
-		block->next->prev = block->prev;
+	tail = block;
 }
 
 bool split_block(struct block_meta *block, size_t size)
 {
-	if (block->size - size > ALIGNED_METADATA_SIZE) {
+	harden_check(block);
+
+	size_t block_size = get_size(block);
+
+	if (block_size - size >= MIN_BLOCK_SIZE) {
 		struct block_meta *new_block = (void *)block + size;
+		bool last = block == tail;
 
-		set_block(new_block, block->size - size, STATUS_FREE, block, block->next);
+		// the footer of the first block is written before the header of the
+		// second one, which then takes over the old footer
+		set_size(block, size);
+		set_block(new_block, block_size - size, STATUS_FREE);
 
-		if (!block->next)
+		if (last)
 			tail = new_block;
 
-		block->size = size;
-		block->next = new_block;
+		heap_stats.splits++;
+		coalesce_with_next(new_block);
 
 		return true;
 	} else {
@@ -128,13 +195,34 @@ bool split_block(struct block_meta *block, size_t size)
 	}
 }
 
+bool is_heap_block(struct block_meta *block)
+{
+	// the header must lie entirely inside the heap before it can be read
+	return (void *)block >= heap_start &&
+		   (void *)block + ALIGNED_METADATA_SIZE <= heap_end &&
+		   !((uintptr_t)block & (ALIGNMENT - 1)) &&
+		   block->magic == BLOCK_MAGIC;
+}
+
+bool is_valid_block(struct block_meta *block)
+{
+#ifdef OSMEM_DEBUG
+	return find_block(block) && block->magic == BLOCK_MAGIC;
+#else
+	return is_heap_block(block) || (block && is_mapped_block(block));
+#endif
+}
+
 bool find_block(struct block_meta *block)
 {
 	if (!block)
 		return false;
 
+	if (is_mapped_block(block))
+		return true;
+
 	for (struct block_meta *curr_block = head; curr_block;
-		 curr_block = curr_block->next) {
+		 curr_block = next_block(curr_block)) {
 		if (block == curr_block)
 			return true;
 	}
@@ -144,44 +232,129 @@ bool find_block(struct block_meta *block)
 
 bool coalesce_with_next(struct block_meta *block)
 {
-	if (!block->next || block->next->status != STATUS_FREE)
+	struct block_meta *next = next_block(block);
+
+	if (!next)
 		return false;
 
-	block->size += block->next->size;
-	block->next = block->next->next;
+	harden_check(next);
 
-	if (!block->next)
+	if (get_status(next) != STATUS_FREE)
+		return false;
+
+	if (next == tail)
 		tail = block;
 
+	free_list_remove(next);
+	next->magic = 0;
+	set_size(block, get_size(block) + get_size(next));
+	heap_stats.coalesces++;
+
 	return true;
 }
 
-void coalesce_free_blocks(void)
+struct block_meta *coalesce(struct block_meta *block)
 {
-	for (struct block_meta *curr_block = head; curr_block;) {
-		if (curr_block->status == STATUS_FREE && curr_block->next &&
-			curr_block->next->status == STATUS_FREE) {
-			curr_block->size += curr_block->next->size;
-			curr_block->next = curr_block->next->next;
-		} else {
-			if (!curr_block->next)
-				tail = curr_block;
+	set_status(block, STATUS_FREE);
+	coalesce_with_next(block);
 
-			curr_block = curr_block->next;
-		}
+	struct block_meta *prev = prev_block(block);
+
+	if (prev)
+		harden_check(prev);
+
+	if (prev && get_status(prev) == STATUS_FREE) {
+		block = prev;
+		coalesce_with_next(block);
 	}
+
+	return block;
 }
 
-struct block_meta *find_best_fit(size_t size)
+size_t size_class(size_t size)
+{
+	return NUM_SIZE_CLASSES - 1 - __builtin_clzl(size);
+}
+
+void free_list_insert(struct block_meta *block)
+{
+	size_t class = size_class(get_size(block));
+
+	block->prev_free = NULL;
+	block->next_free = free_lists[class];
+
+	if (free_lists[class])
+		free_lists[class]->prev_free = block;
+
+	free_lists[class] = block;
+	free_lists_mask |= (size_t)1 << class;
+}
+
+void free_list_remove(struct block_meta *block)
+{
+	size_t class = size_class(get_size(block));
+
+	if (block->prev_free)
+		block->prev_free->next_free = block->next_free;
+	else
+		free_lists[class] = block->next_free;
+
+	if (block->next_free)
+		block->next_free->prev_free = block->prev_free;
+
+	if (!free_lists[class])
+		free_lists_mask &= ~((size_t)1 << class);
+}
+
+// finds the smallest block of a size class that can hold size bytes
+static struct block_meta *find_best_fit_in_class(size_t class, size_t size)
 {
 	struct block_meta *best_fit = NULL;
 
-	for (struct block_meta *curr_block = head; curr_block;
-		 curr_block = curr_block->next) {
-		if (curr_block->status == STATUS_FREE && curr_block->size >= size &&
-			(!best_fit || curr_block->size < best_fit->size))
+	for (struct block_meta *curr_block = free_lists[class]; curr_block;
+		 curr_block = curr_block->next_free) {
+		heap_stats.best_fit_visits++;
+
+		if (get_size(curr_block) >= size &&
+			(!best_fit || get_size(curr_block) < get_size(best_fit)))
 			best_fit = curr_block;
 	}
 
 	return best_fit;
 }
+
+struct block_meta *find_best_fit(size_t size)
+{
+	size_t class = size_class(size);
+
+	heap_stats.best_fit_searches++;
+
+	struct block_meta *best_fit = find_best_fit_in_class(class, size);
+
+	if (best_fit || class == NUM_SIZE_CLASSES - 1)
+		return best_fit;
+
+	// every block of a larger class fits, so the smallest non-empty one holds
+	// the best fit of the whole heap
+	size_t larger_classes = free_lists_mask >> (class + 1);
+
+	if (!larger_classes)
+		return NULL;
+
+	return find_best_fit_in_class(class + 1 + __builtin_ctzl(larger_classes),
+								  size);
+}
+
+void free_list_stats(size_t *free_bytes, size_t *largest)
+{
+	*free_bytes = 0;
+	*largest = 0;
+
+	for (size_t class = 0; class < NUM_SIZE_CLASSES; class++) {
+		for (struct block_meta *curr_block = free_lists[class]; curr_block;
+			 curr_block = curr_block->next_free) {
+			*free_bytes += get_size(curr_block);
+			*largest = MAX(*largest, get_size(curr_block));
+		}
+	}
+}
@@ -1,9 +1,65 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
 #include "osmem.h"
+#include "mapped_blocks.h"
+#include "harden.h"
+#include "tcache.h"
+#include "stats.h"
 #include <sys/mman.h>
+#include <stdint.h>
 #include <string.h>
 
+// Requests of at least this size, metadata included, are served by mmap.
+static size_t mmap_threshold = MMAP_THRESHOLD;
+
+// Size of the first sbrk call, split to serve the following requests.
+static size_t prealloc_size = MMAP_THRESHOLD;
+
+// Size above which a free block at the end of the heap is trimmed.
+static size_t trim_threshold = TRIM_THRESHOLD;
+
+// Size of a free block inside the heap from which its freed pages are madvised.
+static size_t madvise_threshold = MADVISE_THRESHOLD;
+
+// Set while freed mappings may raise mmap_threshold and trim_threshold, until
+// one of them is tuned by hand.
+static bool dynamic_threshold = true;
+
+// reads a size tunable from the environment, returns false if it is not set
+static bool read_tunable(const char *name, size_t *value)
+{
+	char *str = getenv(name), *end;
+
+	if (!str || !*str)
+		return false;
+
+	unsigned long long parsed = strtoull(str, &end, 0);
+
+	if (*end)
+		return false;
+
+	*value = parsed;
+	return true;
+}
+
+static void __attribute__((constructor)) init_tunables(void)
+{
+	size_t value;
+
+	if (read_tunable("OSMEM_MMAP_THRESHOLD", &value))
+		os_mallopt(OS_M_MMAP_THRESHOLD, value);
+
+	if (read_tunable("OSMEM_PREALLOC_SIZE", &value))
+		os_mallopt(OS_M_PREALLOC_SIZE, value);
+
+	if (read_tunable("OSMEM_TRIM_THRESHOLD", &value))
+		os_mallopt(OS_M_TRIM_THRESHOLD, value);
+
+	if (read_tunable("OSMEM_MADVISE_THRESHOLD", &value))
+		os_mallopt(OS_M_MADVISE_THRESHOLD, value);
+}
+
 void *alloc(size_t size, size_t max_heap_allocation_size)
 {
 	// if size is 0, return NULL
@@ -11,51 +67,57 @@ void *alloc(size_t size, size_t max_heap_allocation_size)
 		return NULL;
 
 	// size of the memory block after allocation
-	size_t aligned_size = ALIGNED_METADATA_SIZE + ALIGN(size);
+	size_t aligned_size = HEAP_BLOCK_SIZE(size);
 	struct block_meta *block;
 
 	// if the size is greater than or equal to the mmap threshold, allocate a
 	// new block
 	if (aligned_size >= max_heap_allocation_size) {
-		block = MMAP_CALL(aligned_size);
+		block = harden_mmap(MAPPED_BLOCK_SIZE(size));
 		DIE(block == MAP_FAILED, "mmap failed");
+		heap_stats.mmap_calls++;
+		heap_stats.mapped_bytes += MAPPED_BLOCK_SIZE(size);
 
-		emplace_front(block, aligned_size, STATUS_MAPPED);
+		// mapped blocks are not part of the heap, only of the registry
+		set_block(block, MAPPED_BLOCK_SIZE(size), STATUS_MAPPED);
+		add_mapped_block(block);
 	} else if (!find_preallocation()) {
-		// if preallocation was not done, allocate a new block of MMAP_THRESHOLD
+		// if preallocation was not done, allocate a new block of prealloc_size
 		// size and split it into an allocated block of the requested size and a
 		// free block of the remaining size
-		block = sbrk(MMAP_THRESHOLD);
+		size_t heap_size = MAX(ALIGN(prealloc_size), aligned_size);
+
+		block = extend_heap(heap_size);
 		DIE(block == BRK_FAILED, "sbrk failed");
 
-		// mapped blocks are placed at the front of the list in order to not
-		// interfere with the allocated and free blocks
-		emplace_back(block, MMAP_THRESHOLD, STATUS_FREE);
+		emplace_back(block, heap_size, STATUS_FREE);
 		split_block(block, aligned_size);
 		set_status(block, STATUS_ALLOC);
 	} else {
-		// otherwise, try to find a free block with the best fit
-		coalesce_free_blocks();
+		// otherwise, try to find a free block with the best fit, free blocks
+		// are already coalesced by os_free
 		struct block_meta *best_fit = find_best_fit(aligned_size);
 
 		// if a free block was found, split it into an allocated block of the
 		// requested size and a free block of the remaining size
 		if (best_fit) {
 			block = best_fit;
+			harden_check(block);
 
 			split_block(block, aligned_size);
 			set_status(block, STATUS_ALLOC);
 		} else if (get_status(back()) == STATUS_FREE) {
 			// if the last block is free, expand it
 			block = back();
-			DIE(sbrk(aligned_size - get_size(block)) == BRK_FAILED,
+			harden_check(block);
+			DIE(extend_heap(aligned_size - get_size(block)) == BRK_FAILED,
 				"sbrk failed");
 
 			set_size(block, aligned_size);
 			set_status(block, STATUS_ALLOC);
 		} else {
 			// otherwise, allocate a new block
-			block = sbrk(aligned_size);
+			block = extend_heap(aligned_size);
 			DIE(block == BRK_FAILED, "sbrk failed");
 
 			// allocated blocks are placed at the back of the list
@@ -66,35 +128,208 @@ void *alloc(size_t size, size_t max_heap_allocation_size)
 	return ((void *)block) + ALIGNED_METADATA_SIZE;
 }
 
-void *os_malloc(size_t size)
+// serves a small block from the thread cache, refilling the cache with a batch
+// of blocks under a single heap lock when it is empty
+static void *cached_alloc(size_t size)
 {
-	// call alloc and compare the requested size with MMAP_THRESHOLD
-	return alloc(size, MMAP_THRESHOLD);
+	size_t aligned_size = HEAP_BLOCK_SIZE(size);
+	struct block_meta *block = tcache_get(aligned_size);
+
+	if (block)
+		return ((void *)block) + ALIGNED_METADATA_SIZE;
+
+	heap_lock();
+
+	void *ptr = alloc(size, mmap_threshold);
+
+	// only blocks that were not enlarged by split_block fit the empty bin
+	for (int i = 1; i < TCACHE_BATCH; i++) {
+		block = ptr - ALIGNED_METADATA_SIZE;
+
+		if (get_size(block) != aligned_size)
+			break;
+
+		tcache_fill(block);
+		ptr = alloc(size, mmap_threshold);
+	}
+
+	if (ptr)
+		tcache_own(ptr - ALIGNED_METADATA_SIZE);
+
+	heap_unlock();
+	return ptr;
 }
 
+// allocates a block, small blocks go through the thread cache; the threshold
+// is passed by address since it may only be read under the heap lock
+static void *locked_alloc(size_t size, const size_t *max_heap_allocation_size)
+{
+	if (size && HEAP_BLOCK_SIZE(size) <= TCACHE_MAX_SIZE)
+		return cached_alloc(size);
 
-void os_free(void *ptr)
+	heap_lock();
+	void *ptr = alloc(size, *max_heap_allocation_size);
+	heap_unlock();
+
+	return ptr;
+}
+
+void *os_malloc(size_t size)
 {
-	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
+	count_request(size);
+
+	// call alloc and compare the requested size with the mmap threshold
+	void *ptr = locked_alloc(size, &mmap_threshold);
+
+	harden_poison_alloc(ptr);
+	return ptr;
+}
+
+// gives the end of a large free block at the end of the heap back to the OS,
+// the block itself stays in the list with a smaller size
+static bool trim_heap(struct block_meta *block)
+{
+	if (block != back() || get_size(block) <= trim_threshold)
+		return false;
+
+	size_t page_size = getpagesize();
+	size_t release = (get_size(block) - MIN_BLOCK_SIZE) & ~(page_size - 1);
+
+	if (!release)
+		return false;
+
+	if (shrink_heap(release) == BRK_FAILED)
+		return false;
 
-	// if the pointer cannot be freed, return
-	if (!ptr || !find_block(block) || get_status(block) == STATUS_FREE)
+	set_size(block, get_size(block) - release);
+	heap_stats.trims++;
+	heap_stats.trimmed_bytes += release;
+
+	return true;
+}
+
+// drops the pages of a freed range that lie inside the free block it was merged
+// into; pages shared with free neighbours are included, the metadata of the
+// free block and the next block are not
+static void advise_heap(struct block_meta *merged, void *start, void *end)
+{
+	size_t page_size = getpagesize();
+	void *merged_end = (void *)merged + get_size(merged) - FOOTER_SIZE;
+	void *first = MAX((void *)((uintptr_t)start & ~(page_size - 1)),
+					  (void *)ALIGN_PAGE((uintptr_t)(merged + 1), page_size));
+	void *last = MIN((void *)ALIGN_PAGE((uintptr_t)end, page_size),
+					 (void *)((uintptr_t)merged_end & ~(page_size - 1)));
+
+	if (get_size(merged) < madvise_threshold || last <= first ||
+		(size_t)(last - first) < MADVISE_MIN_PAGES * page_size)
 		return;
 
+#ifdef MADV_FREE
+	DIE(madvise(first, last - first, MADV_FREE), "madvise failed");
+#else
+	DIE(madvise(first, last - first, MADV_DONTNEED), "madvise failed");
+#endif
+
+	heap_stats.madvises++;
+	heap_stats.madvised_bytes += last - first;
+}
+
+// marks a heap block free, merged with its free neighbours, then gives what is
+// not needed back to the OS
+static void release_heap_block(struct block_meta *block)
+{
+	void *start = block;
+	void *end = (void *)block + get_size(block);
+
+	block = coalesce(block);
+
+	if (!trim_heap(block))
+		advise_heap(block, start, end);
+}
+
+// gives a valid block back to the heap, the caller holds the heap lock
+static void free_block(struct block_meta *block)
+{
+	harden_check(block);
+
 	// if the block is mapped, unmap it
 	if (get_status(block) == STATUS_MAPPED) {
-		erase(block);
-		DIE(munmap(block, get_size(block)), "munmap failed");
+		// like glibc, serve blocks of this size from the heap from now on, so
+		// a program that keeps allocating and freeing them stops paying an
+		// mmap/munmap pair each time; the threshold is compared with heap
+		// block sizes, which include a footer
+		size_t heap_size = HEAP_BLOCK_SIZE(get_payload_size(block));
+
+		if (dynamic_threshold && heap_size >= mmap_threshold &&
+			heap_size < MMAP_THRESHOLD_MAX) {
+			mmap_threshold = heap_size + 1;
+			trim_threshold = 2 * mmap_threshold;
+		}
+
+		remove_mapped_block(block);
+		heap_stats.munmap_calls++;
+		heap_stats.mapped_bytes -= get_size(block);
+		DIE(harden_munmap(block), "munmap failed");
 	} else {
-		// otherwise, set the block status to free, but keep it in the list
-		set_status(block, STATUS_FREE);
+		// otherwise, set the block status to free, but keep it in the list;
+		// the hardened build holds it back in quarantine and lets older
+		// blocks go instead
+		for (block = harden_quarantine(block); block;
+			 block = harden_quarantine(NULL))
+			release_heap_block(block);
+	}
+}
+
+void release_blocks(struct block_meta *blocks)
+{
+	heap_lock();
+
+	while (blocks) {
+		struct block_meta *next = blocks->next_free;
+
+		blocks->magic = BLOCK_MAGIC;
+		free_block(blocks);
+		blocks = next;
 	}
+
+	heap_unlock();
+}
+
+void os_free(void *ptr)
+{
+	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
+	struct block_meta *evicted;
+
+	if (!ptr)
+		return;
+
+	// small blocks are kept in the thread cache, a full bin gives half of its
+	// blocks back to the heap
+	if (tcache_put(block, &evicted)) {
+		if (evicted)
+			release_blocks(evicted);
+		return;
+	}
+
+	heap_lock();
+
+	// if the pointer can be freed, give the block back to the heap
+	if (is_valid_block(block) && get_status(block) != STATUS_FREE)
+		free_block(block);
+	else
+		harden_bad_pointer(ptr);
+
+	heap_unlock();
 }
 
 void *os_calloc(size_t nmemb, size_t size)
 {
+	size_t page_size = getpagesize();
+
+	count_request(nmemb * size);
+
 	// call alloc and compare the requested size with the page size
-	void *ptr = alloc(nmemb * size, getpagesize());
+	void *ptr = locked_alloc(nmemb * size, &page_size);
 
 	// if alloc failed, return NULL
 	if (!ptr)
@@ -105,69 +340,289 @@ void *os_calloc(size_t nmemb, size_t size)
 	return ptr;
 }
 
-void *os_realloc(void *ptr, size_t size)
+// resizes a mapped block with mremap, so the kernel moves page tables instead
+// of the data being copied
+static void *remap_block(struct block_meta *block, size_t aligned_size)
 {
-	// if size is 0, realloc behaves like free
-	if (size == 0) {
-		os_free(ptr);
-		return NULL;
+	size_t page_size = getpagesize();
+	size_t old_size = get_size(block);
+	size_t new_size = ALIGN_PAGE(aligned_size, page_size);
+
+	if (new_size > old_size) {
+		// grow geometrically, so repeated small grows do not each cost a
+		// syscall
+		new_size = MAX(new_size,
+					   ALIGN_PAGE(old_size + old_size / 2, page_size));
+	} else if (new_size > old_size - old_size / 4) {
+		// only shrink when at least a quarter of the mapping is released
+		return ((void *)block) + ALIGNED_METADATA_SIZE;
 	}
 
-	// if ptr is NULL, realloc behaves like malloc
-	if (!ptr)
-		return os_malloc(size);
+	// the block may move, so it leaves the registry until the new address is
+	// known
+	remove_mapped_block(block);
+
+	block = mremap(block, old_size, new_size, MREMAP_MAYMOVE);
+	DIE(block == MAP_FAILED, "mremap failed");
+	heap_stats.mremap_calls++;
+	heap_stats.mapped_bytes += new_size - old_size;
+
+	set_size(block, new_size);
+	add_mapped_block(block);
 
+	return ((void *)block) + ALIGNED_METADATA_SIZE;
+}
+
+// resizes a block in place when possible, the caller holds the heap lock
+static void *realloc_block(void *ptr, size_t size)
+{
 	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
 
-	if (!find_block(block) || get_status(block) == STATUS_FREE)
+	if (!is_valid_block(block) || get_status(block) == STATUS_FREE) {
+		harden_bad_pointer(ptr);
 		return NULL;
+	}
+
+	harden_check(block);
 
 	// size of the data in the memory block found at address ptr
-	size_t ptr_data_size = get_size(block);
+	size_t ptr_data_size = get_payload_size(block);
 
 	// size of the memory block after reallocation
-	size_t aligned_size = ALIGNED_METADATA_SIZE + ALIGN(size);
+	size_t aligned_size = HEAP_BLOCK_SIZE(size);
+
+	// mapped blocks that stay above the threshold are remapped
+	if (HARDEN_REMAP && get_status(block) == STATUS_MAPPED &&
+		aligned_size >= mmap_threshold)
+		return remap_block(block, MAPPED_BLOCK_SIZE(size));
 
-	// if the memory block is mapped, allocate a new one and copy the data
-	if (get_status(block) == STATUS_MAPPED || aligned_size >= MMAP_THRESHOLD) {
-		void *new_ptr = os_malloc(size);
+	// otherwise, if the block moves between the heap and a mapping, allocate
+	// a new one and copy the data
+	if (get_status(block) == STATUS_MAPPED || aligned_size >= mmap_threshold) {
+		void *new_ptr = alloc(size, mmap_threshold);
 
 		memmove(new_ptr, ptr, MIN(ptr_data_size, size));
-		os_free(ptr);
+		free_block(block);
 		return new_ptr;
 	}
 
-	// try to coalsece with the following free blocks
-	bool expanded = false;
-
-	// try to coalesce with the next free blocks while the size is smaller than
-	// the requested size
-	while (get_size(block) < aligned_size) {
-		if (!coalesce_with_next(block))
-			break;
-		expanded = true;
-	}
+	// free blocks are never adjacent, so a single merge with the next block
+	// gives all the room available after this one
+	coalesce_with_next(block);
 
 	// try to expand the block
 	if (get_size(block) >= aligned_size) {
 		split_block(block, aligned_size);
-		set_status(block, STATUS_ALLOC);
 		return ptr;
-	} else if (block == back() && !expanded) {
-		DIE(sbrk(aligned_size - get_size(block)) == BRK_FAILED, "sbrk failed");
+	} else if (block == back()) {
+		DIE(extend_heap(aligned_size - get_size(block)) == BRK_FAILED,
+			"sbrk failed");
 
 		set_size(block, aligned_size);
-		set_status(block, STATUS_ALLOC);
 		return ptr;
 	}
 
+	// try to grow backwards into a free previous block, moving the data down
+	struct block_meta *prev = prev_block(block);
+
+	if (prev && get_status(prev) == STATUS_FREE &&
+		get_size(prev) + get_size(block) >= aligned_size) {
+		void *new_ptr = ((void *)prev) + ALIGNED_METADATA_SIZE;
+
+		// the block is absorbed without being freed first, the free list
+		// links would overwrite the start of its data
+		set_status(prev, STATUS_ALLOC);
+		set_size(prev, get_size(prev) + get_size(block));
+		block->magic = 0;
+
+		// the data is moved before splitting, the new free block may start
+		// inside the old payload
+		memmove(new_ptr, ptr, ptr_data_size);
+		split_block(prev, aligned_size);
+		return new_ptr;
+	}
+
 	// if block cannot be expanded, allocate a new one and copy the data
-	void *new_ptr = os_malloc(size);
+	void *new_ptr = alloc(size, mmap_threshold);
 
 	if (!new_ptr)
 		return NULL;
 
 	memmove(new_ptr, ptr, MIN(ptr_data_size, size));
-	os_free(ptr);
+	free_block(block);
 	return new_ptr;
 }
+
+void *os_realloc(void *ptr, size_t size)
+{
+	// if size is 0, realloc behaves like free
+	if (size == 0) {
+		os_free(ptr);
+		return NULL;
+	}
+
+	// if ptr is NULL, realloc behaves like malloc
+	if (!ptr)
+		return os_malloc(size);
+
+	count_request(size);
+
+	heap_lock();
+	void *new_ptr = realloc_block(ptr, size);
+	heap_unlock();
+
+	return new_ptr;
+}
+
+// serves a block whose payload is a multiple of alignment, which is a power of
+// 2 larger than ALIGNMENT; the caller holds the heap lock
+static void *aligned_alloc_block(size_t alignment, size_t size)
+{
+	// the padding in front of the payload is either empty or a whole free
+	// block, so room is asked for the alignment and a minimal block
+	if (size > SIZE_MAX - alignment - 2 * MIN_BLOCK_SIZE)
+		return NULL;
+
+	// mapped payloads always sit right after the start of a page, so aligned
+	// blocks come from the heap, whatever their size
+	void *ptr = alloc(size + alignment + MIN_BLOCK_SIZE, SIZE_MAX);
+	uintptr_t aligned = ALIGN_PAGE((uintptr_t)ptr, alignment);
+
+	while (aligned != (uintptr_t)ptr && aligned - (uintptr_t)ptr < MIN_BLOCK_SIZE)
+		aligned += alignment;
+
+	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
+	size_t padding = aligned - (uintptr_t)ptr;
+
+	// hand the padding back to the heap as a free block in front of the
+	// aligned one
+	if (padding) {
+		struct block_meta *aligned_block = (void *)block + padding;
+
+		split_block(block, padding);
+		set_status(aligned_block, STATUS_ALLOC);
+		coalesce(block);
+		block = aligned_block;
+	}
+
+	// and the space left after the payload as a free block after it
+	split_block(block, HEAP_BLOCK_SIZE(size));
+
+	return (void *)aligned;
+}
+
+void *os_memalign(size_t alignment, size_t size)
+{
+	// alignment must be a power of 2
+	if (!alignment || (alignment & (alignment - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (alignment <= ALIGNMENT)
+		return os_malloc(size);
+
+	if (size == 0)
+		return NULL;
+
+	count_request(size);
+
+	heap_lock();
+	void *ptr = aligned_alloc_block(alignment, size);
+	heap_unlock();
+
+	harden_poison_alloc(ptr);
+
+	if (!ptr)
+		errno = ENOMEM;
+
+	return ptr;
+}
+
+void *os_aligned_alloc(size_t alignment, size_t size)
+{
+	return os_memalign(alignment, size);
+}
+
+int os_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	// alignment must be a power of 2 multiple of sizeof(void *)
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+		return EINVAL;
+
+	void *ptr = os_memalign(alignment, size);
+
+	if (!ptr && size)
+		return ENOMEM;
+
+	*memptr = ptr;
+	return 0;
+}
+
+size_t os_malloc_usable_size(void *ptr)
+{
+	// if the pointer is NULL, there is nothing to measure
+	if (!ptr)
+		return 0;
+
+	struct block_meta *block = ptr - ALIGNED_METADATA_SIZE;
+	size_t usable_size = 0;
+
+	heap_lock();
+
+	if (is_valid_block(block) && get_status(block) != STATUS_FREE)
+		usable_size = get_payload_size(block);
+
+	heap_unlock();
+	return usable_size;
+}
+
+
+int os_mallopt(int param, size_t value)
+{
+	int ret = 1;
+
+	heap_lock();
+
+	switch (param) {
+	case OS_M_MMAP_THRESHOLD:
+		// thresholds set by hand are never adjusted again
+		mmap_threshold = value;
+		dynamic_threshold = false;
+		break;
+	case OS_M_PREALLOC_SIZE:
+		prealloc_size = value;
+		break;
+	case OS_M_TRIM_THRESHOLD:
+		trim_threshold = value;
+		dynamic_threshold = false;
+		break;
+	case OS_M_MADVISE_THRESHOLD:
+		madvise_threshold = value;
+		break;
+	default:
+		ret = 0;
+	}
+
+	heap_unlock();
+	return ret;
+}
+
+void os_malloc_stats(struct os_malloc_stats *out)
+{
+	heap_lock();
+
+	*out = heap_stats;
+	sum_requests(out);
+	free_list_stats(&out->free_bytes, &out->largest_free);
+
+	if (!empty())
+		out->heap_bytes = (void *)back() + get_size(back()) - (void *)front();
+
+	out->in_use_bytes = out->heap_bytes - out->free_bytes + out->mapped_bytes;
+
+	heap_unlock();
+
+	out->fragmentation = out->free_bytes ?
+		1 - (double)out->largest_free / out->free_bytes : 0;
+}
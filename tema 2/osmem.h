@@ -8,15 +8,130 @@
 #include "printf.h"
 #include "block_meta.h"
 
-#define BRK_FAILED ((void *)-1)
-
 #define MMAP_CALL(size) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+// aligns size to the next multiple of page_size, which is a power of 2
+#define ALIGN_PAGE(size, page_size) (((size) + (page_size) - 1) & ~((page_size) - 1))
+
 void *os_malloc(size_t size);
 void os_free(void *ptr);
 void *os_calloc(size_t nmemb, size_t size);
 void *os_realloc(void *ptr, size_t size);
+
+/* Usual size of a cache line, an alignment that keeps objects from sharing one */
+#define OS_CACHE_LINE_SIZE 64
+
+/**
+ * @brief Allocates size bytes at an address that is a multiple of alignment.
+ *
+ * The padding in front of the block and the space after it go back to the
+ * heap as free blocks, so only the requested size stays allocated. Blocks
+ * aligned above ALIGNMENT always come from the heap.
+ *
+ * @param alignment A power of 2.
+ * @param size The size of the memory block.
+ *
+ * @return The block, or NULL with errno set to EINVAL if alignment is not a
+ * power of 2, or ENOMEM if the block does not fit.
+ */
+void *os_memalign(size_t alignment, size_t size);
+
+/**
+ * @brief Same as os_memalign, for C11 aligned_alloc.
+ */
+void *os_aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * @brief Same as os_memalign, with the error returned like posix_memalign.
+ *
+ * @param memptr Set to the block on success.
+ * @param alignment A power of 2 multiple of sizeof(void *).
+ * @param size The size of the memory block.
+ *
+ * @return 0 on success, EINVAL or ENOMEM otherwise.
+ */
+int os_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+/**
+ * @brief Gives the number of bytes usable in an allocated block, which may be
+ * more than were asked for.
+ *
+ * @param ptr A pointer returned by the allocator, or NULL.
+ *
+ * @return The usable size, or 0 for NULL and invalid pointers.
+ */
+size_t os_malloc_usable_size(void *ptr);
+
+/* Parameters of os_mallopt, also read at startup from the environment */
+#define OS_M_MMAP_THRESHOLD    1 /* OSMEM_MMAP_THRESHOLD */
+#define OS_M_PREALLOC_SIZE     2 /* OSMEM_PREALLOC_SIZE */
+#define OS_M_TRIM_THRESHOLD    3 /* OSMEM_TRIM_THRESHOLD */
+#define OS_M_MADVISE_THRESHOLD 4 /* OSMEM_MADVISE_THRESHOLD */
+
+/**
+ * @brief Tunes the allocator at runtime, like mallopt.
+ *
+ * OS_M_MMAP_THRESHOLD sets the size, metadata included, from which requests
+ * are served by mmap. Until it is set, freeing a mapped block raises the
+ * threshold above that block, up to MMAP_THRESHOLD_MAX. OS_M_PREALLOC_SIZE
+ * sets the size of the first sbrk call and only matters before the first
+ * allocation from the heap. OS_M_TRIM_THRESHOLD sets the size above which a
+ * free block at the end of the heap is given back with a negative sbrk, it
+ * follows the dynamic mmap threshold until set. OS_M_MADVISE_THRESHOLD sets
+ * the size of a free block inside the heap from which the pages freed into it
+ * are madvised.
+ *
+ * @param param The parameter to change.
+ * @param value The new value of the parameter.
+ *
+ * @return 1 on success, 0 if the parameter is unknown.
+ */
+int os_mallopt(int param, size_t value);
+
+/* Buckets of the request size histogram, bucket i counts sizes in [2^i, 2^(i+1)) */
+#define OS_STATS_BUCKETS (8 * sizeof(size_t))
+
+/* Statistics of the allocator, either counters or computed when read */
+struct os_malloc_stats {
+	size_t heap_bytes; // Size of the heap.
+	size_t mapped_bytes; // Size of the blocks mapped with mmap.
+	size_t in_use_bytes; // Bytes in allocated blocks, metadata included.
+	size_t free_bytes; // Bytes in free blocks of the heap.
+	size_t largest_free; // Size of the largest free block of the heap.
+	double fragmentation; // 1 - largest_free / free_bytes.
+	size_t sbrk_calls; // sbrk calls, both growing and trimming the heap.
+	size_t mmap_calls; // mmap calls for blocks and their registry.
+	size_t munmap_calls; // munmap calls for blocks and their registry.
+	size_t mremap_calls; // mremap calls resizing mapped blocks.
+	size_t trims; // Negative sbrk calls.
+	size_t trimmed_bytes; // Bytes removed from the end of the heap.
+	size_t madvises; // madvise calls on free pages inside the heap.
+	size_t madvised_bytes; // Bytes madvised inside the heap.
+	size_t splits; // Blocks split in two.
+	size_t coalesces; // Blocks merged with their next block.
+	size_t best_fit_searches; // Searches of the free lists.
+	size_t best_fit_visits; // Free blocks looked at by those searches.
+	size_t requests[OS_STATS_BUCKETS]; // Histogram of the requested sizes.
+};
+
+/**
+ * @brief Reads the allocator statistics.
+ *
+ * @param stats Filled with the current values of the statistics.
+ */
+void os_malloc_stats(struct os_malloc_stats *stats);
+
+/**
+ * @brief Prints the allocator statistics to stderr.
+ *
+ * Also done at exit when the OSMEM_STATS environment variable is set.
+ */
+void os_malloc_stats_print(void);
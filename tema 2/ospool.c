@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include "osmem.h"
+#include "ospool.h"
+
+/* A slab holds at least this many objects, larger objects get larger slabs */
+#define MIN_OBJECTS_PER_SLAB 8
+
+struct slab {
+	os_pool_t *pool; // The pool the slab belongs to.
+	struct slab *prev; // Previous slab in the list of the pool.
+	struct slab *next; // Next slab in the list of the pool.
+	void *free; // First free object, the next one is stored inside it.
+	size_t used; // Number of objects in use.
+	size_t carved; // Number of objects ever handed out, the rest are untouched.
+};
+
+struct os_pool {
+	size_t obj_size; // Size of an object, rounded up to the alignment.
+	size_t slab_size; // Size of a slab, a power of 2 multiple of the page size.
+	size_t obj_offset; // Offset of the first object inside a slab.
+	size_t capacity; // Number of objects in a slab.
+	struct slab *partial; // Slabs with free objects.
+	struct slab *full; // Slabs with no free objects.
+	struct slab *empty; // A slab with no objects in use, kept for reuse.
+};
+
+static void slab_push(struct slab **list, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+
+	if (*list)
+		(*list)->prev = slab;
+
+	*list = slab;
+}
+
+static void slab_remove(struct slab **list, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+// maps a slab aligned to its size; mappings are only page aligned, so larger
+// slabs map twice as much and unmap the misaligned head and the tail
+static struct slab *map_slab(os_pool_t *pool)
+{
+	size_t slab_size = pool->slab_size;
+	size_t map_size = slab_size == (size_t)getpagesize() ? slab_size
+														 : 2 * slab_size;
+	void *mem = MMAP_CALL(map_size);
+
+	DIE(mem == MAP_FAILED, "mmap failed");
+
+	void *start = (void *)ALIGN_PAGE((uintptr_t)mem, slab_size);
+	size_t head_size = start - mem;
+
+	if (head_size)
+		DIE(munmap(mem, head_size), "munmap failed");
+
+	if (map_size - head_size > slab_size)
+		DIE(munmap(start + slab_size, map_size - head_size - slab_size),
+			"munmap failed");
+
+	struct slab *slab = start;
+
+	slab->pool = pool;
+	slab->free = NULL;
+	slab->used = 0;
+	slab->carved = 0;
+
+	return slab;
+}
+
+os_pool_t *os_pool_create(size_t obj_size, size_t align)
+{
+	if (!align)
+		align = ALIGNMENT;
+
+	if (!obj_size || (align & (align - 1)))
+		return NULL;
+
+	os_pool_t *pool = os_malloc(sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+
+	// a free object holds the pointer to the next one
+	obj_size = MAX(obj_size, sizeof(void *));
+	pool->obj_size = ALIGN_PAGE(obj_size, align);
+	pool->obj_offset = ALIGN_PAGE(sizeof(struct slab), align);
+
+	pool->slab_size = getpagesize();
+	while (pool->slab_size - pool->obj_offset <
+		   MIN_OBJECTS_PER_SLAB * pool->obj_size)
+		pool->slab_size *= 2;
+
+	pool->capacity = (pool->slab_size - pool->obj_offset) / pool->obj_size;
+	pool->partial = NULL;
+	pool->full = NULL;
+	pool->empty = NULL;
+
+	return pool;
+}
+
+void *os_pool_alloc(os_pool_t *pool)
+{
+	struct slab *slab = pool->partial;
+	void *obj;
+
+	if (!slab) {
+		if (pool->empty) {
+			slab = pool->empty;
+			pool->empty = NULL;
+		} else {
+			slab = map_slab(pool);
+		}
+
+		slab_push(&pool->partial, slab);
+	}
+
+	// reuse freed objects first, then carve new ones in address order
+	if (slab->free) {
+		obj = slab->free;
+		slab->free = *(void **)obj;
+	} else {
+		obj = (void *)slab + pool->obj_offset + slab->carved * pool->obj_size;
+		slab->carved++;
+	}
+
+	if (++slab->used == pool->capacity) {
+		slab_remove(&pool->partial, slab);
+		slab_push(&pool->full, slab);
+	}
+
+	return obj;
+}
+
+void os_pool_free(os_pool_t *pool, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	struct slab *slab = (void *)((uintptr_t)ptr & ~(pool->slab_size - 1));
+
+	if (slab->pool != pool)
+		return;
+
+	*(void **)ptr = slab->free;
+	slab->free = ptr;
+
+	if (slab->used-- == pool->capacity) {
+		slab_remove(&pool->full, slab);
+		slab_push(&pool->partial, slab);
+	}
+
+	if (slab->used)
+		return;
+
+	// keep one empty slab around, so a pool hovering around a slab boundary
+	// does not map and unmap on every call
+	slab_remove(&pool->partial, slab);
+
+	if (pool->empty) {
+		DIE(munmap(slab, pool->slab_size), "munmap failed");
+	} else {
+		slab->free = NULL;
+		slab->carved = 0;
+		pool->empty = slab;
+	}
+}
+
+static void unmap_slabs(os_pool_t *pool, struct slab *slab)
+{
+	while (slab) {
+		struct slab *next = slab->next;
+
+		DIE(munmap(slab, pool->slab_size), "munmap failed");
+		slab = next;
+	}
+}
+
+void os_pool_destroy(os_pool_t *pool)
+{
+	unmap_slabs(pool, pool->partial);
+	unmap_slabs(pool, pool->full);
+
+	if (pool->empty)
+		DIE(munmap(pool->empty, pool->slab_size), "munmap failed");
+
+	os_free(pool);
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Pools of fixed-size objects carved from slabs, mappings aligned to their own
+ * size so that the slab of an object is found by masking its address. Every
+ * slab keeps an embedded free list of its objects, so allocating and freeing
+ * never search. Pools are not thread-safe.
+ */
+
+typedef struct os_pool os_pool_t;
+
+/**
+ * @brief Creates a pool of objects of the same size.
+ *
+ * @param obj_size The size of an object, must be greater than 0.
+ * @param align The alignment of every object, a power of 2, or 0 for the
+ * default alignment of the allocator.
+ *
+ * @return A pointer to the new pool, or NULL if the arguments are invalid.
+ */
+os_pool_t *os_pool_create(size_t obj_size, size_t align);
+
+/**
+ * @brief Allocates an object from a pool.
+ *
+ * @param pool The pool to allocate from.
+ *
+ * @return A pointer to the object.
+ */
+void *os_pool_alloc(os_pool_t *pool);
+
+/**
+ * @brief Gives an object back to the pool it was allocated from.
+ *
+ * @param pool The pool the object was allocated from.
+ * @param ptr The object, or NULL.
+ */
+void os_pool_free(os_pool_t *pool, void *ptr);
+
+/**
+ * @brief Destroys a pool and unmaps all of its slabs, including the objects
+ * still in use.
+ *
+ * @param pool The pool to destroy.
+ */
+void os_pool_destroy(os_pool_t *pool);
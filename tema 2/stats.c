@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include "stats.h"
+#include "tcache.h"
+
+struct os_malloc_stats heap_stats;
+
+// Set at startup if OSMEM_STATS asks for the statistics to be printed at exit.
+static bool print_at_exit;
+
+static size_t request_bucket(size_t size)
+{
+	return size ? OS_STATS_BUCKETS - 1 - __builtin_clzl(size) : 0;
+}
+
+#ifdef OSMEM_THREADS
+
+#include <pthread.h>
+
+struct thread_stats {
+	size_t requests[OS_STATS_BUCKETS]; // Only written by the owner thread.
+	struct thread_stats *prev; // Previous thread in the list of live threads.
+	struct thread_stats *next; // Next thread in the list of live threads.
+	bool registered; // Set once the thread is in the list of live threads.
+};
+
+static __thread struct thread_stats local;
+
+// Live threads, guarded by the heap lock.
+static struct thread_stats *threads;
+
+// Requests of the threads that exited, guarded by the heap lock.
+static size_t retired[OS_STATS_BUCKETS];
+
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+static void retire_thread(void *arg)
+{
+	struct thread_stats *stats = arg;
+
+	heap_lock();
+
+	for (size_t i = 0; i < OS_STATS_BUCKETS; i++)
+		retired[i] += stats->requests[i];
+
+	if (stats->prev)
+		stats->prev->next = stats->next;
+	else
+		threads = stats->next;
+
+	if (stats->next)
+		stats->next->prev = stats->prev;
+
+	heap_unlock();
+}
+
+static void create_stats_key(void)
+{
+	pthread_key_create(&stats_key, retire_thread);
+}
+
+static void register_thread(void)
+{
+	pthread_once(&stats_key_once, create_stats_key);
+	pthread_setspecific(stats_key, &local);
+
+	heap_lock();
+
+	local.prev = NULL;
+	local.next = threads;
+
+	if (threads)
+		threads->prev = &local;
+
+	threads = &local;
+	heap_unlock();
+
+	local.registered = true;
+}
+
+void count_request(size_t size)
+{
+	if (!local.registered)
+		register_thread();
+
+	// a plain load and store, other threads only read the counter
+	size_t *counter = &local.requests[request_bucket(size)];
+
+	__atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+void sum_requests(struct os_malloc_stats *stats)
+{
+	for (size_t i = 0; i < OS_STATS_BUCKETS; i++) {
+		stats->requests[i] += retired[i];
+
+		for (struct thread_stats *t = threads; t; t = t->next)
+			stats->requests[i] += __atomic_load_n(&t->requests[i], __ATOMIC_RELAXED);
+	}
+}
+
+#else
+
+// Requests of the only thread.
+static size_t requests[OS_STATS_BUCKETS];
+
+void count_request(size_t size)
+{
+	requests[request_bucket(size)]++;
+}
+
+void sum_requests(struct os_malloc_stats *stats)
+{
+	for (size_t i = 0; i < OS_STATS_BUCKETS; i++)
+		stats->requests[i] += requests[i];
+}
+
+#endif
+
+// printf to stderr without the buffering of stdio, which may allocate
+static void print_line(const char *format, ...)
+{
+	char line[256];
+	va_list args;
+
+	va_start(args, format);
+	int len = vsnprintf(line, sizeof(line), format, args);
+
+	va_end(args);
+
+	if (len > 0)
+		write(STDERR_FILENO, line, MIN((size_t)len, sizeof(line) - 1));
+}
+
+void os_malloc_stats_print(void)
+{
+	struct os_malloc_stats stats;
+
+	os_malloc_stats(&stats);
+
+	print_line("osmem statistics\n");
+	print_line("  heap            %zu bytes\n", stats.heap_bytes);
+	print_line("  mapped          %zu bytes\n", stats.mapped_bytes);
+	print_line("  in use          %zu bytes\n", stats.in_use_bytes);
+	print_line("  free            %zu bytes\n", stats.free_bytes);
+	print_line("  largest free    %zu bytes\n", stats.largest_free);
+	print_line("  fragmentation   %.2f%%\n", 100 * stats.fragmentation);
+	print_line("  syscalls        sbrk %zu, mmap %zu, munmap %zu, mremap %zu, madvise %zu\n",
+			   stats.sbrk_calls, stats.mmap_calls, stats.munmap_calls,
+			   stats.mremap_calls, stats.madvises);
+	print_line("  trimmed         %zu bytes in %zu calls\n",
+			   stats.trimmed_bytes, stats.trims);
+	print_line("  madvised        %zu bytes in %zu calls\n",
+			   stats.madvised_bytes, stats.madvises);
+	print_line("  splits          %zu\n", stats.splits);
+	print_line("  coalesces       %zu\n", stats.coalesces);
+	print_line("  best fit        %zu searches, %zu blocks visited\n",
+			   stats.best_fit_searches, stats.best_fit_visits);
+	print_line("  requests\n");
+
+	for (size_t i = 0; i < OS_STATS_BUCKETS; i++) {
+		if (stats.requests[i])
+			print_line("    < 2^%-2zu        %zu\n", i + 1,
+					   stats.requests[i]);
+	}
+}
+
+static void __attribute__((constructor)) init_stats(void)
+{
+	char *value = getenv("OSMEM_STATS");
+
+	print_at_exit = value && *value && *value != '0';
+}
+
+static void __attribute__((destructor)) print_stats(void)
+{
+	if (print_at_exit)
+		os_malloc_stats_print();
+}
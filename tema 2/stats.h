@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include "osmem.h"
+
+/*
+ * Counters of the allocator. The ones in heap_stats are only updated with the
+ * heap lock held, the request histogram is kept per thread, so counting a
+ * request never touches a shared cache line.
+ */
+
+// Counters updated under the heap lock.
+extern struct os_malloc_stats heap_stats;
+
+/**
+ * @brief Adds a request to the histogram of request sizes of the calling
+ * thread.
+ *
+ * @param size The size of the request.
+ */
+void count_request(size_t size);
+
+/**
+ * @brief Adds the request histograms of all threads to the given statistics.
+ *
+ * Must be called with the heap lock held.
+ *
+ * @param stats The statistics to add to.
+ */
+void sum_requests(struct os_malloc_stats *stats);
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <pthread.h>
+#include "tcache.h"
+
+struct tcache_bin {
+	struct block_meta *first; // Cached blocks, linked by next_free.
+	unsigned int count; // Number of cached blocks.
+};
+
+/*
+ * Blocks freed by other threads for a cache, linked by next_free. Any thread
+ * pushes on it, only the owner takes it, so both sides only need an atomic
+ * instruction; a whole cache line each keeps the threads apart.
+ */
+struct remote_list {
+	struct block_meta *first; // REMOTE_CLOSED while no thread owns the cache.
+	bool used; // Set while a thread owns the cache.
+} __attribute__((aligned(64)));
+
+#define REMOTE_CLOSED ((struct block_meta *)1)
+
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct tcache_bin bins[TCACHE_NUM_BINS];
+
+// Set once the thread has registered the destructor that empties its cache.
+static __thread bool registered;
+
+// Index of the remote list of the thread's cache, 0 if all of them are taken.
+static __thread unsigned int owner;
+
+static struct remote_list remote_lists[TCACHE_MAX_OWNERS];
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+void heap_lock(void)
+{
+	pthread_mutex_lock(&heap_mutex);
+}
+
+void heap_unlock(void)
+{
+	pthread_mutex_unlock(&heap_mutex);
+}
+
+static struct block_meta *detach(struct tcache_bin *bin, unsigned int count)
+{
+	struct block_meta *blocks = bin->first;
+	struct block_meta *last = blocks;
+
+	for (unsigned int i = 1; i < count; i++)
+		last = last->next_free;
+
+	bin->first = last->next_free;
+	bin->count -= count;
+	last->next_free = NULL;
+
+	return blocks;
+}
+
+static void release_tcache(void *arg)
+{
+	(void)arg;
+
+	if (owner) {
+		struct remote_list *list = &remote_lists[owner];
+		struct block_meta *remote = __atomic_exchange_n(&list->first,
+									REMOTE_CLOSED, __ATOMIC_ACQUIRE);
+
+		if (remote)
+			release_blocks(remote);
+		__atomic_store_n(&list->used, false, __ATOMIC_RELEASE);
+		owner = 0;
+	}
+
+	for (size_t i = 0; i < TCACHE_NUM_BINS; i++) {
+		if (bins[i].count)
+			release_blocks(detach(&bins[i], bins[i].count));
+	}
+}
+
+static void create_tcache_key(void)
+{
+	pthread_key_create(&tcache_key, release_tcache);
+}
+
+static struct tcache_bin *get_bin(size_t size)
+{
+	return &bins[size / ALIGNMENT - 1];
+}
+
+// claims a free remote list for the cache of the calling thread, without the
+// heap lock, which may already be held
+static void claim_remote_list(void)
+{
+	for (unsigned int i = 1; i < TCACHE_MAX_OWNERS; i++) {
+		struct remote_list *list = &remote_lists[i];
+
+		if (!__atomic_load_n(&list->used, __ATOMIC_RELAXED) &&
+			!__atomic_exchange_n(&list->used, true, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&list->first, NULL, __ATOMIC_RELEASE);
+			owner = i;
+			return;
+		}
+	}
+}
+
+static void register_tcache(void)
+{
+	// the value only has to be non-NULL for the destructor to run
+	pthread_once(&tcache_key_once, create_tcache_key);
+	pthread_setspecific(tcache_key, bins);
+	claim_remote_list();
+	registered = true;
+}
+
+static void push(struct tcache_bin *bin, struct block_meta *block)
+{
+	if (!registered)
+		register_tcache();
+
+	block->magic = TCACHE_MAGIC;
+	block->owner = owner;
+	block->next_free = bin->first;
+	bin->first = block;
+	bin->count++;
+}
+
+// pushes a block on the remote list of the cache that owns it, returns false
+// if no thread owns that cache any more
+static bool remote_free(struct block_meta *block)
+{
+	struct remote_list *list = &remote_lists[block->owner];
+	struct block_meta *first = __atomic_load_n(&list->first, __ATOMIC_RELAXED);
+
+	// a second free of the block fails validation from now on
+	block->magic = TCACHE_MAGIC;
+
+	do {
+		if (first == REMOTE_CLOSED)
+			return false;
+		block->next_free = first;
+	} while (!__atomic_compare_exchange_n(&list->first, &first, block, true,
+										  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+// moves the blocks other threads freed for this cache to its bins, the ones
+// that do not fit go back to the heap under a single lock
+static void reclaim_remote(void)
+{
+	struct block_meta *blocks = __atomic_exchange_n(&remote_lists[owner].first,
+											NULL, __ATOMIC_ACQUIRE);
+	struct block_meta *evicted = NULL;
+
+	while (blocks) {
+		struct block_meta *next = blocks->next_free;
+		struct tcache_bin *bin = get_bin(get_size(blocks));
+
+		if (bin->count == TCACHE_BIN_CAPACITY) {
+			blocks->next_free = evicted;
+			evicted = blocks;
+		} else {
+			push(bin, blocks);
+		}
+
+		blocks = next;
+	}
+
+	if (evicted)
+		release_blocks(evicted);
+}
+
+struct block_meta *tcache_get(size_t aligned_size)
+{
+	struct tcache_bin *bin = get_bin(aligned_size);
+	struct block_meta *block = bin->first;
+
+	// an empty bin is refilled from the remote list before the heap
+	if (!block && owner &&
+		__atomic_load_n(&remote_lists[owner].first, __ATOMIC_RELAXED)) {
+		reclaim_remote();
+		block = bin->first;
+	}
+
+	if (!block)
+		return NULL;
+
+	bin->first = block->next_free;
+	bin->count--;
+	block->magic = BLOCK_MAGIC;
+
+	return block;
+}
+
+void tcache_fill(struct block_meta *block)
+{
+	push(get_bin(get_size(block)), block);
+}
+
+void tcache_own(struct block_meta *block)
+{
+	if (!registered)
+		register_tcache();
+
+	block->owner = owner;
+}
+
+bool tcache_put(struct block_meta *block, struct block_meta **evicted)
+{
+	*evicted = NULL;
+
+	if (!is_heap_block(block) || get_status(block) != STATUS_ALLOC ||
+		get_size(block) > TCACHE_MAX_SIZE)
+		return false;
+
+	if (block->owner && block->owner != owner && remote_free(block))
+		return true;
+
+	struct tcache_bin *bin = get_bin(get_size(block));
+
+	if (bin->count == TCACHE_BIN_CAPACITY)
+		*evicted = detach(bin, TCACHE_BATCH);
+
+	push(bin, block);
+	return true;
+}
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stdbool.h>
+#include "block_meta.h"
+
+/*
+ * Per-thread caches of small blocks, only built with OSMEM_THREADS.
+ *
+ * A cached block stays STATUS_ALLOC in the heap, so it is never coalesced or
+ * handed out by the heap while its thread owns it. Its magic word is set to
+ * TCACHE_MAGIC, which makes a second free of the same pointer fail validation.
+ *
+ * Each small block handed out records the cache of the thread it came from.
+ * A thread freeing a block of another cache pushes it, without a lock, on the
+ * remote list of that cache, which its thread takes whole once one of its bins
+ * runs empty. Blocks thus return to the thread that allocates them, instead of
+ * piling up in the caches of the threads that only free. Once a thread exits,
+ * the blocks of its cache that are freed go to the cache of the freeing thread.
+ */
+
+#ifdef OSMEM_THREADS
+
+/* One bin for every block size up to 1 KiB, metadata included */
+#define TCACHE_NUM_BINS (1024 / ALIGNMENT)
+
+/*
+ * Largest block size served from the thread caches; the hardened build sends
+ * every block through the heap and its quarantine instead
+ */
+#ifdef OSMEM_HARDEN
+#define TCACHE_MAX_SIZE 0
+#else
+#define TCACHE_MAX_SIZE (TCACHE_NUM_BINS * ALIGNMENT)
+#endif
+
+/* Maximum number of blocks kept in one bin */
+#define TCACHE_BIN_CAPACITY 32
+
+/* Number of blocks moved between a bin and the heap at once */
+#define TCACHE_BATCH (TCACHE_BIN_CAPACITY / 2)
+
+#define TCACHE_MAGIC 0x7CAC4E5Bu
+
+/* Number of threads whose caches can own blocks at once, 0 is no owner */
+#define TCACHE_MAX_OWNERS 256
+
+/**
+ * @brief Acquires the lock protecting the shared heap.
+ */
+void heap_lock(void);
+
+/**
+ * @brief Releases the lock protecting the shared heap.
+ */
+void heap_unlock(void);
+
+/**
+ * @brief Takes a block of the given size from the calling thread's cache.
+ *
+ * @param aligned_size The size of the block, metadata included.
+ *
+ * @return A pointer to the block, or NULL if the bin is empty.
+ */
+struct block_meta *tcache_get(size_t aligned_size);
+
+/**
+ * @brief Stores a freshly allocated block in the calling thread's cache.
+ *
+ * The bin of the block must not be full, which holds right after a miss.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void tcache_fill(struct block_meta *block);
+
+/**
+ * @brief Makes the calling thread's cache the owner of a block it hands out,
+ * so that the block comes back to it when another thread frees it.
+ *
+ * @param block Pointer to the block metadata structure.
+ */
+void tcache_own(struct block_meta *block);
+
+/**
+ * @brief Stores a block released by the user in the calling thread's cache,
+ * or on the remote list of the cache that owns it.
+ *
+ * If the bin of the block is full, half of it is detached first and returned
+ * through evicted, linked by next_free, for the caller to give back to the
+ * heap.
+ *
+ * @param block Pointer to the block metadata structure.
+ * @param evicted Set to the list of detached blocks, or NULL.
+ *
+ * @return true if the block was cached, false if it is not a valid small heap
+ * block and has to go through the heap.
+ */
+bool tcache_put(struct block_meta *block, struct block_meta **evicted);
+
+/**
+ * @brief Gives a list of blocks linked by next_free back to the heap.
+ *
+ * Implemented by the allocator, it takes the heap lock once for the whole
+ * list.
+ *
+ * @param blocks The first block of the list.
+ */
+void release_blocks(struct block_meta *blocks);
+
+#else
+
+#define TCACHE_MAX_SIZE 0
+#define TCACHE_BATCH 1
+
+static inline void heap_lock(void) {}
+static inline void heap_unlock(void) {}
+
+static inline struct block_meta *tcache_get(size_t aligned_size)
+{
+	(void)aligned_size;
+	return NULL;
+}
+
+static inline void tcache_fill(struct block_meta *block)
+{
+	(void)block;
+}
+
+static inline void tcache_own(struct block_meta *block)
+{
+	(void)block;
+}
+
+static inline bool tcache_put(struct block_meta *block,
+							  struct block_meta **evicted)
+{
+	(void)block;
+	(void)evicted;
+	return false;
+}
+
+#endif
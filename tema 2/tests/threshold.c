@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Regression check of the dynamic mmap threshold: once a large mapped block
+ * is freed, blocks of the same size come from the heap, so a program that
+ * keeps allocating and freeing them only calls mmap for the first one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "osmem.h"
+
+#define SIZE (200 * 1024)
+#define ROUNDS 5
+
+int main(void)
+{
+	struct os_malloc_stats first, stats;
+
+	for (int i = 0; i < ROUNDS; i++) {
+		char *ptr = os_malloc(SIZE);
+
+		memset(ptr, i, SIZE);
+		os_free(ptr);
+
+		// the first block is mapped, along with the registry of mappings
+		if (i == 0)
+			os_malloc_stats(&first);
+	}
+
+	os_malloc_stats(&stats);
+
+	if (stats.mmap_calls != first.mmap_calls ||
+		stats.munmap_calls != first.munmap_calls) {
+		printf("threshold: FAILED, %zu mmap and %zu munmap calls after the first free\n",
+			   stats.mmap_calls - first.mmap_calls,
+			   stats.munmap_calls - first.munmap_calls);
+		return 1;
+	}
+
+	printf("threshold: OK\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Writes a synthetic graph, as text or, when the output name ends in .bin,
+ * in the binary format. The node values are random in [-1000, 1000]. Prints
+ * the number of nodes and edges it wrote.
+ *
+ * er     Erdos-Renyi, num_nodes * degree / 2 uniformly random edges
+ * rmat   R-MAT (a = 0.57, b = c = 0.19), power-law degrees, ids shuffled
+ * grid   square grid, each node linked to its right and lower neighbour
+ * chain  a single path 0 - 1 - ... - num_nodes - 1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "os_graph.h"
+#include "log/log.h"
+#include "utils.h"
+
+static uint64_t state;
+
+/* xorshift64* */
+static uint64_t next_random(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned int random_below(uint64_t n)
+{
+	return (next_random() >> 11) % n;
+}
+
+static void generate_er(unsigned int n, unsigned int m, os_edge_t *edges)
+{
+	for (unsigned int i = 0; i < m; i++) {
+		edges[i].src = random_below(n);
+		do {
+			edges[i].dst = random_below(n);
+		} while (n > 1 && edges[i].dst == edges[i].src);
+	}
+}
+
+static unsigned int rmat_node(unsigned int scale, unsigned int *other)
+{
+	unsigned int src = 0, dst = 0;
+
+	for (unsigned int bit = 0; bit < scale; bit++) {
+		uint64_t r = next_random() % 100;
+
+		/* a: neither half, b: dst half, c: src half, d: both. */
+		src = 2 * src + (r >= 76);
+		dst = 2 * dst + ((r >= 57 && r < 76) || r >= 95);
+	}
+
+	*other = dst;
+
+	return src;
+}
+
+static void generate_rmat(unsigned int n, unsigned int m, os_edge_t *edges)
+{
+	unsigned int scale = 0;
+	unsigned int *perm;
+
+	while ((1ULL << scale) < n)
+		scale++;
+
+	/*
+	 * Shuffle the ids, so the hubs are not all next to each other, but keep
+	 * the biggest hub as node 0, where the traversals start.
+	 */
+	perm = malloc(n * sizeof(*perm));
+	DIE(perm == NULL, "malloc");
+	for (unsigned int i = 0; i < n; i++)
+		perm[i] = i;
+	for (unsigned int i = n - 1; i > 1; i--) {
+		unsigned int j = 1 + random_below(i), tmp = perm[i];
+
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+
+	for (unsigned int i = 0; i < m; i++) {
+		unsigned int src, dst;
+
+		do {
+			src = rmat_node(scale, &dst);
+		} while (src >= n || dst >= n);
+
+		edges[i].src = perm[src];
+		edges[i].dst = perm[dst];
+	}
+
+	free(perm);
+}
+
+static void generate_grid(unsigned int side, os_edge_t *edges)
+{
+	unsigned int m = 0;
+
+	for (unsigned int row = 0; row < side; row++) {
+		for (unsigned int col = 0; col < side; col++) {
+			unsigned int node = row * side + col;
+
+			if (col + 1 < side)
+				edges[m++] = (os_edge_t){ node, node + 1 };
+			if (row + 1 < side)
+				edges[m++] = (os_edge_t){ node, node + side };
+		}
+	}
+}
+
+static int write_text(const char *path, unsigned int n, unsigned int m, int *values,
+		      os_edge_t *edges)
+{
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL) {
+		log_error("Can't open %s", path);
+		return -1;
+	}
+
+	fprintf(file, "%u %u\n", n, m);
+	for (unsigned int i = 0; i < n; i++)
+		fprintf(file, "%d%c", values[i], i + 1 < n ? ' ' : '\n');
+	for (unsigned int i = 0; i < m; i++)
+		fprintf(file, "%u %u\n", edges[i].src, edges[i].dst);
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int n, m, degree;
+	const char *kind, *output;
+	os_edge_t *edges;
+	int *values;
+	size_t len;
+	int rc;
+
+	if (argc != 6) {
+		fprintf(stderr, "Usage: %s er|rmat|grid|chain num_nodes degree seed output_file\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	kind = argv[1];
+	n = strtoul(argv[2], NULL, 10);
+	degree = strtoul(argv[3], NULL, 10);
+	state = strtoull(argv[4], NULL, 10) * 2 + 1;
+	output = argv[5];
+
+	if (n == 0) {
+		fprintf(stderr, "A graph needs at least one node\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(kind, "grid") == 0) {
+		unsigned int side = 1;
+
+		while ((side + 1) * (side + 1) <= n)
+			side++;
+		n = side * side;
+		m = 2 * side * (side - 1);
+	} else if (strcmp(kind, "chain") == 0) {
+		m = n > 0 ? n - 1 : 0;
+	} else if (strcmp(kind, "er") == 0 || strcmp(kind, "rmat") == 0) {
+		m = (uint64_t)n * degree / 2;
+	} else {
+		fprintf(stderr, "Unknown graph kind %s\n", kind);
+		exit(EXIT_FAILURE);
+	}
+
+	values = malloc(n * sizeof(*values));
+	DIE(n != 0 && values == NULL, "malloc");
+	edges = malloc(m * sizeof(*edges));
+	DIE(m != 0 && edges == NULL, "malloc");
+
+	for (unsigned int i = 0; i < n; i++)
+		values[i] = (int)random_below(2001) - 1000;
+
+	if (strcmp(kind, "er") == 0) {
+		generate_er(n, m, edges);
+	} else if (strcmp(kind, "rmat") == 0) {
+		generate_rmat(n, m, edges);
+	} else if (strcmp(kind, "grid") == 0) {
+		unsigned int side = 0;
+
+		while (side * side < n)
+			side++;
+		generate_grid(side, edges);
+	} else {
+		for (unsigned int i = 0; i < m; i++)
+			edges[i] = (os_edge_t){ i, i + 1 };
+	}
+
+	len = strlen(output);
+	if (len > 4 && strcmp(output + len - 4, ".bin") == 0) {
+		os_graph_t *graph = create_graph_from_data(n, m, values, edges);
+
+		DIE(graph == NULL, "create_graph_from_data");
+		rc = save_graph(graph, output);
+		destroy_graph(graph);
+	} else {
+		rc = write_text(output, n, m, values, edges);
+	}
+
+	free(edges);
+	free(values);
+
+	if (rc < 0)
+		exit(EXIT_FAILURE);
+
+	printf("%u %u\n", n, m);
+
+	return 0;
+}
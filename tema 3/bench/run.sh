@@ -0,0 +1,78 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Generates every kind of graph of bench/graph_gen, then times serial and
+# both engines of parallel on it at every thread count. The sizes and thread
+# counts can be changed through the environment:
+#
+#   NODES=1000000 DEGREE=8 THREADS="1 2 4 8" KINDS="er rmat grid chain"
+#
+# Load and traverse are reported separately, edges/s and speedup are for the
+# traversal only, against serial. Exits with 1 if any sum differs from the
+# serial one.
+
+cd "$(dirname "$0")" || exit 1
+
+NODES=${NODES:-1000000}
+DEGREE=${DEGREE:-8}
+THREADS=${THREADS:-"1 2 4 8"}
+KINDS=${KINDS:-"er rmat grid chain"}
+DATA=${DATA:-/tmp/os_graph_bench}
+export GRAPH_TIMES=1
+
+mkdir -p "$DATA" || exit 1
+status=0
+
+# run label command...: prints one line and sets sum, traverse
+run() {
+	label=$1
+	shift
+	out=$("$@" 2>"$DATA/times")
+	rc=$?
+	times=$(grep '^load ' "$DATA/times")
+	if [ $rc != 0 ] || [ -z "$times" ]; then
+		printf "%-7s %-14s failed (exit %d)\n" "$kind" "$label" $rc
+		sum=failed
+		return
+	fi
+
+	sum=$out
+	load=$(echo "$times" | awk '{ print $2 }')
+	traverse=$(echo "$times" | awk '{ print $5 }')
+	printf "%-7s %-14s %10s %12s %14s %8s  %s\n" "$kind" "$label" "$load" "$traverse" \
+		"$(awk -v m="$edges" -v t="$traverse" 'BEGIN { print (t > 0 ? sprintf("%.3g", m / t * 1e3) : "-") }')" \
+		"$(awk -v s="$serial" -v t="$traverse" 'BEGIN { print (t > 0 && s > 0 ? sprintf("%.2f", s / t) : "-") }')" \
+		"$sum"
+}
+
+check() {
+	if [ "$sum" != failed ] && [ "$sum" != "$expected" ]; then
+		echo "sum mismatch: expected $expected" >&2
+		status=1
+	fi
+}
+
+printf "%-7s %-14s %10s %12s %14s %8s  %s\n" graph run "load ms" "traverse ms" "edges/s" \
+	speedup sum
+
+for kind in $KINDS; do
+	set -- $(./graph_gen "$kind" "$NODES" "$DEGREE" 1 "$DATA/$kind.bin") || exit 1
+	edges=$2
+	./graph_gen "$kind" "$NODES" "$DEGREE" 1 "$DATA/$kind.txt" > /dev/null || exit 1
+
+	serial=0
+	run serial-text ../serial "$DATA/$kind.txt"
+	expected=$sum
+	run serial ../serial "$DATA/$kind.bin"
+	check
+	[ "$sum" != failed ] && serial=$traverse
+
+	for engine in tasks bfs; do
+		for t in $THREADS; do
+			run "$engine-$t" env PARALLEL_ENGINE=$engine ../parallel "$DATA/$kind.bin" "$t"
+			check
+		done
+	done
+done
+
+exit $status
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "os_graph.h"
+#include "log/log.h"
+#include "utils.h"
+
+/*
+ * Converts a text graph to the binary format, which serial and parallel
+ * then map without parsing.
+ */
+int main(int argc, char *argv[])
+{
+	os_graph_t *graph;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s input_file output_file\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	graph = create_graph_from_path(argv[1], 0);
+	DIE(graph == NULL, "create_graph_from_path");
+
+	if (save_graph(graph, argv[2]) < 0)
+		exit(EXIT_FAILURE);
+
+	destroy_graph(graph);
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "os_bfs.h"
+#include "utils.h"
+
+/* Beamer's switching thresholds. */
+#define BFS_ALPHA		14
+#define BFS_BETA		24
+
+#define BFS_TOP_DOWN_GRAIN	64	/* Frontier nodes per chunk, at least. */
+#define BFS_BOTTOM_UP_GRAIN	4096	/* Nodes per chunk, at least, a multiple of 64. */
+#define BFS_BUFFER_SIZE		256
+
+typedef struct bfs {
+	os_graph_t *graph;
+
+	/* One bit per node. */
+	_Atomic uint64_t *visited;
+	_Atomic uint64_t *frontier_bits;	/* Only filled in for bottom-up levels. */
+
+	/* The current frontier and the next one, as lists of nodes. */
+	unsigned int *frontier;
+	size_t frontier_size;
+	unsigned int *next;
+	atomic_size_t next_size;
+	atomic_size_t next_degrees;	/* Sum of the degrees of the next frontier. */
+
+	_Atomic int64_t sum;
+} bfs_t;
+
+/* Nodes found by one chunk, flushed to the next frontier as it fills up. */
+typedef struct bfs_buffer {
+	unsigned int nodes[BFS_BUFFER_SIZE];
+	size_t size;
+	size_t degrees;
+	int64_t sum;
+} bfs_buffer_t;
+
+static inline bool test_bit(_Atomic uint64_t *bits, unsigned int i)
+{
+	return atomic_load_explicit(&bits[i / 64], memory_order_relaxed) & (1ULL << (i % 64));
+}
+
+/* Sets bit i, true if this call is the one that set it. */
+static inline bool test_and_set_bit(_Atomic uint64_t *bits, unsigned int i)
+{
+	uint64_t mask = 1ULL << (i % 64);
+
+	if (atomic_load_explicit(&bits[i / 64], memory_order_relaxed) & mask)
+		return false;
+
+	return !(atomic_fetch_or_explicit(&bits[i / 64], mask, memory_order_relaxed) & mask);
+}
+
+static void flush(bfs_t *bfs, bfs_buffer_t *b)
+{
+	size_t pos = atomic_fetch_add_explicit(&bfs->next_size, b->size, memory_order_relaxed);
+
+	memcpy(bfs->next + pos, b->nodes, b->size * sizeof(b->nodes[0]));
+	b->size = 0;
+}
+
+static inline void visit(bfs_t *bfs, bfs_buffer_t *b, unsigned int v)
+{
+	b->nodes[b->size++] = v;
+	b->degrees += graph_degree(bfs->graph, v);
+	b->sum += bfs->graph->info[v];
+
+	if (b->size == BFS_BUFFER_SIZE)
+		flush(bfs, b);
+}
+
+static void finish(bfs_t *bfs, bfs_buffer_t *b)
+{
+	flush(bfs, b);
+	atomic_fetch_add_explicit(&bfs->next_degrees, b->degrees, memory_order_relaxed);
+	atomic_fetch_add_explicit(&bfs->sum, b->sum, memory_order_relaxed);
+}
+
+/* Every edge out of the frontier claims the node at its other end. */
+static void top_down(size_t begin, size_t end, void *ctx)
+{
+	bfs_t *bfs = ctx;
+	bfs_buffer_t b = { .size = 0, .degrees = 0, .sum = 0 };
+
+	for (size_t i = begin; i < end; i++) {
+		unsigned int u = bfs->frontier[i];
+		const unsigned int *neighbours = graph_neighbours(bfs->graph, u);
+		unsigned int degree = graph_degree(bfs->graph, u);
+
+		for (unsigned int j = 0; j < degree; j++)
+			if (test_and_set_bit(bfs->visited, neighbours[j]))
+				visit(bfs, &b, neighbours[j]);
+	}
+
+	finish(bfs, &b);
+}
+
+/* Every unvisited node looks for a parent in the frontier, stopping at the first. */
+static void bottom_up(size_t begin, size_t end, void *ctx)
+{
+	bfs_t *bfs = ctx;
+	bfs_buffer_t b = { .size = 0, .degrees = 0, .sum = 0 };
+
+	for (size_t v = begin; v < end; v++) {
+		const unsigned int *neighbours;
+		unsigned int degree;
+
+		if (test_bit(bfs->visited, v))
+			continue;
+
+		neighbours = graph_neighbours(bfs->graph, v);
+		degree = graph_degree(bfs->graph, v);
+		for (unsigned int j = 0; j < degree; j++) {
+			if (test_bit(bfs->frontier_bits, neighbours[j])) {
+				test_and_set_bit(bfs->visited, v);
+				visit(bfs, &b, v);
+				break;
+			}
+		}
+	}
+
+	finish(bfs, &b);
+}
+
+static void set_frontier_bits(size_t begin, size_t end, void *ctx)
+{
+	bfs_t *bfs = ctx;
+
+	for (size_t i = begin; i < end; i++)
+		test_and_set_bit(bfs->frontier_bits, bfs->frontier[i]);
+}
+
+/* The bitmap only holds the frontier, so whole words can be cleared. */
+static void clear_frontier_bits(size_t begin, size_t end, void *ctx)
+{
+	bfs_t *bfs = ctx;
+
+	for (size_t i = begin; i < end; i++)
+		atomic_store_explicit(&bfs->frontier_bits[bfs->frontier[i] / 64], 0,
+				      memory_order_relaxed);
+}
+
+static size_t grain(os_threadpool_t *tp, size_t n, size_t min)
+{
+	size_t g = n / (8 * tp->num_threads) + 1;
+
+	return g > min ? g : min;
+}
+
+int64_t graph_bfs_sum(os_graph_t *graph, os_threadpool_t *tp, unsigned int source)
+{
+	size_t words = (graph->num_nodes + 63) / 64;
+	size_t frontier_degrees, unexplored_degrees;
+	bool use_bottom_up = false;
+	unsigned int *tmp;
+	bfs_t bfs;
+
+	if (source >= graph->num_nodes)
+		return 0;
+
+	bfs.graph = graph;
+	bfs.visited = calloc(words, sizeof(*bfs.visited));
+	DIE(bfs.visited == NULL, "calloc");
+	bfs.frontier_bits = calloc(words, sizeof(*bfs.frontier_bits));
+	DIE(bfs.frontier_bits == NULL, "calloc");
+	bfs.frontier = malloc(graph->num_nodes * sizeof(*bfs.frontier));
+	DIE(bfs.frontier == NULL, "malloc");
+	bfs.next = malloc(graph->num_nodes * sizeof(*bfs.next));
+	DIE(bfs.next == NULL, "malloc");
+
+	test_and_set_bit(bfs.visited, source);
+	bfs.frontier[0] = source;
+	bfs.frontier_size = 1;
+	atomic_init(&bfs.sum, graph->info[source]);
+
+	frontier_degrees = graph_degree(graph, source);
+	unexplored_degrees = 2 * (size_t)graph->num_edges - frontier_degrees;
+
+	while (bfs.frontier_size != 0) {
+		atomic_store_explicit(&bfs.next_size, 0, memory_order_relaxed);
+		atomic_store_explicit(&bfs.next_degrees, 0, memory_order_relaxed);
+
+		if (use_bottom_up) {
+			size_t g = grain(tp, graph->num_nodes, BFS_BOTTOM_UP_GRAIN);
+
+			/* Chunks of whole words, so no two of them write the same visited word. */
+			parallel_for(tp, 0, graph->num_nodes, (g + 63) / 64 * 64, bottom_up, &bfs);
+			parallel_for(tp, 0, bfs.frontier_size,
+				     grain(tp, bfs.frontier_size, BFS_TOP_DOWN_GRAIN),
+				     clear_frontier_bits, &bfs);
+		} else {
+			parallel_for(tp, 0, bfs.frontier_size,
+				     grain(tp, bfs.frontier_size, BFS_TOP_DOWN_GRAIN), top_down, &bfs);
+		}
+
+		tmp = bfs.frontier;
+		bfs.frontier = bfs.next;
+		bfs.next = tmp;
+		bfs.frontier_size = atomic_load_explicit(&bfs.next_size, memory_order_relaxed);
+		frontier_degrees = atomic_load_explicit(&bfs.next_degrees, memory_order_relaxed);
+		unexplored_degrees -= frontier_degrees;
+
+		/*
+		 * Bottom-up pays off once the frontier has more edges than a
+		 * fraction of the unexplored part, until it shrinks again.
+		 */
+		if (!use_bottom_up && frontier_degrees > unexplored_degrees / BFS_ALPHA)
+			use_bottom_up = true;
+		else if (use_bottom_up && bfs.frontier_size < graph->num_nodes / BFS_BETA)
+			use_bottom_up = false;
+
+		if (use_bottom_up)
+			parallel_for(tp, 0, bfs.frontier_size,
+				     grain(tp, bfs.frontier_size, BFS_TOP_DOWN_GRAIN),
+				     set_frontier_bits, &bfs);
+	}
+
+	free(bfs.next);
+	free(bfs.frontier);
+	free(bfs.frontier_bits);
+	free(bfs.visited);
+
+	return atomic_load(&bfs.sum);
+}
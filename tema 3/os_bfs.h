@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_BFS_H__
+#define __OS_BFS_H__	1
+
+#include <stdint.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+/*
+ * Level-synchronous BFS from source over the pool, returning the sum of the
+ * info of every node reachable from it. Every level runs as one
+ * parallel_for(): top-down over the frontier while it is small, bottom-up
+ * over the unvisited nodes while it is large (S. Beamer et al.,
+ * "Direction-Optimizing Breadth-First Search", SC 2012). Must be called from
+ * outside the pool. graph->visited is not used.
+ */
+int64_t graph_bfs_sum(os_graph_t *graph, os_threadpool_t *tp, unsigned int source);
+
+#endif
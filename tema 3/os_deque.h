@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Chase-Lev work-stealing deque, with the memory orderings from:
+ * N. M. Le et al., "Correct and Efficient Work-Stealing for Weak Memory
+ * Models", PPoPP 2013.
+ *
+ * Only the owner pushes and pops, at the bottom, in LIFO order. Any other
+ * thread may steal from the top, in FIFO order.
+ */
+
+#ifndef __OS_DEQUE_H__
+#define __OS_DEQUE_H__	1
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+
+#define OS_DEQUE_INITIAL_SIZE	256
+
+typedef struct os_deque_array_t {
+	size_t mask;
+	/* Arrays replaced by a bigger one, a thief may still be reading them. */
+	struct os_deque_array_t *prev;
+	_Atomic(void *) items[];
+} os_deque_array_t;
+
+typedef struct os_deque_t {
+	/* top and bottom are written by different threads, keep them apart. */
+	_Alignas(64) atomic_long top;
+	_Alignas(64) atomic_long bottom;
+	_Atomic(os_deque_array_t *) array;
+} os_deque_t;
+
+static inline os_deque_array_t *deque_array_create(size_t size, os_deque_array_t *prev)
+{
+	os_deque_array_t *a = malloc(sizeof(*a) + size * sizeof(a->items[0]));
+
+	DIE(a == NULL, "malloc");
+
+	a->mask = size - 1;
+	a->prev = prev;
+
+	return a;
+}
+
+static inline void deque_init(os_deque_t *d)
+{
+	atomic_init(&d->top, 0);
+	atomic_init(&d->bottom, 0);
+	atomic_init(&d->array, deque_array_create(OS_DEQUE_INITIAL_SIZE, NULL));
+}
+
+static inline void deque_destroy(os_deque_t *d)
+{
+	os_deque_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+	while (a != NULL) {
+		os_deque_array_t *prev = a->prev;
+
+		free(a);
+		a = prev;
+	}
+}
+
+/* Number of items, only exact when no other thread touches the deque. */
+static inline long deque_size(os_deque_t *d)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	return b > t ? b - t : 0;
+}
+
+/* Owner only: double the array, copying the live items [t, b). */
+static inline os_deque_array_t *deque_grow(os_deque_t *d, os_deque_array_t *a, long t, long b)
+{
+	os_deque_array_t *n = deque_array_create(2 * (a->mask + 1), a);
+
+	for (long i = t; i < b; i++)
+		atomic_store_explicit(&n->items[i & n->mask],
+				      atomic_load_explicit(&a->items[i & a->mask], memory_order_relaxed),
+				      memory_order_relaxed);
+
+	atomic_store_explicit(&d->array, n, memory_order_release);
+
+	return n;
+}
+
+/* Owner only: push an item at the bottom. */
+static inline void deque_push(os_deque_t *d, void *item)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	os_deque_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+	if (b - t > (long)a->mask)
+		a = deque_grow(d, a, t, b);
+
+	atomic_store_explicit(&a->items[b & a->mask], item, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+/* Owner only: push n items at the bottom, made visible to thieves at once. */
+static inline void deque_push_many(os_deque_t *d, void **items, size_t n)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	os_deque_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+	while (b - t + (long)n > (long)a->mask + 1)
+		a = deque_grow(d, a, t, b);
+
+	for (size_t i = 0; i < n; i++)
+		atomic_store_explicit(&a->items[(b + i) & a->mask], items[i], memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&d->bottom, b + n, memory_order_relaxed);
+}
+
+/* Owner only: pop the most recently pushed item, NULL if empty. */
+static inline void *deque_pop(os_deque_t *d)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	os_deque_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+	void *item = NULL;
+	long t;
+
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	if (t <= b) {
+		item = atomic_load_explicit(&a->items[b & a->mask], memory_order_relaxed);
+
+		if (t == b) {
+			/* Last item, race the thieves for it. */
+			if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+								     memory_order_seq_cst,
+								     memory_order_relaxed))
+				item = NULL;
+			atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return item;
+}
+
+/* Any thread: take the oldest item, NULL if empty or lost to another thief. */
+static inline void *deque_steal(os_deque_t *d)
+{
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+	if (t >= b)
+		return NULL;
+
+	os_deque_array_t *a = atomic_load_explicit(&d->array, memory_order_acquire);
+	void *item = atomic_load_explicit(&a->items[t & a->mask], memory_order_relaxed);
+
+	if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+						     memory_order_seq_cst, memory_order_relaxed))
+		return NULL;
+
+	return item;
+}
+
+#endif
@@ -2,6 +2,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "os_graph.h"
 #include "log/log.h"
@@ -24,45 +31,95 @@ os_node_t *os_create_node(unsigned int id, int info)
 }
 
 /* Graph functions */
-os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
-		int *values, os_edge_t *edges)
+
+/*
+ * Builds the compatibility view: the pointers and then the nodes they point
+ * to, in one block, with the neighbours pointing in the CSR arrays.
+ */
+static void create_node_view(os_graph_t *graph)
+{
+	os_node_t *nodes;
+
+	graph->nodes = malloc(graph->num_nodes * (sizeof(*graph->nodes) + sizeof(*nodes)));
+	DIE(graph->num_nodes != 0 && graph->nodes == NULL, "malloc");
+	nodes = (os_node_t *)(graph->nodes + graph->num_nodes);
+
+	for (unsigned int i = 0; i < graph->num_nodes; i++) {
+		nodes[i].id = i;
+		nodes[i].info = graph->info[i];
+		nodes[i].num_neighbours = graph_degree(graph, i);
+		nodes[i].neighbours = graph->edges + graph->offsets[i];
+		graph->nodes[i] = &nodes[i];
+	}
+}
+
+/* Builds the CSR arrays from an edge list, info is taken over. */
+static os_graph_t *create_graph_csr(unsigned int num_nodes, unsigned int num_edges,
+		int *info, const os_edge_t *edges)
 {
 	os_graph_t *graph;
+	size_t *next;
+
+	for (unsigned int i = 0; i < num_edges; i++) {
+		if (edges[i].src >= num_nodes || edges[i].dst >= num_nodes) {
+			log_error("Edge %u (%u, %u) is out of range", i, edges[i].src, edges[i].dst);
+			free(info);
+			return NULL;
+		}
+	}
 
 	graph = malloc(sizeof(*graph));
 	DIE(graph == NULL, "malloc");
 
 	graph->num_nodes = num_nodes;
 	graph->num_edges = num_edges;
+	graph->info = info;
+	graph->mapping = NULL;
+	graph->mapping_size = 0;
 
-	graph->nodes = malloc(num_nodes * sizeof(os_node_t *));
-	DIE(graph->nodes == NULL, "malloc");
-
-	for (unsigned int i = 0; i < graph->num_nodes; i++) {
-		graph->nodes[i] = os_create_node(i, values[i]);
-		graph->nodes[i]->neighbours = malloc(graph->num_nodes * sizeof(unsigned int));
-		DIE(graph->nodes[i]->neighbours == NULL, "malloc");
-		graph->nodes[i]->num_neighbours = 0;
+	/* Count the degrees, shifted by one so the prefix sum gives the offsets. */
+	graph->offsets = calloc(num_nodes + 1, sizeof(*graph->offsets));
+	DIE(graph->offsets == NULL, "calloc");
+	for (unsigned int i = 0; i < num_edges; i++) {
+		graph->offsets[edges[i].src + 1]++;
+		graph->offsets[edges[i].dst + 1]++;
 	}
+	for (unsigned int i = 0; i < num_nodes; i++)
+		graph->offsets[i + 1] += graph->offsets[i];
 
-	for (unsigned int i = 0; i < graph->num_edges; i++) {
-		unsigned int isrc, idst;
-
-		isrc = edges[i].src;
-		idst = edges[i].dst;
-		graph->nodes[isrc]->neighbours[graph->nodes[isrc]->num_neighbours++] = idst;
-		graph->nodes[idst]->neighbours[graph->nodes[idst]->num_neighbours++] = isrc;
+	/* Fill in the rows, in the order the edges were given. */
+	graph->edges = malloc(2 * (size_t)num_edges * sizeof(*graph->edges));
+	DIE(num_edges != 0 && graph->edges == NULL, "malloc");
+	next = malloc(num_nodes * sizeof(*next));
+	DIE(num_nodes != 0 && next == NULL, "malloc");
+	for (unsigned int i = 0; i < num_nodes; i++)
+		next[i] = graph->offsets[i];
+	for (unsigned int i = 0; i < num_edges; i++) {
+		graph->edges[next[edges[i].src]++] = edges[i].dst;
+		graph->edges[next[edges[i].dst]++] = edges[i].src;
 	}
+	free(next);
 
-	graph->visited = malloc(graph->num_nodes * sizeof(*graph->visited));
-	DIE(graph->visited == NULL, "malloc");
+	create_node_view(graph);
 
-	for (unsigned int i = 0; i < graph->num_nodes; i++)
-		graph->visited[i] = NOT_VISITED;
+	graph->visited = calloc(num_nodes, sizeof(*graph->visited));
+	DIE(num_nodes != 0 && graph->visited == NULL, "calloc");
 
 	return graph;
 }
 
+os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
+		int *values, os_edge_t *edges)
+{
+	int *info;
+
+	info = malloc(num_nodes * sizeof(*info));
+	DIE(num_nodes != 0 && info == NULL, "malloc");
+	memcpy(info, values, num_nodes * sizeof(*info));
+
+	return create_graph_csr(num_nodes, num_edges, info, edges);
+}
+
 os_graph_t *create_graph_from_file(FILE *file)
 {
 	unsigned int num_nodes, num_edges;
@@ -104,12 +161,470 @@ out:
 	return graph;
 }
 
+/*
+ * Text loader. The file is mapped and split in chunks at whitespace, one per
+ * thread. Every thread first counts the numbers in its chunk, the prefix sum
+ * of the counts tells it where its numbers go, then it parses them straight
+ * into the node values and the edge list.
+ */
+#define LOAD_MIN_CHUNK		(1 << 20)
+#define LOAD_MAX_THREADS	64
+
+typedef struct load_chunk {
+	const char *begin, *end;
+	size_t first;			/* Index of the first number of the chunk. */
+	size_t count;
+	bool error;
+	struct load_job *job;
+} load_chunk_t;
+
+typedef struct load_job {
+	unsigned int num_nodes;
+	size_t num_numbers;		/* num_nodes + 2 * num_edges */
+	int *info;
+	unsigned int *edges;		/* src, dst pairs, laid out as os_edge_t */
+	pthread_barrier_t counted;
+	load_chunk_t chunks[LOAD_MAX_THREADS];
+	unsigned int num_chunks;
+} load_job_t;
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/* Parses a number at p, returns its end or NULL if it is not one. */
+static inline const char *parse_number(const char *p, const char *end, long *value)
+{
+	bool negative = *p == '-';
+	unsigned long v = 0;
+	const char *digits;
+
+	p += negative;
+	digits = p;
+	for (unsigned int d; p < end && (d = (unsigned char)*p - '0') < 10; p++)
+		v = 10 * v + d;
+
+	if (p == digits || (p < end && !is_space(*p)))
+		return NULL;
+
+	*value = negative ? -(long)v : (long)v;
+
+	return p;
+}
+
+/* Counts the starts of the words, in a loop the compiler can vectorize. */
+static size_t count_numbers(const char *p, const char *end)
+{
+	size_t n = end - p;
+	size_t count;
+
+	if (n == 0)
+		return 0;
+
+	count = !is_space(p[0]);
+	for (size_t i = 1; i < n; i++)
+		count += is_space(p[i - 1]) & !is_space(p[i]);
+
+	return count;
+}
+
+static void parse_chunk(load_chunk_t *chunk)
+{
+	load_job_t *job = chunk->job;
+	const char *p = chunk->begin;
+	size_t index = chunk->first;
+	size_t last = chunk->first + chunk->count;
+
+	if (last > job->num_numbers)
+		last = job->num_numbers;
+
+	while (index < last) {
+		long value;
+
+		while (is_space(*p))
+			p++;
+
+		p = parse_number(p, chunk->end, &value);
+		if (p == NULL) {
+			chunk->error = true;
+			return;
+		}
+
+		if (index < job->num_nodes)
+			job->info[index] = (int)value;
+		else
+			job->edges[index - job->num_nodes] = (unsigned int)value;
+		index++;
+	}
+}
+
+static void *load_thread(void *arg)
+{
+	load_chunk_t *chunk = arg;
+	load_job_t *job = chunk->job;
+
+	chunk->count = count_numbers(chunk->begin, chunk->end);
+
+	/*
+	 * Once every chunk is counted, one of the threads, whichever the
+	 * barrier picks, computes where every chunk starts; the second wait
+	 * holds the others back until it is done.
+	 */
+	if (pthread_barrier_wait(&job->counted) == PTHREAD_BARRIER_SERIAL_THREAD) {
+		size_t first = 0;
+
+		for (unsigned int i = 0; i < job->num_chunks; i++) {
+			job->chunks[i].first = first;
+			first += job->chunks[i].count;
+		}
+	}
+	pthread_barrier_wait(&job->counted);
+
+	parse_chunk(chunk);
+
+	return NULL;
+}
+
+static unsigned int load_threads(size_t size, unsigned int num_threads)
+{
+	if (num_threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		num_threads = cpus > 0 ? cpus : 1;
+	}
+	if (num_threads > LOAD_MAX_THREADS)
+		num_threads = LOAD_MAX_THREADS;
+	if (num_threads > size / LOAD_MIN_CHUNK + 1)
+		num_threads = size / LOAD_MIN_CHUNK + 1;
+
+	return num_threads;
+}
+
+static os_graph_t *parse_graph(const char *data, size_t size, unsigned int num_threads)
+{
+	const char *p = data, *end = data + size;
+	long header[2];
+	load_job_t *job;
+	pthread_t threads[LOAD_MAX_THREADS];
+	os_graph_t *graph = NULL;
+	bool error = false;
+	size_t total = 0;
+
+	for (int i = 0; i < 2; i++) {
+		while (p < end && is_space(*p))
+			p++;
+		if (p == end || (p = parse_number(p, end, &header[i])) == NULL ||
+		    header[i] < 0 || header[i] > (long)(unsigned int)-1) {
+			log_error("Can't read from file");
+			return NULL;
+		}
+	}
+
+	job = calloc(1, sizeof(*job));
+	DIE(job == NULL, "calloc");
+
+	job->num_nodes = header[0];
+	job->num_numbers = header[0] + 2 * (size_t)header[1];
+	job->info = malloc(job->num_nodes * sizeof(*job->info));
+	DIE(job->num_nodes != 0 && job->info == NULL, "malloc");
+	job->edges = malloc(2 * (size_t)header[1] * sizeof(*job->edges));
+	DIE(header[1] != 0 && job->edges == NULL, "malloc");
+
+	/* Chunks end at whitespace, so no number is split between two of them. */
+	job->num_chunks = load_threads(end - p, num_threads);
+	for (unsigned int i = 0; i < job->num_chunks; i++) {
+		const char *b = i == 0 ? p : job->chunks[i - 1].end;
+		const char *e = i == job->num_chunks - 1 ? end : p + (end - p) / job->num_chunks * (i + 1);
+
+		if (e < b)
+			e = b;
+		while (e < end && !is_space(*e))
+			e++;
+
+		job->chunks[i].begin = b;
+		job->chunks[i].end = e;
+		job->chunks[i].job = job;
+	}
+
+	DIE(pthread_barrier_init(&job->counted, NULL, job->num_chunks) != 0, "pthread_barrier_init");
+	for (unsigned int i = 1; i < job->num_chunks; i++)
+		DIE(pthread_create(&threads[i], NULL, load_thread, &job->chunks[i]) != 0,
+		    "pthread_create");
+	load_thread(&job->chunks[0]);
+	for (unsigned int i = 1; i < job->num_chunks; i++)
+		pthread_join(threads[i], NULL);
+	DIE(pthread_barrier_destroy(&job->counted) != 0, "pthread_barrier_destroy");
+
+	for (unsigned int i = 0; i < job->num_chunks; i++) {
+		error |= job->chunks[i].error;
+		total += job->chunks[i].count;
+	}
+
+	if (error || total < job->num_numbers) {
+		log_error("Can't read from file");
+		free(job->info);
+	} else {
+		graph = create_graph_csr(job->num_nodes, header[1], job->info,
+					 (const os_edge_t *)job->edges);
+	}
+
+	free(job->edges);
+	free(job);
+
+	return graph;
+}
+
+/*
+ * Binary format, written by save_graph(). The arrays are used from the
+ * mapping as they are, once the header was checked against the size of the
+ * file and the offsets and edges against the number of nodes.
+ */
+static bool check_graph_header(const os_graph_file_header_t *h, size_t size)
+{
+	uint64_t info_size, offsets_size, edges_size;
+
+	if (size < sizeof(*h) || memcmp(h->magic, OS_GRAPH_MAGIC, sizeof(h->magic)) != 0)
+		return false;
+	if (h->version != OS_GRAPH_VERSION || h->header_size != sizeof(*h) ||
+	    h->num_nodes > (unsigned int)-1 || h->num_edges > (unsigned int)-1)
+		return false;
+
+	info_size = h->num_nodes * sizeof(int);
+	offsets_size = (h->num_nodes + 1) * sizeof(size_t);
+	edges_size = 2 * h->num_edges * sizeof(unsigned int);
+
+	/* Every array is aligned and inside the file, in this order; the
+	 * sizes fit in 64 bits, the offsets are compared by difference, so
+	 * that none of it can wrap around.
+	 */
+	if (h->info_offset % OS_GRAPH_ALIGN || h->offsets_offset % OS_GRAPH_ALIGN ||
+	    h->edges_offset % OS_GRAPH_ALIGN)
+		return false;
+	if (h->info_offset < sizeof(*h) || h->offsets_offset < h->info_offset ||
+	    h->offsets_offset - h->info_offset < info_size ||
+	    h->edges_offset < h->offsets_offset ||
+	    h->edges_offset - h->offsets_offset < offsets_size ||
+	    h->edges_offset > size || size - h->edges_offset < edges_size)
+		return false;
+
+	return true;
+}
+
+/*
+ * The traversals index edges with the offsets and nodes with the edges, with
+ * no check of their own: the offsets never go down and end at the number of
+ * edges, and every edge is a node.
+ */
+static bool check_graph_arrays(const os_graph_t *graph)
+{
+	const size_t *offsets = graph->offsets;
+	size_t num_edges = 2 * (size_t)graph->num_edges;
+
+	if (offsets[0] != 0 || offsets[graph->num_nodes] != num_edges)
+		return false;
+
+	for (unsigned int i = 0; i < graph->num_nodes; i++)
+		if (offsets[i + 1] < offsets[i])
+			return false;
+
+	for (size_t i = 0; i < num_edges; i++)
+		if (graph->edges[i] >= graph->num_nodes)
+			return false;
+
+	return true;
+}
+
+static os_graph_t *graph_from_mapping(void *data, size_t size)
+{
+	const os_graph_file_header_t *h = data;
+	os_graph_t *graph;
+
+	if (!check_graph_header(h, size)) {
+		log_error("Not a graph file of version %d", OS_GRAPH_VERSION);
+		return NULL;
+	}
+
+	graph = malloc(sizeof(*graph));
+	DIE(graph == NULL, "malloc");
+
+	graph->num_nodes = h->num_nodes;
+	graph->num_edges = h->num_edges;
+	graph->info = (int *)((char *)data + h->info_offset);
+	graph->offsets = (size_t *)((char *)data + h->offsets_offset);
+	graph->edges = (unsigned int *)((char *)data + h->edges_offset);
+
+	if (!check_graph_arrays(graph)) {
+		log_error("Graph file has broken offsets or edges");
+		free(graph);
+		return NULL;
+	}
+
+	graph->nodes = NULL;
+	graph->mapping = data;
+	graph->mapping_size = size;
+
+	graph->visited = calloc(graph->num_nodes, sizeof(*graph->visited));
+	DIE(graph->num_nodes != 0 && graph->visited == NULL, "calloc");
+
+	return graph;
+}
+
+/* Maps a whole file read-only, NULL if it can't be opened or is empty. */
+static void *map_path(const char *path, size_t *size)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		log_error("Can't open %s", path);
+		return NULL;
+	}
+
+	DIE(fstat(fd, &st) < 0, "fstat");
+	if (st.st_size == 0) {
+		log_error("Can't read from file");
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	DIE(data == MAP_FAILED, "mmap");
+	close(fd);
+
+	*size = st.st_size;
+
+	return data;
+}
+
+static bool is_graph_file(const void *data, size_t size)
+{
+	return size >= sizeof(OS_GRAPH_MAGIC) && memcmp(data, OS_GRAPH_MAGIC, sizeof(OS_GRAPH_MAGIC)) == 0;
+}
+
+os_graph_t *create_graph_from_mmap(const char *path)
+{
+	os_graph_t *graph;
+	size_t size;
+	void *data;
+
+	data = map_path(path, &size);
+	if (data == NULL)
+		return NULL;
+
+	graph = graph_from_mapping(data, size);
+	if (graph == NULL)
+		munmap(data, size);
+
+	return graph;
+}
+
+os_graph_t *create_graph_from_path(const char *path, unsigned int num_threads)
+{
+	os_graph_t *graph;
+	size_t size;
+	void *data;
+
+	data = map_path(path, &size);
+	if (data == NULL)
+		return NULL;
+
+	if (is_graph_file(data, size)) {
+		graph = graph_from_mapping(data, size);
+		if (graph == NULL)
+			munmap(data, size);
+		return graph;
+	}
+
+	madvise(data, size, MADV_SEQUENTIAL);
+	graph = parse_graph(data, size, num_threads);
+	munmap(data, size);
+
+	return graph;
+}
+
+static int write_padded(FILE *file, const void *data, size_t size, uint64_t *offset)
+{
+	static const char zeros[OS_GRAPH_ALIGN];
+	size_t pad = (OS_GRAPH_ALIGN - *offset % OS_GRAPH_ALIGN) % OS_GRAPH_ALIGN;
+
+	if (fwrite(zeros, 1, pad, file) != pad || fwrite(data, 1, size, file) != size)
+		return -1;
+	*offset += pad + size;
+
+	return 0;
+}
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + OS_GRAPH_ALIGN - 1) / OS_GRAPH_ALIGN * OS_GRAPH_ALIGN;
+}
+
+int save_graph(const os_graph_t *graph, const char *path)
+{
+	os_graph_file_header_t h = { 0 };
+	uint64_t offset = 0;
+	FILE *file;
+	int rc;
+
+	memcpy(h.magic, OS_GRAPH_MAGIC, sizeof(h.magic));
+	h.version = OS_GRAPH_VERSION;
+	h.header_size = sizeof(h);
+	h.num_nodes = graph->num_nodes;
+	h.num_edges = graph->num_edges;
+	h.info_offset = align_offset(sizeof(h));
+	h.offsets_offset = align_offset(h.info_offset + h.num_nodes * sizeof(*graph->info));
+	h.edges_offset = align_offset(h.offsets_offset + (h.num_nodes + 1) * sizeof(*graph->offsets));
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		log_error("Can't open %s", path);
+		return -1;
+	}
+
+	rc = write_padded(file, &h, sizeof(h), &offset);
+	if (rc == 0)
+		rc = write_padded(file, graph->info, h.num_nodes * sizeof(*graph->info), &offset);
+	if (rc == 0)
+		rc = write_padded(file, graph->offsets, (h.num_nodes + 1) * sizeof(*graph->offsets), &offset);
+	if (rc == 0)
+		rc = write_padded(file, graph->edges, 2 * h.num_edges * sizeof(*graph->edges), &offset);
+
+	if (fclose(file) != 0)
+		rc = -1;
+	if (rc < 0)
+		log_error("Can't write to %s", path);
+
+	return rc;
+}
+
+void destroy_graph(os_graph_t *graph)
+{
+	if (graph == NULL)
+		return;
+
+	free(graph->visited);
+	if (graph->mapping != NULL) {
+		munmap(graph->mapping, graph->mapping_size);
+	} else {
+		free(graph->nodes);
+		free(graph->edges);
+		free(graph->offsets);
+		free(graph->info);
+	}
+	free(graph);
+}
+
 void print_graph(os_graph_t *graph)
 {
 	for (unsigned int i = 0; i < graph->num_nodes; i++) {
+		const unsigned int *neighbours = graph_neighbours(graph, i);
+
 		printf("[%d]: ", i);
-		for (unsigned int j = 0; j < graph->nodes[i]->num_neighbours; j++)
-			printf("%d ", graph->nodes[i]->neighbours[j]);
+		for (unsigned int j = 0; j < graph_degree(graph, i); j++)
+			printf("%d ", neighbours[j]);
 		printf("\n");
 	}
 }
@@ -4,6 +4,9 @@
 #define __OS_GRAPH_H__	1
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 typedef struct os_node_t {
 	unsigned int id;
@@ -13,26 +16,92 @@ typedef struct os_node_t {
 	unsigned int *neighbours;
 } os_node_t;
 
+/*
+ * The graph is kept in CSR (compressed sparse row) form: the neighbours of
+ * node i are edges[offsets[i]] up to edges[offsets[i + 1]], and its value is
+ * info[i]. Every undirected edge is stored once in each direction.
+ */
 typedef struct os_graph_t {
 	unsigned int num_nodes;
 	unsigned int num_edges;
 
+	size_t *offsets;		/* num_nodes + 1 entries */
+	unsigned int *edges;		/* 2 * num_edges entries */
+	int *info;			/* num_nodes entries */
+
+	/*
+	 * Pointer per node view, for compatibility, its neighbours point in
+	 * edges. NULL for graphs loaded from a binary file.
+	 */
 	os_node_t **nodes;
 	enum {
 		NOT_VISITED = 0,
 		PROCESSING = 1,
 		DONE = 2
 	} *visited;
+
+	/* Binary file the arrays point in, NULL if they were allocated. */
+	void *mapping;
+	size_t mapping_size;
 } os_graph_t;
 
 typedef struct os_edge_t {
 	unsigned int src, dst;
 } os_edge_t;
 
+/*
+ * Binary graph file, in native byte order: this header, then info, offsets
+ * and edges as they are in os_graph_t, each at an offset that is a multiple
+ * of OS_GRAPH_ALIGN.
+ */
+#define OS_GRAPH_MAGIC		"OSGRAPH"
+#define OS_GRAPH_VERSION	1
+#define OS_GRAPH_ALIGN		64
+
+typedef struct os_graph_file_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t num_nodes;
+	uint64_t num_edges;
+	uint64_t info_offset;
+	uint64_t offsets_offset;
+	uint64_t edges_offset;
+} os_graph_file_header_t;
+
+static inline unsigned int graph_degree(const os_graph_t *graph, unsigned int idx)
+{
+	return graph->offsets[idx + 1] - graph->offsets[idx];
+}
+
+static inline const unsigned int *graph_neighbours(const os_graph_t *graph, unsigned int idx)
+{
+	return graph->edges + graph->offsets[idx];
+}
+
+/*
+ * With GRAPH_TIMES set, serial and parallel print to stderr how long loading
+ * and traversing the graph took.
+ */
+#define GRAPH_TIMES_ENV		"GRAPH_TIMES"
+
+static inline double graph_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
 os_node_t *os_create_node(unsigned int id, int info);
 os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
 		int *values, os_edge_t *edges);
 os_graph_t *create_graph_from_file(FILE *file);
+os_graph_t *create_graph_from_path(const char *path, unsigned int num_threads);
+os_graph_t *create_graph_from_mmap(const char *path);
+int save_graph(const os_graph_t *graph, const char *path);
+void destroy_graph(os_graph_t *graph);
 void print_graph(os_graph_t *graph);
 
 #endif
@@ -1,26 +1,107 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdatomic.h>
+#include <sched.h>
 
 #include "os_threadpool.h"
 #include "log/log.h"
 #include "utils.h"
 
-/* Create a task that would be executed by a thread. */
-os_task_t *create_task(void (*action)(void *), void *arg, void (*destroy_arg)(void *))
+/*
+ * An idle worker polls the queues this many times, pausing twice as long
+ * after each round, before it parks on task_waiting.
+ */
+#define SPIN_ROUNDS		10
+
+/* Nodes looked up in sysfs for a NUMA aware pool. */
+#define MAX_NUMA_NODES		64
+
+/* Most destroyed tasks a worker keeps for reuse. */
+#define TASK_CACHE_SIZE		1024
+
+static inline void cpu_relax(void)
 {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+/* Worker running on the current thread, NULL outside of any pool. */
+static __thread os_worker_t *current_worker;
+
+/*
+ * Tasks are recycled through the free list of the worker that destroys them,
+ * other threads use malloc and free.
+ */
+static os_task_t *alloc_task(void)
+{
+	os_worker_t *w = current_worker;
 	os_task_t *t;
 
+	if (w != NULL && w->free_tasks != NULL) {
+		t = list_entry(w->free_tasks, os_task_t, list);
+		w->free_tasks = w->free_tasks->next;
+		w->num_free_tasks--;
+		return t;
+	}
+
 	t = malloc(sizeof(*t));
 	DIE(t == NULL, "malloc");
 
+	return t;
+}
+
+static void free_task(os_task_t *t)
+{
+	os_worker_t *w = current_worker;
+
+	if (w == NULL || w->num_free_tasks >= TASK_CACHE_SIZE) {
+		free(t);
+		return;
+	}
+
+	t->list.next = w->free_tasks;
+	w->free_tasks = &t->list;
+	w->num_free_tasks++;
+}
+
+/* Create a task that would be executed by a thread. */
+os_task_t *create_task(void (*action)(void *), void *arg, void (*destroy_arg)(void *))
+{
+	os_task_t *t = alloc_task();
+
 	t->action = action;		// the function
 	t->argument = arg;		// arguments for the function
 	t->destroy_arg = destroy_arg;	// destroy argument function
+	t->group = NULL;
+	t->priority = TP_PRIORITY_NORMAL;
+
+	return t;
+}
+
+/* Create a task whose argument is a copy of size bytes stored in the task. */
+os_task_t *create_task_inline(void (*action)(void *), const void *arg, size_t size)
+{
+	os_task_t *t;
+
+	assert(size <= OS_TASK_INLINE_SIZE);
+
+	t = alloc_task();
+	memcpy(t->inline_arg, arg, size);
+	t->action = action;
+	t->argument = t->inline_arg;
+	t->destroy_arg = NULL;
+	t->group = NULL;
+	t->priority = TP_PRIORITY_NORMAL;
 
 	return t;
 }
@@ -30,64 +111,376 @@ void destroy_task(os_task_t *t)
 {
 	if (t->destroy_arg != NULL)
 		t->destroy_arg(t->argument);
-	free(t);
+	free_task(t);
 }
 
-/* Put a new task to threadpool task queue. */
+static os_worker_t *worker_of(os_threadpool_t *tp)
+{
+	return current_worker != NULL && current_worker->tp == tp ? current_worker : NULL;
+}
+
+/* Index of the calling worker in tp, -1 if the caller is not one of them. */
+int tp_worker_id(os_threadpool_t *tp)
+{
+	os_worker_t *w = worker_of(tp);
+
+	return w != NULL ? (int)w->id : -1;
+}
+
+/*
+ * Wake up to n parked workers, after new tasks were queued. The fence pairs
+ * with the one in dequeue_task(): either the worker sees the tasks before it
+ * parks or this sees it counted in num_sleeping.
+ */
+static void wake_workers(os_threadpool_t *tp, unsigned int n)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&tp->num_sleeping, memory_order_relaxed) == 0)
+		return;
+
+	pthread_mutex_lock(&tp->queue_mutex);
+	for (unsigned int i = 0; i < n && i < tp->num_sleeping; i++)
+		pthread_cond_signal(&tp->task_waiting);
+	pthread_mutex_unlock(&tp->queue_mutex);
+}
+
+/* Injection queue for a task submitted from outside: the caller's node. */
+static unsigned int submitter_node(os_threadpool_t *tp)
+{
+	int cpu;
+
+	if (tp->num_nodes == 1)
+		return 0;
+
+	cpu = sched_getcpu();
+
+	return cpu >= 0 && cpu < CPU_SETSIZE ? tp->cpu_node[cpu] : 0;
+}
+
+static os_list_node_t *lane_head(os_threadpool_t *tp, unsigned int node, unsigned int priority)
+{
+	return &tp->heads[node * TP_NUM_PRIORITIES + priority];
+}
+
+/* Add a task to its lane, with queue_mutex held. */
+static void inject_task(os_threadpool_t *tp, unsigned int node, os_task_t *t)
+{
+	assert(t->priority < TP_NUM_PRIORITIES);
+
+	list_add(lane_head(tp, node, t->priority), &t->list);
+	atomic_fetch_add_explicit(&tp->lane_tasks[t->priority], 1, memory_order_relaxed);
+}
+
+/*
+ * Put a new task to threadpool task queue. Workers push to their own deque,
+ * other threads to the injection queue.
+ */
 void enqueue_task(os_threadpool_t *tp, os_task_t *t)
 {
+	os_worker_t *w;
+
 	assert(tp != NULL);
 	assert(t != NULL);
 
-	pthread_mutex_lock(&tp->queue_mutex);
-	list_add(&tp->head, &t->list);
-	pthread_mutex_unlock(&tp->queue_mutex);
-	pthread_cond_broadcast(&tp->task_waiting);
+	atomic_fetch_add_explicit(&tp->pending, 1, memory_order_relaxed);
+	if (tp->stats != NULL)
+		t->enqueue_ns = tp_now_ns();
+
+	w = worker_of(tp);
+	if (w != NULL && t->priority == TP_PRIORITY_NORMAL) {
+		deque_push(&w->deque, t);
+	} else {
+		unsigned int node = w != NULL ? w->node : submitter_node(tp);
+
+		pthread_mutex_lock(&tp->queue_mutex);
+		inject_task(tp, node, t);
+		pthread_mutex_unlock(&tp->queue_mutex);
+	}
+
+	wake_workers(tp, 1);
 }
 
 /*
- * Check if queue is empty.
+ * Put a batch of tasks to threadpool task queue, with a single deque update
+ * or a single lock of the injection queue.
+ */
+void enqueue_tasks(os_threadpool_t *tp, os_task_t **tasks, unsigned int n)
+{
+	os_worker_t *w;
+	unsigned int i;
+
+	assert(tp != NULL);
+	assert(n == 0 || tasks != NULL);
+
+	if (n == 0)
+		return;
+
+	atomic_fetch_add_explicit(&tp->pending, n, memory_order_relaxed);
+	if (tp->stats != NULL) {
+		uint64_t now = tp_now_ns();
+
+		for (i = 0; i < n; i++)
+			tasks[i]->enqueue_ns = now;
+	}
+
+	/* Only a batch of normal priority tasks can go to the worker's deque. */
+	w = worker_of(tp);
+	for (i = 0; i < n; i++)
+		if (tasks[i]->priority != TP_PRIORITY_NORMAL)
+			break;
+
+	if (w != NULL && i == n) {
+		deque_push_many(&w->deque, (void **)tasks, n);
+	} else {
+		unsigned int node = w != NULL ? w->node : submitter_node(tp);
+
+		pthread_mutex_lock(&tp->queue_mutex);
+		for (i = 0; i < n; i++)
+			inject_task(tp, node, tasks[i]);
+		pthread_mutex_unlock(&tp->queue_mutex);
+	}
+
+	wake_workers(tp, n);
+}
+
+/*
+ * Check if the injection queues are empty.
  * This function should be called in a synchronized manner.
  */
 static int queue_is_empty(os_threadpool_t *tp)
 {
-	return list_empty(&tp->head);
+	for (unsigned int i = 0; i < tp->num_nodes * TP_NUM_PRIORITIES; i++)
+		if (!list_empty(&tp->heads[i]))
+			return 0;
+
+	return 1;
+}
+
+/* Check if any task is queued anywhere in the pool. */
+static int pool_is_empty(os_threadpool_t *tp)
+{
+	if (!queue_is_empty(tp))
+		return 0;
+
+	for (unsigned int i = 0; i < tp->num_threads; i++)
+		if (deque_size(&tp->workers[i].deque) > 0)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Take the oldest injected task of a lane, from the queue of the given node
+ * first. NULL if the lane is empty, which is checked without the lock.
+ */
+static os_task_t *take_injected(os_threadpool_t *tp, unsigned int node, unsigned int priority)
+{
+	os_task_t *t = NULL;
+
+	if (atomic_load_explicit(&tp->lane_tasks[priority], memory_order_relaxed) == 0)
+		return NULL;
+
+	pthread_mutex_lock(&tp->queue_mutex);
+	for (unsigned int i = 0; i < tp->num_nodes; i++) {
+		os_list_node_t *head = lane_head(tp, (node + i) % tp->num_nodes, priority);
+
+		if (!list_empty(head)) {
+			t = list_entry(head->prev, os_task_t, list);
+			list_del(head->prev);
+			atomic_fetch_sub_explicit(&tp->lane_tasks[priority], 1, memory_order_relaxed);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tp->queue_mutex);
+
+	return t;
+}
+
+/*
+ * Steal from the other workers, starting with a random victim. Workers of
+ * the same NUMA node are tried before the remote ones.
+ */
+static os_task_t *steal_task(os_threadpool_t *tp, os_worker_t *self)
+{
+	unsigned int n = tp->num_threads;
+	unsigned int first;
+
+	if (self != NULL) {
+		/* xorshift32 */
+		self->seed ^= self->seed << 13;
+		self->seed ^= self->seed >> 17;
+		self->seed ^= self->seed << 5;
+		first = self->seed % n;
+	} else {
+		first = 0;
+	}
+
+	for (int remote = 0; remote < (tp->num_nodes > 1 && self != NULL ? 2 : 1); remote++) {
+		for (unsigned int i = 0; i < n; i++) {
+			os_worker_t *victim = &tp->workers[(first + i) % n];
+			os_task_t *t;
+
+			if (victim == self)
+				continue;
+			if (tp->num_nodes > 1 && self != NULL && (victim->node != self->node) != remote)
+				continue;
+			if (deque_size(&victim->deque) == 0)
+				continue;
+
+			t = deque_steal(&victim->deque);
+			if (self != NULL && self->stats != NULL) {
+				self->stats->steal_attempts++;
+				self->stats->steals += t != NULL;
+			}
+			if (t != NULL)
+				return t;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a task without blocking: high priority tasks first, then the worker's
+ * own deque, then the normal injection queue, then the other workers'
+ * deques, and low priority tasks last. Every TP_STARVATION_PERIOD tasks, a
+ * worker looks at the lanes from the lowest one up, so neither low nor
+ * normal priority tasks starve under a flood of more urgent ones.
+ */
+static os_task_t *find_task(os_threadpool_t *tp, os_worker_t *self)
+{
+	unsigned int node = self != NULL ? self->node : submitter_node(tp);
+	os_task_t *t = NULL;
+
+	if (self != NULL && ++self->picks % TP_STARVATION_PERIOD == 0) {
+		t = take_injected(tp, node, TP_PRIORITY_LOW);
+		if (t == NULL)
+			t = deque_pop(&self->deque);
+		if (t == NULL)
+			t = take_injected(tp, node, TP_PRIORITY_NORMAL);
+		if (t != NULL)
+			return t;
+	}
+
+	t = take_injected(tp, node, TP_PRIORITY_HIGH);
+	if (t == NULL && self != NULL)
+		t = deque_pop(&self->deque);
+	if (t == NULL)
+		t = take_injected(tp, node, TP_PRIORITY_NORMAL);
+	if (t == NULL)
+		t = steal_task(tp, self);
+	if (t == NULL)
+		t = take_injected(tp, node, TP_PRIORITY_LOW);
+
+	return t;
 }
 
 /*
  * Get a task from threadpool task queue.
  * Block if no task is available.
- * Return NULL if work is complete, i.e. no task will become available,
- * i.e. all threads are going to block.
+ * Return NULL once the pool is stopped, which wait_for_completion() only
+ * does after every task has finished.
  */
 
 os_task_t *dequeue_task(os_threadpool_t *tp)
 {
-	pthread_mutex_lock(&tp->queue_mutex);
+	os_worker_t *self = worker_of(tp);
+
+	while (1) {
+		os_task_t *t = find_task(tp, self);
+
+		/* Spin a little first, short tasks often arrive in bursts. */
+		for (unsigned int round = 0; t == NULL && round < SPIN_ROUNDS && !tp->stopped; round++) {
+			for (unsigned int i = 0; i < 1u << round; i++)
+				cpu_relax();
+			t = find_task(tp, self);
+		}
+
+		if (t != NULL)
+			return t;
+
+		uint64_t parked = self != NULL && self->stats != NULL ? tp_now_ns() : 0;
+
+		pthread_mutex_lock(&tp->queue_mutex);
+		atomic_fetch_add(&tp->num_sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		// wait for a task to be added to the queue if the queue is empty and the
+		// threadpool has not finished its work
+		while (!tp->stopped && pool_is_empty(tp))
+			pthread_cond_wait(&tp->task_waiting, &tp->queue_mutex);
+
+		atomic_fetch_sub(&tp->num_sleeping, 1);
+
+		if (parked != 0) {
+			self->stats->parks++;
+			self->stats->park_ns += tp_now_ns() - parked;
+		}
 
-	// wait for a task to be added to the queue if the queue is empty and the
-	// threadpool has not finished its work
-	while (!tp->stopped && queue_is_empty(tp))
-		pthread_cond_wait(&tp->task_waiting, &tp->queue_mutex);
+		if (tp->stopped && pool_is_empty(tp)) {
+			pthread_mutex_unlock(&tp->queue_mutex);
+			return NULL;
+		}
 
-	if (queue_is_empty(tp)) {
 		pthread_mutex_unlock(&tp->queue_mutex);
-		return NULL;
 	}
+}
 
-	os_task_t *t = list_entry(tp->head.prev, os_task_t, list);
-
-	list_del(tp->head.prev);
+/* Wake every parked thread, for waiters whose group just finished. */
+static void wake_all(os_threadpool_t *tp)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&tp->num_sleeping, memory_order_relaxed) == 0)
+		return;
 
+	pthread_mutex_lock(&tp->queue_mutex);
+	pthread_cond_broadcast(&tp->task_waiting);
 	pthread_mutex_unlock(&tp->queue_mutex);
+}
 
-	return t;
+/*
+ * Run a dequeued task. The last task of a group wakes up its waiter, the
+ * last task of the pool wakes up tp_wait_idle().
+ */
+static void run_task(os_threadpool_t *tp, os_task_t *t)
+{
+	tp_group_t *g = t->group;
+	os_worker_t *w = worker_of(tp);
+	tp_worker_stats_t *stats = w != NULL ? w->stats : NULL;
+	uint64_t start = 0;
+
+	/* Only workers count, threads helping in tp_group_wait() do not. */
+	if (stats != NULL) {
+		start = tp_now_ns();
+		tp_histogram_record(&stats->wait_ns, start - t->enqueue_ns);
+	}
+
+	t->action(t->argument);
+	destroy_task(t);
+
+	if (stats != NULL) {
+		stats->executed++;
+		tp_histogram_record(&stats->run_ns, tp_now_ns() - start);
+	}
+
+	/* The waiter may return as soon as pending is 0, g is not used after. */
+	if (g != NULL && atomic_fetch_sub(&g->pending, 1) == 1)
+		wake_all(tp);
+
+	if (atomic_fetch_sub_explicit(&tp->pending, 1, memory_order_acq_rel) == 1) {
+		pthread_mutex_lock(&tp->queue_mutex);
+		pthread_cond_broadcast(&tp->idle);
+		pthread_mutex_unlock(&tp->queue_mutex);
+	}
 }
 
 /* Loop function for threads */
 static void *thread_loop_function(void *arg)
 {
-	os_threadpool_t *tp = (os_threadpool_t *)arg;
+	os_worker_t *w = (os_worker_t *)arg;
+	os_threadpool_t *tp = w->tp;
+
+	current_worker = w;
 
 	while (1) {
 		os_task_t *t;
@@ -95,46 +488,355 @@ static void *thread_loop_function(void *arg)
 		t = dequeue_task(tp);
 		if (t == NULL)
 			break;
-		t->action(t->argument);
-		destroy_task(t);
+		run_task(tp, t);
 	}
 
 	return NULL;
 }
 
+void tp_group_init(tp_group_t *g, os_threadpool_t *tp)
+{
+	g->tp = tp;
+	atomic_init(&g->pending, 0);
+}
+
+void tp_group_submit(tp_group_t *g, os_task_t *t)
+{
+	t->group = g;
+	atomic_fetch_add(&g->pending, 1);
+	enqueue_task(g->tp, t);
+}
+
+/*
+ * Wait for the tasks of the group, running queued tasks meanwhile. When
+ * there is nothing to run, park like an idle worker until either a task is
+ * queued or a group finishes.
+ */
+void tp_group_wait(tp_group_t *g)
+{
+	os_threadpool_t *tp = g->tp;
+	os_worker_t *self = worker_of(tp);
+
+	while (atomic_load(&g->pending) > 0) {
+		os_task_t *t = find_task(tp, self);
+
+		if (t != NULL) {
+			run_task(tp, t);
+			continue;
+		}
+
+		pthread_mutex_lock(&tp->queue_mutex);
+		atomic_fetch_add(&tp->num_sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		while (atomic_load(&g->pending) > 0 && pool_is_empty(tp))
+			pthread_cond_wait(&tp->task_waiting, &tp->queue_mutex);
+
+		atomic_fetch_sub(&tp->num_sleeping, 1);
+		pthread_mutex_unlock(&tp->queue_mutex);
+	}
+}
+
+static void future_action(void *arg)
+{
+	tp_future_t *f = (tp_future_t *)arg;
+
+	f->result = f->fn(f->arg);
+}
+
+void tp_future_submit(os_threadpool_t *tp, tp_future_t *f, void *(*fn)(void *), void *arg)
+{
+	tp_group_init(&f->group, tp);
+	f->fn = fn;
+	f->arg = arg;
+	f->result = NULL;
+	tp_group_submit(&f->group, create_task(future_action, f, NULL));
+}
+
+void *tp_future_get(tp_future_t *f)
+{
+	tp_group_wait(&f->group);
+
+	return f->result;
+}
+
+typedef struct {
+	size_t begin, end;
+	void (*fn)(size_t begin, size_t end, void *ctx);
+	void *ctx;
+} parallel_for_chunk_t;
+
+static void parallel_for_action(void *arg)
+{
+	parallel_for_chunk_t *c = (parallel_for_chunk_t *)arg;
+
+	c->fn(c->begin, c->end, c->ctx);
+}
+
+void parallel_for(os_threadpool_t *tp, size_t begin, size_t end, size_t grain,
+		  void (*fn)(size_t begin, size_t end, void *ctx), void *ctx)
+{
+	size_t num_chunks;
+	parallel_for_chunk_t *chunks;
+	os_task_t **tasks;
+	tp_group_t g;
+
+	if (begin >= end)
+		return;
+
+	/* Enough chunks for every thread to steal a few. */
+	if (grain == 0)
+		grain = (end - begin) / (8 * tp->num_threads) + 1;
+
+	num_chunks = (end - begin + grain - 1) / grain;
+	if (num_chunks == 1) {
+		fn(begin, end, ctx);
+		return;
+	}
+
+	chunks = malloc(num_chunks * sizeof(*chunks));
+	DIE(chunks == NULL, "malloc");
+	tasks = malloc(num_chunks * sizeof(*tasks));
+	DIE(tasks == NULL, "malloc");
+
+	tp_group_init(&g, tp);
+	for (size_t i = 0; i < num_chunks; i++) {
+		chunks[i].begin = begin + i * grain;
+		chunks[i].end = chunks[i].begin + grain < end ? chunks[i].begin + grain : end;
+		chunks[i].fn = fn;
+		chunks[i].ctx = ctx;
+		tasks[i] = create_task(parallel_for_action, &chunks[i], NULL);
+		tasks[i]->group = &g;
+	}
+
+	atomic_store(&g.pending, num_chunks);
+	enqueue_tasks(tp, tasks, num_chunks);
+	tp_group_wait(&g);
+
+	free(tasks);
+	free(chunks);
+}
+
+/*
+ * Wait until every enqueued task has finished, including the tasks they
+ * enqueued in turn. The pool stays usable. Must not be called by a task.
+ */
+void tp_wait_idle(os_threadpool_t *tp)
+{
+	assert(worker_of(tp) == NULL);
+
+	pthread_mutex_lock(&tp->queue_mutex);
+	while (atomic_load_explicit(&tp->pending, memory_order_acquire) > 0)
+		pthread_cond_wait(&tp->idle, &tp->queue_mutex);
+	pthread_mutex_unlock(&tp->queue_mutex);
+}
+
 /* Wait completion of all threads. This is to be called by the main thread. */
 void wait_for_completion(os_threadpool_t *tp)
 {
+	tp_wait_idle(tp);
+
 	// stop the threadpool and broadcast the condition variable to wake up all
+	pthread_mutex_lock(&tp->queue_mutex);
 	tp->stopped = true;
 	pthread_cond_broadcast(&tp->task_waiting);
+	pthread_mutex_unlock(&tp->queue_mutex);
 
 	/* Join all worker threads. */
 	for (unsigned int i = 0; i < tp->num_threads; i++)
 		pthread_join(tp->threads[i], NULL);
+
+	if (tp->stats != NULL)
+		tp_stats_stop_sampler(tp);
+}
+
+/*
+ * Read the CPUs of every NUMA node from sysfs into cpu_node. Return the
+ * number of nodes, 1 when the system does not report any.
+ */
+static unsigned int read_numa_nodes(unsigned short *cpu_node)
+{
+	unsigned int num_nodes = 0;
+
+	for (unsigned int node = 0; node < MAX_NUMA_NODES; node++) {
+		char path[64];
+		unsigned int lo, hi;
+		FILE *f;
+		int c;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+		f = fopen(path, "r");
+		if (f == NULL)
+			break;
+
+		/* A list of ranges, such as "0-3,8-11". */
+		while (fscanf(f, "%u", &lo) == 1) {
+			hi = lo;
+			c = fgetc(f);
+			if (c == '-') {
+				if (fscanf(f, "%u", &hi) != 1)
+					break;
+				c = fgetc(f);
+			}
+
+			for (unsigned int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+				cpu_node[cpu] = node;
+
+			if (c != ',')
+				break;
+		}
+
+		fclose(f);
+		num_nodes = node + 1;
+	}
+
+	return num_nodes > 0 ? num_nodes : 1;
+}
+
+/*
+ * Place the workers on the usable CPUs, one after the other. A NUMA aware
+ * pool takes them from every node in turn, so all nodes get workers.
+ */
+static void place_workers(os_threadpool_t *tp, const cpu_set_t *allowed)
+{
+	int cpus[CPU_SETSIZE];
+	unsigned int num_cpus = 0;
+
+	if (tp->num_nodes > 1) {
+		int more = 1;
+
+		for (unsigned int round = 0; more; round++) {
+			more = 0;
+			for (unsigned int node = 0; node < tp->num_nodes; node++) {
+				unsigned int seen = 0;
+
+				for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+					if (!CPU_ISSET(cpu, allowed) || tp->cpu_node[cpu] != node)
+						continue;
+					if (seen++ == round) {
+						cpus[num_cpus++] = cpu;
+						more = 1;
+						break;
+					}
+				}
+			}
+		}
+	} else {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, allowed))
+				cpus[num_cpus++] = cpu;
+	}
+
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		tp->workers[i].cpu = num_cpus > 0 ? cpus[i % num_cpus] : -1;
+		tp->workers[i].node = tp->num_nodes > 1 ? tp->cpu_node[tp->workers[i].cpu] : 0;
+	}
 }
 
 /* Create a new threadpool. */
 os_threadpool_t *create_threadpool(unsigned int num_threads)
+{
+	os_threadpool_config_t config = { .num_threads = num_threads };
+
+	return create_threadpool_config(&config);
+}
+
+/* Create a new threadpool, placed and sized as configured. */
+os_threadpool_t *create_threadpool_config(const os_threadpool_config_t *config)
 {
 	os_threadpool_t *tp = NULL;
+	unsigned int num_threads;
+	cpu_set_t allowed;
+	pthread_attr_t attr;
 	int rc;
 
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		CPU_ZERO(&allowed);
+		CPU_SET(0, &allowed);
+	}
+
+	num_threads = config->num_threads;
+	if (num_threads == 0)
+		num_threads = CPU_COUNT(&allowed);
+
 	tp = malloc(sizeof(*tp));
 	DIE(tp == NULL, "malloc");
 
-	list_init(&tp->head);
+	tp->num_nodes = 1;
+	tp->cpu_node = NULL;
+	if (config->numa) {
+		tp->cpu_node = calloc(CPU_SETSIZE, sizeof(*tp->cpu_node));
+		DIE(tp->cpu_node == NULL, "calloc");
+		tp->num_nodes = read_numa_nodes(tp->cpu_node);
+	}
+
+	tp->heads = malloc(tp->num_nodes * TP_NUM_PRIORITIES * sizeof(*tp->heads));
+	DIE(tp->heads == NULL, "malloc");
+	for (unsigned int i = 0; i < tp->num_nodes * TP_NUM_PRIORITIES; i++)
+		list_init(&tp->heads[i]);
+	for (unsigned int i = 0; i < TP_NUM_PRIORITIES; i++)
+		atomic_init(&tp->lane_tasks[i], 0);
 
 	DIE(pthread_mutex_init(&tp->queue_mutex, NULL) != 0, "pthread_mutex_init");
 	DIE(pthread_cond_init(&tp->task_waiting, NULL) != 0, "pthread_cond_init");
+	DIE(pthread_cond_init(&tp->idle, NULL) != 0, "pthread_cond_init");
+	atomic_init(&tp->pending, 0);
+	atomic_init(&tp->num_sleeping, 0);
 	tp->stopped = false;
+	tp->stats = NULL;
 
 	tp->num_threads = num_threads;
 	tp->threads = malloc(num_threads * sizeof(*tp->threads));
 	DIE(tp->threads == NULL, "malloc");
+
+	/* The deques must be ready before any worker can steal from them. */
+	rc = posix_memalign((void **)&tp->workers, _Alignof(os_worker_t),
+			    num_threads * sizeof(*tp->workers));
+	DIE(rc != 0, "posix_memalign");
+	for (unsigned int i = 0; i < num_threads; ++i) {
+		deque_init(&tp->workers[i].deque);
+		tp->workers[i].tp = tp;
+		tp->workers[i].id = i;
+		tp->workers[i].seed = 2654435761u * (i + 1);
+		tp->workers[i].picks = 0;
+		tp->workers[i].stats = NULL;
+		tp->workers[i].free_tasks = NULL;
+		tp->workers[i].num_free_tasks = 0;
+	}
+	place_workers(tp, &allowed);
+
+	if (config->stats) {
+		tp->stats = tp_stats_create(num_threads, config->sample_interval_ms);
+		for (unsigned int i = 0; i < num_threads; ++i)
+			tp->workers[i].stats = &tp->stats->workers[i];
+		tp_stats_start_sampler(tp);
+	}
+
 	for (unsigned int i = 0; i < num_threads; ++i) {
-		rc = pthread_create(&tp->threads[i], NULL, &thread_loop_function, (void *)tp);
-		DIE(rc < 0, "pthread_create");
+		cpu_set_t set;
+
+		DIE(pthread_attr_init(&attr) != 0, "pthread_attr_init");
+		if (config->stack_size != 0)
+			DIE(pthread_attr_setstacksize(&attr, config->stack_size) != 0,
+			    "pthread_attr_setstacksize");
+
+		/* A pinned worker gets its CPU, a NUMA one all CPUs of its node. */
+		if (config->pin_threads || tp->num_nodes > 1) {
+			CPU_ZERO(&set);
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if (!CPU_ISSET(cpu, &allowed))
+					continue;
+				if (config->pin_threads ? cpu == tp->workers[i].cpu
+							: tp->cpu_node[cpu] == tp->workers[i].node)
+					CPU_SET(cpu, &set);
+			}
+			DIE(pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0,
+			    "pthread_attr_setaffinity_np");
+		}
+
+		rc = pthread_create(&tp->threads[i], &attr, &thread_loop_function, &tp->workers[i]);
+		DIE(rc != 0, "pthread_create");
+		pthread_attr_destroy(&attr);
 	}
 
 	return tp;
@@ -147,12 +849,35 @@ void destroy_threadpool(os_threadpool_t *tp)
 
 	DIE(pthread_mutex_destroy(&tp->queue_mutex) != 0, "pthread_mutex_destroy");
 	DIE(pthread_cond_destroy(&tp->task_waiting) != 0, "pthread_cond_destroy");
+	DIE(pthread_cond_destroy(&tp->idle) != 0, "pthread_cond_destroy");
+
+	for (unsigned int i = 0; i < tp->num_nodes * TP_NUM_PRIORITIES; i++) {
+		list_for_each_safe(n, p, &tp->heads[i]) {
+			list_del(n);
+			destroy_task(list_entry(n, os_task_t, list));
+		}
+	}
+
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		os_task_t *t;
+
+		while ((t = deque_pop(&tp->workers[i].deque)) != NULL)
+			destroy_task(t);
+		deque_destroy(&tp->workers[i].deque);
+
+		while (tp->workers[i].free_tasks != NULL) {
+			os_list_node_t *next = tp->workers[i].free_tasks->next;
 
-	list_for_each_safe(n, p, &tp->head) {
-		list_del(n);
-		destroy_task(list_entry(n, os_task_t, list));
+			free(list_entry(tp->workers[i].free_tasks, os_task_t, list));
+			tp->workers[i].free_tasks = next;
+		}
 	}
 
+	free(tp->workers);
 	free(tp->threads);
+	free(tp->heads);
+	free(tp->cpu_node);
+	if (tp->stats != NULL)
+		tp_stats_destroy(tp->stats);
 	free(tp);
 }
@@ -7,41 +7,150 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include "os_list.h"
+#include "os_deque.h"
+#include "os_threadpool_stats.h"
+
+/* Arguments up to this size can be stored in the task itself. */
+#define OS_TASK_INLINE_SIZE	32
+
+/*
+ * Priority lanes. High priority tasks overtake everything queued, low
+ * priority ones only run when there is nothing else to do, or when a worker
+ * ran TP_STARVATION_PERIOD tasks since it last looked at them.
+ */
+enum {
+	TP_PRIORITY_HIGH,
+	TP_PRIORITY_NORMAL,
+	TP_PRIORITY_LOW,
+	TP_NUM_PRIORITIES
+};
+
+#define TP_STARVATION_PERIOD	16
+
+struct tp_group;
 
 typedef struct {
 	void *argument;
 	void (*action)(void *arg);
 	void (*destroy_arg)(void *arg);
+	struct tp_group *group;		/* Set by tp_group_submit(). */
+	unsigned int priority;		/* TP_PRIORITY_NORMAL unless changed. */
+	uint64_t enqueue_ns;		/* Only set when statistics are on. */
 	os_list_node_t list;
+	_Alignas(16) char inline_arg[OS_TASK_INLINE_SIZE];
 } os_task_t;
 
+struct os_threadpool;
+
+/*
+ * Per-worker state. Tasks enqueued by a worker go to its own deque, where it
+ * pops them newest first while idle workers steal the oldest ones.
+ */
+typedef struct os_worker_t {
+	os_deque_t deque;
+	struct os_threadpool *tp;
+	unsigned int id;
+	unsigned int node;	/* NUMA node, 0 unless the pool is NUMA aware. */
+	int cpu;		/* CPU the worker was placed on. */
+	unsigned int seed;	/* Picks the first victim to steal from. */
+	unsigned int picks;	/* Tasks taken, for the starvation check. */
+	tp_worker_stats_t *stats;	/* NULL unless statistics are on. */
+
+	/* Destroyed tasks kept for reuse, linked through list.next. */
+	os_list_node_t *free_tasks;
+	unsigned int num_free_tasks;
+} __attribute__((aligned(64))) os_worker_t;
+
 typedef struct os_threadpool {
 	unsigned int num_threads;
 	pthread_t *threads;
+	os_worker_t *workers;
 
 	/*
-	 * Head of queue used to store tasks.
+	 * Injection queues, one per priority lane and NUMA node, lane_head()
+	 * picks one. Normal priority tasks enqueued by workers go to their
+	 * deques, everything else is injected. For each head:
 	 * First item is head.next, if head.next != head (i.e. if queue
 	 * is not empty).
 	 * Last item is head.prev, if head.prev != head (i.e. if queue
 	 * is not empty).
 	 */
-	os_list_node_t head;
+	os_list_node_t *heads;
+	unsigned int num_nodes;
+	unsigned short *cpu_node;	/* NUMA node of every CPU, if num_nodes > 1. */
+	/* Tasks in the injection queues of every lane, read without the lock. */
+	atomic_uint lane_tasks[TP_NUM_PRIORITIES];
 
-	/* TODO: Define threadpool / queue synchronization data. */
+	/* Protects heads, workers sleep on task_waiting while holding it. */
 	pthread_mutex_t queue_mutex;
 	pthread_cond_t task_waiting;
+	/* Workers parked on task_waiting, only woken when there is work. */
+	atomic_uint num_sleeping;
 	atomic_bool stopped;
+
+	/* Tasks enqueued and not finished yet, idle is signalled at zero. */
+	atomic_size_t pending;
+	pthread_cond_t idle;
+
+	tp_stats_t *stats;		/* NULL unless statistics are on. */
 } os_threadpool_t;
 
 os_task_t *create_task(void (*f)(void *), void *arg, void (*destroy_arg)(void *));
+os_task_t *create_task_inline(void (*f)(void *), const void *arg, size_t size);
 void destroy_task(os_task_t *t);
 
+typedef struct os_threadpool_config {
+	unsigned int num_threads;	/* 0 for one thread per usable CPU. */
+	bool pin_threads;		/* Pin every worker to a single CPU. */
+	bool numa;			/* Keep workers and queues per NUMA node. */
+	size_t stack_size;		/* 0 for the default stack size. */
+	bool stats;			/* Count per-worker events and latencies. */
+	unsigned int sample_interval_ms;	/* Sample the queue depth, 0 to never. */
+} os_threadpool_config_t;
+
 os_threadpool_t *create_threadpool(unsigned int num_threads);
+os_threadpool_t *create_threadpool_config(const os_threadpool_config_t *config);
 void destroy_threadpool(os_threadpool_t *tp);
 
 void enqueue_task(os_threadpool_t *q, os_task_t *t);
+void enqueue_tasks(os_threadpool_t *tp, os_task_t **tasks, unsigned int n);
 os_task_t *dequeue_task(os_threadpool_t *tp);
 void wait_for_completion(os_threadpool_t *tp);
+void tp_wait_idle(os_threadpool_t *tp);
+int tp_worker_id(os_threadpool_t *tp);
+void tp_stats_dump(os_threadpool_t *tp, FILE *f);
+
+/*
+ * A set of tasks that can be waited for on its own, while the pool runs
+ * other work. Waiting runs queued tasks instead of blocking, so groups can
+ * be waited for from inside tasks, and nested, without deadlocks.
+ */
+typedef struct tp_group {
+	os_threadpool_t *tp;
+	atomic_size_t pending;
+} tp_group_t;
+
+void tp_group_init(tp_group_t *g, os_threadpool_t *tp);
+void tp_group_submit(tp_group_t *g, os_task_t *t);
+void tp_group_wait(tp_group_t *g);
+
+/* A single call run on the pool, with a slot for its result. */
+typedef struct tp_future {
+	tp_group_t group;
+	void *(*fn)(void *arg);
+	void *arg;
+	void *result;
+} tp_future_t;
+
+void tp_future_submit(os_threadpool_t *tp, tp_future_t *f, void *(*fn)(void *), void *arg);
+void *tp_future_get(tp_future_t *f);
+
+/*
+ * Run fn over [begin, end) split in chunks of grain items (0 picks a size
+ * from the number of threads), and return once every chunk is done. The
+ * calling thread runs queued tasks while it waits.
+ */
+void parallel_for(os_threadpool_t *tp, size_t begin, size_t end, size_t grain,
+		  void (*fn)(size_t begin, size_t end, void *ctx), void *ctx);
 
 #endif
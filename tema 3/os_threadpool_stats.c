@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "os_threadpool.h"
+#include "os_threadpool_stats.h"
+#include "utils.h"
+
+static unsigned int bucket_of(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < TP_HIST_SUB_BUCKETS)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - TP_HIST_SUB_BITS + 1) * TP_HIST_SUB_BUCKETS +
+	       ((value >> (msb - TP_HIST_SUB_BITS)) & (TP_HIST_SUB_BUCKETS - 1));
+}
+
+/* Largest value that falls in a bucket. */
+static uint64_t bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < TP_HIST_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / TP_HIST_SUB_BUCKETS - 1;
+
+	return ((uint64_t)(TP_HIST_SUB_BUCKETS + bucket % TP_HIST_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+void tp_histogram_record(tp_histogram_t *h, uint64_t value)
+{
+	h->counts[bucket_of(value)]++;
+	h->total++;
+	if (value > h->max)
+		h->max = value;
+}
+
+void tp_histogram_merge(tp_histogram_t *dst, const tp_histogram_t *src)
+{
+	for (unsigned int i = 0; i < TP_HIST_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->total += src->total;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* Value below which percentile % of the recorded values are, 0 if empty. */
+uint64_t tp_histogram_percentile(const tp_histogram_t *h, double percentile)
+{
+	uint64_t rank = (uint64_t)(h->total * percentile / 100.0);
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < TP_HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen > rank)
+			return bucket_max(i) < h->max ? bucket_max(i) : h->max;
+	}
+
+	return h->max;
+}
+
+tp_stats_t *tp_stats_create(unsigned int num_workers, unsigned int interval_ms)
+{
+	tp_stats_t *stats;
+	int rc;
+
+	stats = calloc(1, sizeof(*stats));
+	DIE(stats == NULL, "calloc");
+
+	rc = posix_memalign((void **)&stats->workers, _Alignof(tp_worker_stats_t),
+			    num_workers * sizeof(*stats->workers));
+	DIE(rc != 0, "posix_memalign");
+	memset(stats->workers, 0, num_workers * sizeof(*stats->workers));
+
+	stats->interval_ms = interval_ms;
+	DIE(pthread_cond_init(&stats->sampler_wakeup, NULL) != 0, "pthread_cond_init");
+
+	return stats;
+}
+
+/* Record the number of pending tasks every interval, until the pool stops. */
+static void *sampler_loop(void *arg)
+{
+	os_threadpool_t *tp = (os_threadpool_t *)arg;
+	tp_stats_t *stats = tp->stats;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	pthread_mutex_lock(&tp->queue_mutex);
+	while (!tp->stopped) {
+		deadline.tv_nsec += (long)(stats->interval_ms % 1000) * 1000000;
+		deadline.tv_sec += stats->interval_ms / 1000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		while (!tp->stopped &&
+		       pthread_cond_timedwait(&stats->sampler_wakeup, &tp->queue_mutex, &deadline) == 0)
+			;
+
+		tp_histogram_record(&stats->depth, atomic_load(&tp->pending));
+	}
+	pthread_mutex_unlock(&tp->queue_mutex);
+
+	return NULL;
+}
+
+void tp_stats_start_sampler(os_threadpool_t *tp)
+{
+	if (tp->stats->interval_ms == 0)
+		return;
+
+	DIE(pthread_create(&tp->stats->sampler, NULL, sampler_loop, tp) != 0, "pthread_create");
+}
+
+/* Called with stopped already set. */
+void tp_stats_stop_sampler(os_threadpool_t *tp)
+{
+	if (tp->stats->interval_ms == 0)
+		return;
+
+	pthread_mutex_lock(&tp->queue_mutex);
+	pthread_cond_signal(&tp->stats->sampler_wakeup);
+	pthread_mutex_unlock(&tp->queue_mutex);
+
+	pthread_join(tp->stats->sampler, NULL);
+}
+
+void tp_stats_destroy(tp_stats_t *stats)
+{
+	DIE(pthread_cond_destroy(&stats->sampler_wakeup) != 0, "pthread_cond_destroy");
+	free(stats->workers);
+	free(stats);
+}
+
+static void dump_histogram(FILE *f, const char *name, const tp_histogram_t *h, double scale,
+			   const char *unit)
+{
+	fprintf(f, "%-22s n %-10llu p50 %-10.1f p90 %-10.1f p99 %-10.1f max %.1f %s\n", name,
+		(unsigned long long)h->total,
+		tp_histogram_percentile(h, 50) / scale, tp_histogram_percentile(h, 90) / scale,
+		tp_histogram_percentile(h, 99) / scale, h->max / scale, unit);
+}
+
+/*
+ * Print the counters of every worker and the latency percentiles of the
+ * whole pool. The numbers are exact once the pool is idle, a dump taken
+ * while tasks run may be slightly behind.
+ */
+void tp_stats_dump(os_threadpool_t *tp, FILE *f)
+{
+	tp_stats_t *stats = tp->stats;
+	tp_histogram_t *wait, *run;
+
+	if (stats == NULL) {
+		fprintf(f, "threadpool: statistics not enabled\n");
+		return;
+	}
+
+	wait = calloc(1, sizeof(*wait));
+	DIE(wait == NULL, "calloc");
+	run = calloc(1, sizeof(*run));
+	DIE(run == NULL, "calloc");
+
+	fprintf(f, "threadpool: %u workers, %zu tasks pending\n",
+		tp->num_threads, atomic_load(&tp->pending));
+	fprintf(f, "%6s %12s %12s %12s %10s %12s\n",
+		"worker", "executed", "steals", "attempts", "parks", "parked_ms");
+
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		tp_worker_stats_t *w = &stats->workers[i];
+
+		fprintf(f, "%6u %12llu %12llu %12llu %10llu %12.1f\n", i,
+			(unsigned long long)w->executed, (unsigned long long)w->steals,
+			(unsigned long long)w->steal_attempts, (unsigned long long)w->parks,
+			w->park_ns / 1e6);
+		tp_histogram_merge(wait, &w->wait_ns);
+		tp_histogram_merge(run, &w->run_ns);
+	}
+
+	dump_histogram(f, "wait (enqueue->start)", wait, 1e3, "us");
+	dump_histogram(f, "run (start->end)", run, 1e3, "us");
+	if (stats->interval_ms != 0)
+		dump_histogram(f, "queue depth", &stats->depth, 1, "tasks");
+
+	free(run);
+	free(wait);
+}
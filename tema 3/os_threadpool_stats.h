@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_THREADPOOL_STATS_H__
+#define __OS_THREADPOOL_STATS_H__	1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Log-linear histogram, HDR style: every power of two range is split in
+ * TP_HIST_SUB_BUCKETS buckets, so a recorded value is off by less than 25%.
+ */
+#define TP_HIST_SUB_BITS	2
+#define TP_HIST_SUB_BUCKETS	(1 << TP_HIST_SUB_BITS)
+#define TP_HIST_BUCKETS		(64 * TP_HIST_SUB_BUCKETS)
+
+typedef struct tp_histogram {
+	uint64_t counts[TP_HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+} tp_histogram_t;
+
+void tp_histogram_record(tp_histogram_t *h, uint64_t value);
+void tp_histogram_merge(tp_histogram_t *dst, const tp_histogram_t *src);
+uint64_t tp_histogram_percentile(const tp_histogram_t *h, double percentile);
+
+/* Counters of one worker, only written by that worker. */
+typedef struct tp_worker_stats {
+	uint64_t executed;
+	uint64_t steal_attempts;
+	uint64_t steals;
+	uint64_t parks;
+	uint64_t park_ns;
+	tp_histogram_t wait_ns;		/* From enqueue to start. */
+	tp_histogram_t run_ns;		/* From start to end. */
+} __attribute__((aligned(64))) tp_worker_stats_t;
+
+typedef struct tp_stats {
+	tp_worker_stats_t *workers;
+
+	/* Queue depth sampler, only running if interval_ms is not 0. */
+	unsigned int interval_ms;
+	pthread_t sampler;
+	pthread_cond_t sampler_wakeup;
+	tp_histogram_t depth;
+} tp_stats_t;
+
+static inline uint64_t tp_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct os_threadpool;
+
+/* Used by the pool itself, around the lifetime of the workers. */
+tp_stats_t *tp_stats_create(unsigned int num_workers, unsigned int interval_ms);
+void tp_stats_start_sampler(struct os_threadpool *tp);
+void tp_stats_stop_sampler(struct os_threadpool *tp);
+void tp_stats_destroy(tp_stats_t *stats);
+
+#endif
@@ -2,6 +2,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <time.h>
@@ -9,16 +12,35 @@
 #include <stdatomic.h>
 
 #include "os_graph.h"
+#include "os_bfs.h"
 #include "os_threadpool.h"
 #include "log/log.h"
 #include "utils.h"
 
-#define NUM_THREADS		4
-
-static atomic_int sum;
+/*
+ * The number of threads is the second argument, or PARALLEL_THREADS, or one
+ * per usable CPU. PARALLEL_PIN=1 pins the workers to CPUs and
+ * PARALLEL_NUMA=1 keeps them and their queues per NUMA node.
+ * PARALLEL_STATS=1 prints the threadpool statistics to stderr at the end.
+ * PARALLEL_ENGINE=bfs uses the level-synchronous BFS instead of one task per
+ * node.
+ */
+#define ENV_THREADS		"PARALLEL_THREADS"
+#define ENV_PIN			"PARALLEL_PIN"
+#define ENV_NUMA		"PARALLEL_NUMA"
+#define ENV_STATS		"PARALLEL_STATS"
+#define ENV_ENGINE		"PARALLEL_ENGINE"
+#define STATS_INTERVAL_MS	10
+#define TASK_BATCH		64
+
+/* One partial sum per worker, and a last one for the main thread. */
+typedef struct partial_sum {
+	int64_t value;
+} __attribute__((aligned(64))) partial_sum_t;
+
+static partial_sum_t *sums;
 static os_graph_t *graph;
 static os_threadpool_t *tp;
-static pthread_mutex_t graph_mutex;
 
 typedef struct graph_task_arg {
 	unsigned int idx;
@@ -33,53 +55,98 @@ void process_node_wrapper(void *arg)
 
 static void process_node(unsigned int idx)
 {
-	os_node_t *node = graph->nodes[idx];
-
-	graph->visited[idx] = DONE;
-	sum += node->info;
-
-	for (unsigned int i = 0; i < node->num_neighbours; i++) {
-		pthread_mutex_lock(&graph_mutex);
-		if (graph->visited[node->neighbours[i]] == NOT_VISITED) {
-			graph_task_arg_t *arg = malloc(sizeof(graph_task_arg_t));
+	const unsigned int *neighbours = graph_neighbours(graph, idx);
+	unsigned int degree = graph_degree(graph, idx);
+	unsigned int claimed[TASK_BATCH];
+	os_task_t *batch[TASK_BATCH];
+	unsigned int i = 0;
+	int id = tp_worker_id(tp);
+
+	__atomic_store_n(&graph->visited[idx], DONE, __ATOMIC_RELAXED);
+	sums[id >= 0 ? (unsigned int)id : tp->num_threads].value += graph->info[idx];
+
+	/* Neighbours are claimed and enqueued TASK_BATCH at a time. */
+	while (i < degree) {
+		unsigned int n = 0;
+
+		/* A node is claimed by whoever moves it out of NOT_VISITED first. */
+		for (; i < degree && n < TASK_BATCH; i++) {
+			__typeof__(*graph->visited) expected = NOT_VISITED;
+
+			if (__atomic_load_n(&graph->visited[neighbours[i]], __ATOMIC_RELAXED) != NOT_VISITED)
+				continue;
+			if (__atomic_compare_exchange_n(&graph->visited[neighbours[i]], &expected, PROCESSING,
+							false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				claimed[n++] = neighbours[i];
+		}
 
-			DIE(arg == NULL, "malloc");
+		for (unsigned int j = 0; j < n; j++) {
+			graph_task_arg_t arg = { .idx = claimed[j] };
 
-			arg->idx = node->neighbours[i];
+			batch[j] = create_task_inline(process_node_wrapper, &arg, sizeof(arg));
+		}
 
-			os_task_t *task = create_task(process_node_wrapper, arg, free);
+		enqueue_tasks(tp, batch, n);
+	}
+}
 
-			graph->visited[node->neighbours[i]] = PROCESSING;
+static bool env_flag(const char *name)
+{
+	const char *value = getenv(name);
 
-			enqueue_task(tp, task);
-		}
-		pthread_mutex_unlock(&graph_mutex);
-	}
+	return value != NULL && strcmp(value, "0") != 0;
 }
 
 int main(int argc, char *argv[])
 {
-	FILE *input_file;
+	os_threadpool_config_t config = { 0 };
+	const char *threads, *engine;
+	double start, load_ms, traverse_ms;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s input_file [num_threads]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	input_file = fopen(argv[1], "r");
-	DIE(input_file == NULL, "fopen");
-
-	graph = create_graph_from_file(input_file);
+	threads = argc == 3 ? argv[2] : getenv(ENV_THREADS);
+	if (threads != NULL)
+		config.num_threads = strtoul(threads, NULL, 10);
+	config.pin_threads = env_flag(ENV_PIN);
+	config.numa = env_flag(ENV_NUMA);
+	config.stats = env_flag(ENV_STATS);
+	config.sample_interval_ms = STATS_INTERVAL_MS;
+
+	start = graph_time_ms();
+	graph = create_graph_from_path(argv[1], config.num_threads);
+	DIE(graph == NULL, "create_graph_from_path");
+	load_ms = graph_time_ms() - start;
+
+	tp = create_threadpool_config(&config);
+	DIE(posix_memalign((void **)&sums, _Alignof(partial_sum_t),
+			   (tp->num_threads + 1) * sizeof(*sums)) != 0, "posix_memalign");
+	memset(sums, 0, (tp->num_threads + 1) * sizeof(*sums));
+
+	/* The traversal is timed without starting the pool. */
+	start = graph_time_ms();
+	engine = getenv(ENV_ENGINE);
+	if (engine != NULL && strcmp(engine, "bfs") == 0)
+		sums[tp->num_threads].value = graph_bfs_sum(graph, tp, 0);
+	else if (graph->num_nodes != 0)
+		process_node(0);
+	wait_for_completion(tp);
+	traverse_ms = graph_time_ms() - start;
+	if (config.stats)
+		tp_stats_dump(tp, stderr);
 
-	DIE(pthread_mutex_init(&graph_mutex, NULL) != 0, "pthread_mutex_init");
+	for (unsigned int i = 1; i <= tp->num_threads; i++)
+		sums[0].value += sums[i].value;
+	if (getenv(GRAPH_TIMES_ENV) != NULL)
+		fprintf(stderr, "load %.3f ms traverse %.3f ms\n", load_ms, traverse_ms);
+	printf("%" PRId64, sums[0].value);
 
-	tp = create_threadpool(NUM_THREADS);
-	process_node(0);
-	wait_for_completion(tp);
+	free(sums);
 	destroy_threadpool(tp);
-
-	DIE(pthread_mutex_destroy(&graph_mutex) != 0, "pthread_mutex_destroy");
-	printf("%d", sum);
+	destroy_graph(graph);
 
 	return 0;
 }
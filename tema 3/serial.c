@@ -2,44 +2,85 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #include "os_graph.h"
 #include "log/log.h"
 #include "utils.h"
 
-static int sum;
+static int64_t sum;
 static os_graph_t *graph;
 
+/* How far ahead in a row the visited entries are prefetched. */
+#define PREFETCH_DISTANCE	8
+
+static inline void visit(unsigned int idx, unsigned int *stack, size_t *top)
+{
+	sum += graph->info[idx];
+	graph->visited[idx] = DONE;
+	stack[(*top)++] = idx;
+}
+
+/*
+ * Depth-first, with an explicit stack instead of recursion, so a path of
+ * millions of nodes does not overflow the thread stack. A node is marked
+ * when it is pushed, so the stack never holds more than num_nodes entries.
+ */
 static void process_node(unsigned int idx)
 {
-	os_node_t *node;
+	unsigned int *stack;
+	size_t top = 0;
 
-	node = graph->nodes[idx];
-	sum += node->info;
-	graph->visited[idx] = DONE;
+	stack = malloc(graph->num_nodes * sizeof(*stack));
+	DIE(stack == NULL, "malloc");
+
+	visit(idx, stack, &top);
 
-	for (unsigned int i = 0; i < node->num_neighbours; i++)
-		if (graph->visited[node->neighbours[i]] == NOT_VISITED)
-			process_node(node->neighbours[i]);
+	while (top != 0) {
+		unsigned int node = stack[--top];
+		const unsigned int *neighbours = graph_neighbours(graph, node);
+		unsigned int degree = graph_degree(graph, node);
+
+		/* The row popped next. */
+		if (top != 0)
+			__builtin_prefetch(graph_neighbours(graph, stack[top - 1]));
+
+		for (unsigned int i = 0; i < degree; i++) {
+			if (i + PREFETCH_DISTANCE < degree)
+				__builtin_prefetch(&graph->visited[neighbours[i + PREFETCH_DISTANCE]]);
+
+			if (graph->visited[neighbours[i]] == NOT_VISITED) {
+				__builtin_prefetch(&graph->offsets[neighbours[i]]);
+				visit(neighbours[i], stack, &top);
+			}
+		}
+	}
+
+	free(stack);
 }
 
 int main(int argc, char *argv[])
 {
-	FILE *input_file;
+	double start, loaded;
 
 	if (argc != 2) {
 		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	input_file = fopen(argv[1], "r");
-	DIE(input_file == NULL, "fopen");
-
-	graph = create_graph_from_file(input_file);
+	start = graph_time_ms();
+	graph = create_graph_from_path(argv[1], 1);
+	DIE(graph == NULL, "create_graph_from_path");
+	loaded = graph_time_ms();
 
-	process_node(0);
+	if (graph->num_nodes != 0)
+		process_node(0);
 
-	printf("%d", sum);
+	if (getenv(GRAPH_TIMES_ENV) != NULL)
+		fprintf(stderr, "load %.3f ms traverse %.3f ms\n", loaded - start,
+			graph_time_ms() - loaded);
+	printf("%" PRId64, sum);
+	destroy_graph(graph);
 
 	return 0;
 }
@@ -0,0 +1,488 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "builtins.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Print the escape sequence that starts at the backslash s, and return its
+ * last character. \c sets *stop, the output ends there.
+ */
+static const char *print_escape(const char *s, bool *stop)
+{
+	int value = 0, digits = 0;
+
+	switch (*++s) {
+	case 'a':
+		putchar('\a');
+		break;
+	case 'b':
+		putchar('\b');
+		break;
+	case 'c':
+		*stop = true;
+		break;
+	case 'e':
+		putchar('\033');
+		break;
+	case 'f':
+		putchar('\f');
+		break;
+	case 'n':
+		putchar('\n');
+		break;
+	case 'r':
+		putchar('\r');
+		break;
+	case 't':
+		putchar('\t');
+		break;
+	case 'v':
+		putchar('\v');
+		break;
+	case '\\':
+		putchar('\\');
+		break;
+	case '0':
+		/* Up to three octal digits, after the 0. */
+		while (digits < 3 && s[1] >= '0' && s[1] <= '7') {
+			value = value * 8 + *++s - '0';
+			digits++;
+		}
+		putchar(value);
+		break;
+	case '\0':
+		/* A lone backslash at the end. */
+		putchar('\\');
+		s--;
+		break;
+	default:
+		putchar('\\');
+		putchar(*s);
+	}
+
+	return s;
+}
+
+/**
+ * Print s, interpreting its escapes. Returns false if it ended with \c.
+ */
+static bool print_escapes(const char *s)
+{
+	bool stop = false;
+
+	for (; *s && !stop; s++) {
+		if (*s == '\\')
+			s = print_escape(s, &stop);
+		else
+			putchar(*s);
+	}
+
+	return !stop;
+}
+
+int shell_echo(int argc, char **argv)
+{
+	bool newline = true, escapes = false;
+	int i;
+
+	/* Options only come first, "-" followed by n, e or E letters. */
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1))
+			break;
+
+		for (const char *option = argv[i] + 1; *option; option++) {
+			if (*option == 'n')
+				newline = false;
+			else
+				escapes = *option == 'e';
+		}
+	}
+
+	for (; i < argc; i++) {
+		if (escapes) {
+			if (!print_escapes(argv[i]))
+				return EXIT_SUCCESS;
+		} else {
+			fputs(argv[i], stdout);
+		}
+
+		if (i + 1 < argc)
+			putchar(' ');
+	}
+
+	if (newline)
+		putchar('\n');
+
+	return EXIT_SUCCESS;
+}
+
+int shell_pwd(int argc, char **argv)
+{
+	char *cwd = getcwd(NULL, 0);
+
+	(void)argc;
+	(void)argv;
+
+	if (cwd == NULL) {
+		perror("pwd");
+		return EXIT_FAILURE;
+	}
+
+	puts(cwd);
+	free(cwd);
+
+	return EXIT_SUCCESS;
+}
+
+int shell_true(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	return EXIT_SUCCESS;
+}
+
+int shell_false(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	return EXIT_FAILURE;
+}
+
+/* The expression of a test command, read left to right. */
+struct test {
+	const char *name;
+	char **argv;
+	int argc;
+	int pos;
+	bool error;
+};
+
+static bool test_or(struct test *t);
+
+static bool test_integer(struct test *t, const char *s, long long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoll(s, &end, 10);
+	if (errno != 0 || end == s || *end != '\0') {
+		fprintf(stderr, "%s: %s: integer expression expected\n", t->name, s);
+		t->error = true;
+		return false;
+	}
+
+	return true;
+}
+
+static bool is_binary(const char *op)
+{
+	static const char * const ops[] = {
+		"=", "==", "!=", "<", ">",
+		"-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+	};
+
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+		if (strcmp(op, ops[i]) == 0)
+			return true;
+
+	return false;
+}
+
+static bool test_binary(struct test *t, const char *left, const char *op,
+						const char *right)
+{
+	long long a, b;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+	if (strcmp(op, "<") == 0)
+		return strcmp(left, right) < 0;
+	if (strcmp(op, ">") == 0)
+		return strcmp(left, right) > 0;
+
+	if (!test_integer(t, left, &a) || !test_integer(t, right, &b))
+		return false;
+
+	switch (op[1] << 8 | op[2]) {
+	case 'e' << 8 | 'q':
+		return a == b;
+	case 'n' << 8 | 'e':
+		return a != b;
+	case 'l' << 8 | 't':
+		return a < b;
+	case 'l' << 8 | 'e':
+		return a <= b;
+	case 'g' << 8 | 't':
+		return a > b;
+	default:
+		return a >= b;
+	}
+}
+
+static bool is_unary(const char *op)
+{
+	return op[0] == '-' && op[1] && op[2] == '\0' && strchr("nzefdrwxsLh", op[1]);
+}
+
+static bool test_unary(const char *op, const char *arg)
+{
+	struct stat st;
+
+	switch (op[1]) {
+	case 'n':
+		return arg[0] != '\0';
+	case 'z':
+		return arg[0] == '\0';
+	case 'r':
+		return access(arg, R_OK) == 0;
+	case 'w':
+		return access(arg, W_OK) == 0;
+	case 'x':
+		return access(arg, X_OK) == 0;
+	case 'L':
+	case 'h':
+		return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	}
+
+	if (stat(arg, &st) != 0)
+		return false;
+
+	switch (op[1]) {
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 's':
+		return st.st_size > 0;
+	default:
+		return true;
+	}
+}
+
+static bool test_primary(struct test *t)
+{
+	char **argv = t->argv + t->pos;
+	int left = t->argc - t->pos;
+	bool value;
+
+	if (left <= 0) {
+		fprintf(stderr, "%s: argument expected\n", t->name);
+		t->error = true;
+		return false;
+	}
+
+	/* "a = b" first, so that "! = x" compares the string "!". */
+	if (left >= 3 && is_binary(argv[1])) {
+		t->pos += 3;
+		return test_binary(t, argv[0], argv[1], argv[2]);
+	}
+
+	if (strcmp(argv[0], "!") == 0) {
+		t->pos++;
+		return !test_primary(t);
+	}
+
+	if (strcmp(argv[0], "(") == 0) {
+		t->pos++;
+		value = test_or(t);
+		if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+			fprintf(stderr, "%s: `)' expected\n", t->name);
+			t->error = true;
+			return false;
+		}
+		t->pos++;
+		return value;
+	}
+
+	if (left >= 2 && is_unary(argv[0])) {
+		t->pos += 2;
+		return test_unary(argv[0], argv[1]);
+	}
+
+	/* A lone string, true if not empty. */
+	t->pos++;
+	return argv[0][0] != '\0';
+}
+
+static bool test_and(struct test *t)
+{
+	bool value = test_primary(t);
+
+	while (!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+		t->pos++;
+		value = test_primary(t) && value;
+	}
+
+	return value;
+}
+
+static bool test_or(struct test *t)
+{
+	bool value = test_and(t);
+
+	while (!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+		t->pos++;
+		value = test_and(t) || value;
+	}
+
+	return value;
+}
+
+int shell_test(int argc, char **argv)
+{
+	struct test t = { argv[0], argv + 1, argc - 1, 0, false };
+	bool value;
+
+	if (strcmp(argv[0], "[") == 0) {
+		if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing `]'\n");
+			return 2;
+		}
+		t.argc--;
+	}
+
+	if (t.argc == 0)
+		return EXIT_FAILURE;
+
+	value = test_or(&t);
+	if (!t.error && t.pos != t.argc) {
+		fprintf(stderr, "%s: %s: unexpected argument\n", t.name, t.argv[t.pos]);
+		t.error = true;
+	}
+
+	if (t.error)
+		return 2;
+
+	return value ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Print one conversion of printf, spec being its "%flags width.precision"
+ * prefix. The missing arguments are empty strings, or 0.
+ */
+static int printf_convert(char *spec, size_t length, char conversion,
+						  const char *arg, bool *stop)
+{
+	char *end;
+	char c[2] = { arg ? arg[0] : '\0', '\0' };
+	int rt = EXIT_SUCCESS;
+
+	if (arg == NULL)
+		arg = "";
+
+	switch (conversion) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		/* Every number is converted as a long long. */
+		spec[length++] = 'l';
+		spec[length++] = 'l';
+		spec[length++] = conversion;
+		spec[length] = '\0';
+
+		errno = 0;
+		long long value = *arg == '\'' || *arg == '"' ? arg[1] :
+						  strtoll(arg, &end, 0);
+
+		if (*arg != '\'' && *arg != '"' && *arg != '\0' &&
+			(errno != 0 || *end != '\0')) {
+			fprintf(stderr, "printf: %s: invalid number\n", arg);
+			rt = EXIT_FAILURE;
+		}
+
+		printf(spec, value);
+		break;
+	case 'c':
+		arg = c;
+		/* fallthrough */
+	case 's':
+		spec[length++] = 's';
+		spec[length] = '\0';
+		printf(spec, arg);
+		break;
+	case 'b':
+		*stop = !print_escapes(arg);
+		break;
+	default:
+		fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+		rt = EXIT_FAILURE;
+		*stop = true;
+	}
+
+	return rt;
+}
+
+int shell_printf(int argc, char **argv)
+{
+	const char *format;
+	int next = 2, first;
+	int rt = EXIT_SUCCESS;
+	bool stop = false;
+
+	if (argc < 2) {
+		fprintf(stderr, "printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+	format = argv[1];
+
+	/* The format is used again while it takes arguments and some are left. */
+	do {
+		first = next;
+
+		for (const char *p = format; *p && !stop; p++) {
+			if (*p == '\\') {
+				p = print_escape(p, &stop);
+				continue;
+			}
+
+			if (*p != '%') {
+				putchar(*p);
+				continue;
+			}
+
+			if (p[1] == '%') {
+				putchar('%');
+				p++;
+				continue;
+			}
+
+			/* Room for the length modifier and the conversion. */
+			char spec[32] = "%";
+			size_t length = 1;
+
+			for (p++; *p && strchr("-+ #0", *p) && length < 8; p++)
+				spec[length++] = *p;
+			for (; isdigit(*p) && length < 16; p++)
+				spec[length++] = *p;
+			if (*p == '.')
+				for (spec[length++] = *p++; isdigit(*p) && length < 24; p++)
+					spec[length++] = *p;
+
+			if (*p == '\0') {
+				fprintf(stderr, "printf: %s: missing conversion\n", spec);
+				return EXIT_FAILURE;
+			}
+
+			rt |= printf_convert(spec, length, *p,
+								 next < argc ? argv[next] : NULL, &stop);
+			next++;
+		}
+	} while (!stop && next > first && next < argc);
+
+	return rt;
+}
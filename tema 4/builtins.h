@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BUILTINS_H
+#define _BUILTINS_H
+
+/**
+ * Internal echo command: the arguments, separated by spaces. -n leaves out
+ * the newline, -e interprets the backslash escapes.
+ */
+int shell_echo(int argc, char **argv);
+
+/**
+ * Internal pwd command: print the current directory.
+ */
+int shell_pwd(int argc, char **argv);
+
+/**
+ * Internal true and false commands.
+ */
+int shell_true(int argc, char **argv);
+int shell_false(int argc, char **argv);
+
+/**
+ * Internal test command, also run as "[ ... ]": 0 if the expression is
+ * true, 1 if it is false and 2 if it is malformed.
+ */
+int shell_test(int argc, char **argv);
+
+/**
+ * Internal printf command: argv[1] is the format, reused while arguments
+ * are left. Supports the escapes, the flags, width and precision and the
+ * conversions d, i, u, o, x, X, c, s, b and %.
+ */
+int shell_printf(int argc, char **argv);
+
+#endif /* _BUILTINS_H */
@@ -1,11 +1,14 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
 #include "cmd.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <stdarg.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +17,19 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "builtins.h"
+#include "hash.h"
+#include "jobs.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
 
 #define READ 0
 #define WRITE 1
 
+/* Limit of the commands of an a & b & ... group running at once, if set. */
+#define MAX_PARALLEL_VAR "MAX_PARALLEL"
+
 #define OUT_FLAGS (O_WRONLY | O_CREAT | (s->io_flags ? O_APPEND : O_TRUNC))
 #define ERR_FLAGS OUT_FLAGS
 
@@ -27,17 +38,28 @@
  */
 static bool shell_cd(word_t *dir)
 {
-	if (setenv("OLDPWD", getcwd(NULL, 0), 1) == -1)
+	char cwd[PATH_MAX];
+	char previous[PATH_MAX];
+	const char *oldpwd = var_get("OLDPWD");
+
+	/* $OLDPWD is replaced below, "cd -" goes where it was before. */
+	if (oldpwd != NULL)
+		snprintf(previous, sizeof(previous), "%s", oldpwd);
+	else
+		previous[0] = '\0';
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
 		return false;
+	var_set("OLDPWD", cwd);
 
 	if (dir == NULL || dir->string == NULL || dir->string[0] == '\0')
-		return chdir(getenv("HOME"));
+		return chdir(var_get("HOME"));
 
 	if (!strcmp(dir->string, ".."))
 		return chdir("..");
 
 	if (!strcmp(dir->string, "-"))
-		return chdir(getenv("OLDPWD"));
+		return chdir(previous);
 
 	if (access(dir->string, F_OK) == 0)
 		return chdir(dir->string);
@@ -54,86 +76,194 @@ static int shell_exit(void)
 	return EXIT_SUCCESS;
 }
 
-static bool do_redirect(int flags, const char *filename, int filedes_count,
-						...)
+/**
+ * Internal commands that take their arguments as an argv and run in the
+ * shell process.
+ */
+static const struct builtin {
+	const char *name;
+	int (*run)(int argc, char **argv);
+} builtins[] = {
+	{ "[", shell_test },
+	{ "echo", shell_echo },
+	{ "false", shell_false },
+	{ "hash", shell_hash },
+	{ "jobs", shell_jobs },
+	{ "printf", shell_printf },
+	{ "pwd", shell_pwd },
+	{ "test", shell_test },
+	{ "true", shell_true },
+	{ "wait", shell_wait },
+};
+
+static const struct builtin *find_builtin(const char *verb)
 {
-	int rc;
-	int fd;
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		if (strcmp(verb, builtins[i].name) == 0)
+			return &builtins[i];
+
+	return NULL;
+}
 
-	fd = open(filename, flags, 0644);
-	if (fd < 0)
+/**
+ * Whether the simple command runs an external program, as opposed to a
+ * builtin or a variable assignment that must run in the shell itself.
+ */
+static bool is_external(simple_command_t *s)
+{
+	const char *verb = s->verb->string;
+
+	if (!strcmp(verb, "cd") || !strcmp(verb, "exit") || !strcmp(verb, "quit") ||
+		find_builtin(verb))
 		return false;
 
-	va_list args;
+	return !(s->verb->next_part && s->verb->next_part->string &&
+			 s->verb->next_part->string[0] == '=');
+}
+
+/**
+ * Open the files of the redirections of a simple command, close-on-exec, as
+ * its plan of descriptors: fds[i] is the one that becomes descriptor i, -1
+ * for the ones not redirected. Each word is expanded once, and a file given
+ * for both output and error is opened once. Returns false if one could not
+ * be opened; the ones that were are in fds all the same.
+ */
+static bool open_redirections(simple_command_t *s, int fds[3])
+{
+	char *in_val = get_word(s->in);
+	char *out_val = get_word(s->out);
+	char *err_val = get_word(s->err);
+	bool rt = true;
+
+	fds[0] = fds[1] = fds[2] = -1;
 
-	va_start(args, filedes_count);
-	for (int i = 0; i < filedes_count; i++) {
-		int filedes = va_arg(args, int);
+	if (s->in) {
+		fds[0] = open(in_val, O_RDONLY | O_CLOEXEC);
+		rt = rt && fds[0] >= 0;
+	}
+
+	if (s->out && s->err && !strcmp(out_val, err_val)) {
+		fds[1] = open(out_val, OUT_FLAGS | O_CLOEXEC, 0644);
+		rt = rt && fds[1] >= 0;
+		if (fds[1] >= 0)
+			fds[2] = fcntl(fds[1], F_DUPFD_CLOEXEC, 0);
+	} else {
+		if (s->out) {
+			fds[1] = open(out_val, OUT_FLAGS | O_CLOEXEC, 0644);
+			rt = rt && fds[1] >= 0;
+		}
 
-		rc = dup2(fd, filedes);
-		if (rc < 0)
-			return false;
+		if (s->err) {
+			fds[2] = open(err_val, ERR_FLAGS | O_CLOEXEC, 0644);
+			rt = rt && fds[2] >= 0;
+		}
 	}
-	va_end(args);
 
-	rc = close(fd);
-	return rc >= 0;
+	return rt;
 }
 
-static const char *handle_token(word_t *word)
+static void close_redirections(int fds[3])
 {
-	if (word->expand)
-		return getenv(word->string) ? getenv(word->string) : "";
-	else
-		return word->string;
+	for (int i = 0; i < 3; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
 }
 
-static char *get_value(word_t *token)
+/**
+ * Install the plan of a command run in the shell itself. Only the redirected
+ * descriptors are touched: each is saved in saved, close-on-exec so a later
+ * child does not inherit it, and replaced; the others are -1 in saved. A
+ * command without redirections costs no dup system call.
+ */
+static void apply_redirections(int fds[3], int saved[3])
 {
-	if (!token)
-		return NULL;
+	fflush(stdout);
+	fflush(stderr);
 
-	char *value = strdup(handle_token(token));
+	for (int i = 0; i < 3; i++) {
+		saved[i] = -1;
+		if (fds[i] < 0)
+			continue;
 
-	while (token->next_part) {
-		token = token->next_part;
-		value = realloc(value, strlen(value) + strlen(handle_token(token)) + 1);
-		strcat(value, handle_token(token));
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+		dup2(fds[i], i);
 	}
-
-	return value;
 }
 
-static bool handle_redirections(simple_command_t *s)
+static void restore_redirections(int saved[3])
 {
-	char *in_val = get_value(s->in);
-	char *out_val = get_value(s->out);
-	char *err_val = get_value(s->err);
+	/* What the command wrote goes out before a child writes its own. */
+	fflush(stdout);
+	fflush(stderr);
 
-	int rt = EXIT_SUCCESS;
+	for (int i = 0; i < 3; i++) {
+		if (saved[i] < 0)
+			continue;
 
-	if (s->in)
-		if (!do_redirect(O_RDONLY, in_val, 1, STDIN_FILENO))
-			rt = EXIT_FAILURE;
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+}
 
-	if (s->out && s->err && !strcmp(out_val, err_val)) {
-		if (!do_redirect(OUT_FLAGS, out_val, 2, STDOUT_FILENO, STDERR_FILENO))
-			rt = EXIT_FAILURE;
-	} else {
-		if (s->out)
-			if (!do_redirect(ERR_FLAGS, out_val, 1, STDOUT_FILENO))
-				rt = EXIT_FAILURE;
+/**
+ * Start an external command without waiting for it, with posix_spawn() so
+ * the shell's address space is not copied. in_fd and out_fd, unless -1,
+ * become its standard input and output, before its own redirections.
+ * Returns the pid, or -1 if it could not be started.
+ */
+static pid_t spawn_simple(simple_command_t *s, int in_fd, int out_fd)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid = -1;
+	int fds[3];
+	int rc;
 
-		if (s->err)
-			if (!do_redirect(OUT_FLAGS, err_val, 1, STDERR_FILENO))
-				rt = EXIT_FAILURE;
+	arena_mark_t mark = arena_mark();
+	int argc;
+	char **argv = get_argv(s, &argc);
+	const char *command_path = argv[0];
+	const char *exec_path = hash_lookup(command_path);
+
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+	if (open_redirections(s, fds)) {
+		for (int i = 0; i < 3; i++)
+			if (fds[i] >= 0)
+				posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+
+		uint64_t start = trace_now();
+
+		rc = ENOENT;
+		if (exec_path != NULL)
+			rc = posix_spawn(&pid, exec_path, &actions, NULL, argv, vars_environ());
+
+		/* A stale entry is looked up again, in the $PATH of the shell. */
+		if (rc == ENOENT && exec_path != NULL && exec_path != command_path) {
+			hash_clear();
+			exec_path = hash_lookup(command_path);
+			if (exec_path != NULL)
+				rc = posix_spawn(&pid, exec_path, &actions, NULL, argv, vars_environ());
+		}
+
+		/* posix_spawn() returns once the child called exec. */
+		if (rc == 0)
+			trace_child(pid, command_path, start, trace_now() - start);
+
+		if (rc != 0) {
+			fprintf(stderr, "Execution failed for '%s'\n", command_path);
+			pid = -1;
+		}
 	}
 
-	free(in_val);
-	free(out_val);
-	free(err_val);
+	close_redirections(fds);
+	posix_spawn_file_actions_destroy(&actions);
+	arena_release(mark);
 
-	return rt == EXIT_SUCCESS;
+	return pid;
 }
 
 /**
@@ -151,18 +281,37 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 
 	/* If builtin command, execute the command. */
 	if (strcmp(s->verb->string, "cd") == 0) {
-		fflush(stdout);
 		int rt = EXIT_SUCCESS;
-		int out_backup = dup(STDOUT_FILENO);
+		int fds[3], saved[3];
 
-		if (!handle_redirections(s))
+		if (!open_redirections(s, fds))
 			rt = EXIT_FAILURE;
 
+		apply_redirections(fds, saved);
+		close_redirections(fds);
 		rt |= shell_cd(s->params);
+		restore_redirections(saved);
 
-		fflush(stdout);
-		dup2(out_backup, STDOUT_FILENO);
-		close(out_backup);
+		return rt;
+	}
+
+	const struct builtin *builtin = find_builtin(s->verb->string);
+
+	if (builtin) {
+		int rt = EXIT_FAILURE;
+		int fds[3], saved[3];
+		int argc;
+		char **argv = get_argv(s, &argc);
+
+		/* Any of the three may be redirected, for this command only. */
+		if (open_redirections(s, fds)) {
+			apply_redirections(fds, saved);
+			close_redirections(fds);
+			rt = builtin->run(argc, argv);
+			restore_redirections(saved);
+		} else {
+			close_redirections(fds);
+		}
 
 		return rt;
 	}
@@ -178,30 +327,23 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 	if (s->verb && s->verb->next_part && s->verb->next_part->string &&
 		s->verb->next_part->string[0] == '=') {
 		const char *env_var = s->verb->string;
-		char *value = get_value(s->verb->next_part->next_part);
-
-		// Set or unset the environment variable
-		if (value[0] == '\0') {
-			if (unsetenv(env_var) == -1) {
-				perror("unsetenv");
-				return EXIT_FAILURE;
-			}
-		} else {
-			if (setenv(env_var, value, 1) == -1) {
-				perror("setenv");
-				return EXIT_FAILURE;
-			}
-		}
+		char *value = get_word(s->verb->next_part->next_part);
+
+		// Set or unset the variable
+		if (value == NULL || value[0] == '\0')
+			var_unset(env_var);
+		else
+			var_set(env_var, value);
 
-		free(value);
+		/* The remembered paths were found in the old $PATH. */
+		if (strcmp(env_var, "PATH") == 0)
+			hash_clear();
 
 		return EXIT_SUCCESS;
 	}
 
 	/* If external command:
-	 *   1. Fork new process
-	 *     2c. Perform redirections in child
-	 *     3c. Load executable in child
+	 *   1. Spawn it, with the redirections as file actions
 	 *   2. Wait for child
 	 *   3. Return exit status
 	 */
@@ -209,141 +351,351 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 	pid_t wait_ret;
 	int status;
 
-	char *command_path = get_word(s->verb);
-	int argc;
-	char **argv = get_argv(s, &argc);
+	pid = spawn_simple(s, -1, -1);
+	if (pid < 0)
+		return EXIT_FAILURE;
 
-	pid = fork();
-	switch (pid) {
-	case -1:
-		DIE(EXIT_FAILURE, "fork");
-		break;
+	wait_ret = trace_wait(pid, &status, 0);
+	DIE(wait_ret < 0, "waitpid");
 
-	case 0:
-		if (!handle_redirections(s))
-			return EXIT_FAILURE;
+	return WEXITSTATUS(status);
+}
 
-		execvp(command_path, argv);
+/**
+ * Start one command of a pipeline or of a parallel group, with in_fd and
+ * out_fd (unless -1) as its standard input and output. A simple external
+ * command is spawned directly, anything else runs in a forked subshell,
+ * which first closes the num_fds pipe descriptors in fds.
+ */
+static pid_t start_command(command_t *cmd, int in_fd, int out_fd, int *fds,
+						 int num_fds, int level, command_t *father)
+{
+	pid_t pid;
 
-		fprintf(stderr, "Execution failed for '%s'\n", command_path);
-		exit(EXIT_FAILURE);
+	if (cmd->op == OP_NONE && cmd->scmd && cmd->scmd->verb &&
+		cmd->scmd->verb->string && is_external(cmd->scmd))
+		return spawn_simple(cmd->scmd, in_fd, out_fd);
 
-	default:
-		wait_ret = waitpid(pid, &status, 0);
-		DIE(wait_ret < 0, "waitpid");
+	uint64_t start = trace_now();
 
-		free(command_path);
-		for (int i = 0; i < argc; i++)
-			free(argv[i]);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+	} else if (pid == 0) {
+		if (in_fd >= 0)
+			dup2(in_fd, STDIN_FILENO);
+		if (out_fd >= 0)
+			dup2(out_fd, STDOUT_FILENO);
+		for (int i = 0; i < num_fds; i++)
+			close(fds[i]);
+		jobs_forget();
+
+		/*
+		 * Not exit(), which would seek the shared stdin back to what this
+		 * copy of the shell has read so far.
+		 */
+		int status = parse_command(cmd, level + 1, father);
+
+		fflush(stdout);
+		_exit(status);
+	}
 
-		free(argv);
+	trace_child(pid, "subshell", start, trace_now() - start);
+
+	return pid;
+}
+
+/**
+ * Store the stages of a chain of pipes, left to right, and return how many
+ * there are. stages may be NULL, to only count them.
+ */
+static int get_stages(command_t *c, command_t **stages)
+{
+	int count;
 
-		return WEXITSTATUS(status);
+	if (c->op != OP_PIPE) {
+		if (stages)
+			stages[0] = c;
+		return 1;
 	}
 
-	return EXIT_SUCCESS;
+	count = get_stages(c->cmd1, stages);
+
+	return count + get_stages(c->cmd2, stages ? stages + count : NULL);
 }
 
 /**
- * Process two commands in parallel, by creating two children.
+ * Run a whole pipeline a | b | ... | z: every pipe is created up front, every
+ * stage is started once, and all of them are reaped by one loop.
  */
-static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
-							command_t *father)
+static int run_on_pipe(command_t *c, int level, command_t *father)
 {
-	int pid1, pid2;
-	int status1, status2;
+	int num_stages = get_stages(c, NULL);
+	command_t **stages = calloc(num_stages, sizeof(*stages));
+	pid_t *pids = calloc(num_stages, sizeof(*pids));
+	int *fds = calloc(2 * (num_stages - 1), sizeof(*fds));
+	int num_fds = 0;
+	int running = 0;
+	int status, last_status = 0;
+
+	DIE(stages == NULL || pids == NULL || fds == NULL, "calloc");
+	get_stages(c, stages);
+
+	/* Close-on-exec, so only the dup2'd copies reach the programs. */
+	for (int i = 0; i < num_stages - 1; i++) {
+		if (pipe2(fds + 2 * i, O_CLOEXEC) == -1) {
+			perror("pipe");
+			break;
+		}
+		num_fds += 2;
+	}
 
-	pid1 = fork();
+	if (num_fds == 2 * (num_stages - 1)) {
+		for (int i = 0; i < num_stages; i++) {
+			int in_fd = i > 0 ? fds[2 * (i - 1) + READ] : -1;
+			int out_fd = i < num_stages - 1 ? fds[2 * i + WRITE] : -1;
 
-	if (pid1 < 0) {
-		return false;
-	} else if (pid1 == 0) {
-		parse_command(cmd1, level + 1, father);
-		exit(EXIT_SUCCESS);
+			pids[i] = start_command(stages[i], in_fd, out_fd, fds, num_fds,
+									level, father);
+			running += pids[i] > 0;
+		}
 	}
 
-	pid2 = fork();
+	for (int i = 0; i < num_fds; i++)
+		close(fds[i]);
 
-	if (pid2 < 0) {
-		return false;
-	} else if (pid2 == 0) {
-		parse_command(cmd2, level + 1, father);
-		exit(EXIT_SUCCESS);
+	/* The status of the pipeline is the one of its last stage. */
+	last_status = pids[num_stages - 1] > 0 ? 0 : EXIT_FAILURE;
+	while (running > 0) {
+		pid_t pid = trace_wait(-1, &status, 0);
+
+		if (pid < 0) {
+			DIE(errno != EINTR, "waitpid");
+			continue;
+		}
+
+		for (int i = 0; i < num_stages; i++) {
+			if (pids[i] != pid)
+				continue;
+
+			running--;
+			if (i == num_stages - 1)
+				last_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			pid = 0;
+		}
+
+		/* A background job that finished meanwhile. */
+		if (pid != 0)
+			job_reaped(pid, status);
 	}
 
-	waitpid(pid1, &status1, 0);
-	waitpid(pid2, &status2, 0);
+	free(fds);
+	free(pids);
+	free(stages);
 
-	return (WIFEXITED(status1) && WIFEXITED(status2)) ? WEXITSTATUS(status2)
-													  : -1;
+	return last_status;
 }
 
 /**
- * Run commands by creating an anonymous pipe (cmd1 | cmd2).
+ * Store the commands of a chain of a & b & ..., left to right, and return
+ * how many there are. stages may be NULL, to only count them. A trailing &
+ * leaves an empty right side, which sets *background.
  */
-static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
-						command_t *father)
+static int get_parallel(command_t *c, command_t **members, bool *background)
 {
-	/* Redirect the output of cmd1 to the input of cmd2. */
-	int pipe_fd[2];
-	int pid1, pid2;
-	int status1, status2;
+	int count;
 
-	if (pipe(pipe_fd) == -1) {
-		perror("pipe");
-		return false;
+	if (c == NULL) {
+		*background = true;
+		return 0;
+	}
+
+	if (c->op != OP_PARALLEL) {
+		if (members)
+			members[0] = c;
+		return 1;
 	}
 
-	pid1 = fork();
+	count = get_parallel(c->cmd1, members, background);
 
-	if (pid1 < 0) {
-		perror("fork");
-		return false;
-	} else if (pid1 == 0) {
-		close(pipe_fd[READ]);
-		dup2(pipe_fd[WRITE], STDOUT_FILENO);
-		close(pipe_fd[WRITE]);
+	return count + get_parallel(c->cmd2, members ? members + count : NULL,
+								background);
+}
+
+/**
+ * Write a command back in shell syntax, for the job table.
+ */
+static void describe_command(FILE *f, command_t *c)
+{
+	static const char * const operators[] = {
+		[OP_SEQUENTIAL] = " ; ",
+		[OP_PARALLEL] = " & ",
+		[OP_CONDITIONAL_NZERO] = " || ",
+		[OP_CONDITIONAL_ZERO] = " && ",
+		[OP_PIPE] = " | ",
+	};
+
+	if (c == NULL)
+		return;
+
+	if (c->op == OP_NONE) {
+		arena_mark_t mark = arena_mark();
+		int argc;
+		char **argv = get_argv(c->scmd, &argc);
+
+		for (int i = 0; i < argc; i++)
+			fprintf(f, "%s%s", i ? " " : "", argv[i]);
+		arena_release(mark);
+		return;
+	}
 
-		exit(parse_command(cmd1, level + 1, father));
+	describe_command(f, c->cmd1);
+	if (c->op < OP_DUMMY && operators[c->op] && c->cmd2) {
+		fputs(operators[c->op], f);
+		describe_command(f, c->cmd2);
 	}
+}
+
+/**
+ * Start the num_members commands of a parallel group, at most limit of them
+ * at a time, and return once all of them did, with the status of the last
+ * one. Unless wait is set, they are all started at once and left running.
+ */
+static int start_group(command_t **members, pid_t *pids, int num_members,
+					   int limit, bool wait, int level, command_t *father)
+{
+	int next = 0, running = 0;
+	int status, last_status = EXIT_FAILURE;
+
+	while (next < num_members || running > 0) {
+		while (next < num_members && running < limit) {
+			pids[next] = start_command(members[next], -1, -1, NULL, 0, level,
+									   father);
+			running += pids[next] > 0;
+			next++;
+		}
 
-	pid2 = fork();
+		if (!wait || running == 0)
+			break;
 
-	if (pid2 < 0) {
-		perror("fork");
-		return false;
-	} else if (pid2 == 0) {
-		close(pipe_fd[WRITE]);
-		dup2(pipe_fd[READ], STDIN_FILENO);
-		close(pipe_fd[READ]);
+		pid_t pid = trace_wait(-1, &status, 0);
 
-		exit(parse_command(cmd2, level + 1, father));
+		if (pid < 0) {
+			DIE(errno != EINTR, "waitpid");
+			continue;
+		}
+
+		for (int i = 0; i < next; i++) {
+			if (pids[i] != pid)
+				continue;
+
+			running--;
+			if (i == num_members - 1)
+				last_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			pid = 0;
+		}
+
+		/* A background job that finished meanwhile. */
+		if (pid != 0)
+			job_reaped(pid, status);
+	}
+
+	return last_status;
+}
+
+/**
+ * Run the group a & b & ...: its commands start at once, at most
+ * $MAX_PARALLEL of them at a time if it is set, like xargs -P, and the
+ * shell waits for all of them. With a trailing & the group becomes a
+ * background job instead, and the shell goes on.
+ */
+static int run_in_parallel(command_t *c, int level, command_t *father)
+{
+	bool background = false;
+	int num_members = get_parallel(c, NULL, &background);
+	command_t **members = calloc(num_members + 1, sizeof(*members));
+	pid_t *pids = calloc(num_members + 1, sizeof(*pids));
+	const char *limit_var = var_get(MAX_PARALLEL_VAR);
+	int limit = limit_var ? atoi(limit_var) : 0;
+	int last_status = EXIT_SUCCESS;
+	int num_pids = 0;
+
+	DIE(members == NULL || pids == NULL, "calloc");
+	get_parallel(c, members, &background);
+
+	if (limit <= 0 || limit > num_members)
+		limit = num_members;
+
+	if (!background) {
+		last_status = start_group(members, pids, num_members, limit, true,
+								  level, father);
+	} else if (limit < num_members) {
+		/*
+		 * A limited background group needs someone to start the rest, that
+		 * is a subshell waiting for the group, which becomes the job.
+		 */
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+		} else if (pid == 0) {
+			jobs_forget();
+			last_status = start_group(members, pids, num_members, limit,
+									  true, level + 1, father);
+			fflush(stdout);
+			_exit(last_status);
+		} else {
+			pids[num_pids++] = pid;
+		}
+	} else {
+		start_group(members, pids, num_members, limit, false, level, father);
+
+		/* Only the started ones, a failed start was already reported. */
+		for (int i = 0; i < num_members; i++)
+			if (pids[i] > 0)
+				pids[num_pids++] = pids[i];
 	}
 
-	close(pipe_fd[READ]);
-	close(pipe_fd[WRITE]);
+	if (num_pids > 0) {
+		char *description;
+		size_t size;
+		FILE *f = open_memstream(&description, &size);
+
+		DIE(f == NULL, "open_memstream");
+		describe_command(f, c);
+		fputs(" &", f);
+		fclose(f);
 
-	waitpid(pid1, &status1, 0);
-	waitpid(pid2, &status2, 0);
+		job_add(pids, num_pids, description);
+		free(description);
+	}
 
-	return (WIFEXITED(status1) && WIFEXITED(status2)) ? WEXITSTATUS(status2)
-													  : -1;
+	free(pids);
+	free(members);
+
+	return last_status;
 }
 
 /**
- * Parse and execute a command.
+ * Execute a command, whose subcommands go through parse_command().
  */
-int parse_command(command_t *c, int level, command_t *father)
+static int run_command(command_t *c, int level, command_t *father)
 {
 	if (!c)
 		return EXIT_FAILURE;
 
-	/* Execute a simple command. */
-	if (c->op == OP_NONE)
-		return parse_simple(c->scmd, level, father);
-
 	int status1, status2;
 
+	/* Execute a simple command, its words are freed right after. */
+	if (c->op == OP_NONE) {
+		arena_mark_t mark = arena_mark();
+
+		status1 = parse_simple(c->scmd, level, father);
+		arena_release(mark);
+
+		return status1;
+	}
+
 	switch (c->op) {
 	case OP_SEQUENTIAL:
 		status1 = parse_command(c->cmd1, level + 1, c);
@@ -352,7 +704,7 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	case OP_PARALLEL:
 		/* Execute the commands simultaneously. */
-		return run_in_parallel(c->cmd1, c->cmd2, level, father);
+		return run_in_parallel(c, level, father);
 
 	case OP_CONDITIONAL_NZERO:
 		/* Execute the second command only if the first one
@@ -376,7 +728,7 @@ int parse_command(command_t *c, int level, command_t *father)
 		/* Redirect the output of the first command to the
 		 * input of the second.
 		 */
-		return run_on_pipe(c->cmd1, c->cmd2, level, father);
+		return run_on_pipe(c, level, father);
 
 	default:
 		return SHELL_EXIT;
@@ -384,3 +736,40 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	return EXIT_SUCCESS;
 }
+
+/**
+ * Parse and execute a command.
+ */
+int parse_command(command_t *c, int level, command_t *father)
+{
+	static const char * const names[] = {
+		[OP_SEQUENTIAL] = ";",
+		[OP_PARALLEL] = "&",
+		[OP_CONDITIONAL_NZERO] = "||",
+		[OP_CONDITIONAL_ZERO] = "&&",
+		[OP_PIPE] = "|",
+	};
+	uint64_t start;
+	char *description;
+	size_t size;
+	FILE *f;
+	int status;
+
+	if (!trace_enabled() || !c)
+		return run_command(c, level, father);
+
+	start = trace_now();
+	status = run_command(c, level, father);
+
+	f = open_memstream(&description, &size);
+	DIE(f == NULL, "open_memstream");
+	describe_command(f, c);
+	fclose(f);
+
+	trace_command(c->op == OP_NONE ? c->scmd->verb->string :
+				  c->op < OP_DUMMY && names[c->op] ? names[c->op] : "?",
+				  description, level, status, start);
+	free(description);
+
+	return status;
+}
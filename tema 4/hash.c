@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "vars.h"
+
+#define NUM_BUCKETS 64
+
+/* Search path used by execvp() when PATH is not set. */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+struct hash_entry {
+	char *name;
+	char *path;
+	unsigned int hits;
+	struct hash_entry *next;
+};
+
+static struct hash_entry *buckets[NUM_BUCKETS];
+
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+
+	return h % NUM_BUCKETS;
+}
+
+/**
+ * Walk $PATH like execvp() does, returning the first regular executable file
+ * named verb, allocated, or NULL.
+ */
+static char *search_path(const char *verb)
+{
+	const char *dirs = var_get("PATH");
+	size_t verb_length = strlen(verb);
+	char *candidate;
+	struct stat st;
+
+	if (dirs == NULL)
+		dirs = DEFAULT_PATH;
+
+	while (true) {
+		const char *end = strchr(dirs, ':');
+		size_t dir_length;
+
+		if (end == NULL)
+			end = dirs + strlen(dirs);
+		dir_length = end - dirs;
+
+		candidate = malloc(dir_length + verb_length + 2);
+		DIE(candidate == NULL, "Error allocating path.");
+
+		/* An empty entry stands for the current directory. */
+		if (dir_length == 0) {
+			memcpy(candidate, verb, verb_length + 1);
+		} else {
+			memcpy(candidate, dirs, dir_length);
+			candidate[dir_length] = '/';
+			memcpy(candidate + dir_length + 1, verb, verb_length + 1);
+		}
+
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+			access(candidate, X_OK) == 0)
+			return candidate;
+
+		free(candidate);
+
+		if (*end == '\0')
+			return NULL;
+
+		dirs = end + 1;
+	}
+}
+
+const char *hash_lookup(const char *verb)
+{
+	struct hash_entry **bucket;
+	struct hash_entry *entry;
+	char *path;
+
+	if (strchr(verb, '/') != NULL)
+		return verb;
+
+	bucket = &buckets[hash_name(verb)];
+	for (entry = *bucket; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->name, verb) == 0) {
+			entry->hits++;
+			return entry->path;
+		}
+	}
+
+	path = search_path(verb);
+	if (path == NULL)
+		return NULL;
+
+	entry = malloc(sizeof(*entry));
+	DIE(entry == NULL, "Error allocating hash entry.");
+
+	entry->name = strdup(verb);
+	DIE(entry->name == NULL, "Error allocating hash entry.");
+	entry->path = path;
+	entry->hits = 1;
+	entry->next = *bucket;
+	*bucket = entry;
+
+	return path;
+}
+
+void hash_clear(void)
+{
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		while (buckets[i] != NULL) {
+			struct hash_entry *next = buckets[i]->next;
+
+			free(buckets[i]->name);
+			free(buckets[i]->path);
+			free(buckets[i]);
+			buckets[i] = next;
+		}
+	}
+}
+
+void hash_print(FILE *stream)
+{
+	bool empty = true;
+
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		for (struct hash_entry *entry = buckets[i]; entry != NULL;
+			 entry = entry->next) {
+			if (empty)
+				fprintf(stream, "hits\tcommand\n");
+			fprintf(stream, "%4u\t%s\n", entry->hits, entry->path);
+			empty = false;
+		}
+	}
+
+	if (empty)
+		fprintf(stream, "hash: hash table empty\n");
+}
+
+int shell_hash(int argc, char **argv)
+{
+	int rt = EXIT_SUCCESS;
+
+	if (argc == 1) {
+		hash_print(stdout);
+		return EXIT_SUCCESS;
+	}
+
+	if (strcmp(argv[1], "-r") == 0) {
+		hash_clear();
+		return EXIT_SUCCESS;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (hash_lookup(argv[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", argv[i]);
+			rt = EXIT_FAILURE;
+		}
+	}
+
+	return rt;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdio.h>
+
+/**
+ * Absolute path of the executable that would run for verb, looked up in
+ * $PATH and remembered for the next calls. A verb containing a slash is
+ * returned as it is. NULL if nothing in $PATH matches.
+ */
+const char *hash_lookup(const char *verb);
+
+/**
+ * Forget every remembered path, after $PATH changed.
+ */
+void hash_clear(void);
+
+/**
+ * Print the remembered paths and how many times each one was used.
+ */
+void hash_print(FILE *stream);
+
+/**
+ * Internal hash command: "hash" prints the table, "hash -r" clears it and
+ * "hash name..." looks the names up.
+ */
+int shell_hash(int argc, char **argv);
+
+#endif /* _HASH_H */
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "jobs.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "utils.h"
+
+struct job {
+	int id;
+	pid_t *pids;
+	int num_pids;
+	int running;
+	int status;			/* Of the last child, once it exited. */
+	bool reported;
+	char *description;
+	struct job *next;
+};
+
+/* The jobs, by increasing number. */
+static struct job *jobs;
+
+static void job_free(struct job *job)
+{
+	free(job->pids);
+	free(job->description);
+	free(job);
+}
+
+int job_add(const pid_t *pids, int num_pids, const char *description)
+{
+	struct job **last = &jobs;
+	struct job *job;
+	int id = 1;
+
+	/* The lowest free number, like bash. */
+	while (*last) {
+		if ((*last)->id != id)
+			break;
+		id++;
+		last = &(*last)->next;
+	}
+
+	job = calloc(1, sizeof(*job));
+	DIE(job == NULL, "Error allocating job.");
+	job->pids = malloc(num_pids * sizeof(*job->pids));
+	DIE(job->pids == NULL, "Error allocating job.");
+	memcpy(job->pids, pids, num_pids * sizeof(*pids));
+	job->description = strdup(description);
+	DIE(job->description == NULL, "Error allocating job.");
+
+	job->id = id;
+	job->num_pids = num_pids;
+	job->running = num_pids;
+	job->next = *last;
+	*last = job;
+
+	if (isatty(STDIN_FILENO))
+		fprintf(stderr, "[%d] %d\n", id, pids[num_pids - 1]);
+
+	return id;
+}
+
+int job_reaped(pid_t pid, int status)
+{
+	for (struct job *job = jobs; job; job = job->next) {
+		for (int i = 0; i < job->num_pids; i++) {
+			if (job->pids[i] != pid)
+				continue;
+
+			job->pids[i] = -1;
+			job->running--;
+			if (i == job->num_pids - 1)
+				job->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static const char *job_state(struct job *job)
+{
+	static char buffer[32];
+
+	if (job->running > 0)
+		return "Running";
+	if (job->status == 0)
+		return "Done";
+
+	snprintf(buffer, sizeof(buffer), "Exit %d", job->status);
+	return buffer;
+}
+
+/**
+ * Remove the finished jobs, printing them first if print is set.
+ */
+static void jobs_prune(bool print)
+{
+	struct job **link = &jobs;
+
+	while (*link) {
+		struct job *job = *link;
+
+		if (job->running > 0) {
+			link = &job->next;
+			continue;
+		}
+
+		if (print && !job->reported)
+			fprintf(stderr, "[%d]  %-10s %s\n", job->id, job_state(job),
+					job->description);
+
+		*link = job->next;
+		job_free(job);
+	}
+}
+
+void jobs_notify(void)
+{
+	pid_t pid;
+	int status;
+
+	if (jobs == NULL)
+		return;
+
+	while ((pid = trace_wait(-1, &status, WNOHANG)) > 0)
+		job_reaped(pid, status);
+
+	jobs_prune(isatty(STDIN_FILENO));
+}
+
+void jobs_forget(void)
+{
+	while (jobs) {
+		struct job *next = jobs->next;
+
+		job_free(jobs);
+		jobs = next;
+	}
+}
+
+int shell_jobs(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	jobs_notify();
+
+	for (struct job *job = jobs; job; job = job->next)
+		printf("[%d]  %-10s %s\n", job->id, job_state(job), job->description);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Block until the job is done, reaping whatever child exits meanwhile.
+ */
+static int job_wait(struct job *job)
+{
+	pid_t pid;
+	int status;
+
+	while (job->running > 0) {
+		pid = trace_wait(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Nothing left to wait for, the children were reaped elsewhere. */
+			job->running = 0;
+			break;
+		}
+
+		job_reaped(pid, status);
+	}
+
+	job->reported = true;
+
+	return job->status;
+}
+
+static struct job *job_find(const char *spec)
+{
+	char *end;
+	long n;
+
+	if (spec[0] == '%') {
+		n = strtol(spec + 1, &end, 10);
+		for (struct job *job = jobs; job && *end == '\0'; job = job->next)
+			if (job->id == n)
+				return job;
+		return NULL;
+	}
+
+	n = strtol(spec, &end, 10);
+	for (struct job *job = jobs; job && *end == '\0'; job = job->next)
+		for (int i = 0; i < job->num_pids; i++)
+			if (job->pids[i] == n)
+				return job;
+
+	return NULL;
+}
+
+int shell_wait(int argc, char **argv)
+{
+	int rt = EXIT_SUCCESS;
+
+	if (argc == 1) {
+		for (struct job *job = jobs; job; job = job->next)
+			rt = job_wait(job);
+	} else {
+		for (int i = 1; i < argc; i++) {
+			struct job *job = job_find(argv[i]);
+
+			if (job == NULL) {
+				fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+				rt = 127;
+				continue;
+			}
+
+			rt = job_wait(job);
+		}
+	}
+
+	return rt;
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <sys/types.h>
+
+/**
+ * Register a background job made of num_pids running children. The
+ * description is copied. Returns the job number.
+ */
+int job_add(const pid_t *pids, int num_pids, const char *description);
+
+/**
+ * Tell the job table that a child was reaped by someone else. Returns
+ * whether it belonged to a job.
+ */
+int job_reaped(pid_t pid, int status);
+
+/**
+ * Reap the finished background children without blocking, and report the
+ * jobs that are done since the last call.
+ */
+void jobs_notify(void);
+
+/**
+ * Drop every job without waiting, in a forked subshell whose children they
+ * are not.
+ */
+void jobs_forget(void);
+
+/**
+ * Internal jobs command: list the background jobs.
+ */
+int shell_jobs(int argc, char **argv);
+
+/**
+ * Internal wait command: "wait" waits for every job, "wait %n" or
+ * "wait pid" for one of them. Returns the status of the last one.
+ */
+int shell_wait(int argc, char **argv);
+
+#endif /* _JOBS_H */
@@ -1,15 +1,25 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../util/parser/parser.h"
 #include "cmd.h"
+#include "jobs.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
 
 #define PROMPT             "> "
-#define CHUNK_SIZE         1024
+#define CHUNK_SIZE         65536
 
 
 void parse_error(const char *str, const int where)
@@ -18,61 +28,167 @@ void parse_error(const char *str, const int where)
 }
 
 /**
- * Readline from mini-shell.
+ * The commands come either from a script, mapped at once, or from a
+ * descriptor read in big blocks, a terminal giving back one line per read.
  */
-static char *read_line(void)
+struct input {
+	int fd;
+	char *data;
+	size_t size;
+	size_t capacity;		/* 0 for a mapped script. */
+	size_t pos;				/* Start of the next line. */
+	size_t scanned;			/* Bytes after pos known to have no newline. */
+	char *tail;				/* Last line of a mapping, without a newline. */
+	bool eof;
+	bool seek;				/* Keep the offset of fd at pos, for children. */
+};
+
+static void open_input(struct input *in, int fd)
 {
-	char *line = NULL;
-	int line_length = 0;
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = fd;
+
+	/* A private mapping, so that newlines can become string ends. */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		in->data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE, fd, 0);
+		if (in->data != MAP_FAILED) {
+			madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+			in->size = st.st_size;
+			in->eof = true;
+			in->seek = fd == STDIN_FILENO;
+			return;
+		}
+	}
 
-	char chunk[CHUNK_SIZE];
-	int chunk_length;
+	in->capacity = CHUNK_SIZE;
+	in->data = malloc(in->capacity);
+	DIE(in->data == NULL, "Error allocating command line");
+}
 
-	char *rc;
+static void close_input(struct input *in)
+{
+	if (in->capacity)
+		free(in->data);
+	else if (in->data)
+		munmap(in->data, in->size);
+	free(in->tail);
+}
 
-	int endline = 0;
+/**
+ * Read more input after the unfinished line, keeping room for its end.
+ */
+static void fill_input(struct input *in)
+{
+	ssize_t n;
 
-	while (!endline) {
-		rc = fgets(chunk, CHUNK_SIZE, stdin);
-		if (rc == NULL)
-			break;
+	if (in->pos > 0) {
+		in->size -= in->pos;
+		memmove(in->data, in->data + in->pos, in->size);
+		in->pos = 0;
+	}
 
-		chunk_length = strlen(chunk);
-		if (chunk[chunk_length - 1] == '\n') {
-			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
-				/* Windows */
-				chunk[chunk_length - 2] = 0;
-			else
-				chunk[chunk_length - 1] = 0;
-			endline = 1;
-		}
+	if (in->size + 1 == in->capacity) {
+		in->capacity *= 2;
+		in->data = realloc(in->data, in->capacity);
+		DIE(in->data == NULL, "Error allocating command line");
+	}
 
-		line = realloc(line, line_length + CHUNK_SIZE);
-		DIE(line == NULL, "Error allocating command line");
+	do {
+		n = read(in->fd, in->data + in->size, in->capacity - in->size - 1);
+	} while (n < 0 && errno == EINTR);
 
-		line[line_length] = '\0';
-		strcat(line, chunk);
+	if (n <= 0)
+		in->eof = true;
+	else
+		in->size += n;
+}
 
-		line_length += CHUNK_SIZE;
+/**
+ * Readline from mini-shell. The line lives in the input buffer, until the
+ * next call.
+ */
+static char *read_line(struct input *in)
+{
+	char *line, *newline;
+	size_t length;
+
+	/*
+	 * As with bash, the commands of a script on the standard input share
+	 * its offset: a command that reads it gets what follows its own line,
+	 * and the script goes on after what was read.
+	 */
+	if (in->seek) {
+		off_t offset = lseek(in->fd, 0, SEEK_CUR);
+
+		if (offset >= 0)
+			in->pos = (size_t)offset < in->size ? (size_t)offset : in->size;
 	}
 
+	for (;;) {
+		newline = memchr(in->data + in->pos + in->scanned, '\n',
+						 in->size - in->pos - in->scanned);
+		if (newline != NULL || in->eof)
+			break;
+
+		in->scanned = in->size - in->pos;
+		fill_input(in);
+	}
+
+	line = in->data + in->pos;
+	in->scanned = 0;
+
+	if (newline != NULL) {
+		length = newline - line;
+		in->pos += length + 1;
+	} else {
+		if (in->pos == in->size)
+			return NULL;
+
+		length = in->size - in->pos;
+		in->pos = in->size;
+
+		/* The buffer has room for the end of the line, a mapping may not. */
+		if (in->capacity == 0) {
+			free(in->tail);
+			in->tail = strndup(line, length);
+			DIE(in->tail == NULL, "Error allocating command line");
+			line = in->tail;
+		}
+	}
+
+	if (in->seek)
+		lseek(in->fd, in->pos, SEEK_SET);
+
+	/* Windows */
+	if (length > 0 && line[length - 1] == '\r')
+		length--;
+	line[length] = '\0';
+
 	return line;
 }
 
-static void start_shell(void)
+static void start_shell(struct input *in)
 {
+	bool interactive = isatty(in->fd);
 	char *line;
 	command_t *root;
 
 	int ret;
 
 	for (;;) {
-		printf(PROMPT);
-		fflush(stdout);
+		/* Report the background jobs that finished since the last line. */
+		jobs_notify();
+		if (interactive) {
+			printf(PROMPT);
+			fflush(stdout);
+		}
 		ret = 0;
 
 		root = NULL;
-		line = read_line();
+		line = read_line(in);
 		if (line == NULL)
 			return;
 		parse_line(line, &root);
@@ -81,16 +197,42 @@ static void start_shell(void)
 			ret = parse_command(root, 0, NULL);
 
 		free_parse_memory();
-		free(line);
 
 		if (ret == SHELL_EXIT)
 			break;
 	}
 }
 
-int main(void)
+/**
+ * mini-shell [script]: without a script, the commands are read from the
+ * standard input.
+ */
+int main(int argc, char *argv[])
 {
-	start_shell();
+	struct input in;
+	int fd = STDIN_FILENO;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [script]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 2) {
+		fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	vars_init();
+	trace_init();
+	open_input(&in, fd);
+	start_shell(&in);
+	close_input(&in);
+
+	if (fd != STDIN_FILENO)
+		close(fd);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,27 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# A script read from the standard input shares the offset of the descriptor
+# with its commands, as with bash: a command that reads the standard input
+# gets the rest of the script, not all of it again, and the script ends there.
+
+SHELL_BIN=${1:-./mini-shell}
+SCRIPT=$(mktemp)
+
+trap 'rm -f "$SCRIPT"' EXIT
+
+printf 'echo before\nwc -c\necho after\ncat\necho lost\n' > "$SCRIPT"
+
+# wc -c counts what follows its line, without reading it; cat reads the
+# rest of the script, which then ends.
+expected=$(printf 'before\n25\nafter\necho lost\n')
+actual=$("$SHELL_BIN" < "$SCRIPT")
+
+if [ "$actual" != "$expected" ]; then
+	echo "stdin_offset: FAILED"
+	echo "expected:"; echo "$expected"
+	echo "got:"; echo "$actual"
+	exit 1
+fi
+
+echo "stdin_offset: OK"
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "vars.h"
+
+/* A started child, until it is reaped. */
+struct traced_child {
+	pid_t pid;
+	uint64_t start;
+	uint64_t spawn_us;
+	char name[32];
+};
+
+/*
+ * Every event is one write() to a descriptor opened in append mode, so the
+ * forked subshells, which inherit it, add their own events safely.
+ */
+static int trace_fd = -1;
+static pid_t trace_owner;
+
+static struct traced_child *children;
+static size_t num_children, children_capacity;
+
+static void write_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static void write_event(char *event, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(trace_fd, event, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		event += n;
+		size -= n;
+	}
+}
+
+/**
+ * Close the array, from the shell that opened the trace only.
+ */
+static void trace_close(void)
+{
+	char end[128];
+	int size;
+
+	if (trace_fd < 0 || getpid() != trace_owner)
+		return;
+
+	size = snprintf(end, sizeof(end),
+					"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+					"\"args\":{\"name\":\"mini-shell\"}}\n]\n", trace_owner);
+	write_event(end, size);
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+void trace_init(void)
+{
+	const char *path = var_get(TRACE_VAR);
+
+	if (path == NULL || path[0] == '\0')
+		return;
+
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+					0644);
+	if (trace_fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	trace_owner = getpid();
+	write_event("[\n", 2);
+	atexit(trace_close);
+}
+
+bool trace_enabled(void)
+{
+	return trace_fd >= 0;
+}
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_command(const char *name, const char *cmd, int level, int status,
+				   uint64_t start)
+{
+	char *event;
+	size_t size;
+	FILE *f;
+
+	if (trace_fd < 0)
+		return;
+
+	f = open_memstream(&event, &size);
+	DIE(f == NULL, "open_memstream");
+
+	fputs("{\"name\":", f);
+	write_json_string(f, name);
+	fprintf(f, ",\"cat\":\"command\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"cmd\":",
+			(unsigned long)start, (unsigned long)(trace_now() - start),
+			getpid(), getpid());
+	write_json_string(f, cmd);
+	fprintf(f, ",\"level\":%d,\"status\":%d}},\n", level, status);
+	fclose(f);
+
+	write_event(event, size);
+	free(event);
+}
+
+void trace_child(pid_t pid, const char *name, uint64_t start,
+				 uint64_t spawn_us)
+{
+	struct traced_child *child;
+
+	if (trace_fd < 0 || pid <= 0)
+		return;
+
+	if (num_children == children_capacity) {
+		children_capacity = children_capacity ? 2 * children_capacity : 16;
+		children = realloc(children, children_capacity * sizeof(*children));
+		DIE(children == NULL, "Error allocating trace.");
+	}
+
+	child = &children[num_children++];
+	child->pid = pid;
+	child->start = start;
+	child->spawn_us = spawn_us;
+	snprintf(child->name, sizeof(child->name), "%s", name);
+}
+
+/**
+ * Write the span of a reaped child, with its resource usage.
+ */
+static void trace_reaped(pid_t pid, int status, struct rusage *usage)
+{
+	struct traced_child child;
+	char *event;
+	size_t size;
+	size_t i;
+	FILE *f;
+
+	for (i = 0; i < num_children; i++)
+		if (children[i].pid == pid)
+			break;
+	if (i == num_children)
+		return;
+
+	child = children[i];
+	children[i] = children[--num_children];
+
+	f = open_memstream(&event, &size);
+	DIE(f == NULL, "open_memstream");
+
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+			"\"args\":{\"name\":", pid);
+	write_json_string(f, child.name);
+	fputs("}},\n{\"name\":", f);
+	write_json_string(f, child.name);
+	fprintf(f, ",\"cat\":\"child\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"spawn_us\":%lu,"
+			"\"user_us\":%ld,\"sys_us\":%ld,\"max_rss_kb\":%ld,",
+			(unsigned long)child.start,
+			(unsigned long)(trace_now() - child.start), pid, pid,
+			(unsigned long)child.spawn_us,
+			usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec,
+			usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec,
+			usage->ru_maxrss);
+	if (WIFEXITED(status))
+		fprintf(f, "\"status\":%d}},\n", WEXITSTATUS(status));
+	else
+		fprintf(f, "\"signal\":%d}},\n", WTERMSIG(status));
+	fclose(f);
+
+	write_event(event, size);
+	free(event);
+}
+
+pid_t trace_wait(pid_t pid, int *status, int options)
+{
+	struct rusage usage;
+
+	if (trace_fd < 0)
+		return waitpid(pid, status, options);
+
+	pid = wait4(pid, status, options, &usage);
+	if (pid > 0)
+		trace_reaped(pid, *status, &usage);
+
+	return pid;
+}
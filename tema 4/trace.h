@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* File the execution trace is written to, when set. */
+#define TRACE_VAR "MINI_SHELL_TRACE"
+
+/**
+ * Start tracing if $MINI_SHELL_TRACE names a file. The trace is a Chrome
+ * trace (JSON array of events, for chrome://tracing or Perfetto): one span
+ * per command run by a shell process, and one per child, from its start to
+ * the moment it was reaped.
+ */
+void trace_init(void);
+
+/**
+ * Whether the trace is being written.
+ */
+bool trace_enabled(void);
+
+/**
+ * Monotonic time, in microseconds.
+ */
+uint64_t trace_now(void);
+
+/**
+ * Record the span of a command executed by this shell process, from start
+ * to now. cmd is written back in shell syntax by the caller, level is its
+ * depth.
+ */
+void trace_command(const char *name, const char *cmd, int level, int status,
+				   uint64_t start);
+
+/**
+ * Remember that the child pid was started at start, and that it took
+ * spawn_us until fork() or posix_spawn() returned.
+ */
+void trace_child(pid_t pid, const char *name, uint64_t start,
+				 uint64_t spawn_us);
+
+/**
+ * waitpid() that also records, for the traced children, their wall and CPU
+ * times from the wait4() resource usage, and their exit status.
+ */
+pid_t trace_wait(pid_t pid, int *status, int options);
+
+#endif /* _TRACE_H */
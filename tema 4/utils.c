@@ -1,45 +1,139 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "utils.h"
+#include "vars.h"
 
-/**
- * Concatenate parts of the word to obtain the command.
- */
-char *get_word(word_t *s)
-{
-	char *string = NULL;
-	int string_length = 0;
+/* Most commands fit in the first block, which is kept between commands. */
+#define ARENA_BLOCK_SIZE 4096
 
-	const char *substring = NULL;
-	int substring_length = 0;
+struct arena_block {
+	struct arena_block *prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
 
-	while (s != NULL) {
-		if (s->expand == true) {
-			substring = getenv(s->string);
+static struct arena_block *arena;
+static struct arena_block *spare;
 
-			/* Prevents strlen from failing. */
-			if (substring == NULL)
-				substring = "";
+void *arena_alloc(size_t size)
+{
+	struct arena_block *block = arena;
+	void *ptr;
+
+	size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+	if (block == NULL || block->size - block->used < size) {
+		if (spare != NULL && spare->size >= size) {
+			block = spare;
+			spare = NULL;
 		} else {
-			substring = s->string;
+			size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+			block = malloc(sizeof(*block) + block_size);
+			DIE(block == NULL, "Error allocating arena block.");
+			block->size = block_size;
 		}
 
-		substring_length = strlen(substring);
+		block->used = 0;
+		block->prev = arena;
+		arena = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+
+	return ptr;
+}
+
+arena_mark_t arena_mark(void)
+{
+	return (arena_mark_t){ arena, arena ? arena->used : 0 };
+}
+
+void arena_release(arena_mark_t mark)
+{
+	while (arena != mark.block) {
+		struct arena_block *block = arena;
+
+		arena = block->prev;
 
-		string = realloc(string, string_length + substring_length + 1);
-		DIE(string == NULL, "Error allocating word string.");
+		/* Keep one block, so that a loop of commands does not call malloc. */
+		if (spare == NULL && block->size == ARENA_BLOCK_SIZE)
+			spare = block;
+		else
+			free(block);
+	}
 
-		string[string_length] = '\0';
-		strcat(string, substring);
+	if (arena != NULL)
+		arena->used = mark.used;
+}
+
+static const char *get_part(word_t *part)
+{
+	const char *value;
+
+	if (!part->expand)
+		return part->string;
+
+	value = var_get(part->string);
+
+	/* Prevents strlen from failing. */
+	return value ? value : "";
+}
 
-		string_length += substring_length;
+/**
+ * Concatenate parts of the word to obtain the command. The lengths are
+ * measured first, so that the word is copied once, to its final place.
+ */
+char *get_word(word_t *s)
+{
+	struct {
+		const char *string;
+		size_t length;
+	} *parts;
+	int num_parts = 0;
+	size_t length = 0;
+	char *string;
+
+	if (s == NULL)
+		return NULL;
+
+	/* A plain word needs no copy of its parts. */
+	if (s->next_part == NULL) {
+		const char *value = get_part(s);
+
+		length = strlen(value);
+		string = arena_alloc(length + 1);
+		memcpy(string, value, length + 1);
+
+		return string;
+	}
+
+	for (word_t *part = s; part != NULL; part = part->next_part)
+		num_parts++;
+
+	parts = arena_alloc(num_parts * sizeof(*parts));
+	num_parts = 0;
+	for (word_t *part = s; part != NULL; part = part->next_part) {
+		parts[num_parts].string = get_part(part);
+		parts[num_parts].length = strlen(parts[num_parts].string);
+		length += parts[num_parts].length;
+		num_parts++;
+	}
 
-		s = s->next_part;
+	string = arena_alloc(length + 1);
+	length = 0;
+	for (int i = 0; i < num_parts; i++) {
+		memcpy(string + length, parts[i].string, parts[i].length);
+		length += parts[i].length;
 	}
+	string[length] = '\0';
 
 	return string;
 }
@@ -64,8 +158,7 @@ char **get_argv(simple_command_t *command, int *size)
 		argc++;
 	}
 
-	argv = calloc(argc + 1, sizeof(char *));
-	DIE(argv == NULL, "Error allocating argv.");
+	argv = arena_alloc((argc + 1) * sizeof(char *));
 
 	argv[0] = get_word(command->verb);
 	DIE(argv[0] == NULL, "Error retrieving word.");
@@ -79,6 +172,7 @@ char **get_argv(simple_command_t *command, int *size)
 		param = param->next_word;
 		argc++;
 	}
+	argv[argc] = NULL;
 
 	*size = argc;
 
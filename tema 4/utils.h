@@ -18,13 +18,36 @@
 	} while (0)
 
 /**
- * Concatenate parts of the word to obtain the command.
+ * Position in the command arena, to free everything allocated after it.
+ */
+typedef struct arena_mark {
+	struct arena_block *block;
+	size_t used;
+} arena_mark_t;
+
+/**
+ * Allocate from the command arena. The memory is only freed in bulk, by
+ * arena_release().
+ */
+void *arena_alloc(size_t size);
+
+arena_mark_t arena_mark(void);
+
+/**
+ * Free what was allocated from the arena since the mark was taken.
+ */
+void arena_release(arena_mark_t mark);
+
+/**
+ * Concatenate parts of the word to obtain the command. The string is
+ * allocated from the command arena.
  */
 char *get_word(word_t *s);
 
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+ * them directly to execv. The list and its strings are allocated from the
+ * command arena.
  */
 char **get_argv(simple_command_t *command, int *size);
 
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "vars.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define NUM_BUCKETS 256
+
+extern char **environ;
+
+/*
+ * A variable is kept as its "name=value" string, which the environment of
+ * the commands points to as it is.
+ */
+struct var {
+	char *entry;
+	size_t name_length;
+	unsigned int hash;
+	struct var *next;
+};
+
+static struct var *buckets[NUM_BUCKETS];
+static unsigned int num_vars;
+
+/* Environment of the commands, NULL once a variable changed. */
+static char **envp;
+
+static unsigned int hash_name(const char *name, size_t length)
+{
+	unsigned int h = 2166136261u;
+
+	for (size_t i = 0; i < length; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+
+	return h;
+}
+
+/* Link to the variable in its bucket, or to the NULL ending the bucket. */
+static struct var **find_var(const char *name, size_t length, unsigned int hash)
+{
+	struct var **link = &buckets[hash % NUM_BUCKETS];
+
+	while (*link != NULL && ((*link)->hash != hash || (*link)->name_length != length ||
+							 memcmp((*link)->entry, name, length) != 0))
+		link = &(*link)->next;
+
+	return link;
+}
+
+static char *make_entry(const char *name, size_t length, const char *value)
+{
+	size_t value_length = strlen(value);
+	char *entry = malloc(length + value_length + 2);
+
+	DIE(entry == NULL, "Error allocating variable.");
+
+	memcpy(entry, name, length);
+	entry[length] = '=';
+	memcpy(entry + length + 1, value, value_length + 1);
+
+	return entry;
+}
+
+static void set_var(const char *name, size_t length, const char *value, bool replace)
+{
+	unsigned int hash = hash_name(name, length);
+	struct var **link = find_var(name, length, hash);
+	struct var *var = *link;
+
+	if (var != NULL) {
+		if (!replace)
+			return;
+		free(var->entry);
+		var->entry = make_entry(name, length, value);
+	} else {
+		var = malloc(sizeof(*var));
+		DIE(var == NULL, "Error allocating variable.");
+
+		var->entry = make_entry(name, length, value);
+		var->name_length = length;
+		var->hash = hash;
+		var->next = NULL;
+		*link = var;
+		num_vars++;
+	}
+
+	free(envp);
+	envp = NULL;
+}
+
+void vars_init(void)
+{
+	/* The first definition of a name wins, as with getenv(). */
+	for (char **env = environ; *env != NULL; env++) {
+		const char *equal = strchr(*env, '=');
+
+		if (equal != NULL)
+			set_var(*env, equal - *env, equal + 1, false);
+	}
+}
+
+const char *var_get(const char *name)
+{
+	size_t length = strlen(name);
+	struct var *var = *find_var(name, length, hash_name(name, length));
+
+	return var != NULL ? var->entry + length + 1 : NULL;
+}
+
+void var_set(const char *name, const char *value)
+{
+	set_var(name, strlen(name), value, true);
+}
+
+void var_unset(const char *name)
+{
+	size_t length = strlen(name);
+	struct var **link = find_var(name, length, hash_name(name, length));
+	struct var *var = *link;
+
+	if (var == NULL)
+		return;
+
+	*link = var->next;
+	free(var->entry);
+	free(var);
+	num_vars--;
+
+	free(envp);
+	envp = NULL;
+}
+
+char **vars_environ(void)
+{
+	unsigned int count = 0;
+
+	if (envp != NULL)
+		return envp;
+
+	envp = malloc((num_vars + 1) * sizeof(*envp));
+	DIE(envp == NULL, "Error allocating environment.");
+
+	for (int i = 0; i < NUM_BUCKETS; i++)
+		for (struct var *var = buckets[i]; var != NULL; var = var->next)
+			envp[count++] = var->entry;
+	envp[count] = NULL;
+
+	return envp;
+}
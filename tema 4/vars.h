@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _VARS_H
+#define _VARS_H
+
+/**
+ * Variables of the shell, in a hash table of its own rather than in its
+ * environment. Every variable is exported to the commands, as assignments
+ * always were, through vars_environ().
+ */
+
+/**
+ * Import the environment the shell was started with.
+ */
+void vars_init(void);
+
+/**
+ * Value of the variable, or NULL if it is not set. The string is valid until
+ * the variable changes.
+ */
+const char *var_get(const char *name);
+
+void var_set(const char *name, const char *value);
+void var_unset(const char *name);
+
+/**
+ * Environment for the commands, as "name=value" strings. It is only built
+ * again after a variable changed.
+ */
+char **vars_environ(void);
+
+#endif /* _VARS_H */
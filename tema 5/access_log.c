@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "access_log.h"
+#include "http-parser/http_parser.h"
+#include "utils/util.h"
+#include "utils/debug.h"
+
+static int log_fd = -1;
+
+/* every ring that registered, the last one first */
+static struct access_log *logs;
+
+static void write_all(const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(log_fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* One line in the combined log format, without referrer and agent. */
+static int format_record(char *line, size_t size, const struct access_record *r)
+{
+	struct in_addr addr = { .s_addr = r->addr };
+	char client[INET_ADDRSTRLEN];
+	char date[32];
+	struct tm tm;
+
+	inet_ntop(AF_INET, &addr, client, sizeof(client));
+	strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", gmtime_r(&r->time, &tm));
+
+	return snprintf(line, size, "%s - - [%s] \"%s %.*s HTTP/%u.%u\" %u %lu %uus\n",
+			client, date, http_method_str(r->method), (int)sizeof(r->path), r->path,
+			r->version / 10, r->version % 10, r->status, (unsigned long)r->bytes,
+			r->duration_us);
+}
+
+/* Write out what the rings have, in one write(2) per buffer. Returns the records written. */
+static unsigned int drain(void)
+{
+	char buffer[64 * 1024];
+	size_t len = 0;
+	unsigned int count = 0;
+	struct access_log *log;
+
+	for (log = __atomic_load_n(&logs, __ATOMIC_ACQUIRE); log != NULL; log = log->next) {
+		unsigned int tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+
+		while (log->head != tail) {
+			struct access_record *r = &log->records[log->head % AWS_ACCESS_LOG_RING];
+
+			if (sizeof(buffer) - len < 256) {
+				write_all(buffer, len);
+				len = 0;
+			}
+			len += format_record(buffer + len, sizeof(buffer) - len, r);
+			__atomic_store_n(&log->head, log->head + 1, __ATOMIC_RELEASE);
+			count++;
+		}
+	}
+
+	write_all(buffer, len);
+
+	return count;
+}
+
+static void *writer_loop(void *arg)
+{
+	struct timespec period = { 0, AWS_ACCESS_LOG_PERIOD * 1000000L };
+
+	(void)arg;
+
+	while (1) {
+		if (drain() == 0)
+			nanosleep(&period, NULL);
+	}
+
+	return NULL;
+}
+
+int access_log_init(void)
+{
+	const char *path = getenv(AWS_ACCESS_LOG_ENV);
+	pthread_t writer;
+	int rc;
+
+	if (path == NULL || path[0] == '\0')
+		return 0;
+
+	log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (log_fd < 0) {
+		dlog(LOG_ERR, "Cannot open the access log %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	rc = pthread_create(&writer, NULL, writer_loop, NULL);
+	DIE(rc != 0, "pthread_create");
+	pthread_detach(writer);
+
+	return 1;
+}
+
+struct access_log *access_log_register(void)
+{
+	struct access_log *log;
+
+	if (log_fd < 0)
+		return NULL;
+
+	log = calloc(1, sizeof(*log));
+	DIE(log == NULL, "calloc");
+
+	log->next = __atomic_load_n(&logs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&logs, &log->next, log, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return log;
+}
+
+struct access_record *access_log_reserve(struct access_log *log)
+{
+	unsigned int head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+
+	if (log->tail - head == AWS_ACCESS_LOG_RING)
+		return NULL;
+
+	return &log->records[log->tail % AWS_ACCESS_LOG_RING];
+}
+
+void access_log_commit(struct access_log *log)
+{
+	__atomic_store_n(&log->tail, log->tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef ACCESS_LOG_H_
+#define ACCESS_LOG_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+/* file the requests are logged to, none by default */
+#define AWS_ACCESS_LOG_ENV	"AWS_ACCESS_LOG"
+
+/* records each worker may have waiting for the writer, a power of two */
+#define AWS_ACCESS_LOG_RING	4096
+
+/* milliseconds the writer sleeps when it found nothing to write */
+#define AWS_ACCESS_LOG_PERIOD	50
+
+/* A request that was answered, as the writer thread formats it. */
+struct access_record {
+	time_t time;
+	uint64_t bytes;
+	uint32_t duration_us;
+	uint32_t addr;			/* IPv4 address of the client */
+	uint16_t status;
+	uint8_t method;
+	uint8_t version;		/* 10 * major + minor */
+	char path[100];			/* cut when longer */
+};
+
+/*
+ * Records of a worker, in a ring it fills and the writer empties, without a
+ * lock: the worker never waits, a record that does not fit is dropped.
+ */
+struct access_log {
+	struct access_record records[AWS_ACCESS_LOG_RING];
+	unsigned int head;		/* next to write out, moved by the writer */
+	unsigned int tail;		/* next to fill, moved by the worker */
+	struct access_log *next;
+};
+
+/*
+ * Open the log named by AWS_ACCESS_LOG and start its writer thread. Returns
+ * 0 if the log is not asked for, or cannot be opened.
+ */
+int access_log_init(void);
+
+/* The ring of the calling worker, or NULL without a log. */
+struct access_log *access_log_register(void);
+
+/* A record to fill, or NULL if the ring is full. */
+struct access_record *access_log_reserve(struct access_log *log);
+void access_log_commit(struct access_log *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
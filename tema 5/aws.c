@@ -1,7 +1,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/types.h>
@@ -14,507 +17,2338 @@
 #include <arpa/inet.h>
 #include <sys/sendfile.h>
 #include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <libaio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 #include "aws.h"
+#include "access_log.h"
+#include "metrics.h"
 #include "utils/util.h"
 #include "utils/debug.h"
 #include "utils/sock_util.h"
 #include "utils/w_epoll.h"
+#ifdef AWS_URING
+#include "utils/w_uring.h"
+#endif
+
+/*
+ * Every worker thread runs its own event loop, with its own listener, epoll
+ * instance and AIO context, and only sees the connections it accepted.
+ */
 
 /* server socket file descriptor */
-static int listenfd;
+static __thread int listenfd;
 
 /* epoll file descriptor */
-static int epollfd;
+static __thread int epollfd;
+
+static __thread io_context_t ctx;
+
+/* signalled by the AIO context when reads complete */
+static __thread int aio_eventfd;
+
+#ifdef AWS_THREADPOOL
+/* Reads run on the thread pool instead, done ones signalled on aio_eventfd. */
+static int offload_threads;
+static __thread struct offload_queue offload_queue;
+#endif
+
+/* counters of this worker, and its ring of the access log if there is one */
+static __thread struct worker_metrics *metrics;
+static __thread struct access_log *access_log;
+
+/* events handled per epoll_wait() call */
+#define AWS_EPOLL_BATCH		256
+
+/* bytes per sendfile() call, and per wake up of a connection */
+#define AWS_SENDFILE_CHUNK	(256 * 1024)
+#define AWS_SENDFILE_BUDGET	(4 * AWS_SENDFILE_CHUNK)
+
+/* number of event loops, each with its own SO_REUSEPORT listener */
+static unsigned int num_workers = 1;
+
+#ifdef AWS_URING
+/* sizes of the submission and completion queues of each worker */
+#define AWS_URING_ENTRIES	256
+#define AWS_URING_CQ_ENTRIES	4096
+
+/* provided buffers the multishot receives fill, a power of two */
+#define AWS_URING_RECV_BUFFERS	128
+#define AWS_URING_RECV_GROUP	0
+
+/* registered buffers the files are read into, and sent from */
+#define AWS_URING_FILE_BUFFERS	32
+#define AWS_URING_CHUNK		(128 * 1024)
+
+/* io_uring was asked for, and whether this worker runs it */
+static int engine_uring;
+static __thread int uring_active;
+
+static void uring_close(struct connection *conn);
+#endif
+
+/*
+ * Free lists of each worker: connections and their buffers are reused
+ * rather than allocated again, up to max of them kept free.
+ */
+struct pool {
+	void *free;
+	unsigned int count;
+	unsigned int max;
+	size_t size;
+};
+
+static __thread struct pool connection_pool = { NULL, 0, 4096, sizeof(struct connection) };
+static __thread struct pool buffer_pool = { NULL, 0, 1024, BUFSIZ };
+static __thread struct pool aio_pool = {
+	NULL, 0, 64, AWS_AIO_BUFFERS * (sizeof(struct aio_buffer) + AWS_AIO_BUFSIZ)
+};
+
+static void *pool_get(struct pool *pool)
+{
+	void *p = pool->free;
+
+	if (p == NULL) {
+		p = malloc(pool->size);
+		DIE(p == NULL, "malloc");
+		return p;
+	}
+
+	pool->free = *(void **)p;
+	pool->count--;
+
+	return p;
+}
 
-static io_context_t ctx;
+static void pool_put(struct pool *pool, void *p)
+{
+	if (pool->count == pool->max) {
+		free(p);
+		return;
+	}
+
+	*(void **)p = pool->free;
+	pool->free = p;
+	pool->count++;
+}
 
 static int aws_on_path_cb(http_parser *p, const char *buf, size_t len)
 {
 	struct connection *conn = (struct connection *)p->data;
+	size_t total = conn->path_len + len;
+
+	/* A path split between two receives comes in two parts. */
+	if (total >= AWS_PATH_INLINE && conn->request_path == conn->path_inline) {
+		if (total >= BUFSIZ)
+			return 1;
+		conn->request_path = pool_get(&buffer_pool);
+		memcpy(conn->request_path, conn->path_inline, conn->path_len);
+	}
 
-	memcpy(conn->request_path, buf, len);
-	conn->request_path[len] = '\0';
+	memcpy(conn->request_path + conn->path_len, buf, len);
+	conn->path_len = total;
+	conn->request_path[total] = '\0';
 	conn->have_path = 1;
 
 	return 0;
 }
 
-static void connection_prepare_send_reply_header(struct connection *conn)
+/* Add to the name or value being received, which may come in parts. */
+static void header_append(struct connection *conn, const char *buf, size_t len)
 {
-	/* Prepare the connection buffer to send the reply header. */
-	struct stat st;
+	/* Too long for any header of interest, the rest is dropped. */
+	if (conn->header_len + len >= AWS_HEADER_INLINE) {
+		conn->header_len = AWS_HEADER_INLINE;
+		return;
+	}
 
-	fstat(conn->fd, &st);
-	conn->file_size = st.st_size;
-	sprintf(conn->send_buffer, "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n", conn->file_size);
-	conn->send_len = strlen(conn->send_buffer);
-	conn->state = STATE_SENDING_DATA;
-	dlog(LOG_INFO, "Sending header\n");
+	memcpy(conn->header_buf + conn->header_len, buf, len);
+	conn->header_len += len;
+	conn->header_buf[conn->header_len] = '\0';
 }
 
-static void connection_prepare_send_404(struct connection *conn)
+static enum request_header header_lookup(struct connection *conn)
 {
-	/* Prepare the connection buffer to send the 404 header. */
-	struct stat st;
-
-	fstat(conn->fd, &st);
-	conn->file_size = st.st_size;
-	sprintf(conn->send_buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: %ld"
-							"\r\nConnection: close\r\n\r\n", conn->file_size);
-	conn->send_len = strlen(conn->send_buffer);
-	conn->state = STATE_404_SENT;
-	dlog(LOG_INFO, "Sending 404\n");
+	if (conn->header_len == AWS_HEADER_INLINE)
+		return HEADER_NONE;
+	if (strcasecmp(conn->header_buf, "Range") == 0)
+		return HEADER_RANGE;
+	if (strcasecmp(conn->header_buf, "If-Modified-Since") == 0)
+		return HEADER_IF_MODIFIED_SINCE;
+	if (strcasecmp(conn->header_buf, "If-None-Match") == 0)
+		return HEADER_IF_NONE_MATCH;
+	if (strcasecmp(conn->header_buf, "If-Range") == 0)
+		return HEADER_IF_RANGE;
+	if (strcasecmp(conn->header_buf, "Accept-Encoding") == 0)
+		return HEADER_ACCEPT_ENCODING;
+
+	return HEADER_NONE;
 }
 
-static enum resource_type connection_get_resource_type(struct connection *conn)
+/*
+ * Parse a "bytes=first-last" range. Several ranges, or a syntax error, and
+ * the whole file is sent instead.
+ */
+static void header_parse_range(struct connection *conn, const char *value)
 {
-	/* Get resource type depending on request path/filename. Filename should
-	 * point to the static or dynamic folder.
-	 */
-	if (strstr(conn->request_path, AWS_REL_STATIC_FOLDER) == conn->request_path + 1)
-		return RESOURCE_TYPE_STATIC;
+	long long first = -1, last = -1;
+	char *end;
 
-	if (strstr(conn->request_path, AWS_REL_DYNAMIC_FOLDER) == conn->request_path + 1)
-		return RESOURCE_TYPE_DYNAMIC;
+	if (strncasecmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL)
+		return;
+	value += 6;
 
-	return RESOURCE_TYPE_NONE;
-}
+	if (*value != '-') {
+		if (*value < '0' || *value > '9')
+			return;
+		first = strtoll(value, &end, 10);
+		value = end;
+	}
+	if (*value++ != '-')
+		return;
+	if (*value >= '0' && *value <= '9') {
+		last = strtoll(value, &end, 10);
+		value = end;
+	}
+	while (*value == ' ' || *value == '\t')
+		value++;
+
+	if (*value != '\0' || (first < 0 && last < 0) || (last >= 0 && last < first))
+		return;
 
+	conn->range_first = first;
+	conn->range_last = last;
+	conn->conditions |= CONDITION_RANGE;
+}
 
-struct connection *connection_create(int sockfd)
+/*
+ * The codings of a list like "gzip, deflate;q=0.5, br;q=0", those with a
+ * weight of zero being refused.
+ */
+static void header_parse_accept_encoding(struct connection *conn, char *value)
 {
-	/* Initialize connection structure on given socket. */
-	struct connection *conn = calloc(1, sizeof(struct connection));
+	char *saveptr, *token;
+
+	for (token = strtok_r(value, ",", &saveptr); token != NULL;
+		 token = strtok_r(NULL, ",", &saveptr)) {
+		char *params = strchr(token, ';');
+		unsigned int bits = 0;
+		size_t len;
+
+		while (*token == ' ' || *token == '\t')
+			token++;
+		len = params != NULL ? (size_t)(params - token) : strlen(token);
+		while (len > 0 && (token[len - 1] == ' ' || token[len - 1] == '\t'))
+			len--;
+
+		if (len == 4 && strncasecmp(token, "gzip", 4) == 0)
+			bits = FILE_ENCODING_BIT(FILE_ENCODING_GZIP);
+		else if (len == 2 && strncasecmp(token, "br", 2) == 0)
+			bits = FILE_ENCODING_BIT(FILE_ENCODING_BR);
+		else if (len == 1 && token[0] == '*')
+			bits = FILE_ENCODING_BIT(FILE_ENCODING_GZIP) | FILE_ENCODING_BIT(FILE_ENCODING_BR);
+
+		if (params != NULL) {
+			char *q = strstr(params, "q=");
+
+			if (q != NULL && strtod(q + 2, NULL) == 0)
+				continue;
+		}
 
-	DIE(conn == NULL, "malloc");
+		conn->accept_encodings |= bits;
+	}
+}
 
-	conn->sockfd = sockfd;
-	conn->fd = -1;
-	conn->state = STATE_INITIAL;
+/* Keep a validator to be compared once the file is known. */
+static void header_copy_validator(char *validator, const char *value, size_t len)
+{
+	/* Too long, it matches nothing. */
+	if (len >= AWS_VALIDATOR_LEN)
+		len = 0;
 
-	return conn;
+	memcpy(validator, value, len);
+	validator[len] = '\0';
 }
 
-void connection_start_async_io(struct connection *conn)
+/* The value of the header was received whole. */
+static void header_done(struct connection *conn)
 {
-	/* Start asynchronous operation (read from file).
-	 * Use io_submit(2) & friends for reading data asynchronously.
-	 */
-	int rc;
+	struct tm tm;
 
-	conn->piocb[0] = &conn->iocb;
-	io_prep_pread(&conn->iocb, conn->fd, conn->recv_buffer, BUFSIZ, conn->file_pos);
+	while (conn->header_len > 0 && conn->header_len < AWS_HEADER_INLINE &&
+		   (conn->header_buf[conn->header_len - 1] == ' ' ||
+		    conn->header_buf[conn->header_len - 1] == '\t'))
+		conn->header_buf[--conn->header_len] = '\0';
 
-	rc = io_submit(ctx, 1, conn->piocb);
-	if (rc != 1) {
-		perror("io_submit");
-		exit(EXIT_FAILURE);
+	if (conn->header != HEADER_NONE && conn->header_len < AWS_HEADER_INLINE) {
+		switch (conn->header) {
+		case HEADER_RANGE:
+			header_parse_range(conn, conn->header_buf);
+			break;
+		case HEADER_IF_MODIFIED_SINCE:
+			memset(&tm, 0, sizeof(tm));
+			if (strptime(conn->header_buf, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+				break;
+			conn->if_modified_since = timegm(&tm);
+			conn->conditions |= CONDITION_IF_MODIFIED_SINCE;
+			break;
+		case HEADER_ACCEPT_ENCODING:
+			header_parse_accept_encoding(conn, conn->header_buf);
+			break;
+		default:
+			break;
+		}
 	}
 
-	conn->piocb[0] = &conn->iocb;
-	io_prep_pwrite(&conn->iocb, conn->sockfd, conn->recv_buffer, BUFSIZ, 0);
-
-	rc = io_submit(ctx, 1, conn->piocb);
-	if (rc != 1) {
-		perror("io_submit");
-		exit(EXIT_FAILURE);
+	/* These are kept even when too long, and then never match. */
+	if (conn->header == HEADER_IF_NONE_MATCH) {
+		header_copy_validator(conn->if_none_match, conn->header_buf, conn->header_len);
+		conn->conditions |= CONDITION_IF_NONE_MATCH;
+	} else if (conn->header == HEADER_IF_RANGE) {
+		header_copy_validator(conn->if_range, conn->header_buf, conn->header_len);
+		conn->conditions |= CONDITION_IF_RANGE;
 	}
+
+	conn->header = HEADER_NONE;
+	conn->header_in_value = 0;
+	conn->header_len = 0;
 }
 
-void connection_remove(struct connection *conn)
+static int aws_on_header_field_cb(http_parser *p, const char *buf, size_t len)
 {
-	/* Remove connection handler. */
-	close(conn->sockfd);
-	conn->state = STATE_CONNECTION_CLOSED;
+	struct connection *conn = (struct connection *)p->data;
+
+	if (conn->header_in_value)
+		header_done(conn);
 
-	if (conn->fd != -1)
-		close(conn->fd);
+	header_append(conn, buf, len);
 
-	free(conn);
+	return 0;
 }
 
-int make_socket_non_blocking(int sockfd)
+static int aws_on_header_value_cb(http_parser *p, const char *buf, size_t len)
 {
-	int flags, s;
+	struct connection *conn = (struct connection *)p->data;
 
-	flags = fcntl(sockfd, F_GETFL, 0);
-	if (flags == -1) {
-		perror("fcntl");
-		return -1;
-	}
-	flags |= O_NONBLOCK;
-	s = fcntl(sockfd, F_SETFL, flags);
-	if (s == -1) {
-		perror("fcntl");
-		return -1;
+	if (!conn->header_in_value) {
+		conn->header = header_lookup(conn);
+		conn->header_in_value = 1;
+		conn->header_len = 0;
+		conn->header_buf[0] = '\0';
 	}
+
+	if (conn->header != HEADER_NONE)
+		header_append(conn, buf, len);
+
 	return 0;
 }
 
-void handle_new_connection(void)
+static int aws_on_headers_complete_cb(http_parser *p)
 {
-	/* Handle a new connection request on the server socket. */
-	static int sockfd;
-	socklen_t addrlen = sizeof(struct sockaddr_in);
-	struct sockaddr_in addr;
-	struct connection *conn;
-	int rc;
+	struct connection *conn = (struct connection *)p->data;
 
-	/* Accept new connection. */
-	sockfd = accept(listenfd, (SSA *) &addr, &addrlen);
-	DIE(sockfd < 0, "accept");
+	if (conn->header_in_value)
+		header_done(conn);
 
-	/* Set socket to be non-blocking. */
-	rc = make_socket_non_blocking(sockfd);
-	DIE(rc < 0, "make_socket_non_blocking");
+	conn->keep_alive = http_should_keep_alive(p);
 
-	/* Instantiate new connection handler. */
-	conn = connection_create(sockfd);
-	DIE(conn == NULL, "connection_create");
+	return 0;
+}
 
-	dlog(LOG_INFO, "New connection from %s:%d on socket %d\n",
-			inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), sockfd);
+/* Stop at the end of the request, the next ones get a fresh parser. */
+static int aws_on_message_complete_cb(http_parser *p)
+{
+	struct connection *conn = (struct connection *)p->data;
 
-	/* Add socket to epoll. */
-	rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_ptr_in");
+	conn->state = STATE_REQUEST_RECEIVED;
 
-	/* Initialize HTTP_REQUEST parser. */
-	http_parser *parser = &conn->request_parser;
+	return 1;
+}
 
-	http_parser_init(parser, HTTP_REQUEST);
-	parser->data = conn;
+static const http_parser_settings aws_parser_settings = {
+	.on_path = aws_on_path_cb,
+	.on_header_field = aws_on_header_field_cb,
+	.on_header_value = aws_on_header_value_cb,
+	.on_headers_complete = aws_on_headers_complete_cb,
+	.on_message_complete = aws_on_message_complete_cb
+};
+
+/*
+ * Admission control. A worker serves up to max_connections at a time: at
+ * the cap, the epoll engine stops watching its listener, so that the new
+ * ones wait in the backlog until enough of the open ones close, and the
+ * replies sent meanwhile close their connection to make room. The io_uring
+ * engine, whose accept stays armed, and a worker out of file descriptors
+ * turn the new ones away with a 503 instead.
+ */
+static unsigned int max_connections = AWS_MAX_CONNECTIONS;
+
+enum listener_state {
+	LISTENER_ACTIVE,
+	LISTENER_PAUSED,		/* at the cap, until connections close */
+	LISTENER_PAUSED_NOFILE		/* accept failing, until the next tick */
+};
+
+static __thread enum listener_state listener_state;
+
+/* Closed to get a descriptor to accept with when out of them. */
+static __thread int reserve_fd = -1;
+
+static const char shed_reply[] =
+	"HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+	"Retry-After: 1\r\nConnection: close\r\n\r\n";
+
+static int at_capacity(void)
+{
+	return metrics->active >= max_connections;
 }
 
-void receive_data(struct connection *conn)
+static void listener_pause(enum listener_state state)
 {
-	/* Receive message on socket.
-	 * Store message in recv_buffer in struct connection.
-	 */
-	ssize_t bytes_recv;
+	int rc;
 
-	do {
-		bytes_recv = recv(conn->sockfd, conn->recv_buffer + conn->recv_len, BUFSIZ - conn->recv_len, 0);
-		dlog(LOG_INFO, "Received %ld bytes\n", bytes_recv);
+	if (listener_state == LISTENER_ACTIVE) {
+		rc = w_epoll_remove_ptr(epollfd, listenfd, &listenfd);
+		DIE(rc < 0, "w_epoll_remove_ptr");
+	}
 
-		if (bytes_recv < 0) {
-			dlog(LOG_ERR, "Error receiving data\n");
-			return;
-		}
+	listener_state = state;
+}
 
-		if (bytes_recv == 0 || strstr(conn->recv_buffer, "\r\n\r\n")) {
-			dlog(LOG_INFO, "Received request:\n%s\n", conn->recv_buffer);
-			dlog(LOG_INFO, "Request received\n");
-			return;
-		}
+static void listener_resume(void)
+{
+	int rc;
 
-		conn->recv_len += bytes_recv;
-	} while (bytes_recv > 0);
+	if (listener_state == LISTENER_ACTIVE)
+		return;
+
+	rc = w_epoll_add_ptr_in(epollfd, listenfd, &listenfd);
+	DIE(rc < 0, "w_epoll_add_ptr_in");
+
+	listener_state = LISTENER_ACTIVE;
 }
 
-int connection_open_file(struct connection *conn)
+/* Turn a new connection away, told to come back later. */
+static void connection_shed(int sockfd)
 {
-	/* Open file and update connection fields. */
-	char filepath[BUFSIZ] = {0};
+	ssize_t n;
+
+	/* Best effort, the socket buffer of a new connection is empty. */
+	n = send(sockfd, shed_reply, sizeof(shed_reply) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	(void)n;
+	close(sockfd);
 
-	strcat(filepath, AWS_DOCUMENT_ROOT);
-	strcat(filepath, conn->request_path + 1);
+	metrics_add(&metrics->shed, 1);
+}
 
-	dlog(LOG_INFO, "Opening file %s\n", conn->filename);
-	int fd = open(filepath, O_RDONLY);
+/*
+ * With the descriptors out, accept the next connection in place of the
+ * reserve to shed it, so that the backlog drains instead of accept failing
+ * over and over. Returns -1 with errno set if there was none, or no reserve.
+ */
+static int listener_shed_one(void)
+{
+	int sockfd, err;
 
-	if (fd < 0) {
-		perror("open");
-		conn->state = STATE_SENDING_404;
+	if (reserve_fd < 0) {
+		errno = EMFILE;
 		return -1;
 	}
 
-	dlog(LOG_INFO, "Opened file %s\n", filepath);
-	conn->fd = fd;
-	conn->state = STATE_SENDING_HEADER;
+	close(reserve_fd);
+	sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	err = errno;
+	if (sockfd >= 0)
+		connection_shed(sockfd);
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	errno = err;
 
-	return 0;
+	return sockfd >= 0 ? 0 : -1;
 }
 
-void connection_complete_async_io(struct connection *conn)
-{
-	/* Complete asynchronous operation; operation returns successfully.
-	 * Prepare socket for sending.
-	 */
-	struct io_event event;
-	int rc;
-
-	rc = io_getevents(ctx, 1, 1, &event, NULL);
-	if (rc != 1 || event.res < 0)
-		return;
+/*
+ * Connections waiting are kept in a timer wheel with one slot per second:
+ * one waiting for its request, or for the client to read its reply, sits in
+ * the slot of its deadline, and every tick closes the ones of the slots
+ * that came due.
+ */
+static __thread struct connection *timer_wheel[AWS_TIMER_SLOTS];
+static __thread time_t timer_now;
 
-	conn->file_pos += event.res;
+static time_t now_seconds(void)
+{
+	struct timespec ts;
 
-	rc = io_getevents(ctx, 1, 1, &event, NULL);
-	if (rc != 1 || event.res != BUFSIZ)
-		return;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
 
-	conn->file_size -= BUFSIZ;
-	conn->state = ((conn->file_size == 0) ? STATE_DATA_SENT : STATE_ASYNC_ONGOING);
+	return ts.tv_sec;
 }
 
-int parse_header(struct connection *conn)
+static uint64_t now_ns(void)
 {
-	/* Parse the HTTP header and extract the file path. */
-	/* Use mostly null settings except for on_path callback. */
-	http_parser_settings settings_on_path = {
-		.on_message_begin = 0,
-		.on_header_field = 0,
-		.on_header_value = 0,
-		.on_path = aws_on_path_cb,
-		.on_url = 0,
-		.on_fragment = 0,
-		.on_query_string = 0,
-		.on_body = 0,
-		.on_headers_complete = 0,
-		.on_message_complete = 0
-	};
-
-	return http_parser_execute(&conn->request_parser,
-								&settings_on_path,
-								conn->recv_buffer,
-								conn->recv_len) != conn->recv_len ? -1 : 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-enum connection_state connection_send_static(struct connection *conn)
+static void timer_remove(struct connection *conn)
 {
-	/* Send static data using sendfile(2). */
-	ssize_t bytes_sent = 0, total_bytes_sent = 0;
+	if (conn->timer_slot < 0)
+		return;
 
-	while (total_bytes_sent < conn->file_size) {
-		bytes_sent = sendfile(conn->sockfd, conn->fd, NULL, conn->file_size);
+	if (conn->timer_prev)
+		conn->timer_prev->timer_next = conn->timer_next;
+	else
+		timer_wheel[conn->timer_slot] = conn->timer_next;
+	if (conn->timer_next)
+		conn->timer_next->timer_prev = conn->timer_prev;
 
-		if (bytes_sent < 0)
-			return STATE_DATA_SENT;
+	conn->timer_prev = conn->timer_next = NULL;
+	conn->timer_slot = -1;
+}
 
-		total_bytes_sent += bytes_sent;
-	}
+static void timer_add(struct connection *conn, int timeout)
+{
+	int slot = (timer_now + timeout) % AWS_TIMER_SLOTS;
 
-	conn->file_size -= total_bytes_sent;
+	timer_remove(conn);
 
-	return conn->file_size == 0 ? STATE_DATA_SENT : STATE_SENDING_DATA;
+	conn->timer_slot = slot;
+	conn->timer_prev = NULL;
+	conn->timer_next = timer_wheel[slot];
+	if (conn->timer_next)
+		conn->timer_next->timer_prev = conn;
+	timer_wheel[slot] = conn;
 }
 
-int connection_send_data(struct connection *conn)
+/* Returns whether a tick passed. */
+static int timer_expire(void)
 {
-	/* May be used as a helper function. */
-	/* Send as much data as possible from the connection send buffer.
-	 * Returns the number of bytes sent or -1 if an error occurred
-	 */
-	ssize_t bytes_sent = 0, total_bytes_sent = 0;
+	time_t now = now_seconds();
+	int ticked = timer_now < now;
 
-	while (total_bytes_sent < conn->send_len) {
-		bytes_sent = send(conn->sockfd, conn->send_buffer + total_bytes_sent,
-							conn->send_len - total_bytes_sent, 0);
+	/* Catch up with every second that passed since the last tick. */
+	while (timer_now < now) {
+		timer_now++;
 
-		if (bytes_sent < 0) {
-			perror("send");
-			return -1;
-		}
+		struct connection *conn = timer_wheel[timer_now % AWS_TIMER_SLOTS];
 
-		total_bytes_sent += bytes_sent;
+		while (conn != NULL) {
+			struct connection *next = conn->timer_next;
+
+			dlog(LOG_INFO, "Closing connection on socket %d, past its deadline\n",
+					conn->sockfd);
+			connection_remove(conn);
+			conn = next;
+		}
 	}
 
-	conn->send_len -= total_bytes_sent;
+	return ticked;
+}
+
+/* Register the socket for events, unless it already is. */
+static void connection_wait_for(struct connection *conn, uint32_t events)
+{
+	int rc;
+
+	if (conn->events == events)
+		return;
 
-	if (conn->fd == -1)
-		conn->state = STATE_DATA_SENT;
-	else if (conn->res_type == RESOURCE_TYPE_STATIC)
-		conn->state = connection_send_static(conn);
+	if (events == EPOLLIN)
+		rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
+	else if (events == EPOLLOUT)
+		rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
 	else
-		conn->state = STATE_ASYNC_ONGOING;
+		rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr");
 
-	return total_bytes_sent;
+	conn->events = events;
 }
 
+/* Wait for the client to make room for the reply, or for the file reads. */
+static void connection_wait_to_send(struct connection *conn, uint32_t events)
+{
+	connection_wait_for(conn, events);
+	timer_add(conn, AWS_WRITE_TIMEOUT);
+}
 
-int connection_send_dynamic(struct connection *conn)
+/* Whether the entity tag is one of the list, compared weakly. */
+static int etag_listed(const char *list, const char *etag)
 {
-	/* Read data asynchronously.
-	 * Returns 0 on success and -1 on error.
-	 */
-	connection_start_async_io(conn);
-	connection_complete_async_io(conn);
+	size_t len = strlen(etag);
+
+	if (strcmp(list, "*") == 0)
+		return 1;
+
+	while (*list != '\0') {
+		while (*list == ' ' || *list == '\t' || *list == ',')
+			list++;
+		if (strncmp(list, "W/", 2) == 0)
+			list += 2;
+		if (strncmp(list, etag, len) == 0 &&
+			(list[len] == '\0' || list[len] == ',' || list[len] == ' ' || list[len] == '\t'))
+			return 1;
+		while (*list != '\0' && *list != ',')
+			list++;
+	}
 
 	return 0;
 }
 
-
-void handle_input(struct connection *conn)
+/* Whether the copy the client has is still current, for a 304. */
+static int connection_not_modified(struct connection *conn)
 {
-	/* Handle input information: may be a new message or notification of
-	 * completion of an asynchronous I/O operation.
-	 */
-	int rc;
+	struct file_entry *file = conn->file;
 
-	switch (conn->state) {
-	case STATE_INITIAL:
-		dlog(LOG_INFO, "Initial state\n");
-		conn->state = STATE_RECEIVING_DATA;
-		break;
-	case STATE_RECEIVING_DATA:
-		dlog(LOG_INFO, "Receiving data\n");
-		receive_data(conn);
+	/* If-None-Match takes precedence over If-Modified-Since. */
+	if (conn->conditions & CONDITION_IF_NONE_MATCH)
+		return etag_listed(conn->if_none_match, file->etag);
 
-		if (conn->recv_len <= 0) {
-			perror("recv");
-			connection_remove(conn);
-			dlog(LOG_INFO, "Error receiving data\n");
-			return;
-		}
+	if (conn->conditions & CONDITION_IF_MODIFIED_SINCE)
+		return file->mtime <= conn->if_modified_since;
 
-		conn->state = STATE_REQUEST_RECEIVED;
-		break;
-	case STATE_CONNECTION_CLOSED:
-		dlog(LOG_INFO, "Connection closed\n");
-		break;
-	default:
-		break;
+	return 0;
+}
+
+/*
+ * Resolve the range asked for against the size of the file, into file_pos
+ * and file_size. Returns 0 for the whole file, 1 for a part of it and -1 if
+ * none of the range is in the file.
+ */
+static int connection_select_range(struct connection *conn)
+{
+	struct file_entry *file = conn->file;
+	long long size = file->size;
+	long long first = conn->range_first, last = conn->range_last;
+
+	if (!(conn->conditions & CONDITION_RANGE))
+		return 0;
+
+	/* The range was for another version of the file: send all of it. */
+	if ((conn->conditions & CONDITION_IF_RANGE) &&
+		strcmp(conn->if_range, file->etag) != 0 &&
+		strcmp(conn->if_range, file->last_modified) != 0)
+		return 0;
+
+	if (first < 0) {
+		/* The last bytes, all of them if the file is shorter. */
+		if (last == 0)
+			return -1;
+		first = last < size ? size - last : 0;
+		last = size - 1;
+	} else if (last < 0 || last >= size) {
+		last = size - 1;
 	}
 
-	rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_update_ptr_inout");
+	if (first >= size)
+		return -1;
+
+	conn->file_pos = first;
+	conn->file_size = last + 1;
+
+	return 1;
 }
 
-void handle_output(struct connection *conn)
+static void connection_prepare_send_reply_header(struct connection *conn)
 {
-	/* Handle output information: may be a new valid requests or notification of
-	 * completion of an asynchronous I/O operation or invalid requests.
+	/* Prepare the connection buffer to send the reply header. A full
+	 * reply has its header rendered by the file cache, a partial or an
+	 * empty one is rendered here.
 	 */
-	int rc;
+	struct file_entry *file = conn->file;
+	const char *connection = conn->keep_alive ? "keep-alive" : "close";
+	int range;
+
+	conn->file_pos = 0;
+	conn->file_size = file->size;
+	conn->send_pos = 0;
+	conn->body = file->data;
+	conn->state = STATE_SENDING_HEADER;
 
-	dlog(LOG_INFO, "Connection status: %d\n", conn->state);
+	if (connection_not_modified(conn)) {
+		conn->status = 304;
+		conn->file_size = 0;
+		conn->send_len = snprintf(conn->send_buffer, sizeof(conn->send_buffer),
+				"HTTP/1.1 304 Not Modified\r\nLast-Modified: %s\r\nETag: %s\r\n"
+				"%sConnection: %s\r\n\r\n", file->last_modified, file->etag,
+				file->encoding_header, connection);
+		dlog(LOG_INFO, "Sending 304\n");
+		return;
+	}
 
-	switch (conn->state) {
-	case STATE_REQUEST_RECEIVED:
-		dlog(LOG_INFO, "Request received\n");
-		rc = parse_header(conn);
-		if (rc < 0) {
-			dlog(LOG_ERR, "Error parsing header\n");
-			conn->state = STATE_SENDING_404;
-			connection_remove(conn);
-			break;
-		}
-		conn->res_type = connection_get_resource_type(conn);
-		connection_open_file(conn);
-		dlog(LOG_INFO, "Request received: EXIT\n");
-		break;
-	case STATE_SENDING_404:
-		dlog(LOG_INFO, "Sending 404: ENTER\n");
-		connection_prepare_send_404(conn);
-		dlog(LOG_INFO, "Sending 404: EXIT\n");
-		break;
-	case STATE_SENDING_HEADER:
-		dlog(LOG_INFO, "Sending header: ENTER\n");
-		connection_prepare_send_reply_header(conn);
-		dlog(LOG_INFO, "Sending header: EXIT\n");
-		break;
-	case STATE_SENDING_DATA:
-		dlog(LOG_INFO, "Sending data\n");
-		rc = connection_send_data(conn);
-		if (rc <= 0) {
-			dlog(LOG_ERR, "Error sending data\n");
-			connection_remove(conn);
-			return;
-		}
-		break;
-	case STATE_ASYNC_ONGOING:
-		dlog(LOG_INFO, "Async ongoing\n");
-		connection_send_dynamic(conn);
-		break;
-	case STATE_DATA_SENT:
-		dlog(LOG_INFO, "Data sent\n");
-		w_epoll_update_fd_in(epollfd, conn->sockfd);
-		connection_remove(conn);
-		break;
-	case STATE_HEADER_SENT:
-		dlog(LOG_INFO, "Header sent\n");
-		w_epoll_update_fd_in(epollfd, conn->sockfd);
-		connection_remove(conn);
-		break;
-	case STATE_404_SENT:
-		dlog(LOG_INFO, "404 sent\n");
-		connection_remove(conn);
-		break;
-	default:
-		break;
+	range = connection_select_range(conn);
+	if (range < 0) {
+		conn->status = 416;
+		conn->file_size = 0;
+		conn->send_len = snprintf(conn->send_buffer, sizeof(conn->send_buffer),
+				"HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n"
+				"Content-Range: bytes */%ld\r\nConnection: %s\r\n\r\n",
+				(long)file->size, connection);
+		dlog(LOG_INFO, "Sending 416\n");
+		return;
 	}
 
-	if (conn->res_type == RESOURCE_TYPE_NONE) {
-		rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
-		DIE(rc < 0, "w_epoll_update_ptr_inout");
+	conn->status = range > 0 ? 206 : 200;
+	if (range > 0) {
+		conn->send_len = snprintf(conn->send_buffer, sizeof(conn->send_buffer),
+				"HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\n"
+				"Content-Range: bytes %zu-%zu/%ld\r\nAccept-Ranges: bytes\r\n"
+				"Last-Modified: %s\r\nETag: %s\r\n%sConnection: %s\r\n\r\n",
+				conn->file_size - conn->file_pos, conn->file_pos, conn->file_size - 1,
+				(long)file->size, file->last_modified, file->etag,
+				file->encoding_header, connection);
+		dlog(LOG_INFO, "Sending 206\n");
+	} else {
+		conn->send_len = file->header_len[conn->keep_alive != 0];
+		memcpy(conn->send_buffer, file->header[conn->keep_alive != 0], conn->send_len);
+		dlog(LOG_INFO, "Sending header\n");
 	}
+
+	/* The reads of a dynamic file start where the range does. */
+	conn->async_read_len = conn->file_pos;
 }
 
-void handle_client(uint32_t event, struct connection *conn)
+static void connection_prepare_send_404(struct connection *conn)
 {
-	/* Handle new client. There can be input and output connections.
-	 * Take care of what happened at the end of a connection.
-	 */
-	if (event & EPOLLIN)
-		handle_input(conn);
-
-	if (event & EPOLLOUT)
-		handle_output(conn);
+	/* Prepare the connection buffer to send the 404 header. */
+	conn->status = 404;
+	conn->file_size = 0;
+	conn->send_len = sprintf(conn->send_buffer,
+				"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+				conn->keep_alive ? "keep-alive" : "close");
+	conn->send_pos = 0;
+	conn->state = STATE_SENDING_404;
+	dlog(LOG_INFO, "Sending 404\n");
 }
 
-int main(void)
+/* IPv4 address of the client, in network order, looked up once. */
+static uint32_t connection_peer_addr(struct connection *conn)
 {
-	int rc;
-
-	/* Initialize asynchronous operations. */
-	rc = io_setup(128, &ctx);
-	DIE(rc < 0, "io_setup");
-
-	/* Initialize multiplexing. */
-	epollfd = w_epoll_create();
-	DIE(epollfd < 0, "w_epoll_create");
-
-	/* Create server socket. */
-	listenfd = tcp_create_listener(AWS_LISTEN_PORT, DEFAULT_LISTEN_BACKLOG);
-	DIE(listenfd < 0, "tcp_create_listener");
-
-	/* Add server socket to epoll object*/
-	rc = w_epoll_add_fd_in(epollfd, listenfd);
-	DIE(rc < 0, "w_epoll_add_fd_in");
-
-	/* Uncomment the following line for debugging. */
-	dlog(LOG_INFO, "Server waiting for connections on port %d\n", AWS_LISTEN_PORT);
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
 
-	/* server main loop */
-	while (1) {
-		struct epoll_event rev;
+	if (conn->peer_addr == 0 &&
+		getpeername(conn->sockfd, (SSA *) &addr, &addrlen) == 0 && addr.sin_family == AF_INET)
+		conn->peer_addr = addr.sin_addr.s_addr;
 
-		/* Wait for events. */
-		rc = w_epoll_wait_infinite(epollfd, &rev);
-		DIE(rc < 0, "w_epoll_wait_infinite");
+	return conn->peer_addr;
+}
 
-		/* Switch event types; consider
-		 *   - new connection requests (on server socket)
-		 *   - socket communication (on connection sockets)
-		 */
-		if (rev.data.fd == listenfd) {
-			if (rev.events & EPOLLIN)
-				handle_new_connection();
-			continue;
-		}
+/* The metrics are only for the host itself. */
+static int connection_is_local(struct connection *conn)
+{
+	return (ntohl(connection_peer_addr(conn)) >> 24) == 127;
+}
 
-		struct connection *conn = (struct connection *)rev.data.ptr;
+static void connection_prepare_send_metrics(struct connection *conn)
+{
+	size_t len;
 
-		dlog(LOG_INFO, "Handle client\n");
-		handle_client(rev.events, conn);
+	conn->body_buffer = metrics_render(&len);
+	if (conn->body_buffer == NULL) {
+		connection_prepare_send_404(conn);
+		return;
 	}
 
-	tcp_close_connection(listenfd);
+	conn->body = conn->body_buffer;
+	conn->status = 200;
+	conn->file_pos = 0;
+	conn->file_size = len;
+	conn->send_len = snprintf(conn->send_buffer, sizeof(conn->send_buffer),
+			"HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\nCache-Control: no-store\r\nConnection: %s\r\n\r\n",
+			len, conn->keep_alive ? "keep-alive" : "close");
+	conn->send_pos = 0;
+	conn->state = STATE_SENDING_HEADER;
+	dlog(LOG_INFO, "Sending metrics\n");
+}
+
+static enum resource_type connection_get_resource_type(struct connection *conn)
+{
+	/* Get resource type depending on request path/filename. Filename should
+	 * point to the static or dynamic folder.
+	 */
+	if (strstr(conn->request_path, AWS_REL_STATIC_FOLDER) == conn->request_path + 1)
+		return RESOURCE_TYPE_STATIC;
+
+	if (strstr(conn->request_path, AWS_REL_DYNAMIC_FOLDER) == conn->request_path + 1)
+		return RESOURCE_TYPE_DYNAMIC;
+
+	return RESOURCE_TYPE_NONE;
+}
+
+/* Give the file back to the cache; the connection is done with it. */
+static void connection_close_file(struct connection *conn)
+{
+	if (conn->file != NULL)
+		file_cache_put(conn->file);
+	conn->file = NULL;
+	conn->fd = -1;
+}
+
+/* Buffers of the pool, taken while the connection is receiving. */
+static void connection_get_recv_buffer(struct connection *conn)
+{
+	if (conn->recv_buffer == NULL)
+		conn->recv_buffer = pool_get(&buffer_pool);
+}
+
+static void connection_put_recv_buffer(struct connection *conn)
+{
+	if (conn->recv_buffer == NULL || conn->recv_len > 0)
+		return;
+
+	pool_put(&buffer_pool, conn->recv_buffer);
+	conn->recv_buffer = NULL;
+}
+
+static void connection_put_path(struct connection *conn)
+{
+	if (conn->request_path != conn->path_inline)
+		pool_put(&buffer_pool, conn->request_path);
+	conn->request_path = conn->path_inline;
+	conn->request_path[0] = '\0';
+	conn->path_len = 0;
+}
+
+/*
+ * Forget the request that was just answered, keeping the next ones that
+ * are already in recv_buffer, so the connection can serve them.
+ */
+static void connection_reset_request(struct connection *conn)
+{
+	connection_close_file(conn);
+	free(conn->body_buffer);
+	conn->body_buffer = NULL;
+	conn->body = NULL;
+
+	conn->recv_len -= conn->request_len;
+	memmove(conn->recv_buffer, conn->recv_buffer + conn->request_len, conn->recv_len);
+	conn->recv_buffer[conn->recv_len] = '\0';
+	conn->request_len = 0;
+	conn->parsed = 0;
+	connection_put_recv_buffer(conn);
+
+	/* The reads of the last reply are all done. */
+	if (conn->aio != NULL && conn->aio_inflight == 0) {
+		pool_put(&aio_pool, conn->aio);
+		conn->aio = NULL;
+	}
+
+	conn->file_size = 0;
+	conn->file_pos = 0;
+	conn->send_len = 0;
+	conn->send_pos = 0;
+	conn->async_read_len = 0;
+	conn->aio_head = 0;
+	conn->aio_tail = 0;
+	conn->have_path = 0;
+	connection_put_path(conn);
+	conn->header = HEADER_NONE;
+	conn->header_in_value = 0;
+	conn->header_len = 0;
+	conn->conditions = 0;
+	conn->accept_encodings = 0;
+	conn->res_type = RESOURCE_TYPE_NONE;
+	conn->keep_alive = 0;
+
+	http_parser_init(&conn->request_parser, HTTP_REQUEST);
+	conn->request_parser.data = conn;
+
+	conn->state = STATE_RECEIVING_DATA;
+}
+
+struct connection *connection_create(int sockfd)
+{
+	/* Initialize connection structure on given socket, reusing a freed
+	 * one if there is.
+	 */
+	struct connection *conn = pool_get(&connection_pool);
+
+	metrics_add(&metrics->accepted, 1);
+	metrics_add(&metrics->active, 1);
+
+	memset(conn, 0, sizeof(*conn));
+	conn->sockfd = sockfd;
+	conn->request_path = conn->path_inline;
+	conn->fd = -1;
+	conn->state = STATE_INITIAL;
+	conn->events = EPOLLIN;
+	conn->timer_slot = -1;
+	conn->uring_buffer = -1;
+
+	return conn;
+}
+
+static void connection_alloc_aio(struct connection *conn)
+{
+	char *data;
+
+	conn->aio = pool_get(&aio_pool);
+
+	data = (char *)(conn->aio + AWS_AIO_BUFFERS);
+	for (int i = 0; i < AWS_AIO_BUFFERS; i++) {
+		conn->aio[i].conn = conn;
+		conn->aio[i].data = data + i * AWS_AIO_BUFSIZ;
+		conn->aio[i].state = AIO_BUFFER_FREE;
+		conn->aio[i].sent = 0;
+	}
+}
+
+/* A read of the pipeline is done, res is its length or -errno. */
+static void aio_buffer_filled(struct aio_buffer *buffer, long res)
+{
+	/* A short read means the file shrank, and the length sent is wrong. */
+	if (res != (long)buffer->len) {
+		dlog(LOG_ERR, "Read of %zu bytes returned %ld\n", buffer->len, res);
+		buffer->len = 0;
+	}
+
+	buffer->sent = 0;
+	buffer->state = AIO_BUFFER_READY;
+}
+
+#ifdef AWS_THREADPOOL
+/* The read of the buffer, on a pool thread: it may block. */
+static void aio_buffer_read(struct offload_task *task)
+{
+	struct aio_buffer *buffer = (struct aio_buffer *)((char *)task -
+			offsetof(struct aio_buffer, task));
+	struct iocb *iocb = &buffer->iocb;
+	size_t pos = 0;
+	ssize_t n = 0;
+
+	while (pos < iocb->u.c.nbytes) {
+		n = pread(iocb->aio_fildes, (char *)iocb->u.c.buf + pos, iocb->u.c.nbytes - pos,
+			  iocb->u.c.offset + pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		pos += n;
+	}
+
+	buffer->res = pos > 0 || n == 0 ? (long)pos : -errno;
+}
+#endif
+
+void connection_start_async_io(struct connection *conn)
+{
+	/* Start asynchronous operation (read from file).
+	 * Every free buffer of the ring gets the next part of the file, and
+	 * all of them are submitted with one io_submit(2). The completions are
+	 * signalled on aio_eventfd.
+	 */
+	struct iocb *piocb[AWS_AIO_BUFFERS];
+	struct aio_buffer *buffers[AWS_AIO_BUFFERS];
+	int count = 0;
+	int rc;
+
+	if (conn->aio == NULL)
+		connection_alloc_aio(conn);
+
+	while (conn->async_read_len < conn->file_size) {
+		struct aio_buffer *buffer = &conn->aio[conn->aio_tail % AWS_AIO_BUFFERS];
+		size_t len = conn->file_size - conn->async_read_len;
+
+		if (buffer->state != AIO_BUFFER_FREE)
+			break;
+
+		if (len > AWS_AIO_BUFSIZ)
+			len = AWS_AIO_BUFSIZ;
+
+		io_prep_pread(&buffer->iocb, conn->fd, buffer->data, len, conn->async_read_len);
+		io_set_eventfd(&buffer->iocb, aio_eventfd);
+		buffer->iocb.data = buffer;
+		buffer->len = len;
+		buffer->state = AIO_BUFFER_READING;
+
+		piocb[count] = &buffer->iocb;
+		buffers[count++] = buffer;
+		conn->aio_tail++;
+		conn->async_read_len += len;
+	}
+
+	if (count == 0)
+		return;
+
+#ifdef AWS_THREADPOOL
+	if (offload_threads > 0) {
+		struct offload_task *tasks[AWS_AIO_BUFFERS];
+
+		for (int i = 0; i < count; i++) {
+			buffers[i]->task.run = aio_buffer_read;
+			tasks[i] = &buffers[i]->task;
+		}
+		offload_submit(&offload_queue, tasks, count);
+
+		conn->aio_inflight += count;
+		metrics_add(&metrics->aio_inflight, count);
+		return;
+	}
+#endif
+
+	rc = io_submit(ctx, count, piocb);
+	if (rc < 0)
+		rc = 0;
+	conn->aio_inflight += rc;
+	metrics_add(&metrics->aio_inflight, rc);
+
+	/* The context is full: read the rest now, rather than stall. */
+	for (int i = rc; i < count; i++) {
+		ssize_t n = pread(conn->fd, buffers[i]->data, buffers[i]->len,
+						  buffers[i]->iocb.u.c.offset);
+
+		aio_buffer_filled(buffers[i], n < 0 ? -errno : n);
+	}
+}
+
+/*
+ * Connections closed while a batch of events is handled are only freed
+ * after it, as a later event of the batch may still be for them, linked by
+ * their timer_next.
+ */
+static __thread struct connection *closed_connections;
+
+static void connection_free(struct connection *conn)
+{
+	metrics_add(&metrics->active, -1);
+	free(conn->body_buffer);
+	if (conn->aio != NULL)
+		pool_put(&aio_pool, conn->aio);
+	if (conn->recv_buffer != NULL)
+		pool_put(&buffer_pool, conn->recv_buffer);
+	connection_put_path(conn);
+	pool_put(&connection_pool, conn);
+
+	/* Accept again with some room, not to pause at every connection. */
+	if (listener_state == LISTENER_PAUSED &&
+	    metrics->active <= max_connections - max_connections / 8)
+		listener_resume();
+}
+
+static void connection_free_later(struct connection *conn)
+{
+	conn->timer_next = closed_connections;
+	closed_connections = conn;
+}
+
+static void free_closed_connections(void)
+{
+	while (closed_connections != NULL) {
+		struct connection *conn = closed_connections;
+
+		closed_connections = conn->timer_next;
+		connection_free(conn);
+	}
+}
+
+void connection_remove(struct connection *conn)
+{
+	/* Remove connection handler. */
+#ifdef AWS_URING
+	if (uring_active) {
+		uring_close(conn);
+		return;
+	}
+#endif
+
+	timer_remove(conn);
+	close(conn->sockfd);
+	conn->sockfd = -1;
+	conn->state = STATE_CONNECTION_CLOSED;
+
+	/* The reads in flight still use the file and the buffers, the last
+	 * completion closes it and frees.
+	 */
+	if (conn->aio_inflight > 0)
+		return;
+
+	connection_close_file(conn);
+	connection_free_later(conn);
+}
+
+int make_socket_non_blocking(int sockfd)
+{
+	int flags, s;
+
+	flags = fcntl(sockfd, F_GETFL, 0);
+	if (flags == -1) {
+		perror("fcntl");
+		return -1;
+	}
+	flags |= O_NONBLOCK;
+	s = fcntl(sockfd, F_SETFL, flags);
+	if (s == -1) {
+		perror("fcntl");
+		return -1;
+	}
+	return 0;
+}
+
+void handle_new_connection(void)
+{
+	/* Handle new connection requests on the server socket, until none is
+	 * left: with a batch of events, the listener is only reported once.
+	 */
+	int sockfd;
+	socklen_t addrlen;
+	struct sockaddr_in addr;
+	struct connection *conn;
+	int rc;
+
+	while (1) {
+		/* At the cap, the backlog keeps the next ones. */
+		if (at_capacity()) {
+			dlog(LOG_INFO, "At %u connections, not accepting\n", max_connections);
+			listener_pause(LISTENER_PAUSED);
+			return;
+		}
+
+		/* Accept new connection, already non-blocking. */
+		addrlen = sizeof(struct sockaddr_in);
+		sockfd = accept4(listenfd, (SSA *) &addr, &addrlen, SOCK_NONBLOCK);
+		if (sockfd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO ||
+			    errno == EPERM)
+				continue;
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+			    errno == ENOMEM) {
+				if (listener_shed_one() == 0)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return;
+
+				/* Not even that, try again on the next tick. */
+				dlog(LOG_ERR, "accept4: %s\n", strerror(errno));
+				listener_pause(LISTENER_PAUSED_NOFILE);
+				return;
+			}
+			DIE(1, "accept4");
+		}
+
+		/* Instantiate new connection handler. */
+		conn = connection_create(sockfd);
+		DIE(conn == NULL, "connection_create");
+
+		dlog(LOG_INFO, "New connection from %s:%d on socket %d\n",
+				inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), sockfd);
+
+		/* Add socket to epoll. */
+		rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
+		DIE(rc < 0, "w_epoll_add_ptr_in");
+
+		/* Initialize HTTP_REQUEST parser. */
+		http_parser *parser = &conn->request_parser;
+
+		http_parser_init(parser, HTTP_REQUEST);
+		parser->data = conn;
+
+		/* A client that connects and says nothing is idle too. */
+		conn->state = STATE_RECEIVING_DATA;
+		timer_add(conn, AWS_IDLE_TIMEOUT);
+	}
+}
+
+/*
+ * Feed the bytes received since the last call to the parser, which keeps
+ * its state in between. Its callbacks move the connection to
+ * STATE_REQUEST_RECEIVED at the exact end of the request, which is where
+ * the parsing stops; the bytes after it are pipelined requests. Returns -1
+ * if the request is malformed.
+ */
+static int connection_parse(struct connection *conn)
+{
+	size_t len = conn->recv_len - conn->parsed;
+	size_t parsed;
+
+	if (len == 0)
+		return 0;
+
+	parsed = http_parser_execute(&conn->request_parser, &aws_parser_settings,
+			conn->recv_buffer + conn->parsed, len);
+
+	/* Stopped by the callback on the last byte of the request. */
+	if (conn->state == STATE_REQUEST_RECEIVED) {
+		conn->parsed += parsed + 1;
+		conn->request_len = conn->parsed;
+		return 0;
+	}
+
+	if (parsed != len)
+		return -1;
+	conn->parsed += len;
+
+	return 0;
+}
+
+void receive_data(struct connection *conn)
+{
+	/* Receive message on socket.
+	 * Store message in recv_buffer in struct connection.
+	 */
+	ssize_t bytes_recv;
+
+	/* A pipelined request may be there already. */
+	if (connection_parse(conn) < 0)
+		goto malformed;
+
+	while (conn->state != STATE_REQUEST_RECEIVED) {
+		/* A request must fit in the buffer, with its terminator. */
+		if (conn->recv_len == BUFSIZ - 1) {
+			dlog(LOG_ERR, "Request too long\n");
+			conn->state = STATE_CONNECTION_CLOSED;
+			return;
+		}
+
+		connection_get_recv_buffer(conn);
+		bytes_recv = recv(conn->sockfd, conn->recv_buffer + conn->recv_len,
+						  BUFSIZ - 1 - conn->recv_len, 0);
+		dlog(LOG_INFO, "Received %ld bytes\n", bytes_recv);
+
+		if (bytes_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			connection_put_recv_buffer(conn);
+			return;
+		}
+
+		if (bytes_recv <= 0) {
+			/* A peer closing between requests is the normal end. */
+			if (bytes_recv < 0 || conn->recv_len > 0)
+				dlog(LOG_ERR, "Error receiving data\n");
+			conn->state = STATE_CONNECTION_CLOSED;
+			return;
+		}
+
+		conn->recv_len += bytes_recv;
+		conn->recv_buffer[conn->recv_len] = '\0';
+		if (connection_parse(conn) < 0)
+			goto malformed;
+	}
+
+	dlog(LOG_INFO, "Received request:\n%.*s\n", (int)conn->request_len, conn->recv_buffer);
+	return;
+
+malformed:
+	dlog(LOG_ERR, "Error parsing header\n");
+	conn->state = STATE_CONNECTION_CLOSED;
+}
+
+int connection_open_file(struct connection *conn)
+{
+	/* Open file and update connection fields. A hot file is already
+	 * open, with its size known. When the client accepts a coding the
+	 * file was also compressed in, brotli first, that copy is sent.
+	 */
+	struct file_entry *file = file_cache_get(conn->request_path, FILE_ENCODING_IDENTITY);
+	unsigned int encodings;
+
+	if (file == NULL) {
+		conn->state = STATE_SENDING_404;
+		return -1;
+	}
+
+	encodings = file->sidecars & conn->accept_encodings;
+	for (int encoding = FILE_ENCODINGS - 1; encodings != 0 && encoding > 0; encoding--) {
+		struct file_entry *sidecar;
+
+		if (!(encodings & FILE_ENCODING_BIT(encoding)))
+			continue;
+
+		sidecar = file_cache_get(conn->request_path, encoding);
+		if (sidecar != NULL) {
+			file_cache_put(file);
+			file = sidecar;
+			break;
+		}
+	}
+
+	conn->file = file;
+	conn->fd = file->fd;
+	conn->state = STATE_SENDING_HEADER;
+
+	return 0;
+}
+
+static void connection_run(struct connection *conn);
+
+void connection_complete_async_io(struct aio_buffer *buffer, long res)
+{
+	/* Complete asynchronous operation; the buffer can be sent now, unless
+	 * the connection was closed meanwhile.
+	 */
+	struct connection *conn = buffer->conn;
+
+	conn->aio_inflight--;
+	metrics_add(&metrics->aio_inflight, -1);
+	aio_buffer_filled(buffer, res);
+
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		if (conn->aio_inflight == 0) {
+			connection_close_file(conn);
+			connection_free_later(conn);
+		}
+		return;
+	}
+
+	connection_run(conn);
+}
+
+/* Handle every AIO completion signalled on the eventfd. */
+static void handle_aio_completions(void)
+{
+	struct io_event events[AWS_AIO_BUFFERS * 16];
+	struct timespec no_wait = { 0, 0 };
+	uint64_t count;
+	int rc;
+
+	if (read(aio_eventfd, &count, sizeof(count)) < 0)
+		return;
+
+#ifdef AWS_THREADPOOL
+	if (offload_threads > 0) {
+		struct offload_task *task = offload_take(&offload_queue);
+
+		while (task != NULL) {
+			struct aio_buffer *buffer = (struct aio_buffer *)((char *)task -
+					offsetof(struct aio_buffer, task));
+
+			task = task->next;
+			connection_complete_async_io(buffer, buffer->res);
+		}
+		return;
+	}
+#endif
+
+	do {
+		rc = io_getevents(ctx, 0, sizeof(events) / sizeof(events[0]), events, &no_wait);
+		for (int i = 0; i < rc; i++)
+			connection_complete_async_io((struct aio_buffer *)events[i].data,
+										 (long)events[i].res);
+	} while (rc == sizeof(events) / sizeof(events[0]));
+}
+
+int parse_header(struct connection *conn)
+{
+	/* The header was parsed while it was received, check that it had the
+	 * file path.
+	 */
+	return conn->have_path ? 0 : -1;
+}
+
+enum connection_state connection_send_static(struct connection *conn)
+{
+	/* Send static data using sendfile(2), from file_pos on. At most
+	 * AWS_SENDFILE_BUDGET bytes go out per call, so that one big file does
+	 * not hold the event loop: a writable socket is reported again.
+	 */
+	size_t sent = 0;
+
+	while (conn->file_pos < conn->file_size && sent < AWS_SENDFILE_BUDGET) {
+		off_t offset = conn->file_pos;
+		size_t count = conn->file_size - conn->file_pos;
+		ssize_t bytes_sent;
+
+		if (count > AWS_SENDFILE_CHUNK)
+			count = AWS_SENDFILE_CHUNK;
+
+		bytes_sent = sendfile(conn->sockfd, conn->fd, &offset, count);
+		if (bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return STATE_SENDING_DATA;
+			if (errno == EINTR)
+				continue;
+			dlog(LOG_ERR, "sendfile: %s\n", strerror(errno));
+			return STATE_CONNECTION_CLOSED;
+		}
+
+		/* The file got shorter than the length already announced. */
+		if (bytes_sent == 0)
+			return STATE_CONNECTION_CLOSED;
+
+		conn->file_pos += bytes_sent;
+		sent += bytes_sent;
+	}
+
+	return conn->file_pos == conn->file_size ? STATE_DATA_SENT : STATE_SENDING_DATA;
+}
+
+int connection_send_data(struct connection *conn)
+{
+	/* May be used as a helper function. */
+	/* Send as much data as possible from the connection send buffer.
+	 * Returns the number of bytes sent, 0 if the socket is full, or -1 if
+	 * an error occurred.
+	 */
+	ssize_t bytes_sent = 0, total_bytes_sent = 0;
+	int flags = MSG_NOSIGNAL;
+
+	/* Hold the header back, to go out with the first bytes of the file.
+	 * Sent alone, Nagle would keep the body of a dynamic file waiting for
+	 * the delayed ACK of the header.
+	 */
+	if (conn->state == STATE_SENDING_HEADER && conn->file_pos < conn->file_size)
+		flags |= MSG_MORE;
+
+	while (conn->send_pos < conn->send_len) {
+		bytes_sent = send(conn->sockfd, conn->send_buffer + conn->send_pos,
+							conn->send_len - conn->send_pos, flags);
+
+		if (bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			dlog(LOG_ERR, "send: %s\n", strerror(errno));
+			return -1;
+		}
+
+		conn->send_pos += bytes_sent;
+		total_bytes_sent += bytes_sent;
+	}
+
+	return total_bytes_sent;
+}
+
+/*
+ * Send the header and the body in memory (a file of the memory cache, or the
+ * metrics) with one sendmsg(2), from where the last call stopped. Returns -1
+ * on error, 0 once all is sent and 1 while the socket is full.
+ */
+static int connection_send_cached(struct connection *conn)
+{
+	struct iovec iov[2];
+	struct msghdr msg = { .msg_iov = iov };
+	ssize_t bytes_sent;
+
+	while (conn->send_pos < conn->send_len || conn->file_pos < conn->file_size) {
+		msg.msg_iovlen = 0;
+		if (conn->send_pos < conn->send_len) {
+			iov[0].iov_base = conn->send_buffer + conn->send_pos;
+			iov[0].iov_len = conn->send_len - conn->send_pos;
+			msg.msg_iovlen++;
+		}
+		if (conn->file_pos < conn->file_size) {
+			iov[msg.msg_iovlen].iov_base = (char *)conn->body + conn->file_pos;
+			iov[msg.msg_iovlen].iov_len = conn->file_size - conn->file_pos;
+			msg.msg_iovlen++;
+		}
+
+		bytes_sent = sendmsg(conn->sockfd, &msg, MSG_NOSIGNAL);
+		if (bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			dlog(LOG_ERR, "sendmsg: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* The header goes first. */
+		size_t header = conn->send_len - conn->send_pos;
+
+		if ((size_t)bytes_sent < header) {
+			conn->send_pos += bytes_sent;
+			continue;
+		}
+		conn->send_pos = conn->send_len;
+		conn->file_pos += bytes_sent - header;
+	}
+
+	return 0;
+}
+
+int connection_send_dynamic(struct connection *conn)
+{
+	/* Send the buffers that were read, in file order, and reuse each sent
+	 * one to read further.
+	 * Returns -1 on error, 1 while the socket is full and 0 while the next
+	 * buffer is being read, or once the whole file was sent.
+	 */
+	connection_start_async_io(conn);
+
+	while (conn->file_pos < conn->file_size) {
+		struct aio_buffer *buffer = &conn->aio[conn->aio_head % AWS_AIO_BUFFERS];
+		ssize_t bytes_sent;
+
+		if (buffer->state != AIO_BUFFER_READY)
+			return 0;
+		if (buffer->len == 0)
+			return -1;
+
+		bytes_sent = send(conn->sockfd, buffer->data + buffer->sent,
+						  buffer->len - buffer->sent, MSG_NOSIGNAL);
+		if (bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			dlog(LOG_ERR, "send: %s\n", strerror(errno));
+			return -1;
+		}
+
+		buffer->sent += bytes_sent;
+		conn->file_pos += bytes_sent;
+
+		if (buffer->sent == buffer->len) {
+			buffer->state = AIO_BUFFER_FREE;
+			conn->aio_head++;
+			connection_start_async_io(conn);
+		}
+	}
+
+	conn->state = STATE_DATA_SENT;
+
+	return 0;
+}
+
+/*
+ * Parse the request that arrived and prepare its reply header.
+ */
+static void connection_handle_request(struct connection *conn)
+{
+	conn->request_start = now_ns();
+
+	if (parse_header(conn) < 0) {
+		dlog(LOG_ERR, "Error parsing header\n");
+		conn->state = STATE_CONNECTION_CLOSED;
+		return;
+	}
+
+	/* Over the cap, connections make room once their reply is sent. */
+	if (listener_state != LISTENER_ACTIVE || at_capacity())
+		conn->keep_alive = 0;
+
+	conn->res_type = connection_get_resource_type(conn);
+	if (strcmp(conn->request_path, AWS_METRICS_PATH) == 0 && connection_is_local(conn))
+		connection_prepare_send_metrics(conn);
+	else if (conn->res_type == RESOURCE_TYPE_NONE || connection_open_file(conn) < 0)
+		connection_prepare_send_404(conn);
+	else
+		connection_prepare_send_reply_header(conn);
+
+	/* A HEAD reply is the header alone, its Content-Length still that of
+	 * the body; nothing of the file is read or sent.
+	 */
+	if (conn->request_parser.method == HTTP_HEAD)
+		conn->file_pos = conn->async_read_len = conn->file_size;
+
+	conn->reply_len = conn->send_len + conn->file_size - conn->file_pos;
+}
+
+/* Account for the reply that was sent whole, and log it. */
+static void connection_request_done(struct connection *conn)
+{
+	uint64_t us = (now_ns() - conn->request_start) / 1000;
+	struct access_record *record;
+
+	metrics_add(&metrics->requests, 1);
+	metrics_add(&metrics->bytes_sent, conn->reply_len);
+	metrics_observe_latency(metrics, us);
+
+	if (access_log == NULL)
+		return;
+
+	record = access_log_reserve(access_log);
+	if (record == NULL) {
+		metrics_add(&metrics->log_dropped, 1);
+		return;
+	}
+
+	record->time = time(NULL);
+	record->bytes = conn->reply_len;
+	record->duration_us = us;
+	record->addr = connection_peer_addr(conn);
+	record->status = conn->status;
+	record->method = conn->request_parser.method;
+	record->version = 10 * conn->request_parser.http_major + conn->request_parser.http_minor;
+	strncpy(record->path, conn->request_path, sizeof(record->path));
+	access_log_commit(access_log);
+}
+
+/*
+ * Move the connection through its states until it has to wait for the
+ * socket, or is closed. A persistent connection goes back to receiving
+ * after each reply, and serves the pipelined requests without waiting.
+ */
+static void connection_run(struct connection *conn)
+{
+	int rc;
+
+	while (1) {
+		switch (conn->state) {
+		case STATE_INITIAL:
+		case STATE_RECEIVING_DATA:
+			receive_data(conn);
+			if (conn->state == STATE_RECEIVING_DATA) {
+				connection_wait_for(conn, EPOLLIN);
+				return;
+			}
+			break;
+		case STATE_REQUEST_RECEIVED:
+			timer_remove(conn);
+			connection_handle_request(conn);
+			break;
+		case STATE_SENDING_HEADER:
+			if (conn->body != NULL) {
+				rc = connection_send_cached(conn);
+				if (rc < 0) {
+					conn->state = STATE_CONNECTION_CLOSED;
+				} else if (rc > 0) {
+					connection_wait_to_send(conn, EPOLLOUT);
+					return;
+				} else {
+					conn->state = STATE_DATA_SENT;
+				}
+				break;
+			}
+			/* fallthrough */
+		case STATE_SENDING_404:
+			if (connection_send_data(conn) < 0) {
+				conn->state = STATE_CONNECTION_CLOSED;
+				break;
+			}
+			if (conn->send_pos < conn->send_len) {
+				connection_wait_to_send(conn, EPOLLOUT);
+				return;
+			}
+
+			if (conn->state == STATE_SENDING_404)
+				conn->state = STATE_404_SENT;
+			else if (conn->res_type == RESOURCE_TYPE_STATIC)
+				conn->state = STATE_SENDING_DATA;
+			else
+				conn->state = STATE_ASYNC_ONGOING;
+			break;
+		case STATE_SENDING_DATA:
+			conn->state = connection_send_static(conn);
+			if (conn->state == STATE_SENDING_DATA) {
+				connection_wait_to_send(conn, EPOLLOUT);
+				return;
+			}
+			break;
+		case STATE_ASYNC_ONGOING:
+			rc = connection_send_dynamic(conn);
+			if (rc < 0) {
+				conn->state = STATE_CONNECTION_CLOSED;
+				break;
+			}
+			if (conn->state == STATE_ASYNC_ONGOING) {
+				/* Waiting for the socket, or for the reads. */
+				connection_wait_to_send(conn, rc > 0 ? EPOLLOUT : 0);
+				return;
+			}
+			break;
+		case STATE_DATA_SENT:
+		case STATE_404_SENT:
+			connection_request_done(conn);
+			if (!conn->keep_alive) {
+				conn->state = STATE_CONNECTION_CLOSED;
+				break;
+			}
+
+			connection_reset_request(conn);
+			timer_add(conn, AWS_IDLE_TIMEOUT);
+			break;
+		case STATE_CONNECTION_CLOSED:
+		default:
+			dlog(LOG_INFO, "Connection closed\n");
+			connection_remove(conn);
+			return;
+		}
+	}
+}
+
+#ifdef AWS_URING
+/*
+ * io_uring engine, chosen with AWS_ENGINE=uring. A connection only lives
+ * through completions, and each ring enter submits every operation queued
+ * since the last one, so the system calls per request do not grow with the
+ * size of the file:
+ *   - one multishot accept reports all the new connections;
+ *   - one multishot recv per connection fills the provided buffers of a
+ *     ring the kernel picks from;
+ *   - files, static or dynamic, go out in chunks, each a read into a
+ *     registered buffer linked to the send of that buffer.
+ */
+enum uring_op {
+	URING_ACCEPT,
+	URING_TICK,
+	URING_RECV,
+	URING_SEND_HEADER,
+	URING_READ,
+	URING_SEND_FILE
+};
+
+/* The operation is kept in the low bits of the connection address. */
+#define URING_DATA(conn, op)	((uint64_t)(uintptr_t)(conn) | (op))
+#define URING_OP_MASK		7
+
+static __thread struct w_uring ring;
+static __thread struct io_uring_buf_ring *recv_ring;
+static __thread char *recv_buffers;
+static __thread char *file_buffers;
+static __thread int free_file_buffers[AWS_URING_FILE_BUFFERS];
+static __thread int num_free_file_buffers;
+static __thread struct __kernel_timespec uring_tick = { .tv_sec = 1 };
+static __thread struct pool chunk_pool = { NULL, 0, 64, AWS_URING_CHUNK };
+
+/* Make room for a chain of count entries, which one submit must take whole. */
+static void uring_reserve(unsigned int count)
+{
+	if (w_uring_sq_space(&ring) >= count)
+		return;
+
+	DIE(w_uring_submit_and_wait(&ring, 0) < 0, "io_uring_enter");
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe = w_uring_get_sqe(&ring);
+
+	if (sqe == NULL) {
+		uring_reserve(1);
+		sqe = w_uring_get_sqe(&ring);
+		DIE(sqe == NULL, "w_uring_get_sqe");
+	}
+
+	return sqe;
+}
+
+static void uring_accept(void)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listenfd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = URING_DATA(NULL, URING_ACCEPT);
+}
+
+/* Tick of the timer wheel. */
+static void uring_timer(void)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (uintptr_t)&uring_tick;
+	sqe->len = 1;
+	sqe->user_data = URING_DATA(NULL, URING_TICK);
+}
+
+static void uring_recv(struct connection *conn)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->sockfd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = AWS_URING_RECV_GROUP;
+	sqe->user_data = URING_DATA(conn, URING_RECV);
+	conn->uring_pending++;
+}
+
+/* Give a receive buffer back to the kernel. */
+static void uring_recycle_recv_buffer(unsigned short bid)
+{
+	unsigned short tail = recv_ring->tail;
+	struct io_uring_buf *buf = &recv_ring->bufs[tail & (AWS_URING_RECV_BUFFERS - 1)];
+
+	buf->addr = (uintptr_t)(recv_buffers + bid * BUFSIZ);
+	buf->len = BUFSIZ;
+	buf->bid = bid;
+	__atomic_store_n(&recv_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void uring_get_file_buffer(struct connection *conn)
+{
+	if (conn->uring_data != NULL)
+		return;
+
+	if (num_free_file_buffers > 0) {
+		conn->uring_buffer = free_file_buffers[--num_free_file_buffers];
+		conn->uring_data = file_buffers + (size_t)conn->uring_buffer * AWS_URING_CHUNK;
+		return;
+	}
+
+	/* All the registered ones are taken: a plain read into another. */
+	conn->uring_data = pool_get(&chunk_pool);
+}
+
+static void uring_put_file_buffer(struct connection *conn)
+{
+	if (conn->uring_buffer >= 0)
+		free_file_buffers[num_free_file_buffers++] = conn->uring_buffer;
+	else if (conn->uring_data != NULL)
+		pool_put(&chunk_pool, conn->uring_data);
+
+	conn->uring_buffer = -1;
+	conn->uring_data = NULL;
+}
+
+/* Read the next chunk of the file, linked to its send. */
+static void uring_send_chunk(struct connection *conn)
+{
+	struct io_uring_sqe *sqe;
+	size_t len = conn->file_size - conn->file_pos;
+
+	if (len > AWS_URING_CHUNK)
+		len = AWS_URING_CHUNK;
+
+	uring_reserve(2);
+
+	sqe = uring_get_sqe();
+	if (conn->uring_buffer >= 0) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = conn->uring_buffer;
+	} else {
+		sqe->opcode = IORING_OP_READ;
+	}
+	sqe->fd = conn->fd;
+	sqe->addr = (uintptr_t)conn->uring_data;
+	sqe->len = len;
+	sqe->off = conn->file_pos;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_DATA(conn, URING_READ);
+
+	sqe = uring_get_sqe();
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->sockfd;
+	sqe->addr = (uintptr_t)conn->uring_data;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sqe->user_data = URING_DATA(conn, URING_SEND_FILE);
+
+	conn->uring_len = len;
+	conn->uring_pending += 2;
+	timer_add(conn, AWS_WRITE_TIMEOUT);
+}
+
+/* Send the reply header, and the first chunk of the file right after it. */
+static void uring_send_reply(struct connection *conn)
+{
+	struct io_uring_sqe *sqe;
+	int body = conn->state == STATE_SENDING_HEADER && conn->file_pos < conn->file_size;
+
+	uring_reserve(3);
+
+	sqe = uring_get_sqe();
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->sockfd;
+	sqe->addr = (uintptr_t)conn->send_buffer;
+	sqe->len = conn->send_len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (body ? MSG_MORE : 0);
+	sqe->flags = body ? IOSQE_IO_LINK : 0;
+	sqe->user_data = URING_DATA(conn, URING_SEND_HEADER);
+	conn->uring_pending++;
+	timer_add(conn, AWS_WRITE_TIMEOUT);
+
+	if (!body)
+		return;
+
+	/* A body in memory goes out whole, right after. */
+	if (conn->body != NULL) {
+		sqe = uring_get_sqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = conn->sockfd;
+		sqe->addr = (uintptr_t)(conn->body + conn->file_pos);
+		sqe->len = conn->file_size - conn->file_pos;
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		sqe->user_data = URING_DATA(conn, URING_SEND_FILE);
+		conn->uring_len = conn->file_size - conn->file_pos;
+		conn->uring_pending++;
+		return;
+	}
+
+	uring_get_file_buffer(conn);
+	uring_send_chunk(conn);
+}
+
+/*
+ * Shutting the socket down ends its multishot recv and fails its sends, the
+ * last completion frees the connection.
+ */
+static void uring_close(struct connection *conn)
+{
+	if (conn->sockfd >= 0) {
+		dlog(LOG_INFO, "Connection closed\n");
+		timer_remove(conn);
+		shutdown(conn->sockfd, SHUT_RDWR);
+		close(conn->sockfd);
+		conn->sockfd = -1;
+		conn->state = STATE_CONNECTION_CLOSED;
+	}
+
+	if (conn->uring_pending > 0)
+		return;
+
+	uring_put_file_buffer(conn);
+	connection_close_file(conn);
+	connection_free(conn);
+}
+
+/* Like connection_run(), the sends being completions instead. */
+static void uring_run(struct connection *conn)
+{
+	while (1) {
+		switch (conn->state) {
+		case STATE_RECEIVING_DATA:
+			if (connection_parse(conn) < 0) {
+				dlog(LOG_ERR, "Error parsing header\n");
+				conn->state = STATE_CONNECTION_CLOSED;
+				break;
+			}
+			if (conn->state == STATE_RECEIVING_DATA)
+				return;
+			break;
+		case STATE_REQUEST_RECEIVED:
+			timer_remove(conn);
+			connection_handle_request(conn);
+			if (conn->state != STATE_CONNECTION_CLOSED) {
+				uring_send_reply(conn);
+				return;
+			}
+			break;
+		case STATE_DATA_SENT:
+		case STATE_404_SENT:
+			connection_request_done(conn);
+			uring_put_file_buffer(conn);
+			if (!conn->keep_alive) {
+				conn->state = STATE_CONNECTION_CLOSED;
+				break;
+			}
+
+			connection_reset_request(conn);
+			timer_add(conn, AWS_IDLE_TIMEOUT);
+			break;
+		case STATE_CONNECTION_CLOSED:
+			uring_close(conn);
+			return;
+		default:
+			/* A send is in flight. */
+			return;
+		}
+	}
+}
+
+static void uring_new_connection(int sockfd)
+{
+	struct connection *conn = connection_create(sockfd);
+
+	dlog(LOG_INFO, "New connection on socket %d\n", sockfd);
+
+	http_parser_init(&conn->request_parser, HTTP_REQUEST);
+	conn->request_parser.data = conn;
+
+	conn->state = STATE_RECEIVING_DATA;
+	timer_add(conn, AWS_IDLE_TIMEOUT);
+	uring_recv(conn);
+}
+
+static void uring_received(struct connection *conn, unsigned short bid, int len)
+{
+	if (conn->recv_len + len > BUFSIZ - 1) {
+		dlog(LOG_ERR, "Request too long\n");
+		conn->state = STATE_CONNECTION_CLOSED;
+	} else {
+		connection_get_recv_buffer(conn);
+		memcpy(conn->recv_buffer + conn->recv_len, recv_buffers + bid * BUFSIZ, len);
+		conn->recv_len += len;
+		conn->recv_buffer[conn->recv_len] = '\0';
+	}
+
+	uring_recycle_recv_buffer(bid);
+}
+
+static void uring_handle_completion(uint64_t data, int res, unsigned int flags)
+{
+	struct connection *conn = (struct connection *)(uintptr_t)(data & ~(uint64_t)URING_OP_MASK);
+	enum uring_op op = data & URING_OP_MASK;
+
+	if (op == URING_TICK) {
+		timer_expire();
+		uring_timer();
+		if (listener_state == LISTENER_PAUSED_NOFILE) {
+			listener_state = LISTENER_ACTIVE;
+			uring_accept();
+		}
+		return;
+	}
+
+	if (op == URING_ACCEPT) {
+		if (res >= 0 && at_capacity()) {
+			connection_shed(res);
+		} else if (res >= 0) {
+			uring_new_connection(res);
+		} else if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM) {
+			while (listener_shed_one() == 0)
+				;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* Not even that, accept again on the next tick. */
+				dlog(LOG_ERR, "accept: %s\n", strerror(errno));
+				listener_state = LISTENER_PAUSED_NOFILE;
+			}
+		} else {
+			dlog(LOG_ERR, "accept: %s\n", strerror(-res));
+		}
+		if (!(flags & IORING_CQE_F_MORE) && listener_state == LISTENER_ACTIVE)
+			uring_accept();
+		return;
+	}
+
+	if (!(flags & IORING_CQE_F_MORE))
+		conn->uring_pending--;
+
+	if (op == URING_RECV && res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+		if (conn->state == STATE_CONNECTION_CLOSED)
+			uring_recycle_recv_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+		else
+			uring_received(conn, flags >> IORING_CQE_BUFFER_SHIFT, res);
+	}
+
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		uring_close(conn);
+		return;
+	}
+
+	switch (op) {
+	case URING_RECV:
+		/* The peer closed, or the receive failed; out of buffers, it
+		 * is only re-armed.
+		 */
+		if (res == 0 || (res < 0 && res != -ENOBUFS))
+			conn->state = STATE_CONNECTION_CLOSED;
+		else if (!(flags & IORING_CQE_F_MORE))
+			uring_recv(conn);
+		break;
+	case URING_SEND_HEADER:
+		if (res != (int)conn->send_len)
+			conn->state = STATE_CONNECTION_CLOSED;
+		else if (conn->state == STATE_SENDING_404)
+			conn->state = STATE_404_SENT;
+		else if (conn->file_pos == conn->file_size)
+			conn->state = STATE_DATA_SENT;
+		else
+			conn->state = STATE_SENDING_DATA;
+		break;
+	case URING_READ:
+		/* A short read also cancels the send linked to it. */
+		if (res != (int)conn->uring_len)
+			conn->state = STATE_CONNECTION_CLOSED;
+		break;
+	case URING_SEND_FILE:
+		if (res != (int)conn->uring_len) {
+			conn->state = STATE_CONNECTION_CLOSED;
+			break;
+		}
+
+		conn->file_pos += res;
+		if (conn->file_pos < conn->file_size)
+			uring_send_chunk(conn);
+		else
+			conn->state = STATE_DATA_SENT;
+		break;
+	default:
+		break;
+	}
+
+	uring_run(conn);
+}
+
+/*
+ * Set up the ring of this worker, with its buffers. Returns -1 if the kernel
+ * lacks io_uring or the features used here.
+ */
+static int uring_setup(void)
+{
+	struct io_uring_buf_reg reg;
+	struct iovec iov[AWS_URING_FILE_BUFFERS];
+
+	if (w_uring_setup(&ring, AWS_URING_ENTRIES, AWS_URING_CQ_ENTRIES) < 0)
+		return -1;
+
+	/* Page aligned, as the kernel wants the buffer ring. */
+	recv_ring = mmap(NULL, AWS_URING_RECV_BUFFERS * sizeof(struct io_uring_buf),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	DIE(recv_ring == MAP_FAILED, "mmap");
+	recv_buffers = malloc(AWS_URING_RECV_BUFFERS * BUFSIZ);
+	DIE(recv_buffers == NULL, "malloc");
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)recv_ring;
+	reg.ring_entries = AWS_URING_RECV_BUFFERS;
+	reg.bgid = AWS_URING_RECV_GROUP;
+	if (w_uring_register(&ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		close(ring.fd);
+		return -1;
+	}
+
+	for (int i = 0; i < AWS_URING_RECV_BUFFERS; i++)
+		uring_recycle_recv_buffer(i);
+
+	/* Without registered buffers, every file is read into the heap. */
+	file_buffers = mmap(NULL, (size_t)AWS_URING_FILE_BUFFERS * AWS_URING_CHUNK,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	DIE(file_buffers == MAP_FAILED, "mmap");
+
+	for (int i = 0; i < AWS_URING_FILE_BUFFERS; i++) {
+		iov[i].iov_base = file_buffers + (size_t)i * AWS_URING_CHUNK;
+		iov[i].iov_len = AWS_URING_CHUNK;
+	}
+
+	if (w_uring_register(&ring, IORING_REGISTER_BUFFERS, iov, AWS_URING_FILE_BUFFERS) < 0) {
+		dlog(LOG_ERR, "Cannot register file buffers: %s\n", strerror(errno));
+	} else {
+		for (int i = 0; i < AWS_URING_FILE_BUFFERS; i++)
+			free_file_buffers[num_free_file_buffers++] = i;
+	}
 
 	return 0;
 }
 
+static void uring_loop(void)
+{
+	struct io_uring_cqe *cqe;
+	int rc;
+
+	uring_accept();
+	uring_timer();
+
+	while (1) {
+		/* Submit everything queued, and wait for a completion. */
+		rc = w_uring_submit_and_wait(&ring, 1);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc < 0, "io_uring_enter");
+
+		while ((cqe = w_uring_peek_cqe(&ring)) != NULL) {
+			uint64_t data = cqe->user_data;
+			int res = cqe->res;
+			unsigned int flags = cqe->flags;
+
+			w_uring_cqe_seen(&ring);
+			uring_handle_completion(data, res, flags);
+		}
+	}
+}
+#endif
+
+void handle_input(struct connection *conn)
+{
+	/* Handle input information: a new message, or the peer closing. */
+	connection_run(conn);
+}
+
+void handle_output(struct connection *conn)
+{
+	/* Handle output information: room in the socket for the reply. */
+	connection_run(conn);
+}
+
+void handle_client(uint32_t event, struct connection *conn)
+{
+	/* Handle new client. There can be input and output connections.
+	 * Take care of what happened at the end of a connection.
+	 */
+	/* Closed by an earlier event of the batch. */
+	if (conn->state == STATE_CONNECTION_CLOSED)
+		return;
+
+	if (event & (EPOLLERR | EPOLLHUP)) {
+		dlog(LOG_INFO, "Connection reset on socket %d\n", conn->sockfd);
+		connection_remove(conn);
+		return;
+	}
+
+	if (event & EPOLLIN)
+		handle_input(conn);
+	else if (event & EPOLLOUT)
+		handle_output(conn);
+}
+
+/*
+ * Event loop of one worker. With more than one worker, each one has its own
+ * SO_REUSEPORT listener on the same port, so the kernel balances the
+ * connections among them and no accept lock is needed.
+ */
+static void *worker_loop(void *arg)
+{
+	int rc;
+
+	(void)arg;
+
+	timer_now = now_seconds();
+	metrics = metrics_register();
+	access_log = access_log_register();
+
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	DIE(reserve_fd < 0, "open");
+
+	/* Create server socket. */
+	if (num_workers > 1)
+		listenfd = tcp_create_reuseport_listener(AWS_LISTEN_PORT, AWS_LISTEN_BACKLOG);
+	else
+		listenfd = tcp_create_listener(AWS_LISTEN_PORT, AWS_LISTEN_BACKLOG);
+	DIE(listenfd < 0, "tcp_create_listener");
+
+	/* Connections are accepted until EAGAIN. */
+	rc = make_socket_non_blocking(listenfd);
+	DIE(rc < 0, "make_socket_non_blocking");
+
+#ifdef AWS_URING
+	if (engine_uring) {
+		if (uring_setup() == 0) {
+			uring_active = 1;
+			dlog(LOG_INFO, "Server waiting for connections on port %d (io_uring)\n",
+					AWS_LISTEN_PORT);
+			uring_loop();
+			return NULL;
+		}
+		dlog(LOG_ERR, "io_uring unavailable (%s), using epoll\n", strerror(errno));
+	}
+#endif
+
+	/* Initialize asynchronous operations. */
+	rc = io_setup(AWS_AIO_EVENTS, &ctx);
+	DIE(rc < 0, "io_setup");
+
+	aio_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	DIE(aio_eventfd < 0, "eventfd");
+
+#ifdef AWS_THREADPOOL
+	offload_queue_init(&offload_queue, aio_eventfd);
+#endif
+
+	/* Initialize multiplexing. */
+	epollfd = w_epoll_create();
+	DIE(epollfd < 0, "w_epoll_create");
+
+	/* Add server socket and AIO notifications to epoll object, told from
+	 * the connections by their address.
+	 */
+	rc = w_epoll_add_ptr_in(epollfd, listenfd, &listenfd);
+	DIE(rc < 0, "w_epoll_add_ptr_in");
+
+	rc = w_epoll_add_ptr_in(epollfd, aio_eventfd, &aio_eventfd);
+	DIE(rc < 0, "w_epoll_add_ptr_in");
+
+	/* Uncomment the following line for debugging. */
+	dlog(LOG_INFO, "Server waiting for connections on port %d\n", AWS_LISTEN_PORT);
+
+	/* server main loop */
+	while (1) {
+		struct epoll_event events[AWS_EPOLL_BATCH];
+		int num_events;
+
+		/* Wait for events, and handle every one that is ready. The timeout
+		 * is the tick of the timer wheel.
+		 */
+		num_events = w_epoll_wait_batch(epollfd, events, AWS_EPOLL_BATCH, 1000);
+		if (num_events < 0 && errno == EINTR)
+			continue;
+		DIE(num_events < 0, "w_epoll_wait_batch");
+
+		for (int i = 0; i < num_events; i++) {
+			struct epoll_event *rev = &events[i];
+
+			/* Switch event types; consider
+			 *   - new connection requests (on server socket)
+			 *   - completed file reads (on the eventfd)
+			 *   - socket communication (on connection sockets)
+			 */
+			if (rev->data.ptr == &listenfd) {
+				if (rev->events & EPOLLIN)
+					handle_new_connection();
+				continue;
+			}
+
+			if (rev->data.ptr == &aio_eventfd) {
+				handle_aio_completions();
+				continue;
+			}
+
+			struct connection *conn = (struct connection *)rev->data.ptr;
+
+			dlog(LOG_INFO, "Handle client\n");
+			handle_client(rev->events, conn);
+		}
+
+		if (timer_expire() && listener_state == LISTENER_PAUSED_NOFILE)
+			listener_resume();
+		free_closed_connections();
+	}
+
+	tcp_close_connection(listenfd);
+
+	return NULL;
+}
+
+int main(void)
+{
+	const char *workers = getenv(AWS_WORKERS_ENV);
+	const char *engine = getenv(AWS_ENGINE_ENV);
+	const char *max = getenv(AWS_MAX_CONNECTIONS_ENV);
+	const char *offload = getenv(AWS_OFFLOAD_ENV);
+	struct rlimit limit;
+	pthread_t *threads;
+	int rc;
+
+	if (workers != NULL && atoi(workers) > 0)
+		num_workers = atoi(workers);
+	if (max != NULL && atoi(max) > 0)
+		max_connections = atoi(max);
+
+	/* As many descriptors as allowed: a connection takes one, and its file
+	 * another while it is not cached.
+	 */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+			dlog(LOG_ERR, "setrlimit: %s\n", strerror(errno));
+	}
+
+	/* sendfile(2) to a peer that is gone raises SIGPIPE, it has no
+	 * MSG_NOSIGNAL: the error is enough.
+	 */
+	signal(SIGPIPE, SIG_IGN);
+
+	access_log_init();
+
+	if (offload != NULL && atoi(offload) > 0) {
+#ifdef AWS_THREADPOOL
+		rc = offload_init(atoi(offload));
+		DIE(rc < 0, "offload_init");
+		offload_threads = atoi(offload);
+#else
+		dlog(LOG_ERR, "Built without the thread pool, reading with AIO\n");
+#endif
+	}
+
+	if (engine != NULL && strcmp(engine, "uring") == 0) {
+#ifdef AWS_URING
+		engine_uring = 1;
+#else
+		dlog(LOG_ERR, "Built without io_uring, using epoll\n");
+#endif
+	}
+
+	/* The main thread is the last worker. */
+	threads = calloc(num_workers, sizeof(*threads));
+	DIE(threads == NULL, "calloc");
+
+	for (unsigned int i = 0; i + 1 < num_workers; i++) {
+		rc = pthread_create(&threads[i], NULL, worker_loop, NULL);
+		DIE(rc != 0, "pthread_create");
+	}
+
+	worker_loop(NULL);
+
+	for (unsigned int i = 0; i + 1 < num_workers; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	return 0;
+}
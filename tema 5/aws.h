@@ -3,7 +3,11 @@
 #ifndef AWS_H_
 #define AWS_H_		1
 
+#include <libaio.h>
+
 #include "http-parser/http_parser.h"
+#include "file_cache.h"
+#include "offload.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +20,33 @@ extern "C" {
 #define AWS_ABS_STATIC_FOLDER	(AWS_DOCUMENT_ROOT AWS_REL_STATIC_FOLDER)
 #define AWS_ABS_DYNAMIC_FOLDER	(AWS_DOCUMENT_ROOT AWS_REL_DYNAMIC_FOLDER)
 
+/* number of event loop threads, one by default */
+#define AWS_WORKERS_ENV		"AWS_WORKERS"
+
+/* I/O engine, "epoll" by default, or "uring" when built with URING=1 */
+#define AWS_ENGINE_ENV		"AWS_ENGINE"
+
+/* threads that read the dynamic files instead of AIO, when built with
+ * THREADPOOL=1; none by default
+ */
+#define AWS_OFFLOAD_ENV		"AWS_OFFLOAD"
+
+/* connections served at a time by each worker, 1024 by default */
+#define AWS_MAX_CONNECTIONS_ENV	"AWS_MAX_CONNECTIONS"
+#define AWS_MAX_CONNECTIONS	1024
+
+/* connections the kernel queues for a listener not accepting */
+#define AWS_LISTEN_BACKLOG	511
+
+/* seconds a connection may take to send its next request */
+#define AWS_IDLE_TIMEOUT	5
+
+/* seconds a reply may wait for the client to make room for more of it */
+#define AWS_WRITE_TIMEOUT	10
+
+/* slots of the timer wheel, one per second, more than the timeouts */
+#define AWS_TIMER_SLOTS		16
+
 enum connection_state {
 	STATE_INITIAL,
 	STATE_RECEIVING_DATA,
@@ -41,40 +72,169 @@ enum resource_type {
 	RESOURCE_TYPE_DYNAMIC
 };
 
-/* Structure acting as a connection handler */
+/* request paths up to this length are kept in the connection itself */
+#define AWS_PATH_INLINE		128
+
+/* the reply headers are built in the connection itself */
+#define AWS_SEND_BUFSIZ		384
+
+/* request header values kept while they are received, and the
+ * If-None-Match and If-Range ones kept until the reply
+ */
+#define AWS_HEADER_INLINE	64
+#define AWS_VALIDATOR_LEN	48
+
+/* Request headers the reply depends on. */
+enum request_header {
+	HEADER_NONE,
+	HEADER_RANGE,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_RANGE,
+	HEADER_ACCEPT_ENCODING
+};
+
+/* conditions of a request, the headers that were present */
+#define CONDITION_RANGE			(1 << HEADER_RANGE)
+#define CONDITION_IF_MODIFIED_SINCE	(1 << HEADER_IF_MODIFIED_SINCE)
+#define CONDITION_IF_NONE_MATCH		(1 << HEADER_IF_NONE_MATCH)
+#define CONDITION_IF_RANGE		(1 << HEADER_IF_RANGE)
+
+/* reads of a dynamic file in flight per connection, and their size */
+#define AWS_AIO_BUFFERS		4
+#define AWS_AIO_BUFSIZ		(8 * BUFSIZ)
+
+/* AIO requests a worker may have in flight */
+#define AWS_AIO_EVENTS		1024
+
+enum aio_buffer_state {
+	AIO_BUFFER_FREE,
+	AIO_BUFFER_READING,
+	AIO_BUFFER_READY
+};
+
+/* One stage of the pipeline that reads a dynamic file and sends it. */
+struct aio_buffer {
+	struct iocb iocb;
+	struct offload_task task;	/* the read of iocb, on the thread pool */
+	long res;
+	struct connection *conn;
+	char *data;
+	size_t len;		/* bytes read */
+	size_t sent;
+	enum aio_buffer_state state;
+};
+
+/*
+ * Structure acting as a connection handler. It only holds what every
+ * connection needs, the buffers come from the pools of the worker when
+ * they are used, so an idle connection is small.
+ */
 struct connection {
-    /* file to be sent */
+    /* file to be sent, from the open file cache */
 	int fd;
-	char filename[BUFSIZ];
+	struct file_entry *file;
 
-    /* asynchronous notification */
-	int eventfd;
 	int sockfd;
 
-	io_context_t ctx;
-	struct iocb iocb;
-	struct iocb *piocb[1];
+	/* part of the file sent, from file_pos to file_size: all of it, or
+	 * the range that was asked for
+	 */
 	size_t file_size;
 
-	/* buffers used for receiving messages */
-	char recv_buffer[BUFSIZ];
+	/* received bytes, in a BUFSIZ buffer of the pool, taken while there
+	 * are some
+	 */
+	char *recv_buffer;
 	size_t recv_len;
 
-	/* Used for sending data (headers, 404 or data populated through async IO). */
-	char send_buffer[BUFSIZ];
+	/* reply body in memory, a file of the memory cache or body_buffer,
+	 * which the connection allocated; else NULL
+	 */
+	const char *body;
+	char *body_buffer;
+
+	/* Used for sending the headers (200 or 404). */
+	char send_buffer[AWS_SEND_BUFSIZ];
 	size_t send_len;
 	size_t send_pos;
 	size_t file_pos;
 	size_t async_read_len;
 
-	/* HTTP request path */
+	/* Dynamic files are read into a ring of buffers, allocated on first
+	 * use: the reads complete in any order, the buffers are sent in order.
+	 */
+	struct aio_buffer *aio;
+	unsigned int aio_head;		/* next buffer to send */
+	unsigned int aio_tail;		/* next buffer to read into */
+	unsigned int aio_inflight;
+
+	/* io_uring engine: operations in flight, and the buffer the chunk of
+	 * the file being sent is read into: registered with the ring
+	 * (uring_buffer is its index), or one of the pool when none was free
+	 */
+	unsigned int uring_pending;
+	int uring_buffer;
+	char *uring_data;
+	size_t uring_len;
+
+	/* HTTP request path, in path_inline, or a buffer of the pool when
+	 * longer
+	 */
 	int have_path;
-	char request_path[BUFSIZ];
+	char *request_path;
+	size_t path_len;
+	char path_inline[AWS_PATH_INLINE];
 	enum resource_type res_type;
 	enum connection_state state;
 
 	/* HTTP_REQUEST parser */
 	http_parser request_parser;
+
+	/* bytes of recv_buffer fed to the parser, and taken by the current
+	 * request once it is complete; the rest are pipelined requests
+	 */
+	size_t parsed;
+	size_t request_len;
+	int keep_alive;
+
+	/* header being received: its name, then its value when it is one of
+	 * enum request_header
+	 */
+	enum request_header header;
+	int header_in_value;
+	char header_buf[AWS_HEADER_INLINE];
+	size_t header_len;
+
+	/* conditions of the request; a range is first-last, first is -1 for
+	 * the last bytes of the file and last is -1 up to its end
+	 */
+	unsigned int conditions;
+	long long range_first, range_last;
+	time_t if_modified_since;
+	char if_none_match[AWS_VALIDATOR_LEN];
+	char if_range[AWS_VALIDATOR_LEN];
+
+	/* codings the client accepts, bits of FILE_ENCODING_BIT() */
+	unsigned int accept_encodings;
+
+	/* reply, for the metrics and the access log: when its request was
+	 * received (CLOCK_MONOTONIC nanoseconds), its status and its length;
+	 * and the IPv4 address of the client once looked up
+	 */
+	uint64_t request_start;
+	unsigned int status;
+	size_t reply_len;
+	uint32_t peer_addr;
+
+	/* epoll events the socket is registered for */
+	uint32_t events;
+
+	/* timer wheel, while waiting for a request or for the client to
+	 * read the reply
+	 */
+	struct connection *timer_prev, *timer_next;
+	int timer_slot;
 };
 
 void handle_client(uint32_t event, struct connection *conn);
@@ -90,8 +250,7 @@ int connection_open_file(struct connection *conn);
 int connection_send_dynamic(struct connection *conn);
 void connection_start_async_io(struct connection *conn);
 enum connection_state connection_send_static(struct connection *conn);
-void connection_complete_async_io(struct connection *conn);
-void connection_start_async_io(struct connection *conn);
+void connection_complete_async_io(struct aio_buffer *buffer, long res);
 
 int parse_header(struct connection *conn);
 
@@ -0,0 +1,775 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * HTTP load generator for aws. Every thread runs an epoll loop over its
+ * share of the connections, and each connection has one request in flight
+ * at a time.
+ *
+ * In a closed loop (the default) a connection sends its next request as
+ * soon as the reply to the last one is in, and the latency of a request is
+ * the time it took. In an open loop (-r) the requests are due at a fixed
+ * rate, whatever the server does: a request that waits for its connection
+ * is late, and its latency counts from the time it was due. This way a
+ * server that stalls is not hidden by the requests that the stall held
+ * back (coordinated omission).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../utils/util.h"
+#include "../utils/sock_util.h"
+#include "../utils/w_epoll.h"
+#include "../http-parser/http_parser.h"
+
+#define BENCH_DEFAULT_PATH	"/static/small.dat"
+
+/* events handled per epoll_wait() call */
+#define BENCH_EPOLL_BATCH	256
+
+/* nanoseconds a connection waits before connecting again after a failure */
+#define BENCH_RETRY_DELAY	(10 * 1000 * 1000ULL)
+
+#define NSEC_PER_SEC		1000000000ULL
+
+/*
+ * Latency histogram, in nanoseconds: exact below HIST_LINEAR, then HIST_HALF
+ * buckets per power of two, which keeps every value within 1.6%.
+ */
+#define HIST_LINEAR		128
+#define HIST_HALF		64
+#define HIST_BUCKETS		(HIST_LINEAR + 57 * HIST_HALF)
+
+struct histogram {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t max;
+};
+
+static struct {
+	const char *host;
+	unsigned short port;
+	unsigned int connections;
+	unsigned int threads;
+	unsigned int duration;
+	unsigned int warmup;
+	double rate;
+	int keep_alive;
+	unsigned int sources;
+	char **paths;
+	unsigned int num_paths;
+} options = {
+	.host = "127.0.0.1",
+	.port = 8888,
+	.connections = 10,
+	.threads = 1,
+	.duration = 10,
+	.keep_alive = 1,
+};
+
+/* requests rendered once, one per path */
+static char **requests;
+static size_t *request_lens;
+
+static struct sockaddr_in server_addr;
+
+/* samples are kept between these two times */
+static uint64_t record_start, record_end;
+
+enum bench_state {
+	BENCH_CONNECTING,
+	BENCH_IDLE,
+	BENCH_SENDING,
+	BENCH_RECEIVING,
+	BENCH_BACKOFF
+};
+
+struct worker;
+
+struct bench_conn {
+	int sockfd;
+	enum bench_state state;
+	struct worker *worker;
+
+	/* index among the connections of the worker, its slot in the rate */
+	unsigned int slot;
+
+	/* request being sent, and where it started */
+	unsigned int path;
+	size_t send_pos;
+	uint64_t start;
+
+	/* open loop: requests that came due for this connection, and those
+	 * that were answered
+	 */
+	uint64_t due;
+	uint64_t answered;
+
+	http_parser parser;
+	int complete;
+
+	/* connections waiting to connect again */
+	uint64_t retry_at;
+	struct bench_conn *backoff_next;
+};
+
+struct worker {
+	pthread_t thread;
+	int epollfd;
+	int timerfd;
+
+	struct bench_conn *conns;
+	unsigned int num_conns;
+	unsigned int first;	/* index of the first connection, overall */
+
+	/* open loop: requests per second, the start of the schedule and the
+	 * next request that will be due
+	 */
+	double rate;
+	uint64_t schedule_start;
+	uint64_t next_request;
+
+	/* wake up time the timer is set to */
+	uint64_t timer_at;
+
+	struct bench_conn *backoff_head, *backoff_tail;
+
+	struct histogram hist;
+	uint64_t requests;
+	uint64_t bytes;
+	uint64_t connect_errors;
+	uint64_t io_errors;
+	uint64_t status_errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static unsigned int hist_index(uint64_t value)
+{
+	int shift;
+
+	if (value < HIST_LINEAR)
+		return value;
+
+	shift = 63 - __builtin_clzll(value) - 6;
+
+	return HIST_LINEAR + (shift - 1) * HIST_HALF + (unsigned int)((value >> shift) - HIST_HALF);
+}
+
+/* Highest value of the bucket. */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int shift;
+	uint64_t mantissa;
+
+	if (index < HIST_LINEAR)
+		return index;
+
+	index -= HIST_LINEAR;
+	shift = index / HIST_HALF + 1;
+	mantissa = index % HIST_HALF + HIST_HALF;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+static void hist_record(struct histogram *hist, uint64_t value)
+{
+	hist->counts[hist_index(value)]++;
+	hist->total++;
+	hist->sum += value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+static void hist_merge(struct histogram *to, const struct histogram *from)
+{
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++)
+		to->counts[i] += from->counts[i];
+	to->total += from->total;
+	to->sum += from->sum;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+/* Smallest value that the fraction of the samples do not exceed. */
+static uint64_t hist_percentile(const struct histogram *hist, double fraction)
+{
+	uint64_t rank = (uint64_t)(fraction * hist->total + 0.5);
+	uint64_t seen = 0;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank)
+			return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+	}
+
+	return hist->max;
+}
+
+static int on_headers_complete(http_parser *p)
+{
+	struct bench_conn *conn = p->data;
+
+	if (p->status_code >= 400)
+		conn->worker->status_errors++;
+
+	return 0;
+}
+
+static int on_message_complete(http_parser *p)
+{
+	struct bench_conn *conn = p->data;
+
+	conn->complete = 1;
+
+	return 0;
+}
+
+static const http_parser_settings reply_settings = {
+	.on_headers_complete = on_headers_complete,
+	.on_message_complete = on_message_complete
+};
+
+/* Due time of the k-th request of the connection, in an open loop. */
+static uint64_t request_due_time(struct bench_conn *conn, uint64_t k)
+{
+	struct worker *w = conn->worker;
+	double n = (double)k * w->num_conns + conn->slot;
+
+	return w->schedule_start + (uint64_t)(n * NSEC_PER_SEC / w->rate);
+}
+
+static void conn_connect(struct bench_conn *conn);
+
+static void conn_backoff(struct bench_conn *conn)
+{
+	struct worker *w = conn->worker;
+
+	conn->state = BENCH_BACKOFF;
+	conn->retry_at = now_ns() + BENCH_RETRY_DELAY;
+	conn->backoff_next = NULL;
+	if (w->backoff_tail)
+		w->backoff_tail->backoff_next = conn;
+	else
+		w->backoff_head = conn;
+	w->backoff_tail = conn;
+}
+
+static void conn_close(struct bench_conn *conn)
+{
+	if (conn->sockfd >= 0)
+		close(conn->sockfd);
+	conn->sockfd = -1;
+}
+
+/* Drop the connection after an error, and make a new one later. */
+static void conn_fail(struct bench_conn *conn, uint64_t *counter)
+{
+	(*counter)++;
+	conn_close(conn);
+	conn_backoff(conn);
+}
+
+static void conn_connect(struct bench_conn *conn)
+{
+	struct worker *w = conn->worker;
+	struct sockaddr_in local;
+	int rc;
+
+	/* Beyond the ports of one address pair, from other loopback ones. */
+	if (options.sources > 1) {
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (w->first + conn->slot) % options.sources);
+	}
+
+	conn->start = now_ns();
+	conn->sockfd = tcp_connect_nonblocking(&server_addr, options.sources > 1 ? &local : NULL);
+	if (conn->sockfd < 0) {
+		w->connect_errors++;
+		conn_backoff(conn);
+		return;
+	}
+
+	rc = w_epoll_add_ptr_out(w->epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_add_ptr_out");
+
+	conn->state = BENCH_CONNECTING;
+	http_parser_init(&conn->parser, HTTP_RESPONSE);
+	conn->parser.data = conn;
+}
+
+/* Send the rest of the request, waiting for the socket when it is full. */
+static void conn_send(struct bench_conn *conn)
+{
+	const char *request = requests[conn->path];
+	size_t len = request_lens[conn->path];
+	int rc;
+
+	while (conn->send_pos < len) {
+		ssize_t n = send(conn->sockfd, request + conn->send_pos, len - conn->send_pos,
+				 MSG_NOSIGNAL);
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (conn->state != BENCH_SENDING) {
+				rc = w_epoll_update_ptr_out(conn->worker->epollfd, conn->sockfd, conn);
+				DIE(rc < 0, "w_epoll_update_ptr_out");
+				conn->state = BENCH_SENDING;
+			}
+			return;
+		}
+		if (n < 0) {
+			conn_fail(conn, &conn->worker->io_errors);
+			return;
+		}
+		conn->send_pos += n;
+	}
+
+	rc = w_epoll_update_ptr_in(conn->worker->epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_in");
+	conn->state = BENCH_RECEIVING;
+}
+
+/*
+ * A connection with nothing in flight sends its next request, if one is
+ * due in an open loop; start is when it began, in a closed loop.
+ */
+static void conn_next(struct bench_conn *conn, uint64_t start)
+{
+	if (conn->state != BENCH_IDLE)
+		return;
+
+	if (conn->worker->rate > 0 && conn->due == conn->answered)
+		return;
+
+	conn->start = start;
+	conn->send_pos = 0;
+	conn->complete = 0;
+	conn_send(conn);
+}
+
+static void conn_answered(struct bench_conn *conn, uint64_t now)
+{
+	struct worker *w = conn->worker;
+	uint64_t start = conn->start;
+	int rc;
+
+	/* Late requests count from when they were due. */
+	if (w->rate > 0)
+		start = request_due_time(conn, conn->answered);
+	conn->answered++;
+
+	if (now >= record_start && now < record_end) {
+		hist_record(&w->hist, now > start ? now - start : 0);
+		w->requests++;
+	}
+
+	conn->path = (conn->path + 1) % options.num_paths;
+
+	if (!options.keep_alive || !http_should_keep_alive(&conn->parser)) {
+		conn_close(conn);
+		conn_connect(conn);
+		return;
+	}
+
+	rc = w_epoll_update_ptr_none(w->epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_none");
+	conn->state = BENCH_IDLE;
+	conn_next(conn, now);
+}
+
+static void conn_receive(struct bench_conn *conn, uint64_t now)
+{
+	struct worker *w = conn->worker;
+	char buffer[64 * 1024];
+	ssize_t n;
+
+	while (1) {
+		n = recv(conn->sockfd, buffer, sizeof(buffer), 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n < 0) {
+			conn_fail(conn, &w->io_errors);
+			return;
+		}
+
+		if (now >= record_start && now < record_end)
+			w->bytes += n;
+
+		/* A reply that ends when the server closes is complete on 0. */
+		if (http_parser_execute(&conn->parser, &reply_settings, buffer, n) != (size_t)n) {
+			conn_fail(conn, &w->io_errors);
+			return;
+		}
+
+		if (conn->complete) {
+			conn_answered(conn, now);
+			return;
+		}
+
+		if (n == 0) {
+			conn_fail(conn, &w->io_errors);
+			return;
+		}
+	}
+}
+
+static void conn_handle(struct bench_conn *conn, uint32_t events, uint64_t now)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	switch (conn->state) {
+	case BENCH_CONNECTING:
+		if (getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			conn_fail(conn, &conn->worker->connect_errors);
+			return;
+		}
+
+		DIE(w_epoll_update_ptr_none(conn->worker->epollfd, conn->sockfd, conn) < 0,
+		    "w_epoll_update_ptr_none");
+		conn->state = BENCH_IDLE;
+
+		/* Without keep-alive, connecting is part of the request. */
+		conn_next(conn, options.keep_alive ? now : conn->start);
+		break;
+	case BENCH_SENDING:
+		conn_send(conn);
+		break;
+	case BENCH_RECEIVING:
+		conn_receive(conn, now);
+		break;
+	default:
+		/* The peer closed an idle connection. */
+		if (events & (EPOLLHUP | EPOLLERR))
+			conn_fail(conn, &conn->worker->io_errors);
+		break;
+	}
+}
+
+/* Make the requests that came due for their connections. */
+static uint64_t worker_schedule(struct worker *w, uint64_t now)
+{
+	while (1) {
+		struct bench_conn *conn = &w->conns[w->next_request % w->num_conns];
+		uint64_t due = request_due_time(conn, w->next_request / w->num_conns);
+
+		if (due > now)
+			return due;
+
+		conn->due++;
+		w->next_request++;
+		conn_next(conn, now);
+	}
+}
+
+/* Connect again the connections whose pause is over, oldest first. */
+static void worker_retry(struct worker *w, uint64_t now)
+{
+	while (w->backoff_head != NULL && w->backoff_head->retry_at <= now) {
+		struct bench_conn *conn = w->backoff_head;
+
+		w->backoff_head = conn->backoff_next;
+		if (w->backoff_head == NULL)
+			w->backoff_tail = NULL;
+		conn_connect(conn);
+	}
+}
+
+static void worker_arm_timer(struct worker *w, uint64_t when)
+{
+	struct itimerspec its = { 0 };
+
+	if (when == w->timer_at)
+		return;
+	w->timer_at = when;
+
+	its.it_value.tv_sec = when / NSEC_PER_SEC;
+	its.it_value.tv_nsec = when % NSEC_PER_SEC;
+	DIE(timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0, "timerfd_settime");
+}
+
+static void *worker_loop(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event events[BENCH_EPOLL_BATCH];
+	uint64_t now = now_ns();
+	uint64_t ticks;
+
+	w->epollfd = w_epoll_create();
+	DIE(w->epollfd < 0, "w_epoll_create");
+
+	w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	DIE(w->timerfd < 0, "timerfd_create");
+	DIE(w_epoll_add_ptr_in(w->epollfd, w->timerfd, &w->timerfd) < 0, "w_epoll_add_ptr_in");
+
+	for (unsigned int i = 0; i < w->num_conns; i++) {
+		w->conns[i].worker = w;
+		w->conns[i].slot = i;
+		w->conns[i].sockfd = -1;
+		w->conns[i].path = (w->first + i) % options.num_paths;
+		conn_connect(&w->conns[i]);
+	}
+
+	w->schedule_start = now;
+
+	while (now < record_end) {
+		uint64_t wake = record_end;
+		int rc;
+
+		if (w->rate > 0) {
+			uint64_t due = worker_schedule(w, now);
+
+			if (due < wake)
+				wake = due;
+		}
+		worker_retry(w, now);
+		if (w->backoff_head != NULL && w->backoff_head->retry_at < wake)
+			wake = w->backoff_head->retry_at;
+		worker_arm_timer(w, wake);
+
+		rc = w_epoll_wait_batch(w->epollfd, events, BENCH_EPOLL_BATCH,
+					EPOLL_TIMEOUT_INFINITE);
+		DIE(rc < 0 && errno != EINTR, "w_epoll_wait_batch");
+
+		now = now_ns();
+		for (int i = 0; i < rc; i++) {
+			if (events[i].data.ptr == &w->timerfd) {
+				/* Only wakes the loop up, and fires once. */
+				if (read(w->timerfd, &ticks, sizeof(ticks)) == sizeof(ticks))
+					w->timer_at = 0;
+				continue;
+			}
+			conn_handle(events[i].data.ptr, events[i].events, now);
+		}
+	}
+
+	for (unsigned int i = 0; i < w->num_conns; i++)
+		conn_close(&w->conns[i]);
+	close(w->timerfd);
+	close(w->epollfd);
+
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [path...]\n"
+		"  -a host     server address (%s)\n"
+		"  -p port     server port (%hu)\n"
+		"  -c count    connections (%u)\n"
+		"  -t count    threads (%u)\n"
+		"  -d seconds  duration of the measure (%u)\n"
+		"  -w seconds  warm up, not measured (%u)\n"
+		"  -r rate     open loop at rate requests per second; closed loop if 0\n"
+		"  -n          no keep-alive, a new connection per request\n"
+		"  -s count    spread the connections over count loopback addresses\n"
+		"The paths are requested in turn, %s by default.\n",
+		argv0, options.host, options.port, options.connections, options.threads,
+		options.duration, options.warmup, BENCH_DEFAULT_PATH);
+	exit(EXIT_FAILURE);
+}
+
+static void parse_options(int argc, char **argv)
+{
+	static char *default_paths[] = { BENCH_DEFAULT_PATH };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:p:c:t:d:w:r:ns:")) != -1) {
+		switch (opt) {
+		case 'a':
+			options.host = optarg;
+			break;
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 'c':
+			options.connections = atoi(optarg);
+			break;
+		case 't':
+			options.threads = atoi(optarg);
+			break;
+		case 'd':
+			options.duration = atoi(optarg);
+			break;
+		case 'w':
+			options.warmup = atoi(optarg);
+			break;
+		case 'r':
+			options.rate = atof(optarg);
+			break;
+		case 'n':
+			options.keep_alive = 0;
+			break;
+		case 's':
+			options.sources = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (options.connections == 0 || options.threads == 0 || options.duration == 0 ||
+	    options.rate < 0)
+		usage(argv[0]);
+	if (options.threads > options.connections)
+		options.threads = options.connections;
+
+	if (optind < argc) {
+		options.paths = argv + optind;
+		options.num_paths = argc - optind;
+	} else {
+		options.paths = default_paths;
+		options.num_paths = 1;
+	}
+}
+
+static void render_requests(void)
+{
+	requests = calloc(options.num_paths, sizeof(*requests));
+	request_lens = calloc(options.num_paths, sizeof(*request_lens));
+	DIE(requests == NULL || request_lens == NULL, "calloc");
+
+	for (unsigned int i = 0; i < options.num_paths; i++) {
+		int len = asprintf(&requests[i],
+				   "GET %s HTTP/1.1\r\nHost: %s:%hu\r\nConnection: %s\r\n\r\n",
+				   options.paths[i], options.host, options.port,
+				   options.keep_alive ? "keep-alive" : "close");
+
+		DIE(len < 0, "asprintf");
+		request_lens[i] = len;
+	}
+}
+
+/* Every connection needs a descriptor. */
+static void raise_file_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		return;
+
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+		ERR("setrlimit");
+
+	if (rl.rlim_cur < options.connections + 16)
+		fprintf(stderr, "warning: %lu descriptors for %u connections\n",
+			(unsigned long)rl.rlim_cur, options.connections);
+}
+
+static void report(struct worker *workers)
+{
+	struct histogram *hist = calloc(1, sizeof(*hist));
+	uint64_t requests = 0, bytes = 0;
+	uint64_t connect_errors = 0, io_errors = 0, status_errors = 0;
+	double seconds = options.duration;
+
+	DIE(hist == NULL, "calloc");
+
+	for (unsigned int i = 0; i < options.threads; i++) {
+		hist_merge(hist, &workers[i].hist);
+		requests += workers[i].requests;
+		bytes += workers[i].bytes;
+		connect_errors += workers[i].connect_errors;
+		io_errors += workers[i].io_errors;
+		status_errors += workers[i].status_errors;
+	}
+
+	printf("%u connections, %u threads, %s, %s\n", options.connections, options.threads,
+	       options.keep_alive ? "keep-alive" : "no keep-alive",
+	       options.rate > 0 ? "open loop" : "closed loop");
+	if (options.rate > 0)
+		printf("  target    %.1f req/s\n", options.rate);
+	printf("  requests  %lu in %.1f s, %.1f req/s, %.2f MiB/s\n",
+	       (unsigned long)requests, seconds, requests / seconds,
+	       bytes / seconds / (1024 * 1024));
+	if (hist->total > 0)
+		printf("  latency   mean %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+		       (double)hist->sum / hist->total / 1000,
+		       hist_percentile(hist, 0.5) / 1000.0,
+		       hist_percentile(hist, 0.99) / 1000.0,
+		       hist_percentile(hist, 0.999) / 1000.0,
+		       hist->max / 1000.0);
+	printf("  errors    connect %lu, io %lu, status %lu\n",
+	       (unsigned long)connect_errors, (unsigned long)io_errors,
+	       (unsigned long)status_errors);
+
+	free(hist);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned int first = 0;
+	uint64_t now;
+	int rc;
+
+	parse_options(argc, argv);
+	render_requests();
+	raise_file_limit();
+
+	rc = tcp_get_server_address(options.host, options.port, &server_addr);
+	DIE(rc < 0, "tcp_get_server_address");
+
+	workers = calloc(options.threads, sizeof(*workers));
+	DIE(workers == NULL, "calloc");
+
+	now = now_ns();
+	record_start = now + options.warmup * NSEC_PER_SEC;
+	record_end = record_start + options.duration * NSEC_PER_SEC;
+
+	for (unsigned int i = 0; i < options.threads; i++) {
+		struct worker *w = &workers[i];
+
+		/* The connections, and the rate, are shared out evenly. */
+		w->num_conns = options.connections / options.threads +
+			(i < options.connections % options.threads);
+		w->first = first;
+		first += w->num_conns;
+		w->rate = options.rate * w->num_conns / options.connections;
+
+		w->conns = calloc(w->num_conns, sizeof(*w->conns));
+		DIE(w->conns == NULL, "calloc");
+
+		rc = pthread_create(&w->thread, NULL, worker_loop, w);
+		DIE(rc != 0, "pthread_create");
+	}
+
+	for (unsigned int i = 0; i < options.threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		free(workers[i].conns);
+	}
+
+	report(workers);
+	free(workers);
+
+	return 0;
+}
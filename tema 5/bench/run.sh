@@ -0,0 +1,35 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Run the benchmark matrix against an aws started from the directory given
+# (the one with its static/ and dynamic/ folders), after creating the files
+# requested there. Set CONNECTIONS, DURATION, RATE or THREADS to change the
+# defaults, e.g. CONNECTIONS="1 100 10000 100000" for the widest range.
+
+set -e
+
+ROOT=${1:-..}
+BENCH=$(dirname "$0")/aws_bench
+CONNECTIONS=${CONNECTIONS:-"1 10 100 1000"}
+DURATION=${DURATION:-10}
+THREADS=${THREADS:-1}
+RATE=${RATE:-0}
+
+for dir in static dynamic; do
+	[ -f "$ROOT/$dir/bench-small.dat" ] || head -c 4096 /dev/urandom > "$ROOT/$dir/bench-small.dat"
+	[ -f "$ROOT/$dir/bench-large.dat" ] || head -c 16777216 /dev/urandom > "$ROOT/$dir/bench-large.dat"
+done
+
+for dir in static dynamic; do
+	for size in small large; do
+		for keep_alive in "" -n; do
+			for c in $CONNECTIONS; do
+				# One loopback address per 20000 connections, for the ports.
+				sources=$((c / 20000 + 1))
+				echo "== /$dir/bench-$size.dat"
+				"$BENCH" -c "$c" -t "$THREADS" -d "$DURATION" -w 1 -r "$RATE" \
+					-s "$sources" $keep_alive "/$dir/bench-$size.dat"
+			done
+		done
+	done
+done
@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "aws.h"
+#include "file_cache.h"
+#include "metrics.h"
+#include "utils/util.h"
+#include "utils/debug.h"
+
+/*
+ * Hash table of the open files, with their least recently used order. The
+ * cache holds a reference on each entry; an evicted entry stays open until
+ * the connections sending it are done.
+ */
+struct file_cache {
+	struct file_entry *buckets[AWS_FILE_CACHE_BUCKETS];
+	struct file_entry *lru_head, *lru_tail;
+	unsigned int count;
+	unsigned long bytes;
+	unsigned long memory;
+};
+
+static __thread struct file_cache cache;
+static __thread struct file_cache_stats stats;
+
+/* suffix of the sibling file of each coding, and the headers sent with it */
+static const char * const encoding_suffix[FILE_ENCODINGS] = { "", ".gz", ".br" };
+static const char * const encoding_header[FILE_ENCODINGS] = {
+	"",
+	"Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n",
+	"Content-Encoding: br\r\nVary: Accept-Encoding\r\n"
+};
+
+static time_t now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return ts.tv_sec;
+}
+
+/* FNV-1a, of the path and the coding */
+static unsigned int hash_path(const char *path, enum file_encoding encoding)
+{
+	unsigned int hash = 2166136261u;
+
+	for (; *path; path++)
+		hash = (hash ^ (unsigned char)*path) * 16777619u;
+	hash = (hash ^ encoding) * 16777619u;
+
+	return hash % AWS_FILE_CACHE_BUCKETS;
+}
+
+static void file_path(char *buf, size_t size, const char *path, enum file_encoding encoding)
+{
+	snprintf(buf, size, "%s%s%s", AWS_DOCUMENT_ROOT, path + 1, encoding_suffix[encoding]);
+}
+
+static void lru_unlink(struct file_entry *file)
+{
+	if (file->lru_prev)
+		file->lru_prev->lru_next = file->lru_next;
+	else
+		cache.lru_head = file->lru_next;
+	if (file->lru_next)
+		file->lru_next->lru_prev = file->lru_prev;
+	else
+		cache.lru_tail = file->lru_prev;
+
+	file->lru_prev = file->lru_next = NULL;
+}
+
+static void lru_push(struct file_entry *file)
+{
+	file->lru_prev = NULL;
+	file->lru_next = cache.lru_head;
+	if (cache.lru_head)
+		cache.lru_head->lru_prev = file;
+	else
+		cache.lru_tail = file;
+	cache.lru_head = file;
+}
+
+static void cache_remove(struct file_entry *file)
+{
+	struct file_entry **link = &cache.buckets[hash_path(file->path, file->encoding)];
+
+	while (*link != file)
+		link = &(*link)->hash_next;
+	*link = file->hash_next;
+
+	lru_unlink(file);
+	metrics_add(&stats.evictions, 1);
+	cache.count--;
+	cache.bytes -= file->size;
+	if (file->data != NULL)
+		cache.memory -= file->size;
+
+	file_cache_put(file);
+}
+
+/*
+ * The codings the resource also exists in. A sibling older than the file
+ * was not made from its current contents, and is not used.
+ */
+static unsigned int file_find_sidecars(struct file_entry *file)
+{
+	char filepath[BUFSIZ];
+	unsigned int sidecars = 0;
+	struct stat st;
+
+	for (int encoding = FILE_ENCODING_GZIP; encoding < FILE_ENCODINGS; encoding++) {
+		file_path(filepath, sizeof(filepath), file->path, encoding);
+		if (stat(filepath, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime >= file->mtime)
+			sidecars |= FILE_ENCODING_BIT(encoding);
+	}
+
+	return sidecars;
+}
+
+/* The 200 reply headers, which depend on the codings there are. */
+static void file_render_headers(struct file_entry *file)
+{
+	const char *vary = "";
+
+	if (file->encoding != FILE_ENCODING_IDENTITY)
+		vary = encoding_header[file->encoding];
+	else if (file->sidecars != 0)
+		vary = "Vary: Accept-Encoding\r\n";
+	file->encoding_header = vary;
+
+	for (int keep_alive = 0; keep_alive < 2; keep_alive++)
+		file->header_len[keep_alive] = snprintf(file->header[keep_alive],
+				sizeof(file->header[keep_alive]),
+				"HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nAccept-Ranges: bytes\r\n"
+				"Last-Modified: %s\r\nETag: %s\r\n%sConnection: %s\r\n\r\n",
+				(long)file->size, file->last_modified, file->etag, vary,
+				keep_alive ? "keep-alive" : "close");
+}
+
+static struct file_entry *file_open(const char *path, enum file_encoding encoding)
+{
+	char filepath[BUFSIZ];
+	struct file_entry *file;
+	struct stat st;
+	struct tm tm;
+	int fd;
+
+	file_path(filepath, sizeof(filepath), path, encoding);
+
+	dlog(LOG_INFO, "Opening file %s\n", filepath);
+	fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		dlog(LOG_INFO, "Cannot open %s: %s\n", filepath, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		dlog(LOG_INFO, "Not a regular file: %s\n", filepath);
+		close(fd);
+		return NULL;
+	}
+
+	file = calloc(1, sizeof(*file));
+	DIE(file == NULL, "calloc");
+	file->path = strdup(path);
+	DIE(file->path == NULL, "strdup");
+
+	file->fd = fd;
+	file->encoding = encoding;
+	file->size = st.st_size;
+	file->mtime = st.st_mtime;
+	file->ino = st.st_ino;
+	file->dev = st.st_dev;
+	file->refs = 1;
+
+	/* Both derived from the fstat(2) above, without reading the file. */
+	strftime(file->last_modified, sizeof(file->last_modified),
+			"%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&file->mtime, &tm));
+	snprintf(file->etag, sizeof(file->etag), "\"%lx-%lx\"",
+			(unsigned long)file->mtime, (unsigned long)file->size);
+
+	if (encoding == FILE_ENCODING_IDENTITY)
+		file->sidecars = file_find_sidecars(file);
+	file_render_headers(file);
+
+	return file;
+}
+
+/* Keep a small file in memory, where it is shared by every connection. */
+static void file_load(struct file_entry *file)
+{
+	off_t pos = 0;
+	ssize_t n;
+
+	if (file->size == 0 || file->size > AWS_FILE_CACHE_SMALL)
+		return;
+
+	file->data = malloc(file->size);
+	DIE(file->data == NULL, "malloc");
+
+	while (pos < file->size) {
+		n = pread(file->fd, file->data + pos, file->size - pos, pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			/* Sent from the file instead. */
+			free(file->data);
+			file->data = NULL;
+			return;
+		}
+		pos += n;
+	}
+}
+
+/* Whether the file at path is still the one the entry has open. */
+static int file_unchanged(struct file_entry *file)
+{
+	char filepath[BUFSIZ];
+	struct stat st;
+
+	file_path(filepath, sizeof(filepath), file->path, file->encoding);
+
+	return stat(filepath, &st) == 0 && st.st_ino == file->ino &&
+		st.st_dev == file->dev && st.st_size == file->size &&
+		st.st_mtime == file->mtime;
+}
+
+struct file_entry *file_cache_get(const char *path, enum file_encoding encoding)
+{
+	time_t now = now_seconds();
+	unsigned int bucket = hash_path(path, encoding);
+	struct file_entry *file = cache.buckets[bucket];
+
+	while (file != NULL && (file->encoding != encoding || strcmp(file->path, path) != 0))
+		file = file->hash_next;
+
+	if (file != NULL && now >= file->expires) {
+		metrics_add(&stats.revalidations, 1);
+		if (file_unchanged(file)) {
+			file->expires = now + AWS_FILE_CACHE_TTL;
+
+			/* The siblings are checked again along with the file. */
+			if (encoding == FILE_ENCODING_IDENTITY) {
+				unsigned int sidecars = file_find_sidecars(file);
+
+				if (sidecars != file->sidecars) {
+					file->sidecars = sidecars;
+					file_render_headers(file);
+				}
+			}
+		} else {
+			cache_remove(file);
+			file = NULL;
+		}
+	}
+
+	if (file != NULL) {
+		metrics_add(&stats.hits, 1);
+		lru_unlink(file);
+		lru_push(file);
+		file->refs++;
+		return file;
+	}
+
+	metrics_add(&stats.misses, 1);
+	file = file_open(path, encoding);
+	if (file == NULL || (unsigned long)file->size > AWS_FILE_CACHE_BYTES)
+		return file;
+
+	/* Make room, least recently used first. */
+	while (cache.count >= AWS_FILE_CACHE_ENTRIES ||
+	       cache.bytes + file->size > AWS_FILE_CACHE_BYTES)
+		cache_remove(cache.lru_tail);
+
+	file_load(file);
+	if (file->data != NULL) {
+		struct file_entry *victim = cache.lru_tail;
+
+		while (victim != NULL && cache.memory + file->size > AWS_FILE_CACHE_MEMORY) {
+			struct file_entry *prev = victim->lru_prev;
+
+			if (victim->data != NULL)
+				cache_remove(victim);
+			victim = prev;
+		}
+		cache.memory += file->size;
+	}
+
+	file->hash_next = cache.buckets[bucket];
+	cache.buckets[bucket] = file;
+	lru_push(file);
+	cache.count++;
+	cache.bytes += file->size;
+	file->expires = now + AWS_FILE_CACHE_TTL;
+
+	/* One reference for the cache, one for the caller. */
+	file->refs++;
+
+	return file;
+}
+
+void file_cache_put(struct file_entry *file)
+{
+	if (--file->refs > 0)
+		return;
+
+	close(file->fd);
+	free(file->data);
+	free(file->path);
+	free(file);
+}
+
+const struct file_cache_stats *file_cache_stats(void)
+{
+	return &stats;
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* files kept open per worker, and the sum of their sizes */
+#define AWS_FILE_CACHE_ENTRIES	512
+#define AWS_FILE_CACHE_BYTES	(256UL * 1024 * 1024)
+
+/* files up to this size are also kept in memory, up to a total */
+#define AWS_FILE_CACHE_SMALL	(16 * 1024)
+#define AWS_FILE_CACHE_MEMORY	(32UL * 1024 * 1024)
+
+/* seconds an entry is trusted before the file is stat(2)ed again */
+#define AWS_FILE_CACHE_TTL	2
+
+#define AWS_FILE_CACHE_BUCKETS	1024
+
+/*
+ * Content codings a resource may also be stored in, as a sibling file with
+ * the suffix of the coding (e.g. "a.css.gz"), compressed ahead of time.
+ */
+enum file_encoding {
+	FILE_ENCODING_IDENTITY,
+	FILE_ENCODING_GZIP,
+	FILE_ENCODING_BR,
+	FILE_ENCODINGS
+};
+
+#define FILE_ENCODING_BIT(encoding)	(1U << (encoding))
+
+/* An open resource, shared by the connections that send it. */
+struct file_entry {
+	int fd;
+	off_t size;
+	time_t mtime;
+
+	/* validators of the contents, as sent in the Last-Modified and ETag
+	 * headers
+	 */
+	char last_modified[32];
+	char etag[40];
+
+	/* coding the file is in, and the other ones it exists in (bits of
+	 * FILE_ENCODING_BIT()), with the headers that tell which was sent
+	 */
+	enum file_encoding encoding;
+	unsigned int sidecars;
+	const char *encoding_header;
+
+	/* 200 reply header, for a closing [0] or persistent [1] connection */
+	char header[2][256];
+	size_t header_len[2];
+
+	/* contents of a small file, sent along with the header; else NULL */
+	char *data;
+
+	/* private to the cache */
+	char *path;
+	ino_t ino;
+	dev_t dev;
+	time_t expires;
+	unsigned int refs;
+	struct file_entry *hash_next;
+	struct file_entry *lru_prev, *lru_next;
+};
+
+/* Counters of the cache of a worker, for the metrics. */
+struct file_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t revalidations;
+	uint64_t evictions;
+};
+
+/*
+ * Open the resource of the request path (e.g. "/static/a.dat"), relative to
+ * the document root, in the given coding; NULL if it cannot be opened, or
+ * is not in that coding. A hit within the TTL costs no system call. Every
+ * entry returned must be given back with file_cache_put(). Each worker
+ * thread has its own cache.
+ */
+struct file_entry *file_cache_get(const char *path, enum file_encoding encoding);
+void file_cache_put(struct file_entry *file);
+
+/* The counters of the cache of the calling thread. */
+const struct file_cache_stats *file_cache_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
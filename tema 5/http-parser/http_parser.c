@@ -27,6 +27,11 @@
 # define MIN(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# include <nmmintrin.h>
+# define HTTP_PARSER_SSE42 1
+#endif
+
 
 #define CALLBACK2(FOR)                                               \
 do {                                                                 \
@@ -189,6 +194,67 @@ static const uint8_t normal_url_char[256] = {
         1,       1,       1,       1,       1,       1,       1,       0 };
 
 
+/* Ranges (pairs of inclusive bounds) of the bytes that end a run of URL
+ * characters, and of a header value. */
+static const char url_special[16] = "\x00\x20" "##" "??" "\x7f\xff";
+#define URL_SPECIAL_LEN 8
+static const char value_special[16] = "\r\r" "\n\n";
+#define VALUE_SPECIAL_LEN 4
+
+#ifdef HTTP_PARSER_SSE42
+/* Length of the run from p on, 16 bytes at a time, that has none of the
+ * special bytes, as picohttpparser does. Only whole blocks: the byte loop
+ * does the rest, and the special byte itself. */
+__attribute__((target("sse4.2")))
+static size_t skip_run_sse42(const char *p, const char *pe,
+                             const char *special, int special_len)
+{
+  const char *start = p;
+  __m128i ranges = _mm_loadu_si128((const __m128i *)special);
+
+  while (pe - p >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    int i = _mm_cmpestri(ranges, special_len, block, 16,
+                         _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES |
+                         _SIDD_UBYTE_OPS);
+    p += i;
+    if (i != 16) break;
+  }
+
+  return p - start;
+}
+#endif
+
+/* Bytes after p that the current state would only step over one by one.
+ * The run stops where nread reaches the header limit, so that the byte loop
+ * fails on the same byte as without it. */
+static inline size_t skip_run(const char *p, const char *pe,
+                              const char *special, int special_len,
+                              uint64_t nread)
+{
+#ifdef HTTP_PARSER_SSE42
+  if (__builtin_cpu_supports("sse4.2")) {
+    size_t run = skip_run_sse42(p, pe, special, special_len);
+
+    return MIN(run, HTTP_MAX_HEADER_SIZE - nread);
+  }
+#else
+  (void)p;
+  (void)pe;
+  (void)special;
+  (void)special_len;
+  (void)nread;
+#endif
+  return 0;
+}
+
+#define SKIP_RUN(special, special_len)                               \
+do {                                                                 \
+  size_t run = skip_run(p + 1, pe, special, special_len, nread);     \
+  p += run;                                                          \
+  nread += run;                                                      \
+} while (0)
+
 enum state
   { s_dead = 1 /* important that this is > 0 */
 
@@ -749,7 +815,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_path:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_special, URL_SPECIAL_LEN);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -823,7 +892,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_query_string:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_special, URL_SPECIAL_LEN);
+          break;
+        }
 
         switch (ch) {
           case '?':
@@ -897,7 +969,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_fragment:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_special, URL_SPECIAL_LEN);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -1279,6 +1354,8 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (header_state) {
           case h_general:
+            /* Nothing to match, up to the end of the line. */
+            SKIP_RUN(value_special, VALUE_SPECIAL_LEN);
             break;
 
           case h_connection:
@@ -1418,7 +1495,7 @@ size_t http_parser_execute (http_parser *parser,
             /* Content-Length header given but zero: Content-Length: 0\r\n */
             CALLBACK2(message_complete);
             state = NEW_MESSAGE();
-          } else if (parser->content_length > 0) {
+          } else if (parser->content_length != (size_t)-1) {
             /* Content-Length header given and non-zero */
             state = s_body_identity;
           } else {
@@ -1568,7 +1645,7 @@ size_t http_parser_execute (http_parser *parser,
   parser->state = state;
   parser->header_state = header_state;
   parser->index = (unsigned char)index;
-  parser->nread = (unsigned char)nread;
+  parser->nread = nread;
 
   return len;
 
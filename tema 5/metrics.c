@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "metrics.h"
+#include "utils/util.h"
+
+/* every worker that registered, the last one first */
+static struct worker_metrics *registered;
+static unsigned int num_registered;
+
+struct worker_metrics *metrics_register(void)
+{
+	struct worker_metrics *metrics = calloc(1, sizeof(*metrics));
+
+	DIE(metrics == NULL, "calloc");
+
+	metrics->worker = __atomic_fetch_add(&num_registered, 1, __ATOMIC_RELAXED);
+	metrics->cache = file_cache_stats();
+
+	metrics->next = __atomic_load_n(&registered, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&registered, &metrics->next, metrics, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return metrics;
+}
+
+void metrics_observe_latency(struct worker_metrics *metrics, uint64_t us)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < METRICS_LATENCY_BUCKETS && us >= (1ULL << bucket))
+		bucket++;
+
+	metrics_add(&metrics->latency[bucket], 1);
+	metrics_add(&metrics->latency_sum_us, us);
+}
+
+static uint64_t load(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* One line per worker for the counter at offset in the metrics. */
+static void render_counter(FILE *f, const char *name, const char *type, const char *help,
+			   size_t offset)
+{
+	struct worker_metrics *m;
+
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	for (m = __atomic_load_n(&registered, __ATOMIC_ACQUIRE); m != NULL; m = m->next)
+		fprintf(f, "%s{worker=\"%u\"} %lu\n", name, m->worker,
+			(unsigned long)load((const uint64_t *)((const char *)m + offset)));
+}
+
+static void render_cache(FILE *f, const char *name, const char *help, size_t offset)
+{
+	struct worker_metrics *m;
+
+	fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	for (m = __atomic_load_n(&registered, __ATOMIC_ACQUIRE); m != NULL; m = m->next)
+		fprintf(f, "%s{worker=\"%u\"} %lu\n", name, m->worker,
+			(unsigned long)load((const uint64_t *)((const char *)m->cache + offset)));
+}
+
+static void render_latency(FILE *f)
+{
+	const char *name = "aws_request_duration_seconds";
+	struct worker_metrics *m;
+
+	fprintf(f, "# HELP %s Time from a request received to its reply sent.\n"
+		"# TYPE %s histogram\n", name, name);
+	for (m = __atomic_load_n(&registered, __ATOMIC_ACQUIRE); m != NULL; m = m->next) {
+		uint64_t count = 0;
+
+		for (unsigned int i = 0; i <= METRICS_LATENCY_BUCKETS; i++) {
+			count += load(&m->latency[i]);
+			if (i < METRICS_LATENCY_BUCKETS)
+				fprintf(f, "%s_bucket{worker=\"%u\",le=\"%g\"} %lu\n", name, m->worker,
+					(1ULL << i) / 1e6, (unsigned long)count);
+			else
+				fprintf(f, "%s_bucket{worker=\"%u\",le=\"+Inf\"} %lu\n", name, m->worker,
+					(unsigned long)count);
+		}
+		fprintf(f, "%s_sum{worker=\"%u\"} %g\n", name, m->worker,
+			load(&m->latency_sum_us) / 1e6);
+		fprintf(f, "%s_count{worker=\"%u\"} %lu\n", name, m->worker, (unsigned long)count);
+	}
+}
+
+#define METRIC(field)		offsetof(struct worker_metrics, field)
+#define CACHE_METRIC(field)	offsetof(struct file_cache_stats, field)
+
+char *metrics_render(size_t *len)
+{
+	char *buffer;
+	FILE *f;
+
+	f = open_memstream(&buffer, len);
+	if (f == NULL)
+		return NULL;
+
+	render_counter(f, "aws_accepted_total", "counter", "Connections accepted.",
+		       METRIC(accepted));
+	render_counter(f, "aws_shed_total", "counter",
+		       "Connections turned away, over the limits.", METRIC(shed));
+	render_counter(f, "aws_connections", "gauge", "Connections open.", METRIC(active));
+	render_counter(f, "aws_requests_total", "counter", "Replies sent.", METRIC(requests));
+	render_counter(f, "aws_sent_bytes_total", "counter", "Bytes of the replies sent.",
+		       METRIC(bytes_sent));
+	render_counter(f, "aws_aio_inflight", "gauge", "File reads submitted, not completed.",
+		       METRIC(aio_inflight));
+	render_counter(f, "aws_access_log_dropped_total", "counter",
+		       "Requests not logged, the writer being behind.", METRIC(log_dropped));
+	render_cache(f, "aws_file_cache_hits_total", "Files found open in the cache.",
+		     CACHE_METRIC(hits));
+	render_cache(f, "aws_file_cache_misses_total", "Files opened.", CACHE_METRIC(misses));
+	render_cache(f, "aws_file_cache_revalidations_total",
+		     "Cached files checked again after their TTL.", CACHE_METRIC(revalidations));
+	render_cache(f, "aws_file_cache_evictions_total", "Files dropped from the cache.",
+		     CACHE_METRIC(evictions));
+	render_latency(f);
+
+	if (fclose(f) != 0) {
+		free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
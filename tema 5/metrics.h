@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef METRICS_H_
+#define METRICS_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_cache.h"
+
+/* path the counters are served at, to clients on the loopback only */
+#define AWS_METRICS_PATH	"/metrics"
+
+/* request latency buckets, powers of two of microseconds: 1 us to 8 s */
+#define METRICS_LATENCY_BUCKETS	24
+
+/*
+ * Counters of a worker. Only the worker writes them, any worker may read
+ * them to render the metrics; a worker that serves /metrics reads those of
+ * the others as they are at that time.
+ */
+struct worker_metrics {
+	unsigned int worker;
+	uint64_t accepted;
+	uint64_t shed;			/* turned away with a 503, over the limits */
+	uint64_t active;		/* connections open */
+	uint64_t requests;
+	uint64_t bytes_sent;		/* of the replies, once sent whole */
+	uint64_t aio_inflight;		/* reads submitted, not completed yet */
+	uint64_t log_dropped;		/* records the access log had no room for */
+	const struct file_cache_stats *cache;
+
+	/* time from a request received to its reply sent, the last bucket
+	 * for the slower ones
+	 */
+	uint64_t latency[METRICS_LATENCY_BUCKETS + 1];
+	uint64_t latency_sum_us;
+
+	struct worker_metrics *next;
+};
+
+/* Change a counter of this worker; a plain store, no locked instruction. */
+static inline void metrics_add(uint64_t *counter, int64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* The counters of the calling worker, registered for the metrics. */
+struct worker_metrics *metrics_register(void);
+
+void metrics_observe_latency(struct worker_metrics *metrics, uint64_t us);
+
+/*
+ * Render the counters of every worker in the Prometheus text format, into
+ * a buffer that the caller frees. Returns NULL if out of memory.
+ */
+char *metrics_render(size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "offload.h"
+#include "os_threadpool.h"
+
+/* tasks handed to the pool with one lock of its queue */
+#define OFFLOAD_BATCH	16
+
+static os_threadpool_t *pool;
+
+int offload_init(unsigned int threads)
+{
+	pool = create_threadpool(threads);
+
+	return pool != NULL ? 0 : -1;
+}
+
+void offload_queue_init(struct offload_queue *queue, int eventfd)
+{
+	queue->done = NULL;
+	queue->eventfd = eventfd;
+}
+
+static void offload_run(void *arg)
+{
+	struct offload_task *task = arg;
+	struct offload_queue *queue = task->queue;
+	struct offload_task *head;
+	uint64_t one = 1;
+	ssize_t n;
+
+	task->run(task);
+
+	/* Once pushed, the task is the worker's again and is not touched. */
+	head = __atomic_load_n(&queue->done, __ATOMIC_RELAXED);
+	do {
+		task->next = head;
+	} while (!__atomic_compare_exchange_n(&queue->done, &head, task, 1,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* The worker takes the whole queue when woken, so only the task that
+	 * found it empty signals.
+	 */
+	if (head == NULL) {
+		n = write(queue->eventfd, &one, sizeof(one));
+		(void)n;
+	}
+}
+
+void offload_submit(struct offload_queue *queue, struct offload_task **tasks, unsigned int n)
+{
+	os_task_t *batch[OFFLOAD_BATCH];
+
+	while (n > 0) {
+		unsigned int count = n < OFFLOAD_BATCH ? n : OFFLOAD_BATCH;
+
+		for (unsigned int i = 0; i < count; i++) {
+			tasks[i]->queue = queue;
+			batch[i] = create_task(offload_run, tasks[i], NULL);
+		}
+		enqueue_tasks(pool, batch, count);
+
+		tasks += count;
+		n -= count;
+	}
+}
+
+struct offload_task *offload_take(struct offload_queue *queue)
+{
+	struct offload_task *task = __atomic_exchange_n(&queue->done, NULL, __ATOMIC_ACQUIRE);
+	struct offload_task *ordered = NULL;
+
+	while (task != NULL) {
+		struct offload_task *next = task->next;
+
+		task->next = ordered;
+		ordered = task;
+		task = next;
+	}
+
+	return ordered;
+}
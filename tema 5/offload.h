@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef OFFLOAD_H_
+#define OFFLOAD_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Blocking work, such as file reads on a file system where AIO is
+ * synchronous, run on the thread pool of tema 3 instead of the event loop.
+ * A task runs on the pool, then goes back to the worker that submitted it
+ * through the queue of that worker, which any pool thread pushes to without
+ * a lock, and the worker drains when its eventfd is signalled.
+ */
+struct offload_task {
+	void (*run)(struct offload_task *task);	/* on a pool thread */
+	struct offload_queue *queue;
+	struct offload_task *next;
+};
+
+/* Tasks of a worker that ran, the last one done first. */
+struct offload_queue {
+	struct offload_task *done;
+	int eventfd;
+};
+
+/* Start the pool that every worker submits to. Returns -1 on failure. */
+int offload_init(unsigned int threads);
+
+void offload_queue_init(struct offload_queue *queue, int eventfd);
+
+/* Run n tasks on the pool, and queue each one back once it ran. */
+void offload_submit(struct offload_queue *queue, struct offload_task **tasks, unsigned int n);
+
+/*
+ * The tasks that ran since the last call, linked by next in the order they
+ * were done. The eventfd is read before, so that a task queued meanwhile
+ * signals it again.
+ */
+struct offload_task *offload_take(struct offload_queue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# A HEAD request gets the headers of the reply and no body, so that a GET
+# pipelined after it on the same connection gets a well framed reply. Run
+# from the directory the server serves, with the server listening.
+
+PORT=${1:-8888}
+FILE=static/head_pipeline.dat
+BODY="hello, head\n"
+
+# a fresh checkout has no static directory, it goes away with the file then
+DIR=$(dirname "$FILE")
+if [ -d "$DIR" ]; then
+	trap 'rm -f "$FILE"' EXIT
+else
+	mkdir -p "$DIR"
+	trap 'rm -f "$FILE"; rmdir "$DIR"' EXIT
+fi
+printf "$BODY" > "$FILE"
+
+python3 - "$PORT" "$FILE" <<'PY'
+import socket
+import sys
+
+port, path = int(sys.argv[1]), "/" + sys.argv[2]
+body = open(sys.argv[2], "rb").read()
+
+sock = socket.create_connection(("127.0.0.1", port), timeout=5)
+sock.sendall(("HEAD %s HTTP/1.1\r\nHost: x\r\n\r\n"
+              "GET %s HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n"
+              % (path, path)).encode())
+
+data = b""
+while True:
+    chunk = sock.recv(65536)
+    if not chunk:
+        break
+    data += chunk
+
+head, sep, rest = data.partition(b"\r\n\r\n")
+expected_length = b"Content-Length: %d" % len(body)
+
+ok = sep and head.startswith(b"HTTP/1.1 200") and expected_length in head
+ok = ok and rest.startswith(b"HTTP/1.1 200")
+if ok:
+    get_head, _, get_body = rest.partition(b"\r\n\r\n")
+    ok = expected_length in get_head and get_body == body
+
+print("head_pipeline: %s" % ("OK" if ok else "FAILED"))
+if not ok:
+    sys.stdout.write(repr(data) + "\n")
+sys.exit(0 if ok else 1)
+PY
@@ -45,14 +45,23 @@ enum {
 #define dprintf(format, ...)
 #endif
 
+/*
+ * The level of a call is a constant: below LOG_LEVEL, or without DEBUG, the
+ * call compiles to nothing, its arguments not even evaluated, but they are
+ * still checked against the format.
+ */
 #if defined DEBUG
 #define dlog(level, format, ...)				\
 	do {							\
-		if (level <= LOG_LEVEL)				\
+		if ((level) <= LOG_LEVEL)			\
 			dprintf(format, ##__VA_ARGS__);		\
 	} while (0)
 #else
-#define dlog(level, format, ...)
+#define dlog(level, format, ...)				\
+	do {							\
+		if (0)						\
+			fprintf(stderr, format, ##__VA_ARGS__);	\
+	} while (0)
 #endif
 
 #ifdef __cplusplus
@@ -48,6 +48,62 @@ int tcp_connect_to_server(const char *name, unsigned short port)
 	return s;
 }
 
+/*
+ * Fill addr with the address of the TCP server identified by name (DNS
+ * name or dotted decimal string) and port, to connect to it many times.
+ */
+
+int tcp_get_server_address(const char *name, unsigned short port,
+		struct sockaddr_in *addr)
+{
+	struct hostent *hent;
+
+	hent = gethostbyname(name);
+	if (hent == NULL)
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	memcpy(&addr->sin_addr.s_addr, hent->h_addr,
+			sizeof(addr->sin_addr.s_addr));
+
+	return 0;
+}
+
+/*
+ * Start connecting to the server at addr, from the local address if not
+ * NULL, and return without waiting: the non-blocking socket is writable
+ * once the connection is made, or has failed (see SO_ERROR). Returns -1 on
+ * error, with errno set, as running out of descriptors or ports is to be
+ * expected under load.
+ */
+
+int tcp_connect_nonblocking(const struct sockaddr_in *addr,
+		const struct sockaddr_in *local)
+{
+	int s, err;
+
+	s = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s < 0)
+		return -1;
+
+	if (local != NULL && bind(s, (const SSA *) local, sizeof(*local)) < 0)
+		goto close_socket;
+
+	if (connect(s, (const SSA *) addr, sizeof(*addr)) < 0 &&
+			errno != EINPROGRESS)
+		goto close_socket;
+
+	return s;
+
+close_socket:
+	err = errno;
+	close(s);
+	errno = err;
+	return -1;
+}
+
 int tcp_close_connection(int sockfd)
 {
 	int rc;
@@ -58,11 +114,7 @@ int tcp_close_connection(int sockfd)
 	return close(sockfd);
 }
 
-/*
- * Create a server socket.
- */
-
-int tcp_create_listener(unsigned short port, int backlog)
+static int create_listener(unsigned short port, int backlog, int reuseport)
 {
 	struct sockaddr_in address;
 	int listenfd;
@@ -77,6 +129,12 @@ int tcp_create_listener(unsigned short port, int backlog)
 				&sock_opt, sizeof(int));
 	DIE(rc < 0, "setsockopt");
 
+	if (reuseport) {
+		rc = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+					&sock_opt, sizeof(int));
+		DIE(rc < 0, "setsockopt");
+	}
+
 	memset(&address, 0, sizeof(address));
 	address.sin_family = AF_INET;
 	address.sin_port = htons(port);
@@ -91,6 +149,26 @@ int tcp_create_listener(unsigned short port, int backlog)
 	return listenfd;
 }
 
+/*
+ * Create a server socket.
+ */
+
+int tcp_create_listener(unsigned short port, int backlog)
+{
+	return create_listener(port, backlog, 0);
+}
+
+/*
+ * Create a server socket that shares its port with the other SO_REUSEPORT
+ * sockets of the same user. The kernel spreads the new connections among
+ * them.
+ */
+
+int tcp_create_reuseport_listener(unsigned short port, int backlog)
+{
+	return create_listener(port, backlog, 1);
+}
+
 /*
  * Use getpeername(2) to extract remote peer address. Fill buffer with
  * address format IP_address:port (e.g. 192.168.0.1:22).
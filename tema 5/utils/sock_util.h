@@ -19,8 +19,13 @@ extern "C" {
 
 
 int tcp_connect_to_server(const char *name, unsigned short port);
+int tcp_get_server_address(const char *name, unsigned short port,
+		struct sockaddr_in *addr);
+int tcp_connect_nonblocking(const struct sockaddr_in *addr,
+		const struct sockaddr_in *local);
 int tcp_close_connection(int s);
 int tcp_create_listener(unsigned short port, int backlog);
+int tcp_create_reuseport_listener(unsigned short port, int backlog);
 int get_peer_address(int sockfd, char *buf, size_t len);
 
 #ifdef __cplusplus
@@ -151,6 +151,17 @@ static inline int w_epoll_update_ptr_inout(int epollfd, int fd, void *ptr)
 	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+/* Only report errors and hang ups, while the connection waits for something else. */
+static inline int w_epoll_update_ptr_none(int epollfd, int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	ev.events = 0;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 static inline int w_epoll_remove_ptr(int epollfd, int fd, void *ptr)
 {
 	struct epoll_event ev;
@@ -170,6 +181,16 @@ static inline int w_epoll_wait_infinite(int epollfd, struct epoll_event *rev)
 {
 	return epoll_wait(epollfd, rev, 1, EPOLL_TIMEOUT_INFINITE);
 }
+
+/*
+ * Wait for up to max events at once, so a busy loop handles all the ready
+ * descriptors with a single system call. Returns the number of events.
+ */
+static inline int w_epoll_wait_batch(int epollfd, struct epoll_event *events,
+		int max, int timeout)
+{
+	return epoll_wait(epollfd, events, max, timeout);
+}
 #ifdef __cplusplus
 }
 #endif